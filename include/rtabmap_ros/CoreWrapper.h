@@ -29,7 +29,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define COREWRAPPER_H_
 
 
+#include <list>
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <nodelet/nodelet.h>
 
 #include <std_srvs/Empty.h>
@@ -88,6 +90,7 @@ typedef actionlib::SimpleActionClient<move_base_msgs::MoveBaseAction> MoveBaseCl
 
 namespace rtabmap {
 class StereoDense;
+class DBDriver;
 }
 
 namespace rtabmap_ros {
@@ -202,6 +205,18 @@ private:
 	bool triggerNewMapCallback(std_srvs::Empty::Request&, std_srvs::Empty::Response&);
 	bool backupDatabaseCallback(std_srvs::Empty::Request&, std_srvs::Empty::Response&);
 	bool detectMoreLoopClosuresCallback(rtabmap_ros::DetectMoreLoopClosures::Request&, rtabmap_ros::DetectMoreLoopClosures::Response&);
+	int detectMoreLoopClosuresParallel(
+			float clusterRadiusMin,
+			float clusterRadiusMax,
+			float clusterAngle,
+			int iterations,
+			bool intraSession,
+			bool interSession,
+			int threads,
+			int maxPairs,
+			float maxDuration,
+			int & pairsTested,
+			int & pairsTotal);
 	bool globalBundleAdjustmentCallback(rtabmap_ros::GlobalBundleAdjustment::Request&, rtabmap_ros::GlobalBundleAdjustment::Response&);
 	bool cleanupLocalGridsCallback(rtabmap_ros::CleanupLocalGrids::Request&, rtabmap_ros::CleanupLocalGrids::Response&);
 	bool setModeLocalizationCallback(std_srvs::Empty::Request&, std_srvs::Empty::Response&);
@@ -220,6 +235,12 @@ private:
 	bool publishMapCallback(rtabmap_ros::PublishMap::Request&, rtabmap_ros::PublishMap::Response&);
 	bool getPlanCallback(nav_msgs::GetPlan::Request  &req, nav_msgs::GetPlan::Response &res);
 	bool getPlanNodesCallback(rtabmap_ros::GetPlan::Request  &req, rtabmap_ros::GetPlan::Response &res);
+	bool computePlan(
+			int goalNode,
+			const rtabmap::Transform & goalPose,
+			float tolerance,
+			std::vector<std::pair<int, rtabmap::Transform> > & path,
+			rtabmap::Transform & transformToGoal);
 	bool setGoalCallback(rtabmap_ros::SetGoal::Request& req, rtabmap_ros::SetGoal::Response& res);
 	bool cancelGoalCallback(std_srvs::Empty::Request& req, std_srvs::Empty::Response& res);
 	bool setLabelCallback(rtabmap_ros::SetLabel::Request& req, rtabmap_ros::SetLabel::Response& res);
@@ -237,6 +258,7 @@ private:
 	void publishLoop(double tfDelay, double tfTolerance);
 
 	void publishStats(const ros::Time & stamp);
+	void labelsConnectCallback(const ros::SingleSubscriberPublisher & pub);
 	void publishCurrentGoal(const ros::Time & stamp);
 	void goalDoneCb(const actionlib::SimpleClientGoalState& state, const move_base_msgs::MoveBaseResultConstPtr& result);
 	void goalActiveCb();
@@ -245,6 +267,91 @@ private:
 	void publishGlobalPath(const ros::Time & stamp);
 	void republishMaps();
 
+	// Read-only view of the map used by query services when map_snapshot_queries is true
+	struct MapSnapshot
+	{
+		MapSnapshot() :
+			lastId(0),
+			gridXMin(0.0f),
+			gridYMin(0.0f),
+			gridCellSize(0.05f)
+		{}
+		ros::Time stamp;
+		std::map<int, rtabmap::Transform> poses;
+		std::multimap<int, rtabmap::Link> links;
+		rtabmap::Transform mapToOdom;
+		int lastId;
+		cv::Mat gridMap;
+		cv::Mat gridProbMap;
+		float gridXMin;
+		float gridYMin;
+		float gridCellSize;
+		boost::shared_ptr<rtabmap::DBDriver> db;
+	};
+	void publishLocalMaps(const rtabmap::Transform & odom, const ros::Time & stamp);
+	bool isStationaryFrame(const rtabmap::Transform & odom, const ros::Time & stamp);
+	void publishSavedMap();
+	void initRtabmap();
+	void setupMemory();
+	void advertiseServices();
+	bool isMemoryLoading() const;
+	void publishMapLoadingStage(int stage);
+	// [iteration, iterations, pairs verified, pairs to verify, registered, loop closures added]
+	void publishLoopClosuresProgress(int iteration, int iterations, int pairsVerified, int pairsTotal, int registered, int detected);
+	// Graph request that the snapshot cannot serve, done on the mapping thread
+	struct GraphQuery
+	{
+		GraphQuery() :
+			optimized(true),
+			global(false),
+			images(false),
+			scan(false),
+			userData(false),
+			grid(false),
+			words(true),
+			globalDescriptors(true)
+		{}
+		bool optimized;
+		bool global;
+		bool images;
+		bool scan;
+		bool userData;
+		bool grid;
+		bool words;
+		bool globalDescriptors;
+		std::map<int, rtabmap::Transform> poses;
+		std::multimap<int, rtabmap::Link> links;
+		std::map<int, rtabmap::Signature> signatures;
+		rtabmap::Transform mapToOdom;
+	};
+	void openMapSnapshotDb();
+	void closeMapSnapshotDb();
+	bool queryGraphOnMappingThread(const boost::shared_ptr<GraphQuery> & query);
+	void queryGraph(boost::shared_ptr<GraphQuery> query);
+	void updateMapSnapshot(const ros::Time & stamp);
+	void buildMapSnapshot();
+	boost::shared_ptr<const MapSnapshot> getMapSnapshot();
+	// false if some nodes could not be copied from working memory
+	bool loadSnapshotSignatures(
+			const MapSnapshot & snapshot,
+			const std::list<int> & ids,
+			bool images,
+			bool scan,
+			bool userData,
+			bool grid,
+			bool words,
+			bool globalDescriptors,
+			std::map<int, rtabmap::Signature> & signatures);
+	void copySignatures(
+			const std::list<int> & ids,
+			bool images,
+			bool scan,
+			bool userData,
+			bool grid,
+			bool words,
+			bool globalDescriptors,
+			boost::shared_ptr<std::map<int, rtabmap::Signature> > signatures);
+
 private:
 	rtabmap::Rtabmap rtabmap_;
 	bool paused_;
@@ -300,6 +407,15 @@ private:
 	ros::Publisher localizationPosePub_;
 	ros::Subscriber initialPoseSub_;
 
+	// 0=loading, 1=saved map published, 2=memory initialized, 3=all local grids loaded
+	ros::Publisher mapLoadingStagePub_;
+	ros::Publisher loopClosuresProgressPub_;
+	int mapLoadingStage_;
+	ros::Publisher localGridsModifiedPub_; // latched, number of cleanup_local_grids calls that modified grids
+	int localGridsModified_;
+	bool memoryLoading_; // working memory is loaded by memoryLoadThread_, services are not advertised yet
+	boost::thread * memoryLoadThread_;
+
 	//Planning stuff
 	ros::Subscriber goalSub_;
 	ros::Subscriber goalNodeSub_;
@@ -314,6 +430,16 @@ private:
 	tf2_ros::TransformBroadcaster tfBroadcaster_;
 	tf::TransformListener tfListener_;
 
+	bool mapSnapshotQueries_;
+	int mapSnapshotQueryThreads_;
+	boost::shared_ptr<const MapSnapshot> mapSnapshot_;
+	bool mapSnapshotDirty_; // map changed since mapSnapshot_ was built
+	ros::Time mapSnapshotStamp_;
+	boost::mutex mapSnapshotMutex_;
+	boost::shared_ptr<rtabmap::DBDriver> mapSnapshotDb_;
+	ros::CallbackQueue mapQueryQueue_;
+	ros::AsyncSpinner * mapQuerySpinner_;
+
 	ros::ServiceServer updateSrv_;
 	ros::ServiceServer resetSrv_;
 	ros::ServiceServer pauseSrv_;
@@ -385,13 +511,56 @@ private:
 	bool odomSensorSync_;
 	float rate_;
 	bool createIntermediateNodes_;
+	bool skipStationaryFrames_;
+	bool newMapPending_;
+	int stationaryFramesSkipped_;
+	rtabmap::Transform lastProcessedOdom_; // odometry pose of the last frame processed by rtabmap
+	bool rgbdEnabled_;
+	float rgbdLinearUpdate_;
+	float rgbdAngularUpdate_;
 	int mappingMaxNodes_;
 	double mappingAltitudeDelta_;
 	bool alreadyRectifiedImages_;
+	rtabmap_ros::StereoCameraModelCache stereoModelCache_;
+	std::vector<rtabmap_ros::ImageIngestionPlan> rgbPlans_; // per camera
+	std::vector<rtabmap_ros::ImageIngestionPlan> depthPlans_;
+	rtabmap_ros::ImageIngestionPlan stereoLeftPlan_;
+	rtabmap_ros::ImageIngestionPlan stereoRightPlan_;
 	bool twoDMapping_;
 	ros::Time previousStamp_;
 	std::set<int> nodesToRepublish_;
 	int maxNodesRepublished_;
+
+	// persistent markers published on "labels"
+	double labelsIdRadius_;
+	double labelsMoveTolerance_;
+	bool labelsResendAll_; // set when a subscriber connects
+	boost::mutex labelsResendMutex_;
+	std::map<int, std::pair<rtabmap::Transform, std::string> > labelsPublishedIds_;
+	std::map<int, std::pair<rtabmap::Transform, std::string> > labelsPublishedLabels_;
+	std::map<int, std::pair<rtabmap::Transform, std::string> > labelsPublishedLandmarks_;
+
+	// plans computed by get_plan services, valid while the optimized
+	// poses of their nodes don't change (least recently used evicted first)
+	struct CachedPlan
+	{
+		int startNode;
+		std::vector<std::pair<int, rtabmap::Transform> > path;
+		rtabmap::Transform transformToGoal;
+		std::map<int, rtabmap::Transform> nodePoses; // optimized poses of the path nodes when computed
+		std::list<std::string>::iterator lruIter;
+	};
+	int planCacheSize_;
+	int planCacheHits_;
+	int planCacheMisses_;
+	std::map<std::string, CachedPlan> planCache_;
+	std::list<std::string> planCacheLru_; // most recently used first
+
+	// localization mode: maps updated only when the graph changed
+	bool localizationLightweight_;
+	std::map<int, rtabmap::Transform> mapsPoses_; // local graph of the last maps update, without the last signature
+	rtabmap::Transform mapsLatestPose_;
+	unsigned int mapsSubscribers_;
 };
 
 }
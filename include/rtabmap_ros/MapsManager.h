@@ -33,8 +33,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <rtabmap/core/FlannIndex.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
+#include <pcl/pcl_base.h>
 #include <ros/time.h>
 #include <ros/publisher.h>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace rtabmap {
 class OctoMap;
@@ -43,6 +46,10 @@ class OccupancyGrid;
 
 }  // namespace rtabmap
 
+namespace octomap {
+class ColorOcTree;
+}  // namespace octomap
+
 class MapsManager {
 public:
 	MapsManager();
@@ -50,9 +57,21 @@ public:
 	void init(ros::NodeHandle & nh, ros::NodeHandle & pnh, const std::string & name, bool usePublicNamespace);
 	void clear();
 	bool hasSubscribers() const;
+	unsigned int getNumSubscribers() const;
 	void backwardCompatibilityParameters(ros::NodeHandle & pnh, rtabmap::ParametersMap & parameters) const;
 	void setParameters(const rtabmap::ParametersMap & parameters);
 	void set2DMap(const cv::Mat & map, float xMin, float yMin, float cellSize, const std::map<int, rtabmap::Transform> & poses, const rtabmap::Memory * memory = 0);
+	bool publishGridMap(const ros::Time & stamp, const std::string & mapFrameId);
+
+	// Local grids of a loaded database are read in background (nearest to robot first) if map_lazy_loading is true
+	bool isLazyLoading() const {return lazyLoading_;}
+	void startLazyLoading(const std::string & databasePath, const std::map<int, rtabmap::Transform> & poses);
+	void stopLazyLoading();
+	void setLazyLoadingPose(const rtabmap::Transform & pose);
+	int lazyLoadingRemaining() const {return (int)lazyNodes_.size();}
+
+	// Nodes left to add to the maps because map_update_budget was reached (done on next updates)
+	int mapUpdatePending() const {return mapUpdatePendingGrids_ + mapUpdatePendingClouds_;}
 
 	std::map<int, rtabmap::Transform> getFilteredPoses(
 			const std::map<int, rtabmap::Transform> & poses);
@@ -69,6 +88,20 @@ public:
 			const ros::Time & stamp,
 			const std::string & mapFrameId);
 
+	// Rolling window around the robot built from the local grids of the nearby nodes
+	bool hasLocalMapSubscribers() const;
+	void publishLocalMaps(
+			const rtabmap::Transform & robotPose,
+			const ros::Time & stamp,
+			const std::string & mapFrameId);
+
+	// 2.5D map (min/max/mean height per cell) fused from the 3D local grids
+	bool hasElevationMapSubscribers() const;
+	void publishElevationMap(
+			const std::map<int, rtabmap::Transform> & poses,
+			const ros::Time & stamp,
+			const std::string & mapFrameId);
+
 	cv::Mat getGridMap(
 			float & xMin,
 			float & yMin,
@@ -79,9 +112,37 @@ public:
 			float & yMin,
 			float & gridCellSize);
 
+	// Not thread-safe when octomap_async is true, use getOctree() instead
 	const rtabmap::OctoMap * getOctomap() const {return octomap_;}
+	// Latest integrated octree (read-only snapshot if octomap_async is true)
+	boost::shared_ptr<const octomap::ColorOcTree> getOctree() const;
+	// Nodes not yet integrated in the octomap by the background thread
+	int octomapPending() const;
 	const rtabmap::OccupancyGrid * getOccupancyGrid() const {return occupancyGrid_;}
 
+private:
+	bool gridPyramidHasSubscribers() const;
+	void publishGridPyramid(
+			const std::map<int, rtabmap::Transform> & poses,
+			const ros::Time & stamp,
+			const std::string & mapFrameId,
+			const cv::Mat & gridMap,
+			float gridXMin,
+			float gridYMin,
+			float gridCellSize,
+			const cv::Mat & gridProbMap);
+	void lazyLoadingThread(const std::string & databasePath, std::map<int, rtabmap::Transform> poses);
+	void addLazyLoadedGrids();
+	bool acquireSharedLocalGrid(int id, const rtabmap::SensorData & data, cv::Mat & ground, cv::Mat & obstacles, cv::Mat & emptyCells, cv::Point3f & viewPoint);
+	void shareLocalGrid(int id, const rtabmap::SensorData & data, const cv::Mat & ground, const cv::Mat & obstacles, const cv::Mat & emptyCells, const cv::Point3f & viewPoint);
+	void releaseSharedLocalGrid(int id);
+	void releaseSharedLocalGrids();
+	void startOctomapThread();
+	void stopOctomapThread();
+	void clearOctomap();
+	void requestOctomapProducts();
+	void octomapThread();
+
 private:
 	// mapping stuff
 	bool cloudOutputVoxelized_;
@@ -92,6 +153,9 @@ private:
 	bool mapCacheCleanup_;
 	bool alwaysUpdateMap_;
 	bool scanEmptyRayTracing_;
+	double mapUpdateBudget_; // ms
+	int mapUpdatePendingGrids_;
+	int mapUpdatePendingClouds_;
 
 	ros::Publisher cloudMapPub_;
 	ros::Publisher cloudGroundPub_;
@@ -122,6 +186,8 @@ private:
 	cv::Mat gridMap_;
 	std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> > gridMaps_; // < <ground, obstacles>, empty cells >
 	std::map<int, cv::Point3f> gridMapsViewpoints_;
+	bool sharedLocalGrids_; // reuse uncompressed grids of other MapsManager instances in the same process
+	std::set<int> sharedLocalGridIds_;
 
 	rtabmap::OccupancyGrid * occupancyGrid_;
 	bool gridUpdated_;
@@ -130,10 +196,134 @@ private:
 	int octomapTreeDepth_;
 	bool octomapUpdated_;
 
+	// With octomap_async, octomap_ is owned by octomapThread_ and
+	// publishers/services read the last snapshot it produced
+	struct OctomapSnapshot
+	{
+		OctomapSnapshot() : treeSize(0), xMin(0.0f), yMin(0.0f), cellSize(0.0f), hasProjection(false), version(0) {}
+		boost::shared_ptr<octomap::ColorOcTree> tree; // copy of the tree, shared with the previous snapshot if it didn't change
+		size_t treeSize;
+		pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud;
+		pcl::IndicesPtr obstacleIndices;
+		pcl::IndicesPtr frontierIndices;
+		pcl::IndicesPtr emptyIndices;
+		pcl::IndicesPtr groundIndices;
+		cv::Mat projection;
+		float xMin;
+		float yMin;
+		float cellSize;
+		bool hasProjection;
+		int version;
+	};
+	bool octomapAsync_;
+	boost::thread * octomapThread_;
+	bool octomapThreadRunning_;
+	mutable boost::mutex octomapMutex_;
+	boost::condition_variable octomapCondition_;
+	std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> > octomapPendingGrids_;
+	std::map<int, cv::Point3f> octomapPendingViewpoints_;
+	std::map<int, rtabmap::Transform> octomapPendingPoses_;
+	bool octomapPendingUpdate_;
+	bool octomapPendingClear_;
+	bool octomapPendingProducts_;
+	int octomapIntegrating_;
+	std::set<int> octomapSentNodes_;
+	boost::shared_ptr<const OctomapSnapshot> octomapSnapshot_;
+	int octomapSnapshotVersion_;
+	int octomapPublishedVersion_;
+	float octomapMinMapSize_; // Grid/MinMapSize for the thread, occupancyGrid_ is not thread-safe
+
 	rtabmap::ParametersMap parameters_;
 
 	bool latching_;
 	std::map<void*, bool> latched_;
+
+	// Coarser levels of the occupancy grid (cell size x2 at each level), updated
+	// only where the full resolution grid changed
+	struct GridLevel
+	{
+		GridLevel() : rate(0.0), gridDirty(true), gridProbDirty(true) {}
+		ros::Publisher gridPub;
+		ros::Publisher gridProbPub;
+		cv::Mat grid;
+		cv::Mat gridProb;
+		double rate;
+		ros::Time lastPublished;
+		bool gridDirty;
+		bool gridProbDirty;
+	};
+	std::vector<GridLevel> gridPyramid_;
+	std::map<int, std::pair<rtabmap::Transform, cv::Rect_<float> > > gridPyramidNodes_; // pose and bounds of the local grids in the pyramid
+	cv::Mat gridPyramidBase_;
+	cv::Mat gridProbPyramidBase_;
+	float gridPyramidXMin_;
+	float gridPyramidYMin_;
+	float gridPyramidCellSize_;
+
+	double localMapRadius_;
+	double localMapRate_;
+	ros::Time localMapLastPublished_;
+	std::map<int, rtabmap::Transform> localMapPoses_;
+	std::map<std::pair<int, int>, std::vector<int> > localMapBuckets_; // nodes overlapping each cell of localMapRadius_ size
+	std::map<int, float> localMapRanges_; // max range of the local grids, in node frame
+	float localMapProbHit_;
+	float localMapProbMiss_;
+	float localMapProbClampingMin_;
+	float localMapProbClampingMax_;
+	float localMapOccupancyThr_;
+	ros::Publisher gridLocalMapPub_;
+	ros::Publisher cloudObstaclesLocalPub_;
+
+	struct ElevationCell
+	{
+		ElevationCell() : minZ(0.0f), maxZ(0.0f), sumZ(0.0), count(0) {}
+		void add(double sum, float zMin, float zMax, int n)
+		{
+			minZ = count?std::min(minZ, zMin):zMin;
+			maxZ = count?std::max(maxZ, zMax):zMax;
+			sumZ += sum;
+			count += n;
+		}
+		float minZ;
+		float maxZ;
+		double sumZ;
+		int count; // 0: unknown
+	};
+	// cell of a node, in world frame
+	struct ElevationContribution
+	{
+		int x;
+		int y;
+		ElevationCell cell;
+	};
+	// fused cells, dense tiles of kElevationTileSize x kElevationTileSize cells
+	static const int kElevationTileSize = 64;
+	struct ElevationTile
+	{
+		ElevationTile() : cells(kElevationTileSize*kElevationTileSize), used(0) {}
+		std::vector<ElevationCell> cells;
+		int used; // known cells
+	};
+	ElevationCell & elevationCell(int x, int y);
+	void removeElevationContributions(const std::vector<ElevationContribution> & contributions, std::set<std::pair<int, int> > & dirtyCells);
+	double elevationCellSize_;
+	float elevationCurrentCellSize_;
+	std::map<int, std::pair<rtabmap::Transform, std::vector<ElevationContribution> > > elevationNodes_; // contributions of each node
+	std::map<std::pair<int, int>, ElevationTile> elevationTiles_;
+	int elevationKnownCells_;
+	bool elevationUpdated_;
+	ros::Publisher elevationMapPub_;
+	ros::Publisher elevationLayersPub_;
+	ros::Publisher elevationInfoPub_;
+
+	bool lazyLoading_;
+	std::set<int> lazyNodes_;
+	boost::thread * lazyLoadingThread_;
+	bool lazyLoadingRunning_;
+	boost::mutex lazyLoadingMutex_;
+	rtabmap::Transform lazyLoadingPose_;
+	std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> > lazyLoadedGrids_;
+	std::map<int, cv::Point3f> lazyLoadedViewpoints_;
 };
 
 #endif /* MAPSMANAGER_H_ */
@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <tf/tf.h>
 #include <tf/transform_listener.h>
+#include <boost/function.hpp>
 #include <geometry_msgs/Transform.h>
 #include <geometry_msgs/Pose.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
@@ -63,6 +64,54 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace rtabmap_ros {
 
+// Conversion of an input image stream to the image types used by rtabmap.
+// The encoding is resolved on the first image and kept until the encoding or
+// the size changes, then images are converted directly in the destination.
+class ImageIngestionPlan
+{
+public:
+	enum Encoding {kUnknown, kMono8, kMono16, kBgr8, kRgb8, kBgra8, kRgba8, kBayerGrbg8, kBayerRggb8, k16UC1, k32FC1};
+	enum Target {
+		kTargetColor, // mono8 or bgr8
+		kTargetMono,  // mono8
+		kTargetDepth  // 16UC1 or 32FC1
+	};
+
+	static Encoding encodingFromString(const std::string & encoding);
+	// Reallocate the buffer only if its size/type changed or if it is still referenced elsewhere (e.g., previous frame).
+	static void reuseBuffer(cv::Mat & buffer, int rows, int cols, int type);
+	// Convert the images side by side in the mosaic (already allocated with reuseBuffer()),
+	// one camera per thread if parallel is true.
+	static void convertToMosaic(
+			const std::vector<cv_bridge::CvImageConstPtr> & images,
+			const std::vector<ImageIngestionPlan> & plans,
+			cv::Mat & mosaic,
+			bool parallel = true);
+
+	ImageIngestionPlan(Target target = kTargetColor);
+	// return false if the encoding is not supported for the target
+	bool update(const cv_bridge::CvImageConstPtr & image);
+	// dst can be a ROI of a larger image of outputType()
+	void convert(const cv::Mat & src, cv::Mat & dst) const;
+	// Convert in the buffer of the plan, kept between frames (see reuseBuffer()).
+	// The returned image shares the buffer.
+	cv::Mat convertToBuffer(const cv::Mat & src);
+	// Buffer of the plan, e.g. for a mosaic of the images of many cameras
+	cv::Mat & buffer() {return buffer_;}
+	Encoding encoding() const {return encoding_;}
+	int outputType() const {return outputType_;}
+	bool needsConversion() const {return code_ != -1;}
+
+private:
+	Target target_;
+	std::string encodingStr_;
+	cv::Size size_;
+	Encoding encoding_;
+	int outputType_;
+	int code_; // cv::cvtColor code, -1: copy, -2: 16 bits to 8 bits
+	cv::Mat buffer_;
+};
+
 void transformToTF(const rtabmap::Transform & transform, tf::Transform & tfTransform);
 rtabmap::Transform transformFromTF(const tf::Transform & transform);
 
@@ -76,7 +125,30 @@ void toCvCopy(const rtabmap_ros::RGBDImage & image, cv_bridge::CvImagePtr & rgb,
 void toCvShare(const rtabmap_ros::RGBDImageConstPtr & image, cv_bridge::CvImageConstPtr & rgb, cv_bridge::CvImageConstPtr & depth);
 void toCvShare(const rtabmap_ros::RGBDImage & image, const boost::shared_ptr<void const>& trackedObject, cv_bridge::CvImageConstPtr & rgb, cv_bridge::CvImageConstPtr & depth);
 void rgbdImageToROS(const rtabmap::SensorData & data, rtabmap_ros::RGBDImage & msg, const std::string & sensorFrameId);
-rtabmap::SensorData rgbdImageFromROS(const rtabmap_ros::RGBDImageConstPtr & image);
+// Plans are the conversion state of the stream (optional): rgb or left
+// (kTargetColor), depth (kTargetDepth) and right (kTargetMono) images.
+rtabmap::SensorData rgbdImageFromROS(
+		const rtabmap_ros::RGBDImageConstPtr & image,
+		ImageIngestionPlan * imagePlan = 0,
+		ImageIngestionPlan * depthPlan = 0,
+		ImageIngestionPlan * rightPlan = 0);
+// True if the compressed image is JPEG ("jpg" from cv_bridge, "<encoding>; jpeg compressed <encoding>"
+// from compressed_image_transport), i.e., the codec of RGBDImage::rgb_compressed.
+bool isJpegCompressedImage(const sensor_msgs::CompressedImage & image);
+// The compressed rgb input can be forwarded unchanged in RGBDImage::rgb_compressed
+// only if it is not decimated and already in JPEG.
+bool canForwardCompressedImage(const sensor_msgs::CompressedImage & image, int decimation = 1);
+// Set RGBDImage::rgb_compressed: the compressed input (can be null) is forwarded unchanged if
+// canForwardCompressedImage(), otherwise the raw image (already decimated) is compressed in JPEG.
+// Return true if the input has been forwarded.
+bool rgbCompressedToROS(
+		const sensor_msgs::CompressedImageConstPtr & input,
+		const cv_bridge::CvImage & image,
+		int decimation,
+		sensor_msgs::CompressedImage & output);
+// True if rgbd_relay can republish the image as is: no conversion is requested
+// or the image is already in the requested form (only compressed or only raw data).
+bool canRelayRGBDImage(const rtabmap_ros::RGBDImage & image, bool compress, bool uncompress);
 
 // copy data
 void compressedMatToBytes(const cv::Mat & compressed, std::vector<unsigned char> & bytes);
@@ -138,6 +210,48 @@ rtabmap::StereoCameraModel stereoCameraModelFromROS(
 		tf::TransformListener & listener,
 		double waitForTransform);
 
+// Stereo model of a fixed stereo rig kept between frames (with its
+// rectification maps initialized), until the camera infos or the
+// transform between the cameras change.
+class StereoCameraModelCache
+{
+public:
+	StereoCameraModelCache() : key_(0) {}
+	static size_t key(
+			const sensor_msgs::CameraInfo & leftCamInfo,
+			const sensor_msgs::CameraInfo & rightCamInfo,
+			bool alreadyRectified,
+			const rtabmap::Transform & stereoTransform);
+	// return false if the model should be recreated
+	bool get(size_t key, const rtabmap::Transform & localTransform, rtabmap::StereoCameraModel & model) const;
+	void set(size_t key, const rtabmap::StereoCameraModel & model, bool initRectification);
+
+	// Transform between the cameras, looked up again only if the frames
+	// changed or if the images are refreshPeriod seconds newer than the last lookup.
+	rtabmap::Transform stereoTransform(
+			const std::string & fromFrameId,
+			const std::string & toFrameId,
+			const ros::Time & stamp,
+			tf::TransformListener & listener,
+			double waitForTransform,
+			double refreshPeriod = 1.0);
+	// Rectify the images with the model set with initRectification. Stripes of both
+	// images are remapped in parallel in buffers kept between frames.
+	// Return false if the images cannot be rectified with the cached model.
+	bool rectify(cv::Mat & left, cv::Mat & right);
+	// Model of the images returned by rectify()
+	rtabmap::StereoCameraModel rectifiedModel(const rtabmap::Transform & localTransform) const;
+
+private:
+	size_t key_;
+	rtabmap::StereoCameraModel model_;
+	cv::Mat rectificationMaps_[2][2]; // left/right, fixed-point maps
+	cv::Mat rectified_[2];
+	std::string stereoFrames_;
+	ros::Time stereoTransformStamp_;
+	rtabmap::Transform stereoTransform_;
+};
+
 void mapDataFromROS(
 		const rtabmap_ros::MapData & msg,
 		std::map<int, rtabmap::Transform> & poses,
@@ -151,6 +265,12 @@ void mapDataToROS(
 		const rtabmap::Transform & mapToOdom,
 		rtabmap_ros::MapData & msg);
 
+// Bulk conversions of graph poses and links, output arrays are resized once
+void posesToROS(const std::map<int, rtabmap::Transform> & poses, std::vector<int> & ids, std::vector<geometry_msgs::Pose> & msgs);
+void posesFromROS(const std::vector<int> & ids, const std::vector<geometry_msgs::Pose> & msgs, std::map<int, rtabmap::Transform> & poses);
+void linksToROS(const std::multimap<int, rtabmap::Link> & links, std::vector<rtabmap_ros::Link> & msgs);
+void linksFromROS(const std::vector<rtabmap_ros::Link> & msgs, std::multimap<int, rtabmap::Link> & links);
+
 void mapGraphFromROS(
 		const rtabmap_ros::MapGraph & msg,
 		std::map<int, rtabmap::Transform> & poses,
@@ -168,6 +288,18 @@ void nodeDataToROS(const rtabmap::Signature & signature, rtabmap_ros::NodeData &
 rtabmap::Signature nodeInfoFromROS(const rtabmap_ros::NodeData & msg);
 void nodeInfoToROS(const rtabmap::Signature & signature, rtabmap_ros::NodeData & msg);
 
+// Uncompress RGB-D data for consumers decimating it afterwards. When decimation
+// is a multiple of 2, 4 or 8, the image is decoded directly at reduced resolution
+// and the depth is decimated to the same size, camera models are scaled accordingly.
+// Returns false (outputs untouched) if the data cannot be decoded that way.
+bool uncompressRGBDDecimated(
+		const rtabmap::SensorData & data,
+		int decimation,
+		cv::Mat & image,
+		cv::Mat & depth,
+		std::vector<rtabmap::CameraModel> & cameraModels,
+		int & remainingDecimation);
+
 std::map<std::string, float> odomInfoToStatistics(const rtabmap::OdometryInfo & info);
 rtabmap::OdometryInfo odomInfoFromROS(const rtabmap_ros::OdomInfo & msg, bool ignoreData = false);
 void odomInfoToROS(const rtabmap::OdometryInfo & info, rtabmap_ros::OdomInfo & msg, bool ignoreData = false);
@@ -180,10 +312,19 @@ rtabmap::Landmarks landmarksFromROS(
 		const std::string & frameId,
 		const std::string & odomFrameId,
 		const ros::Time & odomStamp,
-		tf::TransformListener & listener,
+		tf::Transformer & listener,
 		double waitForTransform,
 		double defaultLinVariance,
 		double defaultAngVariance);
+// Same with the TF lookups done by the functions: baseToCamera(cameraFrameId, stamp)
+// and odometry correction(stamp). Each (cameraFrameId, stamp) and stamp is looked up once.
+rtabmap::Landmarks landmarksFromROS(
+		const std::map<int, std::pair<geometry_msgs::PoseWithCovarianceStamped, float> > & tags,
+		const std::string & frameId,
+		const boost::function<rtabmap::Transform(const std::string &, const ros::Time &)> & baseToCameraLookup,
+		const boost::function<rtabmap::Transform(const ros::Time &)> & correctionLookup,
+		double defaultLinVariance,
+		double defaultAngVariance);
 
 inline double timestampFromROS(const ros::Time & stamp) {return double(stamp.sec) + double(stamp.nsec)/1000000000.0;}
 
@@ -192,7 +333,7 @@ rtabmap::Transform getTransform(
 		const std::string & fromFrameId,
 		const std::string & toFrameId,
 		const ros::Time & stamp,
-		tf::TransformListener & listener,
+		tf::Transformer & listener,
 		double waitForTransform);
 
 
@@ -203,7 +344,7 @@ rtabmap::Transform getTransform(
 		const std::string & fixedFrame,
 		const ros::Time & stampSource,
 		const ros::Time & stampTarget,
-		tf::TransformListener & listener,
+		tf::Transformer & listener,
 		double waitForTransform);
 
 bool convertRGBDMsgs(
@@ -223,7 +364,9 @@ bool convertRGBDMsgs(
 		const std::vector<cv::Mat> & localDescriptorsMsgs = std::vector<cv::Mat>(),
 		std::vector<cv::KeyPoint> * localKeyPoints = 0,
 		std::vector<cv::Point3f> * localPoints3d = 0,
-		cv::Mat * localDescriptors = 0);
+		cv::Mat * localDescriptors = 0,
+		std::vector<ImageIngestionPlan> * imagePlans = 0, // per camera, kept by the caller between frames
+		std::vector<ImageIngestionPlan> * depthPlans = 0);
 
 bool convertStereoMsg(
 		const cv_bridge::CvImageConstPtr& leftImageMsg,
@@ -238,7 +381,10 @@ bool convertStereoMsg(
 		rtabmap::StereoCameraModel & stereoModel,
 		tf::TransformListener & listener,
 		double waitForTransform,
-		bool alreadyRectified);
+		bool alreadyRectified,
+		StereoCameraModelCache * stereoModelCache = 0,
+		ImageIngestionPlan * leftPlan = 0, // kept by the caller between frames
+		ImageIngestionPlan * rightPlan = 0);
 
 bool convertScanMsg(
 		const sensor_msgs::LaserScan & scan2dMsg,
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NODEDATACACHE_H_
+#define NODEDATACACHE_H_
+
+#include "rtabmap_ros/NodeData.h"
+#include <string>
+#include <set>
+
+namespace rtabmap_ros {
+
+/**
+ * On-disk cache of NodeData messages, one file per node id. The serialized
+ * message is stored with its checksum, so truncated or corrupted files are
+ * detected and discarded on load. Used by downstream nodes (e.g.,
+ * map_assembler) to avoid requesting again all node data from rtabmap after
+ * a restart.
+ */
+class NodeDataCache
+{
+public:
+	NodeDataCache(const std::string & path = "");
+
+	void setPath(const std::string & path);
+	const std::string & path() const {return path_;}
+	bool isEnabled() const {return !path_.empty();}
+
+	bool contains(int id) const;
+	bool load(int id, rtabmap_ros::NodeData & msg) const;
+	bool save(const rtabmap_ros::NodeData & msg) const;
+	void remove(int id) const;
+	std::set<int> ids() const;
+	void clear() const;
+
+private:
+	std::string fileName(int id) const;
+
+private:
+	std::string path_;
+};
+
+}
+
+#endif /* NODEDATACACHE_H_ */
@@ -40,6 +40,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <rtabmap_ros/ResetPose.h>
 #include <rtabmap/core/SensorData.h>
+#include <rtabmap/core/LaserScan.h>
 #include <rtabmap/core/Parameters.h>
 
 #include <boost/thread.hpp>
@@ -73,6 +74,7 @@ public:
 	const rtabmap::ParametersMap & parameters() const {return parameters_;}
 	bool isPaused() const {return paused_;}
 	rtabmap::Transform getTransform(const std::string & fromFrameId, const std::string & toFrameId, const ros::Time & stamp) const;
+	double waitForTransformDuration() const {return waitForTransform_?waitForTransformDuration_:0.0;}
 
 protected:
 	void startWarningThread(const std::string & subscribedTopicsMsg, bool approxSync);
@@ -84,6 +86,8 @@ protected:
 
 private:
 	void warningLoop(const std::string & subscribedTopicsMsg, bool approxSync);
+	void localScanMapLoop();
+	void publishLocalScanMap(const rtabmap::LaserScan & scanMap, const std_msgs::Header & header);
 	virtual void onInit();
 	virtual void onOdomInit() = 0;
 	virtual void updateParameters(rtabmap::ParametersMap & parameters) {}
@@ -116,6 +120,8 @@ private:
 	ros::Publisher odomInfoLitePub_;
 	ros::Publisher odomLocalMap_;
 	ros::Publisher odomLocalScanMap_;
+	ros::Publisher odomLocalScanMapAdded_;
+	ros::Publisher odomLocalScanMapRemoved_;
 	ros::Publisher odomLastFrame_;
 	ros::Publisher odomRgbdImagePub_;
 	ros::ServiceServer resetSrv_;
@@ -146,6 +152,18 @@ private:
 	bool imuProcessed_;
 	std::map<double, rtabmap::IMU> imus_;
 	std::pair<rtabmap::SensorData, std_msgs::Header > bufferedData_;
+
+	// local scan map conversion, done outside the odometry thread
+	double localScanMapRate_;
+	boost::thread * localScanMapThread_;
+	boost::mutex localScanMapMutex_;
+	boost::condition_variable localScanMapCondition_;
+	bool localScanMapStop_;
+	bool localScanMapReceived_;
+	rtabmap::LaserScan localScanMapReceivedScan_;
+	std_msgs::Header localScanMapReceivedHeader_;
+	rtabmap::LaserScan localScanMapPrevious_;
+	ros::Time localScanMapLastFullStamp_;
 };
 
 }
@@ -0,0 +1,34 @@
+#!/usr/bin/env python
+# Collects a statistic of rtabmap's info topic (CPU time per frame by default)
+# and prints its mean, median and 95th percentile on shutdown.
+import rospy
+from rtabmap_ros.msg import Info
+
+def callback(info):
+    global values
+    global stat
+    if stat in info.statsKeys:
+        values.append(info.statsValues[info.statsKeys.index(stat)])
+
+def report():
+    if not values:
+        rospy.logwarn("No \"%s\" received on info topic", stat)
+        return
+    sortedValues = sorted(values)
+    rospy.loginfo("%s over %d frames: mean=%.3f median=%.3f p95=%.3f",
+        stat,
+        len(sortedValues),
+        sum(sortedValues)/len(sortedValues),
+        sortedValues[len(sortedValues)//2],
+        sortedValues[min(len(sortedValues)-1, int(len(sortedValues)*0.95))])
+
+if __name__ == "__main__":
+
+    rospy.init_node("cpu_per_frame", anonymous=True)
+
+    stat = rospy.get_param('~stat', 'RtabmapROS/CpuTotal/ms')
+    values = []
+
+    rospy.Subscriber("info", Info, callback, queue_size=10)
+    rospy.on_shutdown(report)
+    rospy.spin()
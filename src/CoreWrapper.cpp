@@ -48,6 +48,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <rtabmap/utilite/UConversion.h>
 #include <rtabmap/utilite/UStl.h>
 #include <rtabmap/utilite/UMath.h>
+#include <rtabmap/utilite/USemaphore.h>
 
 #include <rtabmap/core/util2d.h>
 #include <rtabmap/core/util3d.h>
@@ -65,6 +66,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifdef WITH_OCTOMAP_MSGS
 #ifdef RTABMAP_OCTOMAP
 #include <octomap_msgs/conversions.h>
+#include <octomap/ColorOcTree.h>
 #include <rtabmap/core/OctoMap.h>
 #endif
 #endif
@@ -79,10 +81,242 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "rtabmap_ros/MsgConversion.h"
 
+#include <ctime>
+
 using namespace rtabmap;
 
 namespace rtabmap_ros {
 
+namespace {
+// Executes a function on the queue of the mapping thread, then releases the semaphore
+class MappingThreadCall : public ros::CallbackInterface
+{
+public:
+	MappingThreadCall(const boost::function<void()> & f, const boost::shared_ptr<USemaphore> & done) :
+		f_(f),
+		done_(done)
+	{}
+	virtual CallResult call()
+	{
+		f_();
+		done_->release();
+		return Success;
+	}
+private:
+	boost::function<void()> f_;
+	boost::shared_ptr<USemaphore> done_;
+};
+
+void closeDb(DBDriver * driver)
+{
+	driver->closeConnection(false);
+	delete driver;
+}
+
+// Adds markers for new, moved or renamed items, and deletes the ones not in current anymore.
+// An empty text means that the marker id is shown.
+void updateLabelMarkers(
+		const std::map<int, std::pair<Transform, std::string> > & current,
+		std::map<int, std::pair<Transform, std::string> > & published,
+		const visualization_msgs::Marker & prototype,
+		double moveTolerance,
+		visualization_msgs::MarkerArray & markers)
+{
+	for(std::map<int, std::pair<Transform, std::string> >::const_iterator iter=current.begin(); iter!=current.end(); ++iter)
+	{
+		std::map<int, std::pair<Transform, std::string> >::iterator jter = published.find(iter->first);
+		if(jter == published.end() ||
+		   jter->second.second.compare(iter->second.second) != 0 ||
+		   jter->second.first.getDistanceSquared(iter->second.first) > moveTolerance*moveTolerance)
+		{
+			visualization_msgs::Marker marker = prototype;
+			marker.id = iter->first;
+			marker.action = visualization_msgs::Marker::ADD;
+			marker.pose.position.x = iter->second.first.x();
+			marker.pose.position.y = iter->second.first.y();
+			marker.pose.position.z = iter->second.first.z();
+			marker.text = iter->second.second.empty()?uNumber2Str(iter->first):iter->second.second;
+			markers.markers.push_back(marker);
+			published[iter->first] = iter->second;
+		}
+	}
+	for(std::map<int, std::pair<Transform, std::string> >::iterator iter=published.begin(); iter!=published.end();)
+	{
+		if(current.find(iter->first) == current.end())
+		{
+			visualization_msgs::Marker marker;
+			marker.header = prototype.header;
+			marker.ns = prototype.ns;
+			marker.id = iter->first;
+			marker.action = visualization_msgs::Marker::DELETE;
+			markers.markers.push_back(marker);
+			published.erase(iter++);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+}
+
+// Pairs of nodes near each other (spatial hashing with cells of maxRadius) not already linked
+std::vector<std::pair<int, int> > findLoopClosureCandidates(
+		const std::map<int, Transform> & poses,
+		const std::map<int, Signature> & signatures,
+		const std::multimap<int, Link> & links,
+		float minRadius,
+		float maxRadius,
+		float maxAngle,
+		bool intraSession,
+		bool interSession)
+{
+	std::set<std::pair<int, int> > linked;
+	for(std::multimap<int, Link>::const_iterator iter=links.begin(); iter!=links.end(); ++iter)
+	{
+		linked.insert(std::make_pair(std::min(iter->second.from(), iter->second.to()), std::max(iter->second.from(), iter->second.to())));
+	}
+
+	typedef std::pair<std::pair<int, int>, int> CellKey;
+	std::map<CellKey, std::vector<int> > cells;
+	for(std::map<int, Transform>::const_iterator iter=poses.lower_bound(1); iter!=poses.end(); ++iter)
+	{
+		cells[CellKey(std::make_pair((int)std::floor(iter->second.x()/maxRadius), (int)std::floor(iter->second.y()/maxRadius)), (int)std::floor(iter->second.z()/maxRadius))].push_back(iter->first);
+	}
+
+	std::vector<std::pair<int, int> > pairs;
+	for(std::map<int, Transform>::const_iterator iter=poses.lower_bound(1); iter!=poses.end(); ++iter)
+	{
+		int cx = (int)std::floor(iter->second.x()/maxRadius);
+		int cy = (int)std::floor(iter->second.y()/maxRadius);
+		int cz = (int)std::floor(iter->second.z()/maxRadius);
+		int mapId = uValue(signatures, iter->first, Signature()).mapId();
+		std::vector<int> candidates;
+		for(int i=-1; i<=1; ++i)
+		{
+			for(int j=-1; j<=1; ++j)
+			{
+				for(int k=-1; k<=1; ++k)
+				{
+					std::map<CellKey, std::vector<int> >::const_iterator cell = cells.find(CellKey(std::make_pair(cx+i, cy+j), cz+k));
+					if(cell == cells.end())
+					{
+						continue;
+					}
+					for(size_t n=0; n<cell->second.size(); ++n)
+					{
+						int id = cell->second[n];
+						if(id <= iter->first || linked.find(std::make_pair(iter->first, id)) != linked.end())
+						{
+							continue;
+						}
+						int otherMapId = uValue(signatures, id, Signature()).mapId();
+						if((!intraSession && mapId == otherMapId) || (!interSession && mapId != otherMapId))
+						{
+							continue;
+						}
+						const Transform & pose = poses.at(id);
+						float d = iter->second.getDistance(pose);
+						if(d > maxRadius || d < minRadius)
+						{
+							continue;
+						}
+						if(maxAngle > 0.0f)
+						{
+							float roll, pitch, yaw;
+							(iter->second.inverse()*pose).getEulerAngles(roll, pitch, yaw);
+							if(fabs(yaw) > maxAngle)
+							{
+								continue;
+							}
+						}
+						candidates.push_back(id);
+					}
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
+		for(size_t n=0; n<candidates.size(); ++n)
+		{
+			pairs.push_back(std::make_pair(iter->first, candidates[n]));
+		}
+	}
+	return pairs;
+}
+
+// Registers every stride-th candidate pair starting at offset, with its own
+// Registration instance. The signatures already contain the features kept in
+// memory and their uncompressed data, they are only copied for each pair.
+class LinkRefinement
+{
+public:
+	LinkRefinement(
+			const ParametersMap & parameters,
+			const std::vector<std::pair<int, int> > & pairs,
+			const std::map<int, Transform> & poses,
+			const std::map<int, Signature> & signatures,
+			std::vector<Link> & links,
+			int offset,
+			int stride) :
+		parameters_(parameters),
+		pairs_(pairs),
+		poses_(poses),
+		signatures_(signatures),
+		links_(links),
+		offset_(offset),
+		stride_(stride)
+	{}
+	void operator()() const
+	{
+		Registration * registration = Registration::create(parameters_);
+		for(int i=offset_; i<(int)pairs_.size(); i+=stride_)
+		{
+			int fromId = pairs_[i].first;
+			int toId = pairs_[i].second;
+			Signature from = signatures_.at(fromId);
+			Signature to = signatures_.at(toId);
+			RegistrationInfo info;
+			Transform guess = poses_.at(fromId).inverse() * poses_.at(toId);
+			Transform t = registration->computeTransformation(from, to, guess, &info);
+			if(!t.isNull())
+			{
+				links_[i] = Link(fromId, toId, Link::kGlobalClosure, t, info.covariance.inv());
+			}
+		}
+		delete registration;
+	}
+private:
+	const ParametersMap & parameters_;
+	const std::vector<std::pair<int, int> > & pairs_;
+	const std::map<int, Transform> & poses_;
+	const std::map<int, Signature> & signatures_;
+	std::vector<Link> & links_;
+	int offset_;
+	int stride_;
+};
+
+// Uncompresses the data of every stride-th signature starting at offset
+class SignatureUncompression
+{
+public:
+	SignatureUncompression(std::vector<Signature*> & signatures, int offset, int stride) :
+		signatures_(signatures),
+		offset_(offset),
+		stride_(stride)
+	{}
+	void operator()() const
+	{
+		for(int i=offset_; i<(int)signatures_.size(); i+=stride_)
+		{
+			signatures_[i]->sensorData().uncompressData();
+		}
+	}
+private:
+	std::vector<Signature*> & signatures_;
+	int offset_;
+	int stride_;
+};
+}
+
 CoreWrapper::CoreWrapper() :
 		CommonDataSubscriber(false),
 		paused_(false),
@@ -113,6 +347,14 @@ CoreWrapper::CoreWrapper() :
 		genDepthFillHolesError_(0.1),
 		scanCloudMaxPoints_(0),
 		mapToOdom_(rtabmap::Transform::getIdentity()),
+		mapLoadingStage_(0),
+		localGridsModified_(0),
+		memoryLoading_(false),
+		memoryLoadThread_(0),
+		mapSnapshotQueries_(false),
+		mapSnapshotQueryThreads_(2),
+		mapSnapshotDirty_(false),
+		mapQuerySpinner_(0),
 		transformThread_(0),
 		tfThreadRunning_(false),
 		stereoToDepth_(false),
@@ -120,13 +362,29 @@ CoreWrapper::CoreWrapper() :
 		odomSensorSync_(false),
 		rate_(Parameters::defaultRtabmapDetectionRate()),
 		createIntermediateNodes_(Parameters::defaultRtabmapCreateIntermediateNodes()),
+		skipStationaryFrames_(false),
+		newMapPending_(false),
+		stationaryFramesSkipped_(0),
+		rgbdEnabled_(Parameters::defaultRGBDEnabled()),
+		rgbdLinearUpdate_(Parameters::defaultRGBDLinearUpdate()),
+		rgbdAngularUpdate_(Parameters::defaultRGBDAngularUpdate()),
 		mappingMaxNodes_(Parameters::defaultGridGlobalMaxNodes()),
 		mappingAltitudeDelta_(Parameters::defaultGridGlobalAltitudeDelta()),
 		alreadyRectifiedImages_(Parameters::defaultRtabmapImagesAlreadyRectified()),
+		stereoLeftPlan_(ImageIngestionPlan::kTargetColor),
+		stereoRightPlan_(ImageIngestionPlan::kTargetMono),
 		twoDMapping_(Parameters::defaultRegForce3DoF()),
 		previousStamp_(0),
 		mbClient_(0),
-		maxNodesRepublished_(2)
+		maxNodesRepublished_(2),
+		labelsIdRadius_(0.0),
+		labelsMoveTolerance_(0.01),
+		labelsResendAll_(false),
+		planCacheSize_(100),
+		planCacheHits_(0),
+		planCacheMisses_(0),
+		localizationLightweight_(false),
+		mapsSubscribers_(0)
 {
 	char * rosHomePath = getenv("ROS_HOME");
 	std::string workingDir = rosHomePath?rosHomePath:UDirectory::homeDir()+"/.ros";
@@ -190,6 +448,10 @@ void CoreWrapper::onInit()
 	pnh.param("use_action_for_goal", useActionForGoal_, useActionForGoal_);
 	pnh.param("use_saved_map", useSavedMap_, useSavedMap_);
 	pnh.param("max_nodes_republished", maxNodesRepublished_, maxNodesRepublished_);
+	pnh.param("labels_id_radius", labelsIdRadius_, labelsIdRadius_);
+	pnh.param("labels_move_tolerance", labelsMoveTolerance_, labelsMoveTolerance_);
+	pnh.param("plan_cache_size", planCacheSize_, planCacheSize_);
+	pnh.param("localization_lightweight", localizationLightweight_, localizationLightweight_);
 	pnh.param("gen_scan",            genScan_, genScan_);
 	pnh.param("gen_scan_max_depth",  genScanMaxDepth_, genScanMaxDepth_);
 	pnh.param("gen_scan_min_depth",  genScanMinDepth_, genScanMinDepth_);
@@ -211,6 +473,9 @@ void CoreWrapper::onInit()
 	}
 	pnh.param("stereo_to_depth", stereoToDepth_, stereoToDepth_);
 	pnh.param("odom_sensor_sync", odomSensorSync_, odomSensorSync_);
+	pnh.param("skip_stationary_frames", skipStationaryFrames_, skipStationaryFrames_);
+	pnh.param("map_snapshot_queries", mapSnapshotQueries_, mapSnapshotQueries_);
+	pnh.param("map_snapshot_query_threads", mapSnapshotQueryThreads_, mapSnapshotQueryThreads_);
 	if(pnh.hasParam("flip_scan"))
 	{
 		NODELET_WARN("Parameter \"flip_scan\" doesn't exist anymore. Rtabmap now "
@@ -234,6 +499,16 @@ void CoreWrapper::onInit()
 	NODELET_INFO("rtabmap: tf_delay      = %f", tfDelay);
 	NODELET_INFO("rtabmap: tf_tolerance  = %f", tfTolerance);
 	NODELET_INFO("rtabmap: odom_sensor_sync   = %s", odomSensorSync_?"true":"false");
+	NODELET_INFO("rtabmap: skip_stationary_frames = %s", skipStationaryFrames_?"true":"false");
+	NODELET_INFO("rtabmap: labels_id_radius = %f", labelsIdRadius_);
+	NODELET_INFO("rtabmap: labels_move_tolerance = %f", labelsMoveTolerance_);
+	NODELET_INFO("rtabmap: plan_cache_size = %d", planCacheSize_);
+	NODELET_INFO("rtabmap: localization_lightweight = %s", localizationLightweight_?"true":"false");
+	NODELET_INFO("rtabmap: map_snapshot_queries = %s", mapSnapshotQueries_?"true":"false");
+	if(mapSnapshotQueries_)
+	{
+		NODELET_INFO("rtabmap: map_snapshot_query_threads = %d", mapSnapshotQueryThreads_);
+	}
 	bool subscribeStereo = false;
 	pnh.param("subscribe_stereo",      subscribeStereo, subscribeStereo);
 	if(subscribeStereo)
@@ -267,12 +542,16 @@ void CoreWrapper::onInit()
 	mapDataPub_ = nh.advertise<rtabmap_ros::MapData>("mapData", 1);
 	mapGraphPub_ = nh.advertise<rtabmap_ros::MapGraph>("mapGraph", 1);
 	landmarksPub_ = nh.advertise<geometry_msgs::PoseArray>("landmarks", 1);
-	labelsPub_ = nh.advertise<visualization_msgs::MarkerArray>("labels", 1);
+	labelsPub_ = nh.advertise<visualization_msgs::MarkerArray>("labels", 1, boost::bind(&CoreWrapper::labelsConnectCallback, this, _1));
 	mapPathPub_ = nh.advertise<nav_msgs::Path>("mapPath", 1);
 	localGridObstacle_ = nh.advertise<sensor_msgs::PointCloud2>("local_grid_obstacle", 1);
 	localGridEmpty_ = nh.advertise<sensor_msgs::PointCloud2>("local_grid_empty", 1);
 	localGridGround_ = nh.advertise<sensor_msgs::PointCloud2>("local_grid_ground", 1);
 	localizationPosePub_ = nh.advertise<geometry_msgs::PoseWithCovarianceStamped>("localization_pose", 1);
+	mapLoadingStagePub_ = nh.advertise<std_msgs::Int32>("map_loading_stage", 1, true);
+	publishMapLoadingStage(0);
+	loopClosuresProgressPub_ = nh.advertise<std_msgs::Int32MultiArray>("detect_more_loop_closures_progress", 1);
+	localGridsModifiedPub_ = nh.advertise<std_msgs::Int32>("local_grids_modified", 1, true);
 	initialPoseSub_ = nh.subscribe("initialpose", 1, &CoreWrapper::initialPoseCallback, this);
 
 	// planning topics
@@ -612,6 +891,9 @@ void CoreWrapper::onInit()
 	{
 		Parameters::parse(parameters_, Parameters::kRegForce3DoF(), twoDMapping_);
 	}
+	Parameters::parse(parameters_, Parameters::kRGBDEnabled(), rgbdEnabled_);
+	Parameters::parse(parameters_, Parameters::kRGBDLinearUpdate(), rgbdLinearUpdate_);
+	Parameters::parse(parameters_, Parameters::kRGBDAngularUpdate(), rgbdAngularUpdate_);
 
 	paused_ = pnh.param("is_rtabmap_paused", paused_);
 	if(paused_)
@@ -638,84 +920,24 @@ void CoreWrapper::onInit()
 
 	mapsManager_.setParameters(parameters_);
 
-	// Init RTAB-Map
-	rtabmap_.init(parameters_, databasePath_);
-
-	if(rtabmap_.getMemory())
+	if(mapsManager_.isLazyLoading())
 	{
-		if(useSavedMap_)
-		{
-			float xMin, yMin, gridCellSize;
-			cv::Mat map = rtabmap_.getMemory()->load2DMap(xMin, yMin, gridCellSize);
-			if(!map.empty())
-			{
-				NODELET_INFO("rtabmap: 2D occupancy grid map loaded (%dx%d).", map.cols, map.rows);
-				mapsManager_.set2DMap(map, xMin, yMin, gridCellSize, rtabmap_.getLocalOptimizedPoses(), rtabmap_.getMemory());
-			}
-		}
-
-		if(rtabmap_.getMemory()->getWorkingMem().size()>1)
-		{
-			NODELET_INFO("rtabmap: Working Memory = %d, Local map = %d.",
-					(int)rtabmap_.getMemory()->getWorkingMem().size()-1,
-					(int)rtabmap_.getLocalOptimizedPoses().size());
-		}
-
-		if(databasePath_.size())
-		{
-			NODELET_INFO("rtabmap: Database version = \"%s\".", rtabmap_.getMemory()->getDatabaseVersion().c_str());
-		}
-
-		if(rtabmap_.getMemory()->isIncremental())
-		{
-			NODELET_INFO("rtabmap: SLAM mode (%s=true)", Parameters::kMemIncrementalMemory().c_str());
-		}
-		else
-		{
-			NODELET_INFO("rtabmap: Localization mode (%s=false)", Parameters::kMemIncrementalMemory().c_str());
-		}
+		publishSavedMap();
 	}
 
-	// setup services
-	updateSrv_ = nh.advertiseService("update_parameters", &CoreWrapper::updateRtabmapCallback, this);
-	resetSrv_ = nh.advertiseService("reset", &CoreWrapper::resetRtabmapCallback, this);
-	pauseSrv_ = nh.advertiseService("pause", &CoreWrapper::pauseRtabmapCallback, this);
-	resumeSrv_ = nh.advertiseService("resume", &CoreWrapper::resumeRtabmapCallback, this);
-	loadDatabaseSrv_ = nh.advertiseService("load_database", &CoreWrapper::loadDatabaseCallback, this);
-	triggerNewMapSrv_ = nh.advertiseService("trigger_new_map", &CoreWrapper::triggerNewMapCallback, this);
-	backupDatabase_ = nh.advertiseService("backup", &CoreWrapper::backupDatabaseCallback, this);
-	detectMoreLoopClosuresSrv_ = nh.advertiseService("detect_more_loop_closures", &CoreWrapper::detectMoreLoopClosuresCallback, this);
-	globalBundleAdjustmentSrv_ = nh.advertiseService("global_bundle_adjustment", &CoreWrapper::globalBundleAdjustmentCallback, this);
-	cleanupLocalGridsSrv_ = nh.advertiseService("cleanup_local_grids", &CoreWrapper::cleanupLocalGridsCallback, this);
-	setModeLocalizationSrv_ = nh.advertiseService("set_mode_localization", &CoreWrapper::setModeLocalizationCallback, this);
-	setModeMappingSrv_ = nh.advertiseService("set_mode_mapping", &CoreWrapper::setModeMappingCallback, this);
-	getNodeDataSrv_ = nh.advertiseService("get_node_data", &CoreWrapper::getNodeDataCallback, this);
-	getMapDataSrv_ = nh.advertiseService("get_map_data", &CoreWrapper::getMapDataCallback, this);
-	getMapData2Srv_ = nh.advertiseService("get_map_data2", &CoreWrapper::getMapData2Callback, this);
-	getMapSrv_ = nh.advertiseService("get_map", &CoreWrapper::getMapCallback, this);
-	getProbMapSrv_ = nh.advertiseService("get_prob_map", &CoreWrapper::getProbMapCallback, this);
-	getGridMapSrv_ = nh.advertiseService("get_grid_map", &CoreWrapper::getGridMapCallback, this);
-	getProjMapSrv_ = nh.advertiseService("get_proj_map", &CoreWrapper::getProjMapCallback, this);
-	publishMapDataSrv_ = nh.advertiseService("publish_map", &CoreWrapper::publishMapCallback, this);
-	getPlanSrv_ = nh.advertiseService("get_plan", &CoreWrapper::getPlanCallback, this);
-	getPlanNodesSrv_ = nh.advertiseService("get_plan_nodes", &CoreWrapper::getPlanNodesCallback, this);
-	setGoalSrv_ = nh.advertiseService("set_goal", &CoreWrapper::setGoalCallback, this);
-	cancelGoalSrv_ = nh.advertiseService("cancel_goal", &CoreWrapper::cancelGoalCallback, this);
-	setLabelSrv_ = nh.advertiseService("set_label", &CoreWrapper::setLabelCallback, this);
-	listLabelsSrv_ = nh.advertiseService("list_labels", &CoreWrapper::listLabelsCallback, this);
-	addLinkSrv_ = nh.advertiseService("add_link", &CoreWrapper::addLinkCallback, this);
-	getNodesInRadiusSrv_ = nh.advertiseService("get_nodes_in_radius", &CoreWrapper::getNodesInRadiusCallback, this);
-#ifdef WITH_OCTOMAP_MSGS
-#ifdef RTABMAP_OCTOMAP
-	octomapBinarySrv_ = nh.advertiseService("octomap_binary", &CoreWrapper::octomapBinaryCallback, this);
-	octomapFullSrv_ = nh.advertiseService("octomap_full", &CoreWrapper::octomapFullCallback, this);
-#endif
-#endif
-	//private services
-	setLogDebugSrv_ = pnh.advertiseService("log_debug", &CoreWrapper::setLogDebug, this);
-	setLogInfoSrv_ = pnh.advertiseService("log_info", &CoreWrapper::setLogInfo, this);
-	setLogWarnSrv_ = pnh.advertiseService("log_warning", &CoreWrapper::setLogWarn, this);
-	setLogErrorSrv_ = pnh.advertiseService("log_error", &CoreWrapper::setLogError, this);
+	// Init RTAB-Map
+	if(mapsManager_.isLazyLoading())
+	{
+		// The saved map is already published. The working memory is loaded
+		// by memoryLoadThread_ (started at the end of onInit), data received
+		// meanwhile is dropped and services are advertised once it is done.
+		memoryLoading_ = true;
+	}
+	else
+	{
+		initRtabmap();
+		advertiseServices();
+	}
 
 	int optimizeIterations = 0;
 	Parameters::parse(parameters_, Parameters::kOptimizerIterations(), optimizeIterations);
@@ -802,8 +1024,9 @@ void CoreWrapper::onInit()
 				}
 			}
 		}
-		if(updateParams)
+		if(updateParams && !memoryLoading_)
 		{
+			// when loading, the memory is initialized with the updated parameters_
 			rtabmap_.parseParameters(parameters_);
 		}
 	}
@@ -822,10 +1045,34 @@ void CoreWrapper::onInit()
 #endif
 	imuSub_ = nh.subscribe("imu", 100, &CoreWrapper::imuAsyncCallback, this);
 	republishNodeDataSub_ = nh.subscribe("republish_node_data", 100, &CoreWrapper::republishNodeDataCallback, this);
+
+	if(memoryLoading_)
+	{
+		NODELET_INFO("rtabmap: Loading working memory in background...");
+		memoryLoadThread_ = new boost::thread(boost::bind(&CoreWrapper::initRtabmap, this));
+	}
 }
 
 CoreWrapper::~CoreWrapper()
 {
+	if(memoryLoadThread_)
+	{
+		memoryLoadThread_->join();
+		delete memoryLoadThread_;
+	}
+	if(mapQuerySpinner_)
+	{
+		mapQuerySpinner_->stop();
+		delete mapQuerySpinner_;
+		getNodeDataSrv_.shutdown();
+		getMapDataSrv_.shutdown();
+		getMapData2Srv_.shutdown();
+		getMapSrv_.shutdown();
+		getProbMapSrv_.shutdown();
+	}
+	mapSnapshot_.reset();
+	mapSnapshotDb_.reset();
+
 	if(transformThread_)
 	{
 		tfThreadRunning_ = false;
@@ -911,6 +1158,10 @@ void CoreWrapper::publishLoop(double tfDelay, double tfTolerance)
 
 void CoreWrapper::defaultCallback(const sensor_msgs::ImageConstPtr & imageMsg)
 {
+	if(isMemoryLoading())
+	{
+		return;
+	}
 	if(!paused_)
 	{
 		ros::Time stamp = imageMsg->header.stamp;
@@ -1009,12 +1260,14 @@ bool CoreWrapper::odomUpdate(const nav_msgs::OdometryConstPtr & odomMsg, ros::Ti
 		{
 			UWARN("Odometry is reset (identity pose or high variance (%f) detected). Increment map id!", MAX(odomMsg->pose.covariance[0], odomMsg->twist.covariance[0]));
 			rtabmap_.triggerNewMap();
+			newMapPending_ = true;
 			covariance_ = cv::Mat();
 		}
 
 		lastPoseIntermediate_ = false;
 		lastPose_ = odom;
 		lastPoseStamp_ = stamp;
+		publishLocalMaps(odom, stamp);
 
 		// Only update variance if odom is not null
 		if(!odom.isNull())
@@ -1074,6 +1327,11 @@ bool CoreWrapper::odomUpdate(const nav_msgs::OdometryConstPtr & odomMsg, ros::Ti
 			previousStamp_ = stamp;
 		}
 
+		if(isStationaryFrame(odom, stamp))
+		{
+			return false;
+		}
+
 		return true;
 	}
 	return false;
@@ -1094,12 +1352,14 @@ bool CoreWrapper::odomTFUpdate(const ros::Time & stamp)
 		{
 			UWARN("Odometry is reset (identity pose detected). Increment map id!");
 			rtabmap_.triggerNewMap();
+			newMapPending_ = true;
 			covariance_ = cv::Mat();
 		}
 
 		lastPoseIntermediate_ = false;
 		lastPose_ = odom;
 		lastPoseStamp_ = stamp;
+		publishLocalMaps(odom, stamp);
 
 		bool ignoreFrame = false;
 		if(stamp.toSec() == 0.0)
@@ -1130,6 +1390,60 @@ bool CoreWrapper::odomTFUpdate(const ros::Time & stamp)
 			previousStamp_ = stamp;
 		}
 
+		if(isStationaryFrame(odom, stamp))
+		{
+			return false;
+		}
+
+		return true;
+	}
+	return false;
+}
+
+// Same check than RGBD/LinearUpdate and RGBD/AngularUpdate in rtabmap (against the
+// odometry pose of the last frame processed), done before the sensor data are
+// converted so that frames that won't be added are not decoded.
+bool CoreWrapper::isStationaryFrame(const Transform & odom, const ros::Time & stamp)
+{
+	// Never skipped in localization mode (memory not incremental), as
+	// every frame can be used to relocalize.
+	if(!skipStationaryFrames_ ||
+		lastPoseIntermediate_ ||
+		newMapPending_ ||
+		odom.isNull() ||
+		lastProcessedOdom_.isNull() ||
+		rtabmap_.getMemory() == 0 ||
+		!rtabmap_.getMemory()->isIncremental())
+	{
+		return false;
+	}
+
+	if(!rgbdEnabled_ || (rgbdLinearUpdate_ <= 0.0f && rgbdAngularUpdate_ <= 0.0f))
+	{
+		return false;
+	}
+
+	float x,y,z,roll,pitch,yaw;
+	(lastProcessedOdom_.inverse() * odom).getTranslationAndEulerAngles(x,y,z,roll,pitch,yaw);
+	if((rgbdAngularUpdate_ <= 0.0f || (fabs(roll) < rgbdAngularUpdate_ && fabs(pitch) < rgbdAngularUpdate_ && fabs(yaw) < rgbdAngularUpdate_)) &&
+	   (rgbdLinearUpdate_ <= 0.0f || (fabs(x) < rgbdLinearUpdate_ && fabs(y) < rgbdLinearUpdate_ && fabs(z) < rgbdLinearUpdate_)))
+	{
+		++stationaryFramesSkipped_;
+
+		// TF is still published by the transform thread, update the localization pose
+		if(localizationPosePub_.getNumSubscribers() &&
+			!rtabmap_.getStatistics().localizationCovariance().empty())
+		{
+			geometry_msgs::PoseWithCovarianceStamped poseMsg;
+			poseMsg.header.frame_id = mapFrameId_;
+			poseMsg.header.stamp = stamp;
+			mapToOdomMutex_.lock();
+			rtabmap_ros::transformToPoseMsg(mapToOdom_*odom, poseMsg.pose.pose);
+			mapToOdomMutex_.unlock();
+			const cv::Mat & cov = rtabmap_.getStatistics().localizationCovariance();
+			memcpy(poseMsg.pose.covariance.data(), cov.data, cov.total()*sizeof(double));
+			localizationPosePub_.publish(poseMsg);
+		}
 		return true;
 	}
 	return false;
@@ -1149,6 +1463,10 @@ void CoreWrapper::commonDepthCallback(
 		const std::vector<std::vector<rtabmap_ros::Point3f> > & localPoints3d,
 		const std::vector<cv::Mat> & localDescriptors)
 {
+	if(isMemoryLoading())
+	{
+		return;
+	}
 	std::string odomFrameId = odomFrameId_;
 	if(odomMsg.get())
 	{
@@ -1243,7 +1561,9 @@ void CoreWrapper::commonDepthCallbackImpl(
 			localDescriptorsMsgs,
 			&keypoints,
 			&points,
-			&descriptors))
+			&descriptors,
+			&rgbPlans_,
+			&depthPlans_))
 	{
 		NODELET_ERROR("Could not convert rgb/depth msgs! Aborting rtabmap update...");
 		return;
@@ -1429,6 +1749,10 @@ void CoreWrapper::commonStereoCallback(
 		const std::vector<rtabmap_ros::Point3f> & localPoints3dMsg,
 		const cv::Mat & localDescriptorsMsg)
 {
+	if(isMemoryLoading())
+	{
+		return;
+	}
 	UTimer timerConversion;
 	std::string odomFrameId = odomFrameId_;
 	if(odomMsg.get())
@@ -1488,7 +1812,10 @@ void CoreWrapper::commonStereoCallback(
 			stereoModel,
 			tfListener_,
 			waitForTransform_?waitForTransformDuration_:0.0,
-			alreadyRectifiedImages_))
+			alreadyRectifiedImages_,
+			&stereoModelCache_,
+			&stereoLeftPlan_,
+			&stereoRightPlan_))
 	{
 		NODELET_ERROR("Could not convert stereo msgs! Aborting rtabmap update...");
 		return;
@@ -1671,6 +1998,10 @@ void CoreWrapper::commonLaserScanCallback(
 		const rtabmap_ros::OdomInfoConstPtr& odomInfoMsg,
 		const rtabmap_ros::GlobalDescriptor & globalDescriptor)
 {
+	if(isMemoryLoading())
+	{
+		return;
+	}
 	UTimer timerConversion;
 	std::string odomFrameId = odomFrameId_;
 	if(odomMsg.get())
@@ -1803,6 +2134,10 @@ void CoreWrapper::commonOdomCallback(
 		const rtabmap_ros::UserDataConstPtr & userDataMsg,
 		const rtabmap_ros::OdomInfoConstPtr& odomInfoMsg)
 {
+	if(isMemoryLoading())
+	{
+		return;
+	}
 	UTimer timerConversion;
 	UASSERT(odomMsg.get());
 	std::string odomFrameId = odomFrameId_;
@@ -2067,6 +2402,8 @@ void CoreWrapper::process(
 		double timeRtabmap = 0.0;
 		double timeUpdateMaps = 0.0;
 		double timePublishMaps = 0.0;
+		bool mapsUpdateSkipped = false;
+		std::clock_t cpuStart = std::clock();
 
 		cv::Mat covariance = odomCovariance;
 		if(covariance.empty() || !uIsFinite(covariance.at<double>(0,0)) || covariance.at<double>(0,0)<=0.0f)
@@ -2118,6 +2455,11 @@ void CoreWrapper::process(
 			rtabmapROSStats_.clear();
 		}
 
+		externalStats.insert(std::make_pair(std::string("RtabmapROS/StationaryFramesSkipped/"), (float)stationaryFramesSkipped_));
+		stationaryFramesSkipped_ = 0;
+		newMapPending_ = false;
+		lastProcessedOdom_ = odom;
+
 		timeMsgConversion += timer.ticks();
 		if(rtabmap_.process(data, odom, covariance, odomVelocity, externalStats))
 		{
@@ -2142,8 +2484,7 @@ void CoreWrapper::process(
 			}
 			else
 			{
-				// Publish local graph, info
-				this->publishStats(stamp);
+				// Localization pose first, the other outputs can take more time
 				if(localizationPosePub_.getNumSubscribers() &&
 					!rtabmap_.getStatistics().localizationCovariance().empty())
 				{
@@ -2156,60 +2497,146 @@ void CoreWrapper::process(
 					memcpy(poseMsg.pose.covariance.data(), cov.data, cov.total()*sizeof(double));
 					localizationPosePub_.publish(poseMsg);
 				}
-				std::map<int, rtabmap::Transform> filteredPoses(rtabmap_.getLocalOptimizedPoses().lower_bound(1), rtabmap_.getLocalOptimizedPoses().end());
-
-				// create a tmp signature with latest sensory data if latest signature was ignored
-				std::map<int, rtabmap::Signature> tmpSignature;
-				if(rtabmap_.getMemory() == 0 ||
-					filteredPoses.size() == 0 ||
-					rtabmap_.getMemory()->getLastSignatureId() != filteredPoses.rbegin()->first ||
-					rtabmap_.getMemory()->getLastWorkingSignature() == 0 ||
-					rtabmap_.getMemory()->getLastWorkingSignature()->sensorData().gridCellSize() == 0 ||
-					(!mapsManager_.getOccupancyGrid()->isGridFromDepth() && data.laserScanRaw().is2d())) // 2d laser scan would fill empty space for latest data
-				{
-					SensorData tmpData = data;
-					tmpData.setId(0);
-					tmpSignature.insert(std::make_pair(0, Signature(0, -1, 0, data.stamp(), "", odom, Transform(), tmpData)));
-					filteredPoses.insert(std::make_pair(0, mapToOdom_*odom));
-				}
 
-				if((mappingMaxNodes_ > 0 || mappingAltitudeDelta_>0.0) && filteredPoses.size()>1)
-				{
-					std::map<int, Transform> nearestPoses = filterNodesToAssemble(filteredPoses, mapToOdom_*odom);
+				// Publish local graph, info
+				this->publishStats(stamp);
 
-					//add latest/zero and make sure those on a planned path are not filtered
-					std::set<int> onPath;
-					if(rtabmap_.getPath().size())
+				bool skipMaps = false;
+				if(localizationLightweight_ && rtabmap_.getMemory() && !rtabmap_.getMemory()->isIncremental())
+				{
+					// In localization, the maps change only if the local graph changed
+					// (re-optimization, nodes retrieved or transferred from WM), if the
+					// latest data overlaid on the maps moved, or if subscribers changed
+					// (latched topics are resent by ROS to new subscribers of a same topic).
+					// The cheap checks are done first, the graph is compared in place
+					// with the one of the last update only if they all passed.
+					unsigned int mapsSubscribers = mapsManager_.getNumSubscribers();
+					skipMaps = mapsSubscribers == mapsSubscribers_ &&
+							!mapsManager_.hasLocalMapSubscribers() &&
+							!mapSnapshotQueries_ &&
+							mapsManager_.lazyLoadingRemaining() == 0 &&
+							!mapsLatestPose_.isNull() &&
+							rtabmap_.getLoopClosureId() == 0 && // a localization re-optimizes the local graph
+							(rgbdLinearUpdate_ > 0.0f || rgbdAngularUpdate_ > 0.0f);
+					mapsSubscribers_ = mapsSubscribers;
+
+					if(skipMaps)
 					{
-						std::vector<int> nextNodes = rtabmap_.getPathNextNodes();
-						onPath.insert(nextNodes.begin(), nextNodes.end());
+						float x,y,z,roll,pitch,yaw;
+						(mapsLatestPose_.inverse() * mapToOdom_*odom).getTranslationAndEulerAngles(x,y,z,roll,pitch,yaw);
+						skipMaps =
+								(rgbdAngularUpdate_ <= 0.0f || (fabs(roll) < rgbdAngularUpdate_ && fabs(pitch) < rgbdAngularUpdate_ && fabs(yaw) < rgbdAngularUpdate_)) &&
+								(rgbdLinearUpdate_ <= 0.0f || (fabs(x) < rgbdLinearUpdate_ && fabs(y) < rgbdLinearUpdate_ && fabs(z) < rgbdLinearUpdate_));
 					}
-					for(std::map<int, Transform>::iterator iter=filteredPoses.begin(); iter!=filteredPoses.end(); ++iter)
+
+					if(skipMaps)
 					{
-						if(iter->first == 0 || onPath.find(iter->first) != onPath.end())
+						// The last signature is not compared: it is replaced on every frame.
+						const std::map<int, Transform> & optimizedPoses = rtabmap_.getLocalOptimizedPoses();
+						int lastId = rtabmap_.getMemory()->getLastSignatureId();
+						std::map<int, Transform>::const_iterator jter=mapsPoses_.begin();
+						for(std::map<int, Transform>::const_iterator iter=optimizedPoses.lower_bound(1); skipMaps && iter!=optimizedPoses.end(); ++iter)
 						{
-							nearestPoses.insert(*iter);
+							if(iter->first != lastId)
+							{
+								skipMaps = jter != mapsPoses_.end() &&
+										iter->first == jter->first &&
+										memcmp(iter->second.data(), jter->second.data(), 12*sizeof(float)) == 0;
+								if(skipMaps)
+								{
+									++jter;
+								}
+							}
 						}
-						else if(onPath.empty())
+						skipMaps = skipMaps && jter == mapsPoses_.end();
+					}
+				}
+				if(skipMaps)
+				{
+					NODELET_DEBUG("Localization: graph and latest pose not changed, maps not updated");
+					mapsUpdateSkipped = true;
+				}
+				else
+				{
+					if(localizationLightweight_)
+					{
+						// copied only when the maps are updated
+						mapsPoses_.clear();
+						if(rtabmap_.getMemory())
 						{
-							break;
+							const std::map<int, Transform> & optimizedPoses = rtabmap_.getLocalOptimizedPoses();
+							int lastId = rtabmap_.getMemory()->getLastSignatureId();
+							for(std::map<int, Transform>::const_iterator iter=optimizedPoses.lower_bound(1); iter!=optimizedPoses.end(); ++iter)
+							{
+								if(iter->first != lastId)
+								{
+									mapsPoses_.insert(mapsPoses_.end(), *iter);
+								}
+							}
 						}
+						mapsLatestPose_ = mapToOdom_*odom;
+					}
+					std::map<int, rtabmap::Transform> filteredPoses(rtabmap_.getLocalOptimizedPoses().lower_bound(1), rtabmap_.getLocalOptimizedPoses().end());
+
+					// create a tmp signature with latest sensory data if latest signature was ignored
+					std::map<int, rtabmap::Signature> tmpSignature;
+					if(rtabmap_.getMemory() == 0 ||
+						filteredPoses.size() == 0 ||
+						rtabmap_.getMemory()->getLastSignatureId() != filteredPoses.rbegin()->first ||
+						rtabmap_.getMemory()->getLastWorkingSignature() == 0 ||
+						rtabmap_.getMemory()->getLastWorkingSignature()->sensorData().gridCellSize() == 0 ||
+						(!mapsManager_.getOccupancyGrid()->isGridFromDepth() && data.laserScanRaw().is2d())) // 2d laser scan would fill empty space for latest data
+					{
+						SensorData tmpData = data;
+						tmpData.setId(0);
+						tmpSignature.insert(std::make_pair(0, Signature(0, -1, 0, data.stamp(), "", odom, Transform(), tmpData)));
+						filteredPoses.insert(std::make_pair(0, mapToOdom_*odom));
 					}
 
-					filteredPoses = nearestPoses;
-				}
+					if((mappingMaxNodes_ > 0 || mappingAltitudeDelta_>0.0) && filteredPoses.size()>1)
+					{
+						std::map<int, Transform> nearestPoses = filterNodesToAssemble(filteredPoses, mapToOdom_*odom);
 
-				// Update maps
-				filteredPoses = mapsManager_.updateMapCaches(
-						filteredPoses,
-						rtabmap_.getMemory(),
-						false,
-						false,
-						tmpSignature);
+						//add latest/zero and make sure those on a planned path are not filtered
+						std::set<int> onPath;
+						if(rtabmap_.getPath().size())
+						{
+							std::vector<int> nextNodes = rtabmap_.getPathNextNodes();
+							onPath.insert(nextNodes.begin(), nextNodes.end());
+						}
+						for(std::map<int, Transform>::iterator iter=filteredPoses.begin(); iter!=filteredPoses.end(); ++iter)
+						{
+							if(iter->first == 0 || onPath.find(iter->first) != onPath.end())
+							{
+								nearestPoses.insert(*iter);
+							}
+							else if(onPath.empty())
+							{
+								break;
+							}
+						}
 
-				timeUpdateMaps = timer.ticks();
+						filteredPoses = nearestPoses;
+					}
+
+					// Update maps (the grid is always kept up to date for map snapshots and while local grids are lazy loaded)
+					mapsManager_.setLazyLoadingPose(mapToOdom_*odom);
+					filteredPoses = mapsManager_.updateMapCaches(
+							filteredPoses,
+							rtabmap_.getMemory(),
+							mapSnapshotQueries_ || mapsManager_.lazyLoadingRemaining() > 0,
+							false,
+							tmpSignature);
 
-				mapsManager_.publishMaps(filteredPoses, stamp, mapFrameId_);
+					timeUpdateMaps = timer.ticks();
+
+					mapsManager_.publishMaps(filteredPoses, stamp, mapFrameId_);
+					updateMapSnapshot(stamp);
+					if(mapLoadingStage_ == 2 && mapsManager_.lazyLoadingRemaining() == 0)
+					{
+						publishMapLoadingStage(3);
+					}
+				}
 
 				// update goal if planning is enabled
 				if(!currentMetricGoal_.isNull())
@@ -2317,11 +2744,22 @@ void CoreWrapper::process(
 				(int)rtabmap_.getLocalOptimizedPoses().size(),
 				rtabmap_.getWMSize()+rtabmap_.getSTMSize());
 		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/HasSubscribers/"), mapsManager_.hasSubscribers()?1:0));
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/MapLoadingStage/"), mapLoadingStage_));
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/MapLoadingRemaining/"), mapsManager_.lazyLoadingRemaining()));
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/MapUpdatePending/"), mapsManager_.mapUpdatePending()));
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/OctomapPending/"), mapsManager_.octomapPending()));
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/PlanCacheHits/"), planCacheHits_));
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/PlanCacheMisses/"), planCacheMisses_));
+		planCacheHits_ = 0;
+		planCacheMisses_ = 0;
 		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/TimeMsgConversion/ms"), timeMsgConversion*1000.0f));
 		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/TimeRtabmap/ms"), timeRtabmap*1000.0f));
 		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/TimeUpdatingMaps/ms"), timeUpdateMaps*1000.0f));
 		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/TimePublishing/ms"), timePublishMaps*1000.0f));
 		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/TimeTotal/ms"), (timeMsgConversion+timeRtabmap+timeUpdateMaps+timePublishMaps)*1000.0f));
+		// CPU time of the whole process (all threads) from RTAB-Map's update to the end of publishing
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/CpuTotal/ms"), float(std::clock()-cpuStart)*1000.0f/float(CLOCKS_PER_SEC)));
+		rtabmapROSStats_.insert(std::make_pair(std::string("RtabmapROS/MapsUpdateSkipped/"), mapsUpdateSkipped?1:0));
 	}
 	else if(!rtabmap_.isIDsGenerated())
 	{
@@ -2537,6 +2975,10 @@ void CoreWrapper::interOdomInfoCallback(const nav_msgs::OdometryConstPtr & msg1,
 
 void CoreWrapper::initialPoseCallback(const geometry_msgs::PoseWithCovarianceStampedConstPtr & msg)
 {
+	if(isMemoryLoading())
+	{
+		return;
+	}
 	Transform intialPose = rtabmap_ros::transformFromPoseMsg(msg->pose.pose);
 	if(intialPose.isNull())
 	{
@@ -2555,6 +2997,10 @@ void CoreWrapper::goalCommonCallback(
 		const ros::Time & stamp,
 		double * planningTime)
 {
+	if(isMemoryLoading())
+	{
+		return;
+	}
 	UTimer timer;
 
 	if(id == 0 && !label.empty() && rtabmap_.getMemory())
@@ -2798,6 +3244,9 @@ bool CoreWrapper::updateRtabmapCallback(std_srvs::Empty::Request&, std_srvs::Emp
 		twoDMapping_= uStr2Bool(parameters_.at(Parameters::kRegForce3DoF()));
 		NODELET_INFO("2D mapping = %s", twoDMapping_?"true":"false");
 	}
+	Parameters::parse(parameters_, Parameters::kRGBDEnabled(), rgbdEnabled_);
+	Parameters::parse(parameters_, Parameters::kRGBDLinearUpdate(), rgbdLinearUpdate_);
+	Parameters::parse(parameters_, Parameters::kRGBDAngularUpdate(), rgbdAngularUpdate_);
 	rtabmap_.parseParameters(parameters_);
 	mapsManager_.setParameters(parameters_);
 	return true;
@@ -2810,6 +3259,11 @@ bool CoreWrapper::resetRtabmapCallback(std_srvs::Empty::Request&, std_srvs::Empt
 	covariance_ = cv::Mat();
 	lastPose_.setIdentity();
 	lastPoseIntermediate_ = false;
+	lastProcessedOdom_.setNull();
+	planCache_.clear();
+	mapsPoses_.clear();
+	mapsLatestPose_.setNull();
+	planCacheLru_.clear();
 	currentMetricGoal_.setNull();
 	lastPublishedMetricGoal_.setNull();
 	goalFrameId_.clear();
@@ -2829,6 +3283,7 @@ bool CoreWrapper::resetRtabmapCallback(std_srvs::Empty::Request&, std_srvs::Empt
 	mapToOdom_.setIdentity();
 	mapToOdomMutex_.unlock();
 	nodesToRepublish_.clear();
+	updateMapSnapshot(ros::Time::now());
 
 	return true;
 }
@@ -2876,6 +3331,9 @@ bool CoreWrapper::loadDatabaseCallback(rtabmap_ros::LoadDatabase::Request& req,
 		return false;
 	}
 
+	// Map queries should not keep the old database open
+	closeMapSnapshotDb();
+
 	if(UFile::exists(newDatabasePath) && req.clear)
 	{
 		UFile::erase(newDatabasePath);
@@ -2900,6 +3358,11 @@ bool CoreWrapper::loadDatabaseCallback(rtabmap_ros::LoadDatabase::Request& req,
 	covariance_ = cv::Mat();
 	lastPose_.setIdentity();
 	lastPoseIntermediate_ = false;
+	lastProcessedOdom_.setNull();
+	planCache_.clear();
+	mapsPoses_.clear();
+	mapsLatestPose_.setNull();
+	planCacheLru_.clear();
 	currentMetricGoal_.setNull();
 	lastPublishedMetricGoal_.setNull();
 	goalFrameId_.clear();
@@ -2954,8 +3417,15 @@ bool CoreWrapper::loadDatabaseCallback(rtabmap_ros::LoadDatabase::Request& req,
 		}
 	}
 
+	publishMapLoadingStage(0);
+	if(mapsManager_.isLazyLoading() && !req.clear)
+	{
+		publishSavedMap();
+	}
+
 	NODELET_INFO("LoadDatabase: Loading database...");
 	rtabmap_.init(parameters_, databasePath_);
+	openMapSnapshotDb();
 	NODELET_INFO("LoadDatabase: Loading database... done!");
 
 	if(rtabmap_.getMemory())
@@ -2970,6 +3440,8 @@ bool CoreWrapper::loadDatabaseCallback(rtabmap_ros::LoadDatabase::Request& req,
 				mapsManager_.set2DMap(map, xMin, yMin, gridCellSize, rtabmap_.getLocalOptimizedPoses(), rtabmap_.getMemory());
 			}
 		}
+		mapsManager_.startLazyLoading(databasePath_, rtabmap_.getLocalOptimizedPoses());
+		publishMapLoadingStage(mapsManager_.lazyLoadingRemaining()?2:3);
 
 		if(rtabmap_.getMemory()->getWorkingMem().size()>1)
 		{
@@ -2991,6 +3463,7 @@ bool CoreWrapper::loadDatabaseCallback(rtabmap_ros::LoadDatabase::Request& req,
 		{
 			NODELET_INFO("LoadDatabase: Localization mode (%s=false)", Parameters::kMemIncrementalMemory().c_str());
 		}
+		updateMapSnapshot(ros::Time::now());
 
 		return true;
 	}
@@ -3002,6 +3475,7 @@ bool CoreWrapper::triggerNewMapCallback(std_srvs::Empty::Request&, std_srvs::Emp
 {
 	NODELET_INFO("rtabmap: Trigger new map");
 	rtabmap_.triggerNewMap();
+	newMapPending_ = true;
 	return true;
 }
 
@@ -3042,6 +3516,8 @@ bool CoreWrapper::backupDatabaseCallback(std_srvs::Empty::Request&, std_srvs::Em
 
 	NODELET_INFO("Backup: Reloading memory...");
 	rtabmap_.init(parameters_, databasePath_);
+	openMapSnapshotDb();
+	updateMapSnapshot(ros::Time::now());
 	NODELET_INFO("Backup: Reloading memory... done!");
 
 	return true;
@@ -3051,6 +3527,7 @@ void CoreWrapper::republishMaps()
 {
 	ros::Time stamp = ros::Time::now();
 	mapsManager_.publishMaps(rtabmap_.getLocalOptimizedPoses(), stamp, mapFrameId_);
+	updateMapSnapshot(stamp);
 
 	if(mapDataPub_.getNumSubscribers())
 	{
@@ -3127,16 +3604,36 @@ bool CoreWrapper::detectMoreLoopClosuresCallback(rtabmap_ros::DetectMoreLoopClos
 			iterations,
 			intraSession?"true":"false",
 			interSession?"true":"false");
-	res.detected = rtabmap_.detectMoreLoopClosures(
-			clusterRadiusMax,
-			clusterAngle*M_PI/180.0,
-			iterations,
-			intraSession,
-			interSession,
-			0,
-			clusterRadiusMin);
-	if(res.detected<0)
-	{
+	res.pairs_tested = 0;
+	res.pairs_total = 0;
+	if(req.threads > 0)
+	{
+		res.detected = detectMoreLoopClosuresParallel(
+				clusterRadiusMin,
+				clusterRadiusMax,
+				clusterAngle*M_PI/180.0,
+				iterations,
+				intraSession,
+				interSession,
+				req.threads,
+				req.max_pairs,
+				req.max_duration,
+				res.pairs_tested,
+				res.pairs_total);
+	}
+	else
+	{
+		res.detected = rtabmap_.detectMoreLoopClosures(
+				clusterRadiusMax,
+				clusterAngle*M_PI/180.0,
+				iterations,
+				intraSession,
+				interSession,
+				0,
+				clusterRadiusMin);
+	}
+	if(res.detected<0)
+	{
 		NODELET_ERROR("Post-Processing: Detecting more loop closures failed!");
 	}
 	else
@@ -3152,6 +3649,215 @@ bool CoreWrapper::detectMoreLoopClosuresCallback(rtabmap_ros::DetectMoreLoopClos
 	return false;
 }
 
+int CoreWrapper::detectMoreLoopClosuresParallel(
+		float clusterRadiusMin,
+		float clusterRadiusMax,
+		float clusterAngle,
+		int iterations,
+		bool intraSession,
+		bool interSession,
+		int threads,
+		int maxPairs,
+		float maxDuration,
+		int & pairsTested,
+		int & pairsTotal)
+{
+	if(rtabmap_.getMemory() == 0)
+	{
+		return -1;
+	}
+	// same parameters than RTAB-Map uses for its own loop closures
+	const ParametersMap & parameters = rtabmap_.getParameters();
+	float optimizeMaxError = Parameters::defaultRGBDOptimizeMaxError();
+	Parameters::parse(parameters, Parameters::kRGBDOptimizeMaxError(), optimizeMaxError);
+
+	UTimer timer;
+	int detected = 0;
+	bool timeout = false;
+	for(int n=0; n<iterations && !timeout; ++n)
+	{
+		std::map<int, Transform> poses;
+		std::multimap<int, Link> links;
+		std::map<int, Signature> signatures; // for map ids
+		rtabmap_.getGraph(poses, links, true, true, &signatures, false, false, false, false);
+
+		std::vector<std::pair<int, int> > pairs = findLoopClosureCandidates(
+				poses,
+				signatures,
+				links,
+				clusterRadiusMin,
+				clusterRadiusMax,
+				clusterAngle,
+				intraSession,
+				interSession);
+		if(maxPairs > 0 && (int)pairs.size() > maxPairs)
+		{
+			pairs.resize(maxPairs);
+		}
+		pairsTotal += (int)pairs.size();
+		NODELET_WARN("Post-Processing: Iteration %d/%d, %d candidate pairs to verify with %d threads...",
+				n+1, iterations, (int)pairs.size(), threads);
+		publishLoopClosuresProgress(n+1, iterations, 0, (int)pairs.size(), 0, detected);
+
+		// Verified by chunks. The signatures of a chunk are copied from memory
+		// with their features, so they are not extracted again for each pair.
+		std::vector<Link> accepted;
+		int pairsTestedBefore = pairsTested;
+		size_t chunkSize = threads*8;
+		for(size_t i=0; i<pairs.size() && !timeout; i+=chunkSize)
+		{
+			std::vector<std::pair<int, int> > chunk(pairs.begin()+i, pairs.begin()+std::min(pairs.size(), i+chunkSize));
+			std::map<int, Signature> chunkSignatures;
+			std::vector<Signature*> toUncompress;
+			for(size_t j=0; j<chunk.size(); ++j)
+			{
+				int ids[2] = {chunk[j].first, chunk[j].second};
+				for(int k=0; k<2; ++k)
+				{
+					if(chunkSignatures.find(ids[k]) == chunkSignatures.end())
+					{
+						Signature & s = chunkSignatures.insert(std::make_pair(ids[k], rtabmap_.getSignatureCopy(ids[k], true, true, false, false, true, false))).first->second;
+						toUncompress.push_back(&s);
+					}
+				}
+			}
+
+			boost::thread_group workers;
+			for(int t=0; t<threads && t<(int)toUncompress.size(); ++t)
+			{
+				workers.create_thread(SignatureUncompression(toUncompress, t, threads));
+			}
+			workers.join_all();
+
+			std::vector<Link> chunkLinks(chunk.size());
+			boost::thread_group registrationWorkers;
+			for(int t=0; t<threads && t<(int)chunk.size(); ++t)
+			{
+				registrationWorkers.create_thread(LinkRefinement(parameters, chunk, poses, chunkSignatures, chunkLinks, t, threads));
+			}
+			registrationWorkers.join_all();
+
+			for(size_t j=0; j<chunkLinks.size(); ++j)
+			{
+				if(chunkLinks[j].from() > 0)
+				{
+					accepted.push_back(chunkLinks[j]);
+				}
+			}
+			pairsTested += (int)chunk.size();
+			NODELET_INFO("Post-Processing: Verified %d/%d pairs, %d registered (%fs)",
+					int(i+chunk.size()), (int)pairs.size(), (int)accepted.size(), timer.elapsed());
+			publishLoopClosuresProgress(n+1, iterations, int(i+chunk.size()), (int)pairs.size(), (int)accepted.size(), detected);
+			timeout = maxDuration > 0.0f && timer.elapsed() > maxDuration;
+		}
+		if(timeout)
+		{
+			NODELET_WARN("Post-Processing: Maximum duration reached (%fs), keeping the %d loop closures found so far", maxDuration, (int)accepted.size());
+		}
+		if(accepted.empty())
+		{
+			break;
+		}
+
+		// The graph is optimized once with all new links, then the links with
+		// an error larger than RGBD/OptimizeMaxError times their standard
+		// deviation are rejected.
+		if(optimizeMaxError > 0.0f)
+		{
+			std::multimap<int, Link> linksWithLoops = links;
+			for(size_t j=0; j<accepted.size(); ++j)
+			{
+				linksWithLoops.insert(std::make_pair(accepted[j].from(), accepted[j]));
+			}
+			Optimizer * optimizer = Optimizer::create(parameters);
+			int rootId = poses.lower_bound(1)!=poses.end()?poses.lower_bound(1)->first:poses.begin()->first; // ignore landmarks
+			std::map<int, Transform> posesOut;
+			std::multimap<int, Link> linksOut;
+			optimizer->getConnectedGraph(rootId, poses, linksWithLoops, posesOut, linksOut);
+			std::map<int, Transform> optimizedPoses = optimizer->optimize(rootId, posesOut, linksOut);
+			delete optimizer;
+
+			std::vector<Link> kept;
+			for(size_t j=0; j<accepted.size(); ++j)
+			{
+				std::map<int, Transform>::iterator fromIter = optimizedPoses.find(accepted[j].from());
+				std::map<int, Transform>::iterator toIter = optimizedPoses.find(accepted[j].to());
+				if(fromIter == optimizedPoses.end() || toIter == optimizedPoses.end())
+				{
+					// optimization failed or link not connected to the root
+					continue;
+				}
+				Transform error = (fromIter->second.inverse() * toIter->second).inverse() * accepted[j].transform();
+				float linearError = error.getNorm();
+				float roll, pitch, yaw;
+				error.getEulerAngles(roll, pitch, yaw);
+				float angularError = std::max(fabs(roll), std::max(fabs(pitch), fabs(yaw)));
+				if(linearError > optimizeMaxError*sqrt(accepted[j].transVariance()) ||
+				   angularError > optimizeMaxError*sqrt(accepted[j].rotVariance()))
+				{
+					NODELET_WARN("Post-Processing: Rejected loop closure %d->%d after optimization (linear error=%fm, angular error=%frad, %s=%f)",
+							accepted[j].from(), accepted[j].to(), linearError, angularError, Parameters::kRGBDOptimizeMaxError().c_str(), optimizeMaxError);
+					continue;
+				}
+				kept.push_back(accepted[j]);
+			}
+			accepted = kept;
+		}
+
+		// Rtabmap::addLink() re-optimizes the whole local graph on each call,
+		// and RTAB-Map 0.20 gives only a const access to its memory. The links
+		// but the last are added directly to the memory (owned by rtabmap_,
+		// only used on this thread), then the last one through addLink() so
+		// that the graph is optimized once with all of them.
+		UTimer addTime;
+		int added = 0;
+		for(size_t j=0; j<accepted.size(); ++j)
+		{
+			bool success;
+			if(j+1 < accepted.size())
+			{
+				success = const_cast<Memory*>(rtabmap_.getMemory())->addLink(accepted[j], true);
+			}
+			else
+			{
+				success = rtabmap_.addLink(accepted[j]);
+			}
+			if(success)
+			{
+				++added;
+			}
+			else
+			{
+				NODELET_WARN("Post-Processing: Failed to add loop closure %d->%d", accepted[j].from(), accepted[j].to());
+			}
+		}
+		detected += added;
+		NODELET_INFO("Post-Processing: Added %d loop closures, graph optimized once (%fs)", added, addTime.ticks());
+		publishLoopClosuresProgress(n+1, iterations, pairsTested-pairsTestedBefore, (int)pairs.size(), (int)accepted.size(), detected);
+		if(added == 0)
+		{
+			break;
+		}
+	}
+	return detected;
+}
+
+void CoreWrapper::publishLoopClosuresProgress(int iteration, int iterations, int pairsVerified, int pairsTotal, int registered, int detected)
+{
+	if(loopClosuresProgressPub_.getNumSubscribers())
+	{
+		std_msgs::Int32MultiArray msg;
+		msg.data.resize(6);
+		msg.data[0] = iteration;
+		msg.data[1] = iterations;
+		msg.data[2] = pairsVerified;
+		msg.data[3] = pairsTotal;
+		msg.data[4] = registered;
+		msg.data[5] = detected;
+		loopClosuresProgressPub_.publish(msg);
+	}
+}
+
 bool CoreWrapper::cleanupLocalGridsCallback(rtabmap_ros::CleanupLocalGrids::Request& req, rtabmap_ros::CleanupLocalGrids::Response& res)
 {
 	NODELET_WARN("Cleanup local grids service called");
@@ -3195,6 +3901,11 @@ bool CoreWrapper::cleanupLocalGridsCallback(rtabmap_ros::CleanupLocalGrids::Requ
 			mapsManager_.clear();
 			mapsManager_.set2DMap(map, xMin, yMin, gridCellSize, rtabmap_.getLocalOptimizedPoses(), rtabmap_.getMemory());
 
+			// Nodes are not republished, tell map_assembler that its node data is stale
+			std_msgs::Int32 msg;
+			msg.data = ++localGridsModified_;
+			localGridsModifiedPub_.publish(msg);
+
 			republishMaps();
 		}
 		return true;
@@ -3297,6 +4008,431 @@ bool CoreWrapper::setLogError(std_srvs::Empty::Request&, std_srvs::Empty::Respon
 	return true;
 }
 
+// Local maps follow the odometry rate instead of the map update rate
+void CoreWrapper::publishLocalMaps(const Transform & odom, const ros::Time & stamp)
+{
+	if(!odom.isNull() && mapsManager_.hasLocalMapSubscribers())
+	{
+		mapToOdomMutex_.lock();
+		Transform pose = mapToOdom_*odom;
+		mapToOdomMutex_.unlock();
+		mapsManager_.publishLocalMaps(pose, stamp, mapFrameId_);
+	}
+}
+
+// Publish the saved 2D map directly from the database before the memory is
+// initialized, which can take a while on large databases.
+void CoreWrapper::publishSavedMap()
+{
+	if(!useSavedMap_ || databasePath_.empty() || !UFile::exists(databasePath_))
+	{
+		return;
+	}
+
+	DBDriver * driver = DBDriver::create();
+	if(driver->openConnection(databasePath_, false))
+	{
+		float xMin, yMin, gridCellSize;
+		cv::Mat map = driver->load2DMap(xMin, yMin, gridCellSize);
+		if(!map.empty())
+		{
+			mapsManager_.set2DMap(map, xMin, yMin, gridCellSize, driver->loadOptimizedPoses());
+			if(mapsManager_.publishGridMap(ros::Time::now(), mapFrameId_))
+			{
+				NODELET_INFO("rtabmap: 2D occupancy grid map published (%dx%d) before loading the memory.", map.cols, map.rows);
+				publishMapLoadingStage(1);
+			}
+		}
+		driver->closeConnection(false);
+	}
+	delete driver;
+}
+
+void CoreWrapper::initRtabmap()
+{
+	UTimer timer;
+	rtabmap_.init(parameters_, databasePath_);
+	NODELET_INFO("rtabmap: Working memory loaded (%fs).", timer.ticks());
+
+	if(memoryLoading_)
+	{
+		// called from memoryLoadThread_, finish on the mapping thread
+		getNodeHandle().getCallbackQueue()->addCallback(ros::CallbackInterfacePtr(new MappingThreadCall(
+				boost::bind(&CoreWrapper::setupMemory, this),
+				boost::shared_ptr<USemaphore>(new USemaphore()))));
+	}
+	else
+	{
+		setupMemory();
+	}
+}
+
+void CoreWrapper::setupMemory()
+{
+	if(rtabmap_.getMemory())
+	{
+		if(useSavedMap_)
+		{
+			float xMin, yMin, gridCellSize;
+			cv::Mat map = rtabmap_.getMemory()->load2DMap(xMin, yMin, gridCellSize);
+			if(!map.empty())
+			{
+				NODELET_INFO("rtabmap: 2D occupancy grid map loaded (%dx%d).", map.cols, map.rows);
+				mapsManager_.set2DMap(map, xMin, yMin, gridCellSize, rtabmap_.getLocalOptimizedPoses(), rtabmap_.getMemory());
+			}
+		}
+		mapsManager_.startLazyLoading(databasePath_, rtabmap_.getLocalOptimizedPoses());
+		publishMapLoadingStage(mapsManager_.lazyLoadingRemaining()?2:3);
+
+		if(rtabmap_.getMemory()->getWorkingMem().size()>1)
+		{
+			NODELET_INFO("rtabmap: Working Memory = %d, Local map = %d.",
+					(int)rtabmap_.getMemory()->getWorkingMem().size()-1,
+					(int)rtabmap_.getLocalOptimizedPoses().size());
+		}
+
+		if(databasePath_.size())
+		{
+			NODELET_INFO("rtabmap: Database version = \"%s\".", rtabmap_.getMemory()->getDatabaseVersion().c_str());
+		}
+
+		if(rtabmap_.getMemory()->isIncremental())
+		{
+			NODELET_INFO("rtabmap: SLAM mode (%s=true)", Parameters::kMemIncrementalMemory().c_str());
+		}
+		else
+		{
+			NODELET_INFO("rtabmap: Localization mode (%s=false)", Parameters::kMemIncrementalMemory().c_str());
+		}
+	}
+	openMapSnapshotDb();
+	updateMapSnapshot(ros::Time::now());
+
+	if(memoryLoading_)
+	{
+		memoryLoading_ = false;
+		advertiseServices();
+	}
+}
+
+bool CoreWrapper::isMemoryLoading() const
+{
+	if(memoryLoading_)
+	{
+		NODELET_WARN_THROTTLE(5, "rtabmap: Working memory is still loading, ignoring received data.");
+	}
+	return memoryLoading_;
+}
+
+void CoreWrapper::advertiseServices()
+{
+	ros::NodeHandle & nh = getNodeHandle();
+	ros::NodeHandle & pnh = getPrivateNodeHandle();
+
+	updateSrv_ = nh.advertiseService("update_parameters", &CoreWrapper::updateRtabmapCallback, this);
+	resetSrv_ = nh.advertiseService("reset", &CoreWrapper::resetRtabmapCallback, this);
+	pauseSrv_ = nh.advertiseService("pause", &CoreWrapper::pauseRtabmapCallback, this);
+	resumeSrv_ = nh.advertiseService("resume", &CoreWrapper::resumeRtabmapCallback, this);
+	loadDatabaseSrv_ = nh.advertiseService("load_database", &CoreWrapper::loadDatabaseCallback, this);
+	triggerNewMapSrv_ = nh.advertiseService("trigger_new_map", &CoreWrapper::triggerNewMapCallback, this);
+	backupDatabase_ = nh.advertiseService("backup", &CoreWrapper::backupDatabaseCallback, this);
+	detectMoreLoopClosuresSrv_ = nh.advertiseService("detect_more_loop_closures", &CoreWrapper::detectMoreLoopClosuresCallback, this);
+	globalBundleAdjustmentSrv_ = nh.advertiseService("global_bundle_adjustment", &CoreWrapper::globalBundleAdjustmentCallback, this);
+	cleanupLocalGridsSrv_ = nh.advertiseService("cleanup_local_grids", &CoreWrapper::cleanupLocalGridsCallback, this);
+	setModeLocalizationSrv_ = nh.advertiseService("set_mode_localization", &CoreWrapper::setModeLocalizationCallback, this);
+	setModeMappingSrv_ = nh.advertiseService("set_mode_mapping", &CoreWrapper::setModeMappingCallback, this);
+	// Map queries are served from the latest snapshot on their own threads if map_snapshot_queries is true
+	ros::NodeHandle mapQueryNh(nh);
+	if(mapSnapshotQueries_)
+	{
+		mapQueryNh.setCallbackQueue(&mapQueryQueue_);
+	}
+	getNodeDataSrv_ = mapQueryNh.advertiseService("get_node_data", &CoreWrapper::getNodeDataCallback, this);
+	getMapDataSrv_ = mapQueryNh.advertiseService("get_map_data", &CoreWrapper::getMapDataCallback, this);
+	getMapData2Srv_ = mapQueryNh.advertiseService("get_map_data2", &CoreWrapper::getMapData2Callback, this);
+	getMapSrv_ = mapQueryNh.advertiseService("get_map", &CoreWrapper::getMapCallback, this);
+	getProbMapSrv_ = mapQueryNh.advertiseService("get_prob_map", &CoreWrapper::getProbMapCallback, this);
+	getGridMapSrv_ = nh.advertiseService("get_grid_map", &CoreWrapper::getGridMapCallback, this);
+	getProjMapSrv_ = nh.advertiseService("get_proj_map", &CoreWrapper::getProjMapCallback, this);
+	publishMapDataSrv_ = nh.advertiseService("publish_map", &CoreWrapper::publishMapCallback, this);
+	getPlanSrv_ = nh.advertiseService("get_plan", &CoreWrapper::getPlanCallback, this);
+	getPlanNodesSrv_ = nh.advertiseService("get_plan_nodes", &CoreWrapper::getPlanNodesCallback, this);
+	setGoalSrv_ = nh.advertiseService("set_goal", &CoreWrapper::setGoalCallback, this);
+	cancelGoalSrv_ = nh.advertiseService("cancel_goal", &CoreWrapper::cancelGoalCallback, this);
+	setLabelSrv_ = nh.advertiseService("set_label", &CoreWrapper::setLabelCallback, this);
+	listLabelsSrv_ = nh.advertiseService("list_labels", &CoreWrapper::listLabelsCallback, this);
+	addLinkSrv_ = nh.advertiseService("add_link", &CoreWrapper::addLinkCallback, this);
+	getNodesInRadiusSrv_ = nh.advertiseService("get_nodes_in_radius", &CoreWrapper::getNodesInRadiusCallback, this);
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+	octomapBinarySrv_ = nh.advertiseService("octomap_binary", &CoreWrapper::octomapBinaryCallback, this);
+	octomapFullSrv_ = nh.advertiseService("octomap_full", &CoreWrapper::octomapFullCallback, this);
+#endif
+#endif
+	// private services
+	setLogDebugSrv_ = pnh.advertiseService("log_debug", &CoreWrapper::setLogDebug, this);
+	setLogInfoSrv_ = pnh.advertiseService("log_info", &CoreWrapper::setLogInfo, this);
+	setLogWarnSrv_ = pnh.advertiseService("log_warning", &CoreWrapper::setLogWarn, this);
+	setLogErrorSrv_ = pnh.advertiseService("log_error", &CoreWrapper::setLogError, this);
+
+	if(mapSnapshotQueries_)
+	{
+		updateMapSnapshot(ros::Time::now());
+		mapQuerySpinner_ = new ros::AsyncSpinner(mapSnapshotQueryThreads_, &mapQueryQueue_);
+		mapQuerySpinner_->start();
+	}
+}
+
+void CoreWrapper::publishMapLoadingStage(int stage)
+{
+	mapLoadingStage_ = stage;
+	std_msgs::Int32 msg;
+	msg.data = stage;
+	mapLoadingStagePub_.publish(msg);
+	if(stage > 0)
+	{
+		NODELET_INFO("rtabmap: Map loading stage %d (%s)", stage,
+				stage==1?"saved map published":stage==2?"memory initialized, loading local grids":"ready");
+	}
+}
+
+void CoreWrapper::openMapSnapshotDb()
+{
+	mapSnapshotDb_.reset();
+	if(!mapSnapshotQueries_ || databasePath_.empty() || !UFile::exists(databasePath_))
+	{
+		return;
+	}
+
+	ParametersMap dbParameters = parameters_;
+	bool inMemory = Parameters::defaultDbSqlite3InMemory();
+	Parameters::parse(dbParameters, Parameters::kDbSqlite3InMemory(), inMemory);
+	if(inMemory)
+	{
+		NODELET_WARN("rtabmap: %s is true, nodes loaded by map queries will be those "
+				"saved in \"%s\" when the database was opened.",
+				Parameters::kDbSqlite3InMemory().c_str(), databasePath_.c_str());
+	}
+	// Never load the whole database in RAM for the query connection
+	uInsert(dbParameters, ParametersPair(Parameters::kDbSqlite3InMemory(), "false"));
+
+	boost::shared_ptr<DBDriver> driver(DBDriver::create(dbParameters), closeDb);
+	if(driver->openConnection(databasePath_, false))
+	{
+		mapSnapshotDb_ = driver;
+	}
+	else
+	{
+		NODELET_ERROR("rtabmap: Cannot open \"%s\" for map queries, node data will "
+				"be copied from working memory only.", databasePath_.c_str());
+	}
+}
+
+void CoreWrapper::closeMapSnapshotDb()
+{
+	// Release the query connection on the current database file, queries
+	// still running keep their snapshot until they return.
+	mapSnapshotDb_.reset();
+	boost::mutex::scoped_lock lock(mapSnapshotMutex_);
+	mapSnapshot_.reset();
+}
+
+bool CoreWrapper::queryGraphOnMappingThread(const boost::shared_ptr<GraphQuery> & query)
+{
+	boost::shared_ptr<USemaphore> done(new USemaphore());
+	getNodeHandle().getCallbackQueue()->addCallback(ros::CallbackInterfacePtr(new MappingThreadCall(
+			boost::bind(&CoreWrapper::queryGraph, this, query),
+			done)));
+	if(!done->acquire(1, 30000))
+	{
+		NODELET_ERROR("rtabmap: Timeout while getting the graph (global=%s optimized=%s) from the mapping thread.",
+				query->global?"true":"false",
+				query->optimized?"true":"false");
+		return false;
+	}
+	return true;
+}
+
+void CoreWrapper::queryGraph(boost::shared_ptr<GraphQuery> query)
+{
+	rtabmap_.getGraph(
+			query->poses,
+			query->links,
+			query->optimized,
+			query->global,
+			&query->signatures,
+			query->images,
+			query->scan,
+			query->userData,
+			query->grid,
+			query->words,
+			query->globalDescriptors);
+	mapToOdomMutex_.lock();
+	query->mapToOdom = mapToOdom_;
+	mapToOdomMutex_.unlock();
+}
+
+void CoreWrapper::updateMapSnapshot(const ros::Time & stamp)
+{
+	if(!mapSnapshotQueries_)
+	{
+		return;
+	}
+	// built on the next query only
+	boost::mutex::scoped_lock lock(mapSnapshotMutex_);
+	mapSnapshotDirty_ = true;
+	mapSnapshotStamp_ = stamp;
+}
+
+void CoreWrapper::buildMapSnapshot()
+{
+	ros::Time stamp;
+	{
+		boost::mutex::scoped_lock lock(mapSnapshotMutex_);
+		if(!mapSnapshotDirty_)
+		{
+			// already built by a previous query
+			return;
+		}
+		stamp = mapSnapshotStamp_;
+	}
+
+	boost::shared_ptr<MapSnapshot> snapshot(new MapSnapshot);
+	snapshot->stamp = stamp;
+	snapshot->poses = rtabmap_.getLocalOptimizedPoses();
+	snapshot->links = rtabmap_.getLocalConstraints();
+	mapToOdomMutex_.lock();
+	snapshot->mapToOdom = mapToOdom_;
+	mapToOdomMutex_.unlock();
+	if(rtabmap_.getMemory() && rtabmap_.getMemory()->getLastWorkingSignature())
+	{
+		snapshot->lastId = rtabmap_.getMemory()->getLastWorkingSignature()->id();
+	}
+	snapshot->gridMap = mapsManager_.getGridMap(snapshot->gridXMin, snapshot->gridYMin, snapshot->gridCellSize);
+	float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
+	snapshot->gridProbMap = mapsManager_.getGridProbMap(xMin, yMin, gridCellSize);
+	snapshot->db = mapSnapshotDb_;
+
+	boost::mutex::scoped_lock lock(mapSnapshotMutex_);
+	mapSnapshot_ = snapshot;
+	mapSnapshotDirty_ = false;
+}
+
+boost::shared_ptr<const CoreWrapper::MapSnapshot> CoreWrapper::getMapSnapshot()
+{
+	bool dirty = false;
+	{
+		boost::mutex::scoped_lock lock(mapSnapshotMutex_);
+		dirty = mapSnapshotDirty_;
+	}
+	if(dirty)
+	{
+		// The map changed since the last query, the snapshot is rebuilt on the
+		// mapping thread. On timeout, the previous snapshot is returned.
+		boost::shared_ptr<USemaphore> done(new USemaphore());
+		getNodeHandle().getCallbackQueue()->addCallback(ros::CallbackInterfacePtr(new MappingThreadCall(
+				boost::bind(&CoreWrapper::buildMapSnapshot, this),
+				done)));
+		if(!done->acquire(1, 30000))
+		{
+			NODELET_WARN("rtabmap: Timeout while updating the map snapshot on the mapping thread, the previous one is used.");
+		}
+	}
+
+	boost::mutex::scoped_lock lock(mapSnapshotMutex_);
+	if(mapSnapshot_.get() == 0)
+	{
+		return boost::shared_ptr<const MapSnapshot>(new MapSnapshot);
+	}
+	return mapSnapshot_;
+}
+
+bool CoreWrapper::loadSnapshotSignatures(
+		const MapSnapshot & snapshot,
+		const std::list<int> & ids,
+		bool images,
+		bool scan,
+		bool userData,
+		bool grid,
+		bool words,
+		bool globalDescriptors,
+		std::map<int, Signature> & signatures)
+{
+	std::list<int> missingIds;
+	if(snapshot.db.get())
+	{
+		std::list<Signature*> loaded;
+		snapshot.db->loadSignatures(ids, loaded);
+		snapshot.db->loadNodeData(loaded, images, scan, userData, grid);
+		for(std::list<Signature*>::iterator iter=loaded.begin(); iter!=loaded.end(); ++iter)
+		{
+			if(!words)
+			{
+				(*iter)->setWords(std::multimap<int, int>(), std::vector<cv::KeyPoint>(), std::vector<cv::Point3f>(), cv::Mat());
+			}
+			if(!globalDescriptors)
+			{
+				(*iter)->sensorData().setGlobalDescriptors(std::vector<GlobalDescriptor>());
+			}
+			signatures.insert(std::make_pair((*iter)->id(), **iter));
+			delete *iter;
+		}
+	}
+	for(std::list<int>::const_iterator iter=ids.begin(); iter!=ids.end(); ++iter)
+	{
+		if(*iter > 0 && signatures.find(*iter) == signatures.end())
+		{
+			missingIds.push_back(*iter);
+		}
+	}
+
+	if(!missingIds.empty())
+	{
+		// Nodes not saved yet in the database are still in working memory, copy them on the mapping thread
+		boost::shared_ptr<std::map<int, Signature> > copied(new std::map<int, Signature>);
+		boost::shared_ptr<USemaphore> done(new USemaphore());
+		getNodeHandle().getCallbackQueue()->addCallback(ros::CallbackInterfacePtr(new MappingThreadCall(
+				boost::bind(&CoreWrapper::copySignatures, this, missingIds, images, scan, userData, grid, words, globalDescriptors, copied),
+				done)));
+		if(done->acquire(1, 5000))
+		{
+			signatures.insert(copied->begin(), copied->end());
+		}
+		else
+		{
+			std::string missing;
+			for(std::list<int>::iterator iter=missingIds.begin(); iter!=missingIds.end(); ++iter)
+			{
+				missing += (missing.empty()?"":" ") + uNumber2Str(*iter);
+			}
+			NODELET_ERROR("rtabmap: Timeout while copying %d node(s) from working memory, the request fails (missing ids: %s).",
+					(int)missingIds.size(), missing.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+void CoreWrapper::copySignatures(
+		const std::list<int> & ids,
+		bool images,
+		bool scan,
+		bool userData,
+		bool grid,
+		bool words,
+		bool globalDescriptors,
+		boost::shared_ptr<std::map<int, Signature> > signatures)
+{
+	for(std::list<int>::const_iterator iter=ids.begin(); iter!=ids.end(); ++iter)
+	{
+		Signature s = rtabmap_.getSignatureCopy(*iter, images, scan, userData, grid, words, globalDescriptors);
+		if(s.id()>0)
+		{
+			signatures->insert(std::make_pair(s.id(), s));
+		}
+	}
+}
+
 bool CoreWrapper::getNodeDataCallback(rtabmap_ros::GetNodeData::Request& req, rtabmap_ros::GetNodeData::Response& res)
 {
 	NODELET_INFO("rtabmap: Getting node data (%d node(s), images=%s scan=%s grid=%s user_data=%s)...",
@@ -3306,6 +4442,31 @@ bool CoreWrapper::getNodeDataCallback(rtabmap_ros::GetNodeData::Request& req, rt
 			req.grid?"true":"false",
 			req.user_data?"true":"false");
 
+	if(mapSnapshotQueries_)
+	{
+		boost::shared_ptr<const MapSnapshot> snapshot = getMapSnapshot();
+		if(req.ids.empty() && snapshot->lastId > 0)
+		{
+			req.ids.push_back(snapshot->lastId);
+		}
+		std::map<int, Signature> signatures;
+		if(!loadSnapshotSignatures(*snapshot, std::list<int>(req.ids.begin(), req.ids.end()), req.images, req.scan, req.user_data, req.grid, true, true, signatures))
+		{
+			return false;
+		}
+		for(size_t i=0; i<req.ids.size(); ++i)
+		{
+			std::map<int, Signature>::iterator iter = signatures.find(req.ids[i]);
+			if(iter != signatures.end())
+			{
+				NodeData msg;
+				rtabmap_ros::nodeDataToROS(iter->second, msg);
+				res.data.push_back(msg);
+			}
+		}
+		return !res.data.empty();
+	}
+
 	if(req.ids.empty() && rtabmap_.getMemory() && rtabmap_.getMemory()->getLastWorkingSignature())
 	{
 		req.ids.push_back(rtabmap_.getMemory()->getLastWorkingSignature()->id());
@@ -3336,6 +4497,49 @@ bool CoreWrapper::getMapDataCallback(rtabmap_ros::GetMap::Request& req, rtabmap_
 	std::map<int, Transform> poses;
 	std::multimap<int, rtabmap::Link> constraints;
 
+	if(mapSnapshotQueries_ && req.optimized && !req.global)
+	{
+		boost::shared_ptr<const MapSnapshot> snapshot = getMapSnapshot();
+		if(!req.graphOnly &&
+		   !loadSnapshotSignatures(*snapshot, uKeysList(snapshot->poses), true, true, true, true, true, true, signatures))
+		{
+			return false;
+		}
+		rtabmap_ros::mapDataToROS(snapshot->poses,
+			snapshot->links,
+			signatures,
+			snapshot->mapToOdom,
+			res.data);
+
+		res.data.header.stamp = ros::Time::now();
+		res.data.header.frame_id = mapFrameId_;
+		return true;
+	}
+	else if(mapSnapshotQueries_)
+	{
+		// The snapshot only contains the optimized local graph
+		boost::shared_ptr<GraphQuery> query(new GraphQuery);
+		query->optimized = req.optimized;
+		query->global = req.global;
+		query->images = !req.graphOnly;
+		query->scan = !req.graphOnly;
+		query->userData = !req.graphOnly;
+		query->grid = !req.graphOnly;
+		if(!queryGraphOnMappingThread(query))
+		{
+			return false;
+		}
+		rtabmap_ros::mapDataToROS(query->poses,
+			query->links,
+			query->signatures,
+			query->mapToOdom,
+			res.data);
+
+		res.data.header.stamp = ros::Time::now();
+		res.data.header.frame_id = mapFrameId_;
+		return true;
+	}
+
 	rtabmap_.getGraph(
 			poses,
 			constraints,
@@ -3373,6 +4577,60 @@ bool CoreWrapper::getMapData2Callback(rtabmap_ros::GetMap2::Request& req, rtabma
 	std::map<int, Transform> poses;
 	std::multimap<int, rtabmap::Link> constraints;
 
+	if(mapSnapshotQueries_ && req.optimized && !req.global)
+	{
+		boost::shared_ptr<const MapSnapshot> snapshot = getMapSnapshot();
+		if((req.with_images || req.with_scans || req.with_user_data || req.with_grids || req.with_words || req.with_global_descriptors) &&
+		   !loadSnapshotSignatures(
+					*snapshot,
+					uKeysList(snapshot->poses),
+					req.with_images,
+					req.with_scans,
+					req.with_user_data,
+					req.with_grids,
+					req.with_words,
+					req.with_global_descriptors,
+					signatures))
+		{
+			return false;
+		}
+		rtabmap_ros::mapDataToROS(snapshot->poses,
+			snapshot->links,
+			signatures,
+			snapshot->mapToOdom,
+			res.data);
+
+		res.data.header.stamp = ros::Time::now();
+		res.data.header.frame_id = mapFrameId_;
+		return true;
+	}
+	else if(mapSnapshotQueries_)
+	{
+		// The snapshot only contains the optimized local graph
+		boost::shared_ptr<GraphQuery> query(new GraphQuery);
+		query->optimized = req.optimized;
+		query->global = req.global;
+		query->images = req.with_images;
+		query->scan = req.with_scans;
+		query->userData = req.with_user_data;
+		query->grid = req.with_grids;
+		query->words = req.with_words;
+		query->globalDescriptors = req.with_global_descriptors;
+		if(!queryGraphOnMappingThread(query))
+		{
+			return false;
+		}
+		rtabmap_ros::mapDataToROS(query->poses,
+			query->links,
+			query->signatures,
+			query->mapToOdom,
+			res.data);
+
+		res.data.header.stamp = ros::Time::now();
+		res.data.header.frame_id = mapFrameId_;
+		return true;
+	}
+
 	rtabmap_.getGraph(
 			poses,
 			constraints,
@@ -3425,13 +4683,24 @@ bool CoreWrapper::getGridMapCallback(nav_msgs::GetMap::Request  &req, nav_msgs::
 
 bool CoreWrapper::getMapCallback(nav_msgs::GetMap::Request  &req, nav_msgs::GetMap::Response &res)
 {
-	// Make sure grid map cache is up to date (in case there is no subscriber on map topics)
-	std::map<int, Transform> poses = rtabmap_.getLocalOptimizedPoses();
-	mapsManager_.updateMapCaches(poses, rtabmap_.getMemory(), true, false);
-
 	// create the grid map
 	float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
-	cv::Mat pixels = mapsManager_.getGridMap(xMin, yMin, gridCellSize);
+	cv::Mat pixels;
+	if(mapSnapshotQueries_)
+	{
+		boost::shared_ptr<const MapSnapshot> snapshot = getMapSnapshot();
+		pixels = snapshot->gridMap;
+		xMin = snapshot->gridXMin;
+		yMin = snapshot->gridYMin;
+		gridCellSize = snapshot->gridCellSize;
+	}
+	else
+	{
+		// Make sure grid map cache is up to date (in case there is no subscriber on map topics)
+		std::map<int, Transform> poses = rtabmap_.getLocalOptimizedPoses();
+		mapsManager_.updateMapCaches(poses, rtabmap_.getMemory(), true, false);
+		pixels = mapsManager_.getGridMap(xMin, yMin, gridCellSize);
+	}
 
 	if(!pixels.empty())
 	{
@@ -3466,13 +4735,24 @@ bool CoreWrapper::getMapCallback(nav_msgs::GetMap::Request  &req, nav_msgs::GetM
 
 bool CoreWrapper::getProbMapCallback(nav_msgs::GetMap::Request  &req, nav_msgs::GetMap::Response &res)
 {
-	// Make sure grid map cache is up to date (in case there is no subscriber on map topics)
-	std::map<int, Transform> poses = rtabmap_.getLocalOptimizedPoses();
-	mapsManager_.updateMapCaches(poses, rtabmap_.getMemory(), true, false);
-
 	// create the grid map
 	float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
-	cv::Mat pixels = mapsManager_.getGridProbMap(xMin, yMin, gridCellSize);
+	cv::Mat pixels;
+	if(mapSnapshotQueries_)
+	{
+		boost::shared_ptr<const MapSnapshot> snapshot = getMapSnapshot();
+		pixels = snapshot->gridProbMap;
+		xMin = snapshot->gridXMin;
+		yMin = snapshot->gridYMin;
+		gridCellSize = snapshot->gridCellSize;
+	}
+	else
+	{
+		// Make sure grid map cache is up to date (in case there is no subscriber on map topics)
+		std::map<int, Transform> poses = rtabmap_.getLocalOptimizedPoses();
+		mapsManager_.updateMapCaches(poses, rtabmap_.getMemory(), true, false);
+		pixels = mapsManager_.getGridProbMap(xMin, yMin, gridCellSize);
+	}
 
 	if(!pixels.empty())
 	{
@@ -3752,6 +5032,99 @@ bool CoreWrapper::publishMapCallback(rtabmap_ros::PublishMap::Request& req, rtab
 	return true;
 }
 
+bool CoreWrapper::computePlan(
+		int goalNode,
+		const Transform & goalPose,
+		float tolerance,
+		std::vector<std::pair<int, Transform> > & path,
+		Transform & transformToGoal)
+{
+	int startNode = rtabmap_.getLastLocationId();
+	std::string key;
+	if(planCacheSize_ > 0)
+	{
+		// goal poses are quantized to 1 cm / 0.01 rad
+		float x=0,y=0,z=0,roll=0,pitch=0,yaw=0;
+		if(goalNode <= 0)
+		{
+			goalPose.getTranslationAndEulerAngles(x,y,z,roll,pitch,yaw);
+		}
+		key = uFormat("%d %d %d %d %d %d %d",
+				startNode, goalNode,
+				(int)floor(x*100.0f+0.5f), (int)floor(y*100.0f+0.5f), (int)floor(z*100.0f+0.5f),
+				(int)floor(yaw*100.0f+0.5f), (int)floor(tolerance*100.0f+0.5f));
+
+		std::map<std::string, CachedPlan>::iterator iter = planCache_.find(key);
+		if(iter != planCache_.end())
+		{
+			// still valid only if the poses of the path didn't change (e.g., after
+			// a loop closure) and the robot didn't leave the start node's radius
+			const std::map<int, Transform> & optimizedPoses = rtabmap_.getLocalOptimizedPoses();
+			bool valid = true;
+			for(std::map<int, Transform>::const_iterator jter=iter->second.nodePoses.begin(); valid && jter!=iter->second.nodePoses.end(); ++jter)
+			{
+				std::map<int, Transform>::const_iterator poseIter = optimizedPoses.find(jter->first);
+				valid = poseIter != optimizedPoses.end() &&
+						memcmp(poseIter->second.data(), jter->second.data(), 12*sizeof(float)) == 0;
+			}
+			std::map<int, Transform>::const_iterator startIter = optimizedPoses.find(iter->second.startNode);
+			if(valid &&
+				startIter != optimizedPoses.end() &&
+				!rtabmap_.getLastLocalizationPose().isNull() &&
+				rtabmap_.getLastLocalizationPose().getDistance(startIter->second) <= rtabmap_.getLocalRadius())
+			{
+				++planCacheHits_;
+				planCacheLru_.splice(planCacheLru_.begin(), planCacheLru_, iter->second.lruIter);
+				path = iter->second.path;
+				transformToGoal = iter->second.transformToGoal;
+				return true;
+			}
+			planCacheLru_.erase(iter->second.lruIter);
+			planCache_.erase(iter);
+		}
+		++planCacheMisses_;
+	}
+
+	bool success = (goalNode > 0 && rtabmap_.computePath(goalNode, tolerance)) ||
+				   (goalNode <= 0 && rtabmap_.computePath(goalPose, tolerance));
+	if(success)
+	{
+		path = rtabmap_.getPath();
+		transformToGoal = rtabmap_.getPathTransformToGoal();
+		if(planCacheSize_ > 0)
+		{
+			CachedPlan plan;
+			plan.startNode = startNode;
+			plan.path = path;
+			plan.transformToGoal = transformToGoal;
+			const std::map<int, Transform> & optimizedPoses = rtabmap_.getLocalOptimizedPoses();
+			bool cacheable = true;
+			for(size_t i=0; cacheable && i<path.size(); ++i)
+			{
+				std::map<int, Transform>::const_iterator poseIter = optimizedPoses.find(path[i].first);
+				cacheable = poseIter != optimizedPoses.end();
+				if(cacheable)
+				{
+					plan.nodePoses.insert(*poseIter);
+				}
+			}
+			if(cacheable)
+			{
+				while((int)planCache_.size() >= planCacheSize_)
+				{
+					planCache_.erase(planCacheLru_.back());
+					planCacheLru_.pop_back();
+				}
+				planCacheLru_.push_front(key);
+				plan.lruIter = planCacheLru_.begin();
+				planCache_.insert(std::make_pair(key, plan));
+			}
+		}
+	}
+	rtabmap_.clearPath(0);
+	return success;
+}
+
 bool CoreWrapper::getPlanCallback(nav_msgs::GetPlan::Request &req, nav_msgs::GetPlan::Response &res)
 {
 	Transform pose = rtabmap_ros::transformFromPoseMsg(req.goal.pose, true);
@@ -3776,10 +5149,11 @@ bool CoreWrapper::getPlanCallback(nav_msgs::GetPlan::Request &req, nav_msgs::Get
 		// To convert back the poses in goal frame
 		coordinateTransform = coordinateTransform.inverse();
 
-		if(rtabmap_.computePath(pose, req.tolerance))
+		std::vector<std::pair<int, Transform> > poses;
+		Transform transformToGoal;
+		if(computePlan(0, pose, req.tolerance, poses, transformToGoal))
 		{
 			NODELET_INFO("Planning: Time computing path = %f s", timer.ticks());
-			const std::vector<std::pair<int, Transform> > & poses = rtabmap_.getPath();
 			res.plan.header.frame_id = req.goal.header.frame_id;
 			res.plan.header.stamp = req.goal.header.stamp;
 			if(poses.size() == 0)
@@ -3800,11 +5174,11 @@ bool CoreWrapper::getPlanCallback(nav_msgs::GetPlan::Request &req, nav_msgs::Get
 					rtabmap_ros::transformToPoseMsg(coordinateTransform*iter->second, res.plan.poses[oi].pose);
 					++oi;
 				}
-				if(!rtabmap_.getPathTransformToGoal().isIdentity())
+				if(!transformToGoal.isIdentity())
 				{
 					res.plan.poses.resize(res.plan.poses.size()+1);
 					res.plan.poses[res.plan.poses.size()-1].header = res.plan.header;
-					Transform p = rtabmap_.getPath().back().second*rtabmap_.getPathTransformToGoal();
+					Transform p = poses.back().second*transformToGoal;
 					rtabmap_ros::transformToPoseMsg(coordinateTransform*p, res.plan.poses[res.plan.poses.size()-1].pose);
 				}
 
@@ -3821,7 +5195,6 @@ bool CoreWrapper::getPlanCallback(nav_msgs::GetPlan::Request &req, nav_msgs::Get
 				NODELET_INFO("Planned path: [%s]", stream.str().c_str());
 			}
 		}
-		rtabmap_.clearPath(0);
 	}
 	return true;
 }
@@ -3857,11 +5230,11 @@ bool CoreWrapper::getPlanNodesCallback(rtabmap_ros::GetPlan::Request &req, rtabm
 		// To convert back the poses in goal frame
 		coordinateTransform = coordinateTransform.inverse();
 
-		if((req.goal_node > 0 && rtabmap_.computePath(req.goal_node, req.tolerance)) ||
-		   (req.goal_node <= 0 && rtabmap_.computePath(pose, req.tolerance)))
+		std::vector<std::pair<int, Transform> > poses;
+		Transform transformToGoal;
+		if(computePlan(req.goal_node, pose, req.tolerance, poses, transformToGoal))
 		{
 			NODELET_INFO("Planning: Time computing path = %f s", timer.ticks());
-			const std::vector<std::pair<int, Transform> > & poses = rtabmap_.getPath();
 			res.plan.header.frame_id = mapFrameId_;
 			res.plan.header.stamp = req.goal_node > 0?ros::Time::now():req.goal.header.stamp;
 			if(poses.size() == 0)
@@ -3888,11 +5261,11 @@ bool CoreWrapper::getPlanNodesCallback(rtabmap_ros::GetPlan::Request &req, rtabm
 					res.plan.nodeIds[oi] = iter->first;
 					++oi;
 				}
-				if(!rtabmap_.getPathTransformToGoal().isIdentity())
+				if(!transformToGoal.isIdentity())
 				{
 					res.plan.poses.resize(res.plan.poses.size()+1);
 					res.plan.nodeIds.resize(res.plan.nodeIds.size()+1);
-					Transform p = rtabmap_.getPath().back().second*rtabmap_.getPathTransformToGoal();
+					Transform p = poses.back().second*transformToGoal;
 					rtabmap_ros::transformToPoseMsg(coordinateTransform*p, res.plan.poses[res.plan.poses.size()-1]);
 					res.plan.nodeIds[res.plan.nodeIds.size()-1] = 0;
 				}
@@ -3910,7 +5283,6 @@ bool CoreWrapper::getPlanNodesCallback(rtabmap_ros::GetPlan::Request &req, rtabm
 				NODELET_INFO("Planned path: [%s]", stream.str().c_str());
 			}
 		}
-		rtabmap_.clearPath(0);
 	}
 	return true;
 }
@@ -4035,6 +5407,13 @@ bool CoreWrapper::getNodesInRadiusCallback(rtabmap_ros::GetNodesInRadius::Reques
 	return true;
 }
 
+void CoreWrapper::labelsConnectCallback(const ros::SingleSubscriberPublisher &)
+{
+	// a new subscriber doesn't have the persistent markers already published
+	boost::mutex::scoped_lock lock(labelsResendMutex_);
+	labelsResendAll_ = true;
+}
+
 void CoreWrapper::publishStats(const ros::Time & stamp)
 {
 	UDEBUG("Publishing stats...");
@@ -4168,7 +5547,21 @@ void CoreWrapper::publishStats(const ros::Time & stamp)
 	}
 
 	bool pubLabels = labelsPub_.getNumSubscribers();
-	visualization_msgs::MarkerArray markers;
+	bool resendLabels = !pubLabels;
+	{
+		boost::mutex::scoped_lock lock(labelsResendMutex_);
+		resendLabels = resendLabels || labelsResendAll_;
+		labelsResendAll_ = false;
+	}
+	if(resendLabels)
+	{
+		// Markers are persistent, resend all of them to new subscribers
+		labelsPublishedIds_.clear();
+		labelsPublishedLabels_.clear();
+		labelsPublishedLandmarks_.clear();
+	}
+
+	std::map<int, std::pair<Transform, std::string> > currentLandmarks;
 	if((landmarksPub_.getNumSubscribers() || pubLabels) && !stats.poses().empty() && stats.poses().begin()->first < 0)
 	{
 		geometry_msgs::PoseArrayPtr msg(new geometry_msgs::PoseArray);
@@ -4182,135 +5575,115 @@ void CoreWrapper::publishStats(const ros::Time & stamp)
 
 			if(pubLabels)
 			{
-				// Add landmark ids
-				visualization_msgs::Marker marker;
-				marker.header.frame_id = mapFrameId_;
-				marker.header.stamp = stamp;
-				marker.ns = "landmarks";
-				marker.id = iter->first;
-				marker.action = visualization_msgs::Marker::ADD;
-				marker.pose.position.x = iter->second.x();
-				marker.pose.position.y = iter->second.y();
-				marker.pose.position.z = iter->second.z();
-				marker.pose.orientation.x = 0.0;
-				marker.pose.orientation.y = 0.0;
-				marker.pose.orientation.z = 0.0;
-				marker.pose.orientation.w = 1.0;
-				marker.scale.x = 1;
-				marker.scale.y = 1;
-				marker.scale.z = 0.35;
-				marker.color.a = 0.7;
-				marker.color.r = 0.0;
-				marker.color.g = 1.0;
-				marker.color.b = 0.0;
-				marker.lifetime = ros::Duration(2.0f/rate_);
-
-				marker.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-				marker.text = uNumber2Str(iter->first);
-
-				markers.markers.push_back(marker);
+				currentLandmarks.insert(currentLandmarks.end(), std::make_pair(iter->first, std::make_pair(iter->second, std::string())));
 			}
 		}
 
 		landmarksPub_.publish(msg);
 	}
 
-	bool pubPath = mapPathPub_.getNumSubscribers();
-	if(pubLabels || pubPath)
+	if(pubLabels)
 	{
-		if(stats.poses().size())
+		Transform robotPose;
+		if(labelsIdRadius_ > 0.0)
 		{
-			nav_msgs::Path path;
-			if(pubPath)
+			mapToOdomMutex_.lock();
+			if(!lastPose_.isNull())
 			{
-				path.poses.resize(stats.poses().size());
+				robotPose = mapToOdom_ * lastPose_;
 			}
-			int oi = 0;
-			for(std::map<int, Transform>::const_iterator poseIter=stats.poses().begin();
-				poseIter!=stats.poses().end();
-				++poseIter)
-			{
-				if(pubLabels && rtabmap_.getMemory())
-				{
-					// Add labels
-					std::map<int, std::string>::const_iterator lter = rtabmap_.getMemory()->getAllLabels().find(poseIter->first);
-					if(lter != rtabmap_.getMemory()->getAllLabels().end() && !lter->second.empty())
-					{
-						visualization_msgs::Marker marker;
-						marker.header.frame_id = mapFrameId_;
-						marker.header.stamp = stamp;
-						marker.ns = "labels";
-						marker.id = -poseIter->first;
-						marker.action = visualization_msgs::Marker::ADD;
-						marker.pose.position.x = poseIter->second.x();
-						marker.pose.position.y = poseIter->second.y();
-						marker.pose.position.z = poseIter->second.z();
-						marker.pose.orientation.x = 0.0;
-						marker.pose.orientation.y = 0.0;
-						marker.pose.orientation.z = 0.0;
-						marker.pose.orientation.w = 1.0;
-						marker.scale.x = 1;
-						marker.scale.y = 1;
-						marker.scale.z = 0.5;
-						marker.color.a = 0.7;
-						marker.color.r = 1.0;
-						marker.color.g = 0.0;
-						marker.color.b = 0.0;
-
-						marker.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-						marker.text = lter->second;
-
-						markers.markers.push_back(marker);
-					}
-
-					// Add node ids
-					visualization_msgs::Marker marker;
-					marker.header.frame_id = mapFrameId_;
-					marker.header.stamp = stamp;
-					marker.ns = "ids";
-					marker.id = poseIter->first;
-					marker.action = visualization_msgs::Marker::ADD;
-					marker.pose.position.x = poseIter->second.x();
-					marker.pose.position.y = poseIter->second.y();
-					marker.pose.position.z = poseIter->second.z();
-					marker.pose.orientation.x = 0.0;
-					marker.pose.orientation.y = 0.0;
-					marker.pose.orientation.z = 0.0;
-					marker.pose.orientation.w = 1.0;
-					marker.scale.x = 1;
-					marker.scale.y = 1;
-					marker.scale.z = 0.2;
-					marker.color.a = 0.5;
-					marker.color.r = 1.0;
-					marker.color.g = 1.0;
-					marker.color.b = 1.0;
-					marker.lifetime = ros::Duration(2.0f/rate_);
+			mapToOdomMutex_.unlock();
+		}
 
-					marker.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
-					marker.text = uNumber2Str(poseIter->first);
+		std::map<int, std::pair<Transform, std::string> > currentIds;
+		for(std::map<int, Transform>::const_iterator poseIter=stats.poses().begin();
+			poseIter!=stats.poses().end();
+			++poseIter)
+		{
+			if(robotPose.isNull() || robotPose.getDistanceSquared(poseIter->second) <= labelsIdRadius_*labelsIdRadius_)
+			{
+				currentIds.insert(currentIds.end(), std::make_pair(poseIter->first, std::make_pair(poseIter->second, std::string())));
+			}
+		}
 
-					markers.markers.push_back(marker);
-				}
-				if(pubPath)
+		std::map<int, std::pair<Transform, std::string> > currentLabels;
+		if(rtabmap_.getMemory())
+		{
+			const std::map<int, std::string> & labels = rtabmap_.getMemory()->getAllLabels();
+			for(std::map<int, std::string>::const_iterator lter=labels.begin(); lter!=labels.end(); ++lter)
+			{
+				std::map<int, Transform>::const_iterator poseIter = stats.poses().find(lter->first);
+				if(!lter->second.empty() && poseIter != stats.poses().end())
 				{
-					rtabmap_ros::transformToPoseMsg(poseIter->second, path.poses.at(oi).pose);
-					path.poses.at(oi).header.frame_id = mapFrameId_;
-					path.poses.at(oi).header.stamp = stamp;
-					++oi;
+					currentLabels.insert(std::make_pair(-lter->first, std::make_pair(poseIter->second, lter->second)));
 				}
 			}
+		}
 
-			if(pubLabels && markers.markers.size())
-			{
-				labelsPub_.publish(markers);
-			}
-			if(pubPath && oi)
-			{
-				path.header.frame_id = mapFrameId_;
-				path.header.stamp = stamp;
-				path.poses.resize(oi);
-				mapPathPub_.publish(path);
-			}
+		visualization_msgs::Marker marker;
+		marker.header.frame_id = mapFrameId_;
+		marker.header.stamp = stamp;
+		marker.pose.orientation.w = 1.0;
+		marker.scale.x = 1;
+		marker.scale.y = 1;
+		marker.type = visualization_msgs::Marker::TEXT_VIEW_FACING;
+
+		visualization_msgs::MarkerArray markers;
+
+		// Add landmark ids
+		marker.ns = "landmarks";
+		marker.scale.z = 0.35;
+		marker.color.a = 0.7;
+		marker.color.r = 0.0;
+		marker.color.g = 1.0;
+		marker.color.b = 0.0;
+		updateLabelMarkers(currentLandmarks, labelsPublishedLandmarks_, marker, labelsMoveTolerance_, markers);
+
+		// Add labels
+		marker.ns = "labels";
+		marker.scale.z = 0.5;
+		marker.color.a = 0.7;
+		marker.color.r = 1.0;
+		marker.color.g = 0.0;
+		marker.color.b = 0.0;
+		updateLabelMarkers(currentLabels, labelsPublishedLabels_, marker, labelsMoveTolerance_, markers);
+
+		// Add node ids
+		marker.ns = "ids";
+		marker.scale.z = 0.2;
+		marker.color.a = 0.5;
+		marker.color.r = 1.0;
+		marker.color.g = 1.0;
+		marker.color.b = 1.0;
+		updateLabelMarkers(currentIds, labelsPublishedIds_, marker, labelsMoveTolerance_, markers);
+
+		if(markers.markers.size())
+		{
+			labelsPub_.publish(markers);
+		}
+	}
+
+	if(mapPathPub_.getNumSubscribers() && stats.poses().size())
+	{
+		nav_msgs::Path path;
+		path.poses.resize(stats.poses().size());
+		int oi = 0;
+		for(std::map<int, Transform>::const_iterator poseIter=stats.poses().begin();
+			poseIter!=stats.poses().end();
+			++poseIter)
+		{
+			rtabmap_ros::transformToPoseMsg(poseIter->second, path.poses.at(oi).pose);
+			path.poses.at(oi).header.frame_id = mapFrameId_;
+			path.poses.at(oi).header.stamp = stamp;
+			++oi;
+		}
+
+		if(oi)
+		{
+			path.header.frame_id = mapFrameId_;
+			path.header.stamp = stamp;
+			path.poses.resize(oi);
+			mapPathPub_.publish(path);
 		}
 	}
 }
@@ -4426,37 +5799,34 @@ void CoreWrapper::goalFeedbackCb(const move_base_msgs::MoveBaseFeedbackConstPtr&
 
 void CoreWrapper::publishLocalPath(const ros::Time & stamp)
 {
-	if(rtabmap_.getPath().size())
+	if((localPathPub_.getNumSubscribers() || localPathNodesPub_.getNumSubscribers()) && rtabmap_.getPath().size())
 	{
 		std::vector<std::pair<int, Transform> > poses = rtabmap_.getPathNextPoses();
 		if(poses.size())
 		{
-			if(localPathPub_.getNumSubscribers() || localPathNodesPub_.getNumSubscribers())
+			nav_msgs::Path path;
+			rtabmap_ros::Path pathNodes;
+			path.header.frame_id = pathNodes.header.frame_id = mapFrameId_;
+			path.header.stamp = pathNodes.header.stamp = stamp;
+			path.poses.resize(poses.size());
+			pathNodes.nodeIds.resize(poses.size());
+			pathNodes.poses.resize(poses.size());
+			int oi = 0;
+			for(std::vector<std::pair<int, Transform> >::iterator iter=poses.begin(); iter!=poses.end(); ++iter)
 			{
-				nav_msgs::Path path;
-				rtabmap_ros::Path pathNodes;
-				path.header.frame_id = pathNodes.header.frame_id = mapFrameId_;
-				path.header.stamp = pathNodes.header.stamp = stamp;
-				path.poses.resize(poses.size());
-				pathNodes.nodeIds.resize(poses.size());
-				pathNodes.poses.resize(poses.size());
-				int oi = 0;
-				for(std::vector<std::pair<int, Transform> >::iterator iter=poses.begin(); iter!=poses.end(); ++iter)
-				{
-					path.poses[oi].header = path.header;
-					rtabmap_ros::transformToPoseMsg(iter->second, path.poses[oi].pose);
-					pathNodes.poses[oi] = path.poses[oi].pose;
-					pathNodes.nodeIds[oi] = iter->first;
-					++oi;
-				}
-				if(localPathPub_.getNumSubscribers())
-				{
-					localPathPub_.publish(path);
-				}
-				if(localPathNodesPub_.getNumSubscribers())
-				{
-					localPathNodesPub_.publish(pathNodes);
-				}
+				path.poses[oi].header = path.header;
+				rtabmap_ros::transformToPoseMsg(iter->second, path.poses[oi].pose);
+				pathNodes.poses[oi] = path.poses[oi].pose;
+				pathNodes.nodeIds[oi] = iter->first;
+				++oi;
+			}
+			if(localPathPub_.getNumSubscribers())
+			{
+				localPathPub_.publish(path);
+			}
+			if(localPathNodesPub_.getNumSubscribers())
+			{
+				localPathNodesPub_.publish(pathNodes);
 			}
 		}
 	}
@@ -4539,8 +5909,9 @@ bool CoreWrapper::octomapBinaryCallback(
 
 	mapsManager_.updateMapCaches(poses, rtabmap_.getMemory(), false, true);
 
-	const rtabmap::OctoMap * octomap = mapsManager_.getOctomap();
-	bool success = octomap->octree()->size() && octomap_msgs::binaryMapToMsg(*octomap->octree(), res.map);
+	// with octomap_async, this is the last tree integrated by the octomap thread
+	boost::shared_ptr<const octomap::ColorOcTree> octree = mapsManager_.getOctree();
+	bool success = octree.get() && octree->size() && octomap_msgs::binaryMapToMsg(*octree, res.map);
 	return success;
 }
 
@@ -4560,8 +5931,9 @@ bool CoreWrapper::octomapFullCallback(
 
 	mapsManager_.updateMapCaches(poses, rtabmap_.getMemory(), false, true);
 
-	const rtabmap::OctoMap * octomap = mapsManager_.getOctomap();
-	bool success = octomap->octree()->size() && octomap_msgs::fullMapToMsg(*octomap->octree(), res.map);
+	// with octomap_async, this is the last tree integrated by the octomap thread
+	boost::shared_ptr<const octomap::ColorOcTree> octree = mapsManager_.getOctree();
+	bool success = octree.get() && octree->size() && octomap_msgs::fullMapToMsg(*octree, res.map);
 	return success;
 }
 #endif
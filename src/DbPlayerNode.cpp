@@ -42,16 +42,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <std_srvs/Empty.h>
 #include <rtabmap_ros/MsgConversion.h>
 #include <rtabmap_ros/SetGoal.h>
+#include <rtabmap_ros/Seek.h>
 #include <rtabmap/utilite/ULogger.h>
 #include <rtabmap/utilite/UStl.h>
 #include <rtabmap/utilite/UThread.h>
 #include <rtabmap/utilite/UDirectory.h>
 #include <rtabmap/utilite/UConversion.h>
+#include <rtabmap/utilite/UTimer.h>
 #include <rtabmap/core/util3d.h>
-#include <rtabmap/core/DBReader.h>
+#include <rtabmap/core/CameraInfo.h>
+#include <rtabmap/core/DBDriver.h>
 #include <rtabmap/core/OdometryEvent.h>
 #include <cmath>
 
+#ifdef RTABMAP_ROS_SQLITE3
+#include <sqlite3.h>
+#endif
+
 #ifndef _WIN32
 #include <sys/ioctl.h>
 #include <termios.h>
@@ -121,6 +128,230 @@ bool resumeCallback(std_srvs::Empty::Request&, std_srvs::Empty::Response&)
 	return true;
 }
 
+// Sequential reader of the database nodes, like rtabmap::DBReader, but
+// that can be repositioned on any node without reopening the database.
+class DbPlayback
+{
+public:
+	DbPlayback(const std::string & databasePath, double rate) :
+		databasePath_(databasePath),
+		rate_(rate),
+		driver_(rtabmap::DBDriver::create()),
+		previousStamp_(0.0),
+		previousCovariance_(cv::Mat::eye(6,6,CV_64FC1)*9999.0)
+	{
+		currentId_ = ids_.end();
+	}
+	~DbPlayback()
+	{
+		driver_->closeConnection(false);
+		delete driver_;
+	}
+
+	bool init(int startId)
+	{
+		if(!driver_->openConnection(databasePath_, false))
+		{
+			return false;
+		}
+		driver_->getAllNodeIds(ids_);
+		return seek(startId);
+	}
+
+	// next node read is the first one at or after id
+	bool seek(int id)
+	{
+		currentId_ = ids_.lower_bound(id);
+		previousStamp_ = 0.0;
+		previousCovariance_ = cv::Mat::eye(6,6,CV_64FC1)*9999.0;
+		return currentId_ != ids_.end();
+	}
+
+	const std::string & databasePath() const {return databasePath_;}
+	const std::set<int> & ids() const {return ids_;}
+	const rtabmap::DBDriver & driver() const {return *driver_;}
+
+	double stamp(int id) const
+	{
+		rtabmap::Transform pose, groundTruth;
+		int mapId, weight;
+		std::string label;
+		double stamp = 0.0;
+		std::vector<float> velocity;
+		rtabmap::GPS gps;
+		rtabmap::EnvSensors sensors;
+		driver_->getNodeInfo(id, pose, mapId, weight, label, stamp, groundTruth, velocity, gps, sensors);
+		return stamp;
+	}
+
+	// Returns a null SensorData (id=0) at the end of the database.
+	// Nodes are paced by their stamps scaled by rate (0 = as fast as possible).
+	rtabmap::SensorData takeImage(rtabmap::CameraInfo * info)
+	{
+		rtabmap::SensorData data;
+		if(currentId_ == ids_.end())
+		{
+			return data;
+		}
+		int id = *currentId_++;
+
+		rtabmap::Transform pose, groundTruth;
+		int mapId, weight;
+		std::string label;
+		double stamp = 0.0;
+		std::vector<float> velocity;
+		rtabmap::GPS gps;
+		rtabmap::EnvSensors sensors;
+		driver_->getNodeData(id, data);
+		driver_->getNodeInfo(id, pose, mapId, weight, label, stamp, groundTruth, velocity, gps, sensors);
+		data.uncompressData();
+		data.setId(id);
+		data.setStamp(stamp);
+		data.setGroundTruth(groundTruth);
+		data.setGPS(gps);
+		data.setEnvSensors(sensors);
+
+		std::multimap<int, rtabmap::Link> links;
+		driver_->loadLinks(id, links, rtabmap::Link::kPosePrior);
+		if(links.size())
+		{
+			data.setGlobalPose(links.begin()->second.transform(), links.begin()->second.infMatrix().inv());
+		}
+
+		// odometry covariance from the link with the previous node, or the last one known
+		links.clear();
+		driver_->loadLinks(id, links, rtabmap::Link::kNeighbor);
+		for(std::multimap<int, rtabmap::Link>::iterator iter=links.begin(); iter!=links.end(); ++iter)
+		{
+			if(iter->first < id)
+			{
+				previousCovariance_ = iter->second.infMatrix().inv();
+				break;
+			}
+		}
+
+		if(rate_ > 0.0 && previousStamp_ > 0.0 && stamp > previousStamp_)
+		{
+			double delay = (stamp - previousStamp_)/rate_ - timer_.getElapsedTime();
+			if(delay > 0.0)
+			{
+				uSleep(delay*1000.0);
+			}
+		}
+		timer_.restart();
+		previousStamp_ = stamp;
+
+		if(info)
+		{
+			info->odomPose = pose;
+			info->odomCovariance = previousCovariance_.clone();
+		}
+		return data;
+	}
+
+private:
+	std::string databasePath_;
+	double rate_;
+	rtabmap::DBDriver * driver_;
+	std::set<int> ids_;
+	std::set<int>::const_iterator currentId_;
+	double previousStamp_;
+	cv::Mat previousCovariance_;
+	UTimer timer_;
+};
+DbPlayback * playback = 0;
+
+// node stamps, read on the first start_stamp or seek request
+std::map<int, double> idToStamp;
+std::map<double, int> stampToId;
+bool stampIndexBuilt = false;
+void buildStampIndex()
+{
+	if(stampIndexBuilt)
+	{
+		return;
+	}
+	stampIndexBuilt = true;
+	UTimer timer;
+#ifdef RTABMAP_ROS_SQLITE3
+	// only the Node table, in a single query
+	sqlite3 * db = 0;
+	if(sqlite3_open_v2(playback->databasePath().c_str(), &db, SQLITE_OPEN_READONLY, 0) == SQLITE_OK)
+	{
+		sqlite3_stmt * stmt = 0;
+		if(sqlite3_prepare_v2(db, "SELECT id, stamp FROM Node;", -1, &stmt, 0) == SQLITE_OK)
+		{
+			while(sqlite3_step(stmt) == SQLITE_ROW)
+			{
+				int id = sqlite3_column_int(stmt, 0);
+				double stamp = sqlite3_column_double(stmt, 1);
+				idToStamp.insert(std::make_pair(id, stamp));
+				stampToId.insert(std::make_pair(stamp, id));
+			}
+			sqlite3_finalize(stmt);
+		}
+		else
+		{
+			ROS_ERROR("Cannot read node stamps: %s", sqlite3_errmsg(db));
+		}
+	}
+	sqlite3_close(db);
+#else
+	// no sqlite3 headers at build time, one query per node
+	for(std::set<int>::const_iterator iter=playback->ids().begin(); iter!=playback->ids().end(); ++iter)
+	{
+		rtabmap::Transform pose, groundTruth;
+		int mapId, weight;
+		std::string label;
+		double stamp = 0.0;
+		std::vector<float> velocity;
+		rtabmap::GPS gps;
+		rtabmap::EnvSensors sensors;
+		if(playback->driver().getNodeInfo(*iter, pose, mapId, weight, label, stamp, groundTruth, velocity, gps, sensors))
+		{
+			idToStamp.insert(idToStamp.end(), std::make_pair(*iter, stamp));
+			stampToId.insert(std::make_pair(stamp, *iter));
+		}
+	}
+#endif
+	ROS_INFO("Indexed stamps of %d nodes (%fs)", (int)idToStamp.size(), timer.ticks());
+}
+
+// first node at or after the stamp, 0 if none
+int findIdFromStamp(double stamp)
+{
+	buildStampIndex();
+	std::map<double, int>::iterator iter = stampToId.lower_bound(stamp);
+	return iter!=stampToId.end()?iter->second:0;
+}
+
+int seekId = 0;
+bool seekCallback(rtabmap_ros::Seek::Request& req, rtabmap_ros::Seek::Response& res)
+{
+	res.id = 0;
+	if(req.id > 0)
+	{
+		std::set<int>::const_iterator iter = playback->ids().lower_bound(req.id);
+		if(iter != playback->ids().end())
+		{
+			res.id = *iter;
+		}
+	}
+	else
+	{
+		res.id = findIdFromStamp(req.stamp);
+	}
+	if(res.id == 0)
+	{
+		ROS_ERROR("seek: no node found at or after id=%d stamp=%f", req.id, req.stamp);
+		return false;
+	}
+	res.stamp = playback->stamp(res.id);
+	seekId = res.id;
+	ROS_INFO("seek: next node is %d (stamp=%f)", res.id, res.stamp);
+	return true;
+}
+
 int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "data_player");
@@ -149,6 +380,8 @@ int main(int argc, char** argv)
 	std::string databasePath = "";
 	bool publishTf = true;
 	int startId = 0;
+	double startStamp = 0.0;
+	double endStamp = 0.0;
 	bool useDbStamps = true;
 
 	pnh.param("frame_id", frameId, frameId);
@@ -159,6 +392,8 @@ int main(int argc, char** argv)
 	pnh.param("database", databasePath, databasePath);
 	pnh.param("publish_tf", publishTf, publishTf);
 	pnh.param("start_id", startId, startId);
+	pnh.param("start_stamp", startStamp, startStamp);
+	pnh.param("end_stamp", endStamp, endStamp);
 
 	// A general 360 lidar with 0.5 deg increment
 	double scanAngleMin, scanAngleMax, scanAngleIncrement, scanRangeMin, scanRangeMax;
@@ -175,6 +410,8 @@ int main(int argc, char** argv)
 	ROS_INFO("rate = %f", rate);
 	ROS_INFO("publish_tf = %s", publishTf?"true":"false");
 	ROS_INFO("start_id = %d", startId);
+	ROS_INFO("start_stamp = %f", startStamp);
+	ROS_INFO("end_stamp = %f", endStamp);
 	ROS_INFO("Publish clock (--clock): %s", publishClock?"true":"false");
 
 	if(databasePath.empty())
@@ -189,15 +426,28 @@ int main(int argc, char** argv)
 	}
 	ROS_INFO("database = %s", databasePath.c_str());
 
-	rtabmap::DBReader reader(databasePath, -rate, false, false, false, startId);
-	if(!reader.init())
+	playback = new DbPlayback(databasePath, rate);
+	if(!playback->init(startId))
 	{
-		ROS_ERROR("Cannot open database \"%s\".", databasePath.c_str());
+		ROS_ERROR("Cannot open database \"%s\" or no node found at or after start_id=%d.", databasePath.c_str(), startId);
+		delete playback;
 		return -1;
 	}
+	if(startStamp > 0.0 && startId == 0)
+	{
+		startId = findIdFromStamp(startStamp);
+		if(startId == 0 || !playback->seek(startId))
+		{
+			ROS_ERROR("No node found after start_stamp=%f", startStamp);
+			delete playback;
+			return -1;
+		}
+		ROS_INFO("Starting at node %d (stamp=%f)", startId, idToStamp.at(startId));
+	}
 
 	ros::ServiceServer pauseSrv = pnh.advertiseService("pause", pauseCallback);
 	ros::ServiceServer resumeSrv = pnh.advertiseService("resume", resumeCallback);
+	ros::ServiceServer seekSrv = pnh.advertiseService("seek", seekCallback);
 
 	image_transport::ImageTransport it(nh);
 	image_transport::Publisher imagePub;
@@ -224,12 +474,12 @@ int main(int argc, char** argv)
 
 	UTimer timer;
 	rtabmap::CameraInfo cameraInfo;
-	rtabmap::SensorData data = reader.takeImage(&cameraInfo);
+	rtabmap::SensorData data = playback->takeImage(&cameraInfo);
 	rtabmap::OdometryInfo odomInfo;
 	odomInfo.reg.covariance = cameraInfo.odomCovariance;
 	rtabmap::OdometryEvent odom(data, cameraInfo.odomPose, odomInfo);
 	double acquisitionTime = timer.ticks();
-	while(ros::ok() && odom.data().id())
+	while(ros::ok() && odom.data().id() && (endStamp <= 0.0 || odom.data().stamp() <= endStamp))
 	{
 		ROS_INFO("Reading sensor data %d...", odom.data().id());
 
@@ -653,7 +903,7 @@ int main(int argc, char** argv)
 			}
 #endif
 
-			if(!paused)
+			if(!paused || seekId)
 			{
 				break;
 			}
@@ -663,13 +913,18 @@ int main(int argc, char** argv)
 		}
 
 		timer.restart();
+		if(seekId)
+		{
+			playback->seek(seekId);
+			seekId = 0;
+		}
 		cameraInfo = rtabmap::CameraInfo();
-		data = reader.takeImage(&cameraInfo);
+		data = playback->takeImage(&cameraInfo);
 		odomInfo.reg.covariance = cameraInfo.odomCovariance;
 		odom = rtabmap::OdometryEvent(data, cameraInfo.odomPose, odomInfo);
 		acquisitionTime = timer.ticks();
 	}
 
-
+	delete playback;
 	return 0;
 }
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ros/ros.h>
 #include "rtabmap_ros/MapData.h"
 #include "rtabmap_ros/MapGraph.h"
+#include "rtabmap_ros/GetMap.h"
 #include "rtabmap_ros/MsgConversion.h"
 #include <rtabmap/core/util3d.h>
 #include <rtabmap/core/Graph.h>
@@ -53,7 +54,8 @@ public:
 		globalOptimization_(true),
 		optimizeFromLastNode_(false),
 		mapToOdom_(rtabmap::Transform::getIdentity()),
-		transformThread_(0)
+		transformThread_(0),
+		syncThread_(0)
 	{
 		ros::NodeHandle nh;
 		ros::NodeHandle pnh("~");
@@ -105,10 +107,28 @@ public:
 			ROS_INFO("map_optimizer: tf_delay = %f", tfDelay);
 			transformThread_ = new boost::thread(boost::bind(&MapOptimizer::publishLoop, this, tfDelay));
 		}
+
+		// After a restart, get the whole graph from rtabmap without node data,
+		// instead of waiting for the next MapData
+		bool startupSync = true;
+		double startupSyncTimeout = 10.0;
+		pnh.param("startup_sync", startupSync, startupSync);
+		pnh.param("startup_sync_timeout", startupSyncTimeout, startupSyncTimeout);
+		ROS_INFO("map_optimizer: startup_sync = %s", startupSync?"true":"false");
+		ROS_INFO("map_optimizer: startup_sync_timeout = %f", startupSyncTimeout);
+		if(startupSync)
+		{
+			syncThread_ = new boost::thread(boost::bind(&MapOptimizer::startupSync, this, startupSyncTimeout));
+		}
 	}
 
 	~MapOptimizer()
 	{
+		if(syncThread_)
+		{
+			syncThread_->join();
+			delete syncThread_;
+		}
 		if(transformThread_)
 		{
 			transformThread_->join();
@@ -136,8 +156,35 @@ public:
 		}
 	}
 
+	void startupSync(double timeout)
+	{
+		ros::NodeHandle nh;
+		ros::ServiceClient graphClient = nh.serviceClient<rtabmap_ros::GetMap>("get_map_data");
+		if(!graphClient.waitForExistence(ros::Duration(timeout)))
+		{
+			ROS_WARN("map_optimizer: Service \"%s\" not available after %f s, skipping startup sync.",
+					graphClient.getService().c_str(), timeout);
+			return;
+		}
+		UTimer timer;
+		rtabmap_ros::GetMap getMap;
+		getMap.request.global = true;
+		getMap.request.optimized = false; // odometry poses
+		getMap.request.graphOnly = true;
+		if(!graphClient.call(getMap))
+		{
+			ROS_WARN("map_optimizer: Failed to call \"%s\", skipping startup sync.", graphClient.getService().c_str());
+			return;
+		}
+		rtabmap_ros::MapDataPtr msg(new rtabmap_ros::MapData(getMap.response.data));
+		ROS_INFO("map_optimizer: Startup sync, received graph of %d nodes and %d links (%fs)",
+				(int)msg->nodes.size(), (int)msg->graph.links.size(), timer.ticks());
+		mapDataReceivedCallback(msg);
+	}
+
 	void mapDataReceivedCallback(const rtabmap_ros::MapDataConstPtr & msg)
 	{
+		boost::mutex::scoped_lock lock(mutex_);
 		// save new poses and constraints
 		// Assuming that nodes/constraints are all linked together
 		UASSERT(msg->graph.posesId.size() == msg->graph.poses.size());
@@ -333,6 +380,8 @@ private:
 
 	tf2_ros::TransformBroadcaster tfBroadcaster_;
 	boost::thread* transformThread_;
+	boost::thread* syncThread_;
+	boost::mutex mutex_;
 };
 
 
@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "rtabmap_ros/MapsManager.h"
+#include "rtabmap_ros/MsgConversion.h"
 
 #include <rtabmap/utilite/ULogger.h>
 #include <rtabmap/utilite/UTimer.h>
@@ -35,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <rtabmap/core/util3d_transforms.h>
 #include <rtabmap/core/util2d.h>
 #include <rtabmap/core/Memory.h>
+#include <rtabmap/core/DBDriver.h>
 #include <rtabmap/core/Graph.h>
 #include <rtabmap/core/Version.h>
 #include <rtabmap/core/OccupancyGrid.h>
@@ -42,10 +44,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <pcl/search/kdtree.h>
 
 #include <nav_msgs/OccupancyGrid.h>
+#include <nav_msgs/MapMetaData.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
 #include <ros/ros.h>
 
 #include <pcl_conversions/pcl_conversions.h>
 
+#include <limits>
+#include <algorithm>
+#include <set>
+#include <cstring>
+
 #ifdef WITH_OCTOMAP_MSGS
 #ifdef RTABMAP_OCTOMAP
 #include <octomap_msgs/conversions.h>
@@ -56,6 +66,36 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 using namespace rtabmap;
 
+namespace {
+
+inline float logodds(float probability)
+{
+	return log(probability/(1.0f-probability));
+}
+
+// Max distance in the XY plane of the cells of a local grid from its node
+float localGridRange(const std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> & grid)
+{
+	float maxSqr = 0.0f;
+	const cv::Mat * mats[3] = {&grid.first.first, &grid.first.second, &grid.second};
+	for(int m=0; m<3; ++m)
+	{
+		const cv::Mat & points = *mats[m];
+		if(points.empty() || points.depth() != CV_32F)
+		{
+			continue;
+		}
+		for(int i=0; i<points.cols; ++i)
+		{
+			const float * pt = points.ptr<float>(0, i);
+			maxSqr = std::max(maxSqr, pt[0]*pt[0] + pt[1]*pt[1]);
+		}
+	}
+	return sqrt(maxSqr);
+}
+
+} // namespace
+
 MapsManager::MapsManager() :
 		cloudOutputVoxelized_(true),
 		cloudSubtractFiltering_(false),
@@ -65,6 +105,10 @@ MapsManager::MapsManager() :
 		mapCacheCleanup_(true),
 		alwaysUpdateMap_(false),
 		scanEmptyRayTracing_(true),
+		mapUpdateBudget_(0.0),
+		mapUpdatePendingGrids_(0),
+		mapUpdatePendingClouds_(0),
+		sharedLocalGrids_(true),
 		assembledObstacles_(new pcl::PointCloud<pcl::PointXYZRGB>),
 		assembledGround_(new pcl::PointCloud<pcl::PointXYZRGB>),
 		occupancyGrid_(new OccupancyGrid),
@@ -72,7 +116,34 @@ MapsManager::MapsManager() :
 		octomap_(new OctoMap),
 		octomapTreeDepth_(16),
 		octomapUpdated_(true),
-		latching_(true)
+		latching_(true),
+		gridPyramidXMin_(0.0f),
+		gridPyramidYMin_(0.0f),
+		gridPyramidCellSize_(0.0f),
+		localMapRadius_(0.0),
+		localMapRate_(5.0),
+		localMapProbHit_(logodds(Parameters::defaultGridGlobalProbHit())),
+		localMapProbMiss_(logodds(Parameters::defaultGridGlobalProbMiss())),
+		localMapProbClampingMin_(logodds(Parameters::defaultGridGlobalProbClampingMin())),
+		localMapProbClampingMax_(logodds(Parameters::defaultGridGlobalProbClampingMax())),
+		localMapOccupancyThr_(logodds(Parameters::defaultGridGlobalOccupancyThr())),
+		elevationCellSize_(0.0),
+		elevationCurrentCellSize_(0.0f),
+		elevationKnownCells_(0),
+		elevationUpdated_(false),
+		lazyLoading_(false),
+		lazyLoadingThread_(0),
+		lazyLoadingRunning_(false),
+		octomapAsync_(false),
+		octomapThread_(0),
+		octomapThreadRunning_(false),
+		octomapPendingUpdate_(false),
+		octomapPendingClear_(false),
+		octomapPendingProducts_(false),
+		octomapIntegrating_(0),
+		octomapSnapshotVersion_(0),
+		octomapPublishedVersion_(0),
+		octomapMinMapSize_(0.0f)
 {
 }
 
@@ -95,6 +166,28 @@ void MapsManager::init(ros::NodeHandle & nh, ros::NodeHandle & pnh, const std::s
 		}
 	}
 	pnh.param("map_always_update", alwaysUpdateMap_, alwaysUpdateMap_);
+	pnh.param("map_lazy_loading", lazyLoading_, lazyLoading_);
+	pnh.param("map_update_budget", mapUpdateBudget_, mapUpdateBudget_);
+
+	int pyramidLevels = 0;
+	std::string pyramidRates;
+	pnh.param("map_pyramid_levels", pyramidLevels, pyramidLevels);
+	pnh.param("map_pyramid_rates", pyramidRates, pyramidRates);
+	pnh.param("map_local_radius", localMapRadius_, localMapRadius_);
+	pnh.param("map_local_rate", localMapRate_, localMapRate_);
+	pnh.param("elevation_cell_size", elevationCellSize_, elevationCellSize_);
+	pnh.param("map_shared_local_grids", sharedLocalGrids_, sharedLocalGrids_);
+	gridPyramid_.clear();
+	if(pyramidLevels > 0)
+	{
+		// one rate (Hz) per level, the last one is used for remaining levels, 0=on every update
+		std::vector<std::string> rates = uListToVector(uSplit(pyramidRates, ' '));
+		gridPyramid_.resize(pyramidLevels);
+		for(int i=0; i<pyramidLevels && !rates.empty(); ++i)
+		{
+			gridPyramid_[i].rate = uStr2Double(rates[i<(int)rates.size()?i:rates.size()-1]);
+		}
+	}
 
 	if(pnh.hasParam("map_negative_scan_empty_ray_tracing"))
 	{
@@ -124,6 +217,14 @@ void MapsManager::init(ros::NodeHandle & nh, ros::NodeHandle & pnh, const std::s
 	ROS_INFO("%s(maps): map_filter_angle           = %f", name.c_str(), mapFilterAngle_);
 	ROS_INFO("%s(maps): map_cleanup                = %s", name.c_str(), mapCacheCleanup_?"true":"false");
 	ROS_INFO("%s(maps): map_always_update          = %s", name.c_str(), alwaysUpdateMap_?"true":"false");
+	ROS_INFO("%s(maps): map_lazy_loading           = %s", name.c_str(), lazyLoading_?"true":"false");
+	ROS_INFO("%s(maps): map_update_budget          = %f ms", name.c_str(), mapUpdateBudget_);
+	ROS_INFO("%s(maps): map_pyramid_levels         = %d", name.c_str(), pyramidLevels);
+	ROS_INFO("%s(maps): map_pyramid_rates          = %s", name.c_str(), pyramidRates.c_str());
+	ROS_INFO("%s(maps): map_local_radius           = %f", name.c_str(), localMapRadius_);
+	ROS_INFO("%s(maps): map_local_rate             = %f", name.c_str(), localMapRate_);
+	ROS_INFO("%s(maps): elevation_cell_size        = %f", name.c_str(), elevationCellSize_);
+	ROS_INFO("%s(maps): map_shared_local_grids     = %s", name.c_str(), sharedLocalGrids_?"true":"false");
 	ROS_INFO("%s(maps): map_empty_ray_tracing      = %s", name.c_str(), scanEmptyRayTracing_?"true":"false");
 	ROS_INFO("%s(maps): cloud_output_voxelized     = %s", name.c_str(), cloudOutputVoxelized_?"true":"false");
 	ROS_INFO("%s(maps): cloud_subtract_filtering   = %s", name.c_str(), cloudSubtractFiltering_?"true":"false");
@@ -143,6 +244,8 @@ void MapsManager::init(ros::NodeHandle & nh, ros::NodeHandle & pnh, const std::s
 		octomapTreeDepth_ = 16;
 	}
 	ROS_INFO("%s(maps): octomap_tree_depth         = %d", name.c_str(), octomapTreeDepth_);
+	pnh.param("octomap_async", octomapAsync_, octomapAsync_);
+	ROS_INFO("%s(maps): octomap_async              = %s", name.c_str(), octomapAsync_?"true":"false");
 #endif
 #endif
 
@@ -166,12 +269,27 @@ void MapsManager::init(ros::NodeHandle & nh, ros::NodeHandle & pnh, const std::s
 	latched_.insert(std::make_pair((void*)&gridMapPub_, false));
 	gridProbMapPub_ = nht->advertise<nav_msgs::OccupancyGrid>("grid_prob_map", 1, latching_);
 	latched_.insert(std::make_pair((void*)&gridProbMapPub_, false));
+	for(size_t i=0; i<gridPyramid_.size(); ++i)
+	{
+		gridPyramid_[i].gridPub = nht->advertise<nav_msgs::OccupancyGrid>(uFormat("grid_map_level%d", (int)i+1), 1, latching_);
+		gridPyramid_[i].gridProbPub = nht->advertise<nav_msgs::OccupancyGrid>(uFormat("grid_prob_map_level%d", (int)i+1), 1, latching_);
+	}
+	if(localMapRadius_ > 0.0)
+	{
+		gridLocalMapPub_ = nht->advertise<nav_msgs::OccupancyGrid>("grid_map_local", 1);
+		cloudObstaclesLocalPub_ = nht->advertise<sensor_msgs::PointCloud2>("cloud_obstacles_local", 1);
+	}
 	cloudMapPub_ = nht->advertise<sensor_msgs::PointCloud2>("cloud_map", 1, latching_);
 	latched_.insert(std::make_pair((void*)&cloudMapPub_, false));
 	cloudObstaclesPub_ = nht->advertise<sensor_msgs::PointCloud2>("cloud_obstacles", 1, latching_);
 	latched_.insert(std::make_pair((void*)&cloudObstaclesPub_, false));
 	cloudGroundPub_ = nht->advertise<sensor_msgs::PointCloud2>("cloud_ground", 1, latching_);
 	latched_.insert(std::make_pair((void*)&cloudGroundPub_, false));
+	elevationMapPub_ = nht->advertise<sensor_msgs::Image>("elevation_map", 1, latching_);
+	latched_.insert(std::make_pair((void*)&elevationMapPub_, false));
+	elevationLayersPub_ = nht->advertise<sensor_msgs::Image>("elevation_map_layers", 1, latching_);
+	latched_.insert(std::make_pair((void*)&elevationLayersPub_, false));
+	elevationInfoPub_ = nht->advertise<nav_msgs::MapMetaData>("elevation_map_info", 1, latching_);
 
 	// deprecated
 	projMapPub_ = nht->advertise<nav_msgs::OccupancyGrid>("proj_map", 1, latching_);
@@ -202,6 +320,13 @@ void MapsManager::init(ros::NodeHandle & nh, ros::NodeHandle & pnh, const std::s
 }
 
 MapsManager::~MapsManager() {
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+	// the octomap thread must not run while the maps are deleted
+	stopOctomapThread();
+#endif
+#endif
+
 	clear();
 
 	delete occupancyGrid_;
@@ -318,8 +443,26 @@ void MapsManager::setParameters(const rtabmap::ParametersMap & parameters)
 	parameters_ = parameters;
 	occupancyGrid_->parseParameters(parameters_);
 
+	// local maps are fused like the global occupancy grid
+	float probHit = Parameters::defaultGridGlobalProbHit();
+	float probMiss = Parameters::defaultGridGlobalProbMiss();
+	float probClampingMin = Parameters::defaultGridGlobalProbClampingMin();
+	float probClampingMax = Parameters::defaultGridGlobalProbClampingMax();
+	float occupancyThr = Parameters::defaultGridGlobalOccupancyThr();
+	Parameters::parse(parameters_, Parameters::kGridGlobalProbHit(), probHit);
+	Parameters::parse(parameters_, Parameters::kGridGlobalProbMiss(), probMiss);
+	Parameters::parse(parameters_, Parameters::kGridGlobalProbClampingMin(), probClampingMin);
+	Parameters::parse(parameters_, Parameters::kGridGlobalProbClampingMax(), probClampingMax);
+	Parameters::parse(parameters_, Parameters::kGridGlobalOccupancyThr(), occupancyThr);
+	localMapProbHit_ = logodds(probHit);
+	localMapProbMiss_ = logodds(probMiss);
+	localMapProbClampingMin_ = logodds(probClampingMin);
+	localMapProbClampingMax_ = logodds(probClampingMax);
+	localMapOccupancyThr_ = logodds(occupancyThr);
+
 #ifdef WITH_OCTOMAP_MSGS
 #ifdef RTABMAP_OCTOMAP
+	stopOctomapThread();
 	if(octomap_)
 	{
 		delete octomap_;
@@ -340,7 +483,7 @@ void MapsManager::set2DMap(
 {
 	occupancyGrid_->setMap(map, xMin, yMin, cellSize, poses);
 	//update cache in case the map should be updated
-	if(memory)
+	if(memory && !lazyLoading_)
 	{
 		for(std::map<int, rtabmap::Transform>::const_iterator iter=poses.lower_bound(1); iter!=poses.end(); ++iter)
 		{
@@ -367,6 +510,7 @@ void MapsManager::set2DMap(
 
 					uInsert(gridMaps_, std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
 					uInsert(gridMapsViewpoints_, std::make_pair(iter->first, data.gridViewPoint()));
+					localMapRanges_.erase(iter->first);
 					occupancyGrid_->addToCache(iter->first, ground, obstacles, emptyCells);
 				}
 			}
@@ -380,8 +524,12 @@ void MapsManager::set2DMap(
 
 void MapsManager::clear()
 {
+	stopLazyLoading();
+	mapUpdatePendingGrids_ = 0;
+	mapUpdatePendingClouds_ = 0;
 	gridMaps_.clear();
 	gridMapsViewpoints_.clear();
+	releaseSharedLocalGrids();
 	assembledGround_->clear();
 	assembledObstacles_->clear();
 	assembledGroundPoses_.clear();
@@ -391,9 +539,25 @@ void MapsManager::clear()
 	groundClouds_.clear();
 	obstacleClouds_.clear();
 	occupancyGrid_->clear();
+	gridPyramidBase_ = cv::Mat();
+	gridProbPyramidBase_ = cv::Mat();
+	gridPyramidNodes_.clear();
+	localMapPoses_.clear();
+	localMapBuckets_.clear();
+	localMapRanges_.clear();
+	elevationNodes_.clear();
+	elevationTiles_.clear();
+	elevationKnownCells_ = 0;
+	for(size_t i=0; i<gridPyramid_.size(); ++i)
+	{
+		gridPyramid_[i].grid = cv::Mat();
+		gridPyramid_[i].gridProb = cv::Mat();
+		gridPyramid_[i].gridDirty = true;
+		gridPyramid_[i].gridProbDirty = true;
+	}
 #ifdef WITH_OCTOMAP_MSGS
 #ifdef RTABMAP_OCTOMAP
-	octomap_->clear();
+	clearOctomap();
 #endif
 #endif
 	for(std::map<void*, bool>::iterator iter=latched_.begin(); iter!=latched_.end(); ++iter)
@@ -418,242 +582,1017 @@ bool MapsManager::hasSubscribers() const
 			octoMapObstacleCloud_.getNumSubscribers() != 0 ||
 			octoMapGroundCloud_.getNumSubscribers() != 0 ||
 			octoMapEmptySpace_.getNumSubscribers() != 0 ||
-			octoMapProj_.getNumSubscribers() != 0;
+			octoMapProj_.getNumSubscribers() != 0 ||
+			gridPyramidHasSubscribers() ||
+			hasLocalMapSubscribers() ||
+			hasElevationMapSubscribers();
 }
 
-std::map<int, Transform> MapsManager::getFilteredPoses(const std::map<int, Transform> & poses)
+unsigned int MapsManager::getNumSubscribers() const
 {
-	if(mapFilterRadius_ > 0.0)
+	unsigned int count =
+			cloudMapPub_.getNumSubscribers() +
+			cloudObstaclesPub_.getNumSubscribers() +
+			cloudGroundPub_.getNumSubscribers() +
+			projMapPub_.getNumSubscribers() +
+			gridMapPub_.getNumSubscribers() +
+			gridProbMapPub_.getNumSubscribers() +
+			scanMapPub_.getNumSubscribers() +
+			octoMapPubBin_.getNumSubscribers() +
+			octoMapPubFull_.getNumSubscribers() +
+			octoMapCloud_.getNumSubscribers() +
+			octoMapFrontierCloud_.getNumSubscribers() +
+			octoMapObstacleCloud_.getNumSubscribers() +
+			octoMapGroundCloud_.getNumSubscribers() +
+			octoMapEmptySpace_.getNumSubscribers() +
+			octoMapProj_.getNumSubscribers() +
+			gridLocalMapPub_.getNumSubscribers() +
+			cloudObstaclesLocalPub_.getNumSubscribers() +
+			elevationMapPub_.getNumSubscribers() +
+			elevationLayersPub_.getNumSubscribers();
+	for(size_t i=0; i<gridPyramid_.size(); ++i)
 	{
-		// filter nodes
-		double angle = mapFilterAngle_ == 0.0?CV_PI+0.1:mapFilterAngle_*CV_PI/180.0;
-		return rtabmap::graph::radiusPosesFiltering(poses, mapFilterRadius_, angle);
+		count += gridPyramid_[i].gridPub.getNumSubscribers() + gridPyramid_[i].gridProbPub.getNumSubscribers();
 	}
-	return std::map<int, Transform>();
+	return count;
 }
 
-std::map<int, rtabmap::Transform> MapsManager::updateMapCaches(
-		const std::map<int, rtabmap::Transform> & posesIn,
-		const rtabmap::Memory * memory,
-		bool updateGrid,
-		bool updateOctomap,
-		const std::map<int, rtabmap::Signature> & signatures)
+bool MapsManager::hasElevationMapSubscribers() const
 {
-	bool updateGridCache = updateGrid || updateOctomap;
-	if(!updateGrid && !updateOctomap)
-	{
-		//  all false, update only those where we have subscribers
-		updateOctomap =
-				octoMapPubBin_.getNumSubscribers() != 0 ||
-				octoMapPubFull_.getNumSubscribers() != 0 ||
-				octoMapCloud_.getNumSubscribers() != 0 ||
-				octoMapFrontierCloud_.getNumSubscribers() != 0 ||
-				octoMapObstacleCloud_.getNumSubscribers() != 0 ||
-				octoMapGroundCloud_.getNumSubscribers() != 0 ||
-				octoMapEmptySpace_.getNumSubscribers() != 0 ||
-				octoMapProj_.getNumSubscribers() != 0;
+	return elevationMapPub_.getNumSubscribers() != 0 ||
+			elevationLayersPub_.getNumSubscribers() != 0;
+}
 
-		updateGrid = projMapPub_.getNumSubscribers() != 0 ||
-				gridMapPub_.getNumSubscribers() != 0 ||
-				gridProbMapPub_.getNumSubscribers() != 0;
+bool MapsManager::hasLocalMapSubscribers() const
+{
+	return gridLocalMapPub_.getNumSubscribers() != 0 ||
+			cloudObstaclesLocalPub_.getNumSubscribers() != 0;
+}
 
-		updateGridCache = updateOctomap || updateGrid ||
-				cloudMapPub_.getNumSubscribers() != 0 ||
-				cloudObstaclesPub_.getNumSubscribers() != 0 ||
-				cloudGroundPub_.getNumSubscribers() != 0 ||
-				scanMapPub_.getNumSubscribers() != 0;
+bool MapsManager::gridPyramidHasSubscribers() const
+{
+	for(size_t i=0; i<gridPyramid_.size(); ++i)
+	{
+		if(gridPyramid_[i].gridPub.getNumSubscribers() != 0 ||
+		   gridPyramid_[i].gridProbPub.getNumSubscribers() != 0)
+		{
+			return true;
+		}
 	}
+	return false;
+}
 
-#ifndef WITH_OCTOMAP_MSGS
-	updateOctomap = false;
-#endif
-#ifndef RTABMAP_OCTOMAP
-	updateOctomap = false;
-#endif
-
-	gridUpdated_ = updateGrid;
-	octomapUpdated_ = updateOctomap;
+bool MapsManager::publishGridMap(const ros::Time & stamp, const std::string & mapFrameId)
+{
+	float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
+	cv::Mat pixels = this->getGridMap(xMin, yMin, gridCellSize);
+	if(pixels.empty() || (!latching_ && gridMapPub_.getNumSubscribers() == 0))
+	{
+		return false;
+	}
 
+	nav_msgs::OccupancyGrid map;
+	map.info.resolution = gridCellSize;
+	map.info.origin.position.x = xMin;
+	map.info.origin.position.y = yMin;
+	map.info.origin.position.z = 0.0;
+	map.info.origin.orientation.x = 0.0;
+	map.info.origin.orientation.y = 0.0;
+	map.info.origin.orientation.z = 0.0;
+	map.info.origin.orientation.w = 1.0;
+	map.info.width = pixels.cols;
+	map.info.height = pixels.rows;
+	map.data.resize(map.info.width * map.info.height);
+	memcpy(map.data.data(), pixels.data, map.info.width * map.info.height);
+	map.header.frame_id = mapFrameId;
+	map.header.stamp = stamp;
+
+	// published even without subscribers so that the latched map is available right away
+	gridMapPub_.publish(map);
+	latched_.at(&gridMapPub_) = gridMapPub_.getNumSubscribers() != 0;
+	return true;
+}
 
-	UDEBUG("Updating map caches...");
+void MapsManager::startLazyLoading(const std::string & databasePath, const std::map<int, rtabmap::Transform> & poses)
+{
+	stopLazyLoading();
+	if(!lazyLoading_ || databasePath.empty())
+	{
+		return;
+	}
 
-	if(!memory && signatures.size() == 0)
+	std::map<int, Transform> toLoad;
+	for(std::map<int, Transform>::const_iterator iter=poses.lower_bound(1); iter!=poses.end(); ++iter)
 	{
-		ROS_ERROR("Memory and signatures should not be both null!?");
-		return std::map<int, rtabmap::Transform>();
+		if(!uContains(gridMaps_, iter->first))
+		{
+			toLoad.insert(*iter);
+			lazyNodes_.insert(iter->first);
+		}
 	}
+	if(toLoad.empty())
+	{
+		return;
+	}
+	ROS_INFO("MapsManager: Loading %d local grids in background...", (int)toLoad.size());
+	lazyLoadingMutex_.lock();
+	lazyLoadingRunning_ = true;
+	lazyLoadingMutex_.unlock();
+	lazyLoadingThread_ = new boost::thread(boost::bind(&MapsManager::lazyLoadingThread, this, databasePath, toLoad));
+}
 
-	// process only nodes (exclude landmarks)
-	std::map<int, rtabmap::Transform> poses;
-	if(posesIn.begin()->first < 0)
+void MapsManager::stopLazyLoading()
+{
+	if(lazyLoadingThread_)
 	{
-		poses.insert(posesIn.lower_bound(0), posesIn.end());
+		lazyLoadingMutex_.lock();
+		lazyLoadingRunning_ = false;
+		lazyLoadingMutex_.unlock();
+		lazyLoadingThread_->join();
+		delete lazyLoadingThread_;
+		lazyLoadingThread_ = 0;
 	}
-	else
+	lazyNodes_.clear();
+	boost::mutex::scoped_lock lock(lazyLoadingMutex_);
+	lazyLoadedGrids_.clear();
+	lazyLoadedViewpoints_.clear();
+	lazyLoadingPose_.setNull();
+}
+
+void MapsManager::setLazyLoadingPose(const rtabmap::Transform & pose)
+{
+	if(lazyLoadingThread_)
 	{
-		poses = posesIn;
+		boost::mutex::scoped_lock lock(lazyLoadingMutex_);
+		lazyLoadingPose_ = pose;
 	}
-	std::map<int, rtabmap::Transform> filteredPoses;
+}
 
-	// update cache
-	if(updateGridCache)
+void MapsManager::lazyLoadingThread(const std::string & databasePath, std::map<int, rtabmap::Transform> poses)
+{
+	ParametersMap parameters = parameters_;
+	uInsert(parameters, ParametersPair(Parameters::kDbSqlite3InMemory(), "false"));
+	DBDriver * driver = DBDriver::create(parameters);
+	if(!driver->openConnection(databasePath, false))
 	{
-		// filter nodes
-		if(mapFilterRadius_ > 0.0)
+		ROS_ERROR("MapsManager: Cannot open database \"%s\" for lazy loading, local grids will be loaded on next map update.", databasePath.c_str());
+		delete driver;
+		boost::mutex::scoped_lock lock(lazyLoadingMutex_);
+		for(std::map<int, Transform>::iterator iter=poses.begin(); iter!=poses.end(); ++iter)
 		{
-			UDEBUG("Filter nodes...");
-			double angle = mapFilterAngle_ == 0.0?CV_PI+0.1:mapFilterAngle_*CV_PI/180.0;
-			filteredPoses = rtabmap::graph::radiusPosesFiltering(poses, mapFilterRadius_, angle);
-			if(poses.find(0) != poses.end())
-			{
-				// make sure to keep latest data
-				filteredPoses.insert(*poses.find(0));
-			}
-		}
-		else
-		{
-			filteredPoses = poses;
+			// empty grids: fallback to normal loading
+			lazyLoadedGrids_.insert(std::make_pair(iter->first, std::make_pair(std::make_pair(cv::Mat(), cv::Mat()), cv::Mat())));
 		}
+		return;
+	}
 
-		if(!alwaysUpdateMap_)
+	UTimer timer;
+	int loaded = 0;
+	// Loading order: nodes sorted by distance to the robot, sorted again only
+	// when the robot moved by more than 1 m (oldest nodes first while the
+	// robot is not localized)
+	const float resortDistanceSqr = 1.0f;
+	std::vector<std::pair<float, int> > order;
+	for(std::map<int, Transform>::iterator iter=poses.begin(); iter!=poses.end(); ++iter)
+	{
+		order.push_back(std::make_pair(0.0f, iter->first));
+	}
+	size_t next = 0;
+	Transform sortedPose;
+	while(!poses.empty())
+	{
+		lazyLoadingMutex_.lock();
+		bool running = lazyLoadingRunning_;
+		Transform pose = lazyLoadingPose_;
+		lazyLoadingMutex_.unlock();
+		if(!running)
 		{
-			filteredPoses.erase(0);
+			break;
 		}
 
-		bool longUpdate = false;
-		UTimer longUpdateTimer;
-		if(filteredPoses.size() > 20)
+		if(!pose.isNull() && (sortedPose.isNull() || sortedPose.getDistanceSquared(pose) > resortDistanceSqr))
 		{
-			if(updateGridCache && gridMaps_.size() < 5)
-			{
-				ROS_WARN("Many occupancy grids should be loaded (~%d), this may take a while to update the map(s)...", int(filteredPoses.size()-gridMaps_.size()));
-				longUpdate = true;
-			}
-#ifdef WITH_OCTOMAP_MSGS
-#ifdef RTABMAP_OCTOMAP
-			if(updateOctomap && octomap_->addedNodes().size() < 5)
+			order.clear();
+			for(std::map<int, Transform>::iterator iter=poses.begin(); iter!=poses.end(); ++iter)
 			{
-				ROS_WARN("Many clouds should be added to octomap (~%d), this may take a while to update the map(s)...", int(filteredPoses.size()-octomap_->addedNodes().size()));
-				longUpdate = true;
+				order.push_back(std::make_pair(iter->second.getDistanceSquared(pose), iter->first));
 			}
-#endif
-#endif
+			std::sort(order.begin(), order.end());
+			next = 0;
+			sortedPose = pose;
 		}
 
-		bool occupancySavedInDB = memory && uStrNumCmp(memory->getDatabaseVersion(), "0.11.10")>=0?true:false;
+		// skip nodes already loaded
+		while(next < order.size() && poses.find(order[next].second) == poses.end())
+		{
+			++next;
+		}
+		UASSERT(next < order.size());
+		std::map<int, Transform>::iterator nearest = poses.find(order[next++].second);
 
-		for(std::map<int, rtabmap::Transform>::iterator iter=filteredPoses.begin(); iter!=filteredPoses.end(); ++iter)
+		SensorData data;
+		driver->getNodeData(nearest->first, data, false, false, false, true);
+		cv::Mat ground, obstacles, emptyCells;
+		if(data.gridCellSize() != 0.0f)
 		{
-			if(!iter->second.isNull())
-			{
-				rtabmap::SensorData data;
-				if(updateGridCache && (iter->first == 0 || !uContains(gridMaps_, iter->first)))
-				{
-					ROS_DEBUG("Data required for %d", iter->first);
-					std::map<int, rtabmap::Signature>::const_iterator findIter = signatures.find(iter->first);
-					if(findIter != signatures.end())
-					{
-						data = findIter->second.sensorData();
-					}
-					else if(memory)
-					{
-						data = memory->getNodeData(iter->first, occupancyGrid_->isGridFromDepth() && !occupancySavedInDB, !occupancyGrid_->isGridFromDepth() && !occupancySavedInDB, false, true);
-					}
+			data.uncompressData(0, 0, 0, 0, &ground, &obstacles, &emptyCells);
+		}
 
-					ROS_DEBUG("Adding grid map %d to cache...", iter->first);
-					cv::Point3f viewPoint;
-					cv::Mat ground, obstacles, emptyCells;
-					if(iter->first > 0)
-					{
-						cv::Mat rgb, depth;
-						LaserScan scan;
-						bool generateGrid = data.gridCellSize() == 0.0f;
-						static bool warningShown = false;
-						if(occupancySavedInDB && generateGrid && !warningShown)
-						{
-							warningShown = true;
-							UWARN("Occupancy grid for location %d should be added to global map (e..g, a ROS node is subscribed to "
-									"any occupancy grid output) but it cannot be found "
-									"in memory. For convenience, the occupancy "
-									"grid is regenerated. Make sure parameter \"%s\" is true to "
-									"avoid this warning for the next locations added to map. For older "
-									"locations already in database without an occupancy grid map, you can use the "
-									"\"rtabmap-databaseViewer\" to regenerate the missing occupancy grid maps and "
-									"save them back in the database for next sessions. This warning is only shown once.",
-									data.id(), Parameters::kRGBDCreateOccupancyGrid().c_str());
-						}
-						if(memory && occupancySavedInDB && generateGrid)
-						{
-							// if we are here, it is because we loaded a database with old nodes not having occupancy grid set
-							// try reload again
-							data = memory->getNodeData(iter->first, occupancyGrid_->isGridFromDepth(), !occupancyGrid_->isGridFromDepth(), false, false);
-						}
-						data.uncompressData(
-								occupancyGrid_->isGridFromDepth() && generateGrid?&rgb:0,
-								occupancyGrid_->isGridFromDepth() && generateGrid?&depth:0,
-								!occupancyGrid_->isGridFromDepth() && generateGrid?&scan:0,
-								0,
-								generateGrid?0:&ground,
-								generateGrid?0:&obstacles,
-								generateGrid?0:&emptyCells);
+		boost::mutex::scoped_lock lock(lazyLoadingMutex_);
+		lazyLoadedGrids_.insert(std::make_pair(nearest->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
+		lazyLoadedViewpoints_.insert(std::make_pair(nearest->first, data.gridViewPoint()));
+		poses.erase(nearest);
+		++loaded;
+	}
+	driver->closeConnection(false);
+	delete driver;
+	ROS_INFO("MapsManager: Loaded %d local grids in background (%fs)", loaded, timer.ticks());
+}
 
-						if(generateGrid)
-						{
-							Signature tmp(data);
-							tmp.setPose(iter->second);
-							occupancyGrid_->createLocalMap(tmp, ground, obstacles, emptyCells, viewPoint);
-							uInsert(gridMaps_, std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
-							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
-						}
-						else
-						{
-							viewPoint = data.gridViewPoint();
-							uInsert(gridMaps_, std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
-							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
-						}
-					}
-					else
-					{
-						// generate tmp occupancy grid for latest id (assuming data is already uncompressed)
-						// For negative laser scans, fill empty space?
-						bool unknownSpaceFilled = Parameters::defaultGridScan2dUnknownSpaceFilled();
-						Parameters::parse(parameters_, Parameters::kGridScan2dUnknownSpaceFilled(), unknownSpaceFilled);
+void MapsManager::addLazyLoadedGrids()
+{
+	if(lazyNodes_.empty())
+	{
+		return;
+	}
 
-						if(unknownSpaceFilled != scanEmptyRayTracing_ && scanEmptyRayTracing_)
-						{
-							ParametersMap parameters;
-							parameters.insert(ParametersPair(Parameters::kGridScan2dUnknownSpaceFilled(), uBool2Str(scanEmptyRayTracing_)));
-							occupancyGrid_->parseParameters(parameters);
-						}
+	std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> > grids;
+	std::map<int, cv::Point3f> viewpoints;
+	lazyLoadingMutex_.lock();
+	grids.swap(lazyLoadedGrids_);
+	viewpoints.swap(lazyLoadedViewpoints_);
+	lazyLoadingMutex_.unlock();
 
-						cv::Mat rgb, depth;
-						LaserScan scan;
-						bool generateGrid = data.gridCellSize() == 0.0f || (unknownSpaceFilled != scanEmptyRayTracing_ && scanEmptyRayTracing_);
-						data.uncompressData(
-							occupancyGrid_->isGridFromDepth() && generateGrid?&rgb:0,
-							occupancyGrid_->isGridFromDepth() && generateGrid?&depth:0,
-							!occupancyGrid_->isGridFromDepth() && generateGrid?&scan:0,
-							0,
-							generateGrid?0:&ground,
-							generateGrid?0:&obstacles,
-							generateGrid?0:&emptyCells);
+	for(std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator iter=grids.begin(); iter!=grids.end(); ++iter)
+	{
+		lazyNodes_.erase(iter->first);
+		if(!iter->second.first.first.empty() || !iter->second.first.second.empty() || !iter->second.second.empty())
+		{
+			uInsert(gridMaps_, *iter);
+			uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewpoints[iter->first]));
+			localMapRanges_.erase(iter->first);
+			occupancyGrid_->addToCache(iter->first, iter->second.first.first, iter->second.first.second, iter->second.second);
+		}
+		// else not in database, it will be generated like any other new node
+	}
 
-						if(generateGrid)
-						{
-							Signature tmp(data);
-							tmp.setPose(iter->second);
-							occupancyGrid_->createLocalMap(tmp, ground, obstacles, emptyCells, viewPoint);
-							uInsert(gridMaps_,  std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
-							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
-						}
-						else
-						{
-							viewPoint = data.gridViewPoint();
-							uInsert(gridMaps_,  std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
-							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
-						}
+	if(lazyNodes_.empty() && lazyLoadingThread_)
+	{
+		lazyLoadingThread_->join();
+		delete lazyLoadingThread_;
+		lazyLoadingThread_ = 0;
+		ROS_INFO("MapsManager: All local grids are loaded.");
+	}
+}
 
-						// put back
+namespace {
+// Uncompressed local grids shared by all MapsManager instances of the
+// process. The compressed bytes are kept to make sure that the grid of
+// another instance is really the one of the received node.
+struct SharedLocalGrid
+{
+	SharedLocalGrid() : users(0) {}
+	cv::Mat groundCompressed;
+	cv::Mat obstaclesCompressed;
+	cv::Mat emptyCellsCompressed;
+	cv::Mat ground;
+	cv::Mat obstacles;
+	cv::Mat emptyCells;
+	cv::Point3f viewPoint;
+	int users;
+};
+boost::mutex g_sharedLocalGridsMutex;
+std::map<int, SharedLocalGrid> g_sharedLocalGrids;
+
+bool sameBytes(const cv::Mat & a, const cv::Mat & b)
+{
+	if(a.empty() || b.empty())
+	{
+		return a.empty() && b.empty();
+	}
+	size_t size = a.total()*a.elemSize();
+	return size == b.total()*b.elemSize() &&
+			a.isContinuous() && b.isContinuous() &&
+			(a.data == b.data || memcmp(a.data, b.data, size) == 0);
+}
+}
+
+bool MapsManager::acquireSharedLocalGrid(
+		int id,
+		const rtabmap::SensorData & data,
+		cv::Mat & ground,
+		cv::Mat & obstacles,
+		cv::Mat & emptyCells,
+		cv::Point3f & viewPoint)
+{
+	if(!sharedLocalGrids_ || id <= 0)
+	{
+		return false;
+	}
+	boost::mutex::scoped_lock lock(g_sharedLocalGridsMutex);
+	std::map<int, SharedLocalGrid>::iterator iter = g_sharedLocalGrids.find(id);
+	if(iter == g_sharedLocalGrids.end() ||
+	   !sameBytes(iter->second.groundCompressed, data.gridGroundCellsCompressed()) ||
+	   !sameBytes(iter->second.obstaclesCompressed, data.gridObstacleCellsCompressed()) ||
+	   !sameBytes(iter->second.emptyCellsCompressed, data.gridEmptyCellsCompressed()))
+	{
+		return false;
+	}
+	ground = iter->second.ground;
+	obstacles = iter->second.obstacles;
+	emptyCells = iter->second.emptyCells;
+	viewPoint = iter->second.viewPoint;
+	if(sharedLocalGridIds_.insert(id).second)
+	{
+		++iter->second.users;
+	}
+	ROS_DEBUG("Reusing uncompressed grid of node %d", id);
+	return true;
+}
+
+void MapsManager::shareLocalGrid(
+		int id,
+		const rtabmap::SensorData & data,
+		const cv::Mat & ground,
+		const cv::Mat & obstacles,
+		const cv::Mat & emptyCells,
+		const cv::Point3f & viewPoint)
+{
+	if(!sharedLocalGrids_ || id <= 0 || sharedLocalGridIds_.find(id) != sharedLocalGridIds_.end())
+	{
+		return;
+	}
+	boost::mutex::scoped_lock lock(g_sharedLocalGridsMutex);
+	SharedLocalGrid & grid = g_sharedLocalGrids[id];
+	if(grid.users > 0)
+	{
+		// keep the one already used by other instances
+		return;
+	}
+	grid.groundCompressed = data.gridGroundCellsCompressed();
+	grid.obstaclesCompressed = data.gridObstacleCellsCompressed();
+	grid.emptyCellsCompressed = data.gridEmptyCellsCompressed();
+	grid.ground = ground;
+	grid.obstacles = obstacles;
+	grid.emptyCells = emptyCells;
+	grid.viewPoint = viewPoint;
+	grid.users = 1;
+	sharedLocalGridIds_.insert(id);
+}
+
+void MapsManager::releaseSharedLocalGrid(int id)
+{
+	if(sharedLocalGridIds_.erase(id) == 0)
+	{
+		return;
+	}
+	boost::mutex::scoped_lock lock(g_sharedLocalGridsMutex);
+	std::map<int, SharedLocalGrid>::iterator iter = g_sharedLocalGrids.find(id);
+	if(iter != g_sharedLocalGrids.end() && --iter->second.users <= 0)
+	{
+		g_sharedLocalGrids.erase(iter);
+	}
+}
+
+void MapsManager::releaseSharedLocalGrids()
+{
+	if(sharedLocalGridIds_.empty())
+	{
+		return;
+	}
+	boost::mutex::scoped_lock lock(g_sharedLocalGridsMutex);
+	for(std::set<int>::iterator iter=sharedLocalGridIds_.begin(); iter!=sharedLocalGridIds_.end(); ++iter)
+	{
+		std::map<int, SharedLocalGrid>::iterator jter = g_sharedLocalGrids.find(*iter);
+		if(jter != g_sharedLocalGrids.end() && --jter->second.users <= 0)
+		{
+			g_sharedLocalGrids.erase(jter);
+		}
+	}
+	sharedLocalGridIds_.clear();
+}
+
+std::map<int, Transform> MapsManager::getFilteredPoses(const std::map<int, Transform> & poses)
+{
+	if(mapFilterRadius_ > 0.0)
+	{
+		// filter nodes
+		double angle = mapFilterAngle_ == 0.0?CV_PI+0.1:mapFilterAngle_*CV_PI/180.0;
+		return rtabmap::graph::radiusPosesFiltering(poses, mapFilterRadius_, angle);
+	}
+	return std::map<int, Transform>();
+}
+
+// Nodes sorted by distance to the robot (latest pose), so that the
+// area around the robot is updated first when the update budget is reached
+template<typename IteratorT>
+std::vector<IteratorT> sortByDistanceToRobot(IteratorT begin, IteratorT end, const std::map<int, rtabmap::Transform> & poses)
+{
+	std::vector<IteratorT> iterators;
+	std::vector<std::pair<float, size_t> > distances;
+	if(!poses.empty())
+	{
+		const Transform & robot = poses.find(0)!=poses.end()?poses.at(0):poses.rbegin()->second;
+		for(IteratorT iter=begin; iter!=end; ++iter)
+		{
+			distances.push_back(std::make_pair(iter->second.isNull()?0.0f:robot.getDistanceSquared(iter->second), iterators.size()));
+			iterators.push_back(iter);
+		}
+	}
+	std::sort(distances.begin(), distances.end());
+	std::vector<IteratorT> sorted(distances.size());
+	for(size_t i=0; i<distances.size(); ++i)
+	{
+		sorted[i] = iterators[distances[i].second];
+	}
+	return sorted;
+}
+
+// Update the map (OccupancyGrid or OctoMap) with the nodes already in it and
+// the new nodes in sortedPoses order, 10 new nodes per update() call, until
+// the budget is reached. The nodes already added are always given so that
+// the map is not reassembled from a partial graph. After a loop closure, the
+// first call still reassembles all of them at once (done by the map itself).
+template<typename MapT>
+bool updateMapWithBudget(
+		MapT & map,
+		const std::map<int, rtabmap::Transform> & poses,
+		const std::vector<std::map<int, rtabmap::Transform>::iterator> & sortedPoses,
+		UTimer & budgetTimer,
+		double budgetMs,
+		int & pending)
+{
+	std::map<int, Transform> mapPoses;
+	const std::map<int, Transform> & addedNodes = map.addedNodes();
+	for(std::map<int, Transform>::const_iterator iter=addedNodes.begin(); iter!=addedNodes.end(); ++iter)
+	{
+		std::map<int, Transform>::const_iterator jter = poses.find(iter->first);
+		if(jter != poses.end())
+		{
+			mapPoses.insert(*jter);
+		}
+	}
+	bool updated = false;
+	int added = 0;
+	for(size_t n=0; n<sortedPoses.size(); ++n)
+	{
+		int id = sortedPoses[n]->first;
+		if(id != 0 && mapPoses.find(id) != mapPoses.end())
+		{
+			continue;
+		}
+		if(id != 0 && budgetTimer.elapsed()*1000.0 > budgetMs)
+		{
+			// done on next update (counted with the local grids not created yet)
+			++pending;
+			continue;
+		}
+		uInsert(mapPoses, *sortedPoses[n]);
+		if(++added % 10 == 0)
+		{
+			updated = map.update(mapPoses) || updated;
+		}
+	}
+	if(added == 0 || added % 10 != 0)
+	{
+		updated = map.update(mapPoses) || updated;
+	}
+	return updated;
+}
+
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+namespace {
+struct NullDeleter
+{
+	void operator()(const void *) const {}
+};
+}
+#endif
+#endif
+
+boost::shared_ptr<const octomap::ColorOcTree> MapsManager::getOctree() const
+{
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+	if(octomapAsync_)
+	{
+		// Copy made by the octomap thread at the end of its last integration,
+		// the caller never waits for an integration in progress
+		boost::mutex::scoped_lock lock(octomapMutex_);
+		if(octomapSnapshot_.get())
+		{
+			return octomapSnapshot_->tree;
+		}
+		return boost::shared_ptr<const octomap::ColorOcTree>();
+	}
+	return boost::shared_ptr<const octomap::ColorOcTree>(octomap_->octree(), NullDeleter());
+#else
+	return boost::shared_ptr<const octomap::ColorOcTree>();
+#endif
+#else
+	return boost::shared_ptr<const octomap::ColorOcTree>();
+#endif
+}
+
+int MapsManager::octomapPending() const
+{
+	boost::mutex::scoped_lock lock(octomapMutex_);
+	return (int)octomapPendingGrids_.size() + octomapIntegrating_;
+}
+
+void MapsManager::startOctomapThread()
+{
+	if(octomapThread_ == 0)
+	{
+		octomapThreadRunning_ = true;
+		octomapThread_ = new boost::thread(boost::bind(&MapsManager::octomapThread, this));
+	}
+}
+
+void MapsManager::stopOctomapThread()
+{
+	if(octomapThread_)
+	{
+		{
+			boost::mutex::scoped_lock lock(octomapMutex_);
+			octomapThreadRunning_ = false;
+		}
+		octomapCondition_.notify_one();
+		octomapThread_->join();
+		delete octomapThread_;
+		octomapThread_ = 0;
+	}
+	boost::mutex::scoped_lock lock(octomapMutex_);
+	octomapPendingGrids_.clear();
+	octomapPendingViewpoints_.clear();
+	octomapPendingPoses_.clear();
+	octomapPendingUpdate_ = false;
+	octomapPendingClear_ = false;
+	octomapPendingProducts_ = false;
+	octomapIntegrating_ = 0;
+	octomapSentNodes_.clear();
+	octomapSnapshot_.reset();
+}
+
+void MapsManager::clearOctomap()
+{
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+	if(octomapThread_)
+	{
+		{
+			boost::mutex::scoped_lock lock(octomapMutex_);
+			octomapPendingGrids_.clear();
+			octomapPendingViewpoints_.clear();
+			octomapPendingPoses_.clear();
+			octomapPendingUpdate_ = false;
+			octomapPendingClear_ = true;
+			octomapSentNodes_.clear();
+			octomapSnapshot_.reset();
+		}
+		octomapCondition_.notify_one();
+	}
+	else
+	{
+		octomapSentNodes_.clear();
+		octomapSnapshot_.reset();
+		octomap_->clear();
+	}
+#endif
+#endif
+}
+
+void MapsManager::requestOctomapProducts()
+{
+	if(octomapThread_)
+	{
+		{
+			boost::mutex::scoped_lock lock(octomapMutex_);
+			octomapPendingProducts_ = true;
+			octomapMinMapSize_ = occupancyGrid_->getMinMapSize();
+		}
+		octomapCondition_.notify_one();
+	}
+}
+
+void MapsManager::octomapThread()
+{
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+	ROS_INFO("MapsManager: octomap thread started");
+	while(1)
+	{
+		std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> > grids;
+		std::map<int, cv::Point3f> viewpoints;
+		std::map<int, rtabmap::Transform> poses;
+		bool clear, update, products;
+		float minMapSize;
+		{
+			boost::mutex::scoped_lock lock(octomapMutex_);
+			while(octomapThreadRunning_ && !octomapPendingUpdate_ && !octomapPendingClear_ && !octomapPendingProducts_)
+			{
+				octomapCondition_.wait(lock);
+			}
+			if(!octomapThreadRunning_)
+			{
+				break;
+			}
+			grids.swap(octomapPendingGrids_);
+			viewpoints.swap(octomapPendingViewpoints_);
+			poses.swap(octomapPendingPoses_);
+			clear = octomapPendingClear_;
+			update = octomapPendingUpdate_;
+			products = octomapPendingProducts_;
+			minMapSize = octomapMinMapSize_;
+			octomapPendingClear_ = false;
+			octomapPendingUpdate_ = false;
+			octomapPendingProducts_ = false;
+			octomapIntegrating_ = (int)grids.size();
+		}
+
+		if(clear)
+		{
+			octomap_->clear();
+		}
+		for(std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator iter=grids.begin(); iter!=grids.end(); ++iter)
+		{
+			octomap_->addToCache(iter->first, iter->second.first.first, iter->second.first.second, iter->second.second, viewpoints.at(iter->first));
+		}
+		bool updated = false;
+		if(update)
+		{
+			UTimer time;
+			updated = octomap_->update(poses);
+			ROS_INFO("Octomap update time = %fs (background)", time.ticks());
+		}
+
+		boost::shared_ptr<OctomapSnapshot> snapshot;
+		if(updated || clear || products)
+		{
+			// read-only products for publishers and services. The tree is
+			// copied only when it changed, so that getOctree() never has to
+			// touch octomap_, the other products only if someone needs them.
+			boost::shared_ptr<octomap::ColorOcTree> previousTree;
+			if(!updated && !clear)
+			{
+				boost::mutex::scoped_lock lock(octomapMutex_);
+				if(octomapSnapshot_.get())
+				{
+					previousTree = octomapSnapshot_->tree;
+				}
+			}
+			snapshot.reset(new OctomapSnapshot);
+			snapshot->treeSize = octomap_->octree()->size();
+			snapshot->tree = previousTree;
+			if(snapshot->tree.get() == 0)
+			{
+				snapshot->tree.reset(new octomap::ColorOcTree(*octomap_->octree()));
+			}
+			if(octoMapCloud_.getNumSubscribers() ||
+				octoMapFrontierCloud_.getNumSubscribers() ||
+				octoMapObstacleCloud_.getNumSubscribers() ||
+				octoMapGroundCloud_.getNumSubscribers() ||
+				octoMapEmptySpace_.getNumSubscribers())
+			{
+				snapshot->obstacleIndices.reset(new std::vector<int>);
+				snapshot->frontierIndices.reset(new std::vector<int>);
+				snapshot->emptyIndices.reset(new std::vector<int>);
+				snapshot->groundIndices.reset(new std::vector<int>);
+				snapshot->cloud = octomap_->createCloud(
+						octomapTreeDepth_,
+						snapshot->obstacleIndices.get(),
+						snapshot->emptyIndices.get(),
+						snapshot->groundIndices.get(),
+						true,
+						snapshot->frontierIndices.get(),
+						0);
+			}
+			if(octoMapProj_.getNumSubscribers())
+			{
+				snapshot->cellSize = 0.05f;
+				snapshot->projection = octomap_->createProjectionMap(snapshot->xMin, snapshot->yMin, snapshot->cellSize, minMapSize, octomapTreeDepth_);
+				snapshot->hasProjection = true;
+			}
+		}
+
+		boost::mutex::scoped_lock lock(octomapMutex_);
+		octomapIntegrating_ = 0;
+		if(snapshot.get() && !octomapPendingClear_)
+		{
+			snapshot->version = ++octomapSnapshotVersion_;
+			octomapSnapshot_ = snapshot;
+		}
+	}
+	ROS_INFO("MapsManager: octomap thread stopped");
+#endif
+#endif
+}
+
+std::map<int, rtabmap::Transform> MapsManager::updateMapCaches(
+		const std::map<int, rtabmap::Transform> & posesIn,
+		const rtabmap::Memory * memory,
+		bool updateGrid,
+		bool updateOctomap,
+		const std::map<int, rtabmap::Signature> & signatures)
+{
+	bool updateGridCache = updateGrid || updateOctomap;
+	if(!updateGrid && !updateOctomap)
+	{
+		//  all false, update only those where we have subscribers
+		updateOctomap =
+				octoMapPubBin_.getNumSubscribers() != 0 ||
+				octoMapPubFull_.getNumSubscribers() != 0 ||
+				octoMapCloud_.getNumSubscribers() != 0 ||
+				octoMapFrontierCloud_.getNumSubscribers() != 0 ||
+				octoMapObstacleCloud_.getNumSubscribers() != 0 ||
+				octoMapGroundCloud_.getNumSubscribers() != 0 ||
+				octoMapEmptySpace_.getNumSubscribers() != 0 ||
+				octoMapProj_.getNumSubscribers() != 0;
+
+		updateGrid = projMapPub_.getNumSubscribers() != 0 ||
+				gridMapPub_.getNumSubscribers() != 0 ||
+				gridProbMapPub_.getNumSubscribers() != 0 ||
+				gridPyramidHasSubscribers();
+
+		updateGridCache = updateOctomap || updateGrid ||
+				hasLocalMapSubscribers() ||
+				hasElevationMapSubscribers() ||
+				cloudMapPub_.getNumSubscribers() != 0 ||
+				cloudObstaclesPub_.getNumSubscribers() != 0 ||
+				cloudGroundPub_.getNumSubscribers() != 0 ||
+				scanMapPub_.getNumSubscribers() != 0;
+	}
+
+#ifndef WITH_OCTOMAP_MSGS
+	updateOctomap = false;
+#endif
+#ifndef RTABMAP_OCTOMAP
+	updateOctomap = false;
+#endif
+
+	gridUpdated_ = updateGrid;
+	octomapUpdated_ = updateOctomap && !octomapAsync_;
+	if(updateOctomap && octomapAsync_)
+	{
+		startOctomapThread();
+	}
+
+	addLazyLoadedGrids();
+
+
+	UDEBUG("Updating map caches...");
+
+	if(!memory && signatures.size() == 0)
+	{
+		ROS_ERROR("Memory and signatures should not be both null!?");
+		return std::map<int, rtabmap::Transform>();
+	}
+
+	// process only nodes (exclude landmarks)
+	std::map<int, rtabmap::Transform> poses;
+	if(posesIn.begin()->first < 0)
+	{
+		poses.insert(posesIn.lower_bound(0), posesIn.end());
+	}
+	else
+	{
+		poses = posesIn;
+	}
+	std::map<int, rtabmap::Transform> filteredPoses;
+
+	// update cache
+	if(updateGridCache)
+	{
+		// filter nodes
+		if(mapFilterRadius_ > 0.0)
+		{
+			UDEBUG("Filter nodes...");
+			double angle = mapFilterAngle_ == 0.0?CV_PI+0.1:mapFilterAngle_*CV_PI/180.0;
+			filteredPoses = rtabmap::graph::radiusPosesFiltering(poses, mapFilterRadius_, angle);
+			if(poses.find(0) != poses.end())
+			{
+				// make sure to keep latest data
+				filteredPoses.insert(*poses.find(0));
+			}
+		}
+		else
+		{
+			filteredPoses = poses;
+		}
+
+		if(!alwaysUpdateMap_)
+		{
+			filteredPoses.erase(0);
+		}
+
+		bool longUpdate = false;
+		UTimer longUpdateTimer;
+		if(filteredPoses.size() > 20 && lazyNodes_.empty())
+		{
+			if(updateGridCache && gridMaps_.size() < 5)
+			{
+				ROS_WARN("Many occupancy grids should be loaded (~%d), this may take a while to update the map(s)...", int(filteredPoses.size()-gridMaps_.size()));
+				longUpdate = true;
+			}
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+			if(updateOctomap && !octomapAsync_ && octomap_->addedNodes().size() < 5)
+			{
+				ROS_WARN("Many clouds should be added to octomap (~%d), this may take a while to update the map(s)...", int(filteredPoses.size()-octomap_->addedNodes().size()));
+				longUpdate = true;
+			}
+#endif
+#endif
+		}
+
+		bool occupancySavedInDB = memory && uStrNumCmp(memory->getDatabaseVersion(), "0.11.10")>=0?true:false;
+		std::map<int, std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> > octomapGrids;
+		std::map<int, cv::Point3f> octomapViewpoints;
+
+		UTimer budgetTimer;
+		mapUpdatePendingGrids_ = 0;
+		std::vector<std::map<int, rtabmap::Transform>::iterator> sortedPoses;
+		if(mapUpdateBudget_ > 0.0)
+		{
+			sortedPoses = sortByDistanceToRobot(filteredPoses.begin(), filteredPoses.end(), filteredPoses);
+		}
+		else
+		{
+			for(std::map<int, rtabmap::Transform>::iterator iter=filteredPoses.begin(); iter!=filteredPoses.end(); ++iter)
+			{
+				sortedPoses.push_back(iter);
+			}
+		}
+		for(size_t n=0; n<sortedPoses.size(); ++n)
+		{
+			std::map<int, rtabmap::Transform>::iterator iter = sortedPoses[n];
+			if(lazyNodes_.find(iter->first) != lazyNodes_.end())
+			{
+				// still loading in background
+				continue;
+			}
+			if(!iter->second.isNull())
+			{
+				rtabmap::SensorData data;
+				if(updateGridCache && (iter->first == 0 || !uContains(gridMaps_, iter->first)))
+				{
+					if(iter->first != 0 && mapUpdateBudget_ > 0.0 && budgetTimer.elapsed()*1000.0 > mapUpdateBudget_)
+					{
+						// done on next update
+						++mapUpdatePendingGrids_;
+						continue;
+					}
+					ROS_DEBUG("Data required for %d", iter->first);
+					std::map<int, rtabmap::Signature>::const_iterator findIter = signatures.find(iter->first);
+					if(findIter != signatures.end())
+					{
+						data = findIter->second.sensorData();
+					}
+					else if(memory)
+					{
+						data = memory->getNodeData(iter->first, occupancyGrid_->isGridFromDepth() && !occupancySavedInDB, !occupancyGrid_->isGridFromDepth() && !occupancySavedInDB, false, true);
+					}
+
+					ROS_DEBUG("Adding grid map %d to cache...", iter->first);
+					cv::Point3f viewPoint;
+					cv::Mat ground, obstacles, emptyCells;
+					if(iter->first > 0)
+					{
+						cv::Mat rgb, depth;
+						LaserScan scan;
+						bool generateGrid = data.gridCellSize() == 0.0f;
+						static bool warningShown = false;
+						if(occupancySavedInDB && generateGrid && !warningShown)
+						{
+							warningShown = true;
+							UWARN("Occupancy grid for location %d should be added to global map (e..g, a ROS node is subscribed to "
+									"any occupancy grid output) but it cannot be found "
+									"in memory. For convenience, the occupancy "
+									"grid is regenerated. Make sure parameter \"%s\" is true to "
+									"avoid this warning for the next locations added to map. For older "
+									"locations already in database without an occupancy grid map, you can use the "
+									"\"rtabmap-databaseViewer\" to regenerate the missing occupancy grid maps and "
+									"save them back in the database for next sessions. This warning is only shown once.",
+									data.id(), Parameters::kRGBDCreateOccupancyGrid().c_str());
+						}
+						if(memory && occupancySavedInDB && generateGrid)
+						{
+							// if we are here, it is because we loaded a database with old nodes not having occupancy grid set
+							// try reload again
+							data = memory->getNodeData(iter->first, occupancyGrid_->isGridFromDepth(), !occupancyGrid_->isGridFromDepth(), false, false);
+						}
+
+						// For decimated depth grids, decode the image directly at reduced resolution
+						int depthDecimation = Parameters::defaultGridDepthDecimation();
+						int remainingDecimation = 0;
+						std::vector<CameraModel> reducedModels;
+						if(occupancyGrid_->isGridFromDepth() && generateGrid)
+						{
+							Parameters::parse(parameters_, Parameters::kGridDepthDecimation(), depthDecimation);
+							if(rtabmap_ros::uncompressRGBDDecimated(data, depthDecimation, rgb, depth, reducedModels, remainingDecimation))
+							{
+								// keep the other data (scan, user data, features...) of the node
+								data.setRGBDImage(rgb, depth, reducedModels, false);
+							}
+							else
+							{
+								remainingDecimation = 0;
+							}
+						}
+						// Another MapsManager of this process (e.g., rtabmap and map_assembler
+						// nodelets in the same manager) may have already uncompressed this grid
+						bool sharedGrid = !generateGrid && acquireSharedLocalGrid(iter->first, data, ground, obstacles, emptyCells, viewPoint);
+						if(remainingDecimation == 0 && !sharedGrid)
+						{
+							data.uncompressData(
+									occupancyGrid_->isGridFromDepth() && generateGrid?&rgb:0,
+									occupancyGrid_->isGridFromDepth() && generateGrid?&depth:0,
+									!occupancyGrid_->isGridFromDepth() && generateGrid?&scan:0,
+									0,
+									generateGrid?0:&ground,
+									generateGrid?0:&obstacles,
+									generateGrid?0:&emptyCells);
+						}
+
+						if(generateGrid)
+						{
+							if(remainingDecimation > 0)
+							{
+								ParametersMap parameters;
+								parameters.insert(ParametersPair(Parameters::kGridDepthDecimation(), uNumber2Str(remainingDecimation)));
+								occupancyGrid_->parseParameters(parameters);
+							}
+							Signature tmp(data);
+							tmp.setPose(iter->second);
+							occupancyGrid_->createLocalMap(tmp, ground, obstacles, emptyCells, viewPoint);
+							if(remainingDecimation > 0)
+							{
+								// put back
+								ParametersMap parameters;
+								parameters.insert(ParametersPair(Parameters::kGridDepthDecimation(), uNumber2Str(depthDecimation)));
+								occupancyGrid_->parseParameters(parameters);
+							}
+							uInsert(gridMaps_, std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
+							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
+							localMapRanges_.erase(iter->first);
+						}
+						else
+						{
+							if(!sharedGrid)
+							{
+								viewPoint = data.gridViewPoint();
+								shareLocalGrid(iter->first, data, ground, obstacles, emptyCells, viewPoint);
+							}
+							uInsert(gridMaps_, std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
+							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
+							localMapRanges_.erase(iter->first);
+						}
+					}
+					else
+					{
+						// generate tmp occupancy grid for latest id (assuming data is already uncompressed)
+						// For negative laser scans, fill empty space?
+						bool unknownSpaceFilled = Parameters::defaultGridScan2dUnknownSpaceFilled();
+						Parameters::parse(parameters_, Parameters::kGridScan2dUnknownSpaceFilled(), unknownSpaceFilled);
+
+						if(unknownSpaceFilled != scanEmptyRayTracing_ && scanEmptyRayTracing_)
+						{
+							ParametersMap parameters;
+							parameters.insert(ParametersPair(Parameters::kGridScan2dUnknownSpaceFilled(), uBool2Str(scanEmptyRayTracing_)));
+							occupancyGrid_->parseParameters(parameters);
+						}
+
+						cv::Mat rgb, depth;
+						LaserScan scan;
+						bool generateGrid = data.gridCellSize() == 0.0f || (unknownSpaceFilled != scanEmptyRayTracing_ && scanEmptyRayTracing_);
+						data.uncompressData(
+							occupancyGrid_->isGridFromDepth() && generateGrid?&rgb:0,
+							occupancyGrid_->isGridFromDepth() && generateGrid?&depth:0,
+							!occupancyGrid_->isGridFromDepth() && generateGrid?&scan:0,
+							0,
+							generateGrid?0:&ground,
+							generateGrid?0:&obstacles,
+							generateGrid?0:&emptyCells);
+
+						if(generateGrid)
+						{
+							Signature tmp(data);
+							tmp.setPose(iter->second);
+							occupancyGrid_->createLocalMap(tmp, ground, obstacles, emptyCells, viewPoint);
+							uInsert(gridMaps_,  std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
+							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
+							localMapRanges_.erase(iter->first);
+						}
+						else
+						{
+							viewPoint = data.gridViewPoint();
+							uInsert(gridMaps_,  std::make_pair(iter->first, std::make_pair(std::make_pair(ground, obstacles), emptyCells)));
+							uInsert(gridMapsViewpoints_, std::make_pair(iter->first, viewPoint));
+							localMapRanges_.erase(iter->first);
+						}
+
+						// put back
 						if(unknownSpaceFilled != scanEmptyRayTracing_ && scanEmptyRayTracing_)
 						{
 							ParametersMap parameters;
@@ -681,7 +1620,8 @@ std::map<int, rtabmap::Transform> MapsManager::updateMapCaches(
 #ifdef RTABMAP_OCTOMAP
 				if(updateOctomap &&
 						(iter->first == 0 ||
-						  octomap_->addedNodes().find(iter->first) == octomap_->addedNodes().end()))
+						 (octomapAsync_ && octomapSentNodes_.find(iter->first) == octomapSentNodes_.end()) ||
+						 (!octomapAsync_ && octomap_->addedNodes().find(iter->first) == octomap_->addedNodes().end())))
 				{
 					std::map<int, std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator mter = gridMaps_.find(iter->first);
 					std::map<int, cv::Point3f>::iterator pter = gridMapsViewpoints_.find(iter->first);
@@ -691,7 +1631,16 @@ std::map<int, rtabmap::Transform> MapsManager::updateMapCaches(
 						   (mter->second.first.second.empty() || mter->second.first.second.channels() > 2) &&
 						   (mter->second.second.empty() || mter->second.second.channels() > 2))
 						{
-							octomap_->addToCache(iter->first, mter->second.first.first, mter->second.first.second, mter->second.second, pter->second);
+							if(octomapAsync_)
+							{
+								// cv::Mat headers only, the ray tracing is done by the octomap thread
+								octomapGrids.insert(*mter);
+								octomapViewpoints.insert(*pter);
+							}
+							else
+							{
+								octomap_->addToCache(iter->first, mter->second.first.first, mter->second.first.second, mter->second.second, pter->second);
+							}
 						}
 						else if(!mter->second.first.first.empty() && !mter->second.first.second.empty() && !mter->second.second.empty())
 						{
@@ -711,17 +1660,53 @@ std::map<int, rtabmap::Transform> MapsManager::updateMapCaches(
 			}
 		}
 
-		if(updateGrid)
+		if(updateGrid && mapUpdateBudget_ > 0.0)
+		{
+			int pending = 0;
+			gridUpdated_ = updateMapWithBudget(*occupancyGrid_, filteredPoses, sortedPoses, budgetTimer, mapUpdateBudget_, pending);
+			mapUpdatePendingGrids_ = std::max(mapUpdatePendingGrids_, pending);
+		}
+		else if(updateGrid)
 		{
 			gridUpdated_ = occupancyGrid_->update(filteredPoses);
 		}
 
 #ifdef WITH_OCTOMAP_MSGS
 #ifdef RTABMAP_OCTOMAP
-		if(updateOctomap)
+		if(updateOctomap && octomapAsync_)
+		{
+			{
+				boost::mutex::scoped_lock lock(octomapMutex_);
+				for(std::map<int, std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator iter=octomapGrids.begin(); iter!=octomapGrids.end(); ++iter)
+				{
+					uInsert(octomapPendingGrids_, *iter);
+					uInsert(octomapPendingViewpoints_, std::make_pair(iter->first, octomapViewpoints.at(iter->first)));
+					if(iter->first > 0)
+					{
+						octomapSentNodes_.insert(iter->first);
+					}
+				}
+				// only the latest poses matter if the thread is late
+				octomapPendingPoses_ = filteredPoses;
+				octomapPendingUpdate_ = true;
+				// occupancyGrid_ is not thread-safe, give its parameters to the thread
+				octomapMinMapSize_ = occupancyGrid_->getMinMapSize();
+			}
+			octomapCondition_.notify_one();
+		}
+		else if(updateOctomap)
 		{
 			UTimer time;
-			octomapUpdated_ = octomap_->update(filteredPoses);
+			if(mapUpdateBudget_ > 0.0)
+			{
+				int pending = 0;
+				octomapUpdated_ = updateMapWithBudget(*octomap_, filteredPoses, sortedPoses, budgetTimer, mapUpdateBudget_, pending);
+				mapUpdatePendingGrids_ = std::max(mapUpdatePendingGrids_, pending);
+			}
+			else
+			{
+				octomapUpdated_ = octomap_->update(filteredPoses);
+			}
 			ROS_INFO("Octomap update time = %fs", time.ticks());
 		}
 #endif
@@ -732,6 +1717,8 @@ std::map<int, rtabmap::Transform> MapsManager::updateMapCaches(
 			if(!uContains(poses, iter->first))
 			{
 				UASSERT(gridMapsViewpoints_.erase(iter->first) != 0);
+				releaseSharedLocalGrid(iter->first);
+				localMapRanges_.erase(iter->first);
 				gridMaps_.erase(iter++);
 			}
 			else
@@ -770,6 +1757,11 @@ std::map<int, rtabmap::Transform> MapsManager::updateMapCaches(
 		{
 			ROS_WARN("Map(s) updated! (%f s)", longUpdateTimer.ticks());
 		}
+		if(mapUpdatePendingGrids_)
+		{
+			ROS_INFO("Map update budget reached (%f ms), %d/%d local grids remaining to add on next updates.",
+					mapUpdateBudget_, mapUpdatePendingGrids_, (int)filteredPoses.size());
+		}
 	}
 
 	return filteredPoses;
@@ -809,6 +1801,44 @@ void MapsManager::publishMaps(
 {
 	ROS_DEBUG("Publishing maps... poses=%d", (int)poses.size());
 
+	if(hasLocalMapSubscribers())
+	{
+		// index the nodes by area so that local maps don't depend on the map
+		// size. A node is added to all cells its local grid overlaps.
+		localMapPoses_ = poses;
+		localMapBuckets_.clear();
+		for(std::map<int, Transform>::const_iterator iter=poses.lower_bound(1); iter!=poses.end(); ++iter)
+		{
+			std::map<int, float>::iterator range = localMapRanges_.find(iter->first);
+			if(range == localMapRanges_.end())
+			{
+				std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> >::const_iterator jter = gridMaps_.find(iter->first);
+				if(jter == gridMaps_.end())
+				{
+					continue;
+				}
+				range = localMapRanges_.insert(std::make_pair(iter->first, localGridRange(jter->second))).first;
+			}
+			int x0 = (int)std::floor((iter->second.x()-range->second)/localMapRadius_);
+			int x1 = (int)std::floor((iter->second.x()+range->second)/localMapRadius_);
+			int y0 = (int)std::floor((iter->second.y()-range->second)/localMapRadius_);
+			int y1 = (int)std::floor((iter->second.y()+range->second)/localMapRadius_);
+			for(int i=x0; i<=x1; ++i)
+			{
+				for(int j=y0; j<=y1; ++j)
+				{
+					localMapBuckets_[std::make_pair(i, j)].push_back(iter->first);
+				}
+			}
+		}
+		if(poses.find(0) != poses.end())
+		{
+			publishLocalMaps(poses.at(0), stamp, mapFrameId);
+		}
+	}
+
+	publishElevationMap(poses, stamp, mapFrameId);
+
 	// publish maps
 	if(cloudMapPub_.getNumSubscribers() ||
 	   scanMapPub_.getNumSubscribers() ||
@@ -898,14 +1928,38 @@ void MapsManager::publishMaps(
 			assembledObstacleIndex_.release();
 		}
 
+		UTimer budgetTimer;
+		mapUpdatePendingClouds_ = 0;
+		std::vector<std::map<int, Transform>::const_iterator> sortedPoses;
+		if(mapUpdateBudget_ > 0.0)
+		{
+			sortedPoses = sortByDistanceToRobot(poses.lower_bound(0), poses.end(), poses);
+		}
+		else
+		{
+			for(std::map<int, Transform>::const_iterator iter=poses.lower_bound(0); iter!=poses.end(); ++iter)
+			{
+				sortedPoses.push_back(iter);
+			}
+		}
 		if(graphGroundOptimized || graphObstacleOptimized)
 		{
 			ROS_INFO("Graph has changed, updating clouds...");
 			UTimer t;
 			cv::Mat tmpGroundPts;
 			cv::Mat tmpObstaclePts;
-			for(std::map<int, Transform>::const_iterator iter = poses.lower_bound(1); iter!=poses.end(); ++iter)
+			for(size_t n=0; n<sortedPoses.size(); ++n)
 			{
+				std::map<int, Transform>::const_iterator iter = sortedPoses[n];
+				if(iter->first == 0)
+				{
+					continue;
+				}
+				if(mapUpdateBudget_ > 0.0 && budgetTimer.elapsed()*1000.0 > mapUpdateBudget_)
+				{
+					// remaining clouds are added back like new nodes on next updates
+					break;
+				}
 				if(updateGround  &&
 				   (graphGroundOptimized || assembledGroundPoses_.find(iter->first) == assembledGroundPoses_.end()))
 				{
@@ -985,8 +2039,19 @@ void MapsManager::publishMaps(
 			ROS_WARN("Graph has changed! The whole cloud is regenerated.");
 		}
 
-		for(std::map<int, Transform>::const_iterator iter = poses.begin(); iter!=poses.end(); ++iter)
+		for(size_t n=0; n<sortedPoses.size(); ++n)
 		{
+			std::map<int, Transform>::const_iterator iter = sortedPoses[n];
+			if(iter->first > 0 &&
+			   mapUpdateBudget_ > 0.0 &&
+			   budgetTimer.elapsed()*1000.0 > mapUpdateBudget_ &&
+			   ((updateGround && assembledGroundPoses_.find(iter->first) == assembledGroundPoses_.end()) ||
+			    (updateObstacles && assembledObstaclePoses_.find(iter->first) == assembledObstaclePoses_.end())))
+			{
+				// done on next update
+				++mapUpdatePendingClouds_;
+				continue;
+			}
 			std::map<int, std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator jter = gridMaps_.find(iter->first);
 			if(updateGround  && assembledGroundPoses_.find(iter->first) == assembledGroundPoses_.end())
 			{
@@ -1097,8 +2162,9 @@ void MapsManager::publishMaps(
 			}
 		}
 
-		ROS_INFO("Assembled %d obstacle and %d ground clouds (%d points, %fs)",
-				countObstacles, countGrounds, (int)(assembledGround_->size() + assembledObstacles_->size()), time.ticks());
+		ROS_INFO("Assembled %d obstacle and %d ground clouds (%d points, %fs)%s",
+				countObstacles, countGrounds, (int)(assembledGround_->size() + assembledObstacles_->size()), time.ticks(),
+				mapUpdatePendingClouds_?uFormat(", %d clouds remaining to add on next updates", mapUpdatePendingClouds_).c_str():"");
 
 		if( countGrounds > 0 ||
 			countObstacles > 0 ||
@@ -1179,124 +2245,361 @@ void MapsManager::publishMaps(
 		groundClouds_.clear();
 		obstacleClouds_.clear();
 	}
-	if(cloudMapPub_.getNumSubscribers() == 0)
+	if(cloudMapPub_.getNumSubscribers() == 0)
+	{
+		latched_.at(&cloudMapPub_) = false;
+	}
+	if(scanMapPub_.getNumSubscribers() == 0)
+	{
+		latched_.at(&scanMapPub_) = false;
+	}
+	if(cloudGroundPub_.getNumSubscribers() == 0)
+	{
+		latched_.at(&cloudGroundPub_) = false;
+	}
+	if(cloudObstaclesPub_.getNumSubscribers() == 0)
+	{
+		latched_.at(&cloudObstaclesPub_) = false;
+	}
+
+#ifdef WITH_OCTOMAP_MSGS
+#ifdef RTABMAP_OCTOMAP
+	boost::shared_ptr<const OctomapSnapshot> octomapSnapshot;
+	if(octomapAsync_)
+	{
+		boost::mutex::scoped_lock lock(octomapMutex_);
+		octomapSnapshot = octomapSnapshot_;
+		octomapUpdated_ = octomapSnapshot.get() && octomapSnapshot->version != octomapPublishedVersion_;
+	}
+	if( (!octomapAsync_ || octomapSnapshot.get()) && (
+		octomapUpdated_ ||
+		!latching_ ||
+		(octoMapPubBin_.getNumSubscribers() && !latched_.at(&octoMapPubBin_)) ||
+		(octoMapPubFull_.getNumSubscribers() && !latched_.at(&octoMapPubFull_)) ||
+		(octoMapCloud_.getNumSubscribers() && !latched_.at(&octoMapCloud_)) ||
+		(octoMapFrontierCloud_.getNumSubscribers() && !latched_.at(&octoMapFrontierCloud_)) ||
+		(octoMapObstacleCloud_.getNumSubscribers() && !latched_.at(&octoMapObstacleCloud_)) ||
+		(octoMapGroundCloud_.getNumSubscribers() && !latched_.at(&octoMapGroundCloud_)) ||
+		(octoMapEmptySpace_.getNumSubscribers() && !latched_.at(&octoMapEmptySpace_)) ||
+		(octoMapProj_.getNumSubscribers() && !latched_.at(&octoMapProj_))))
+	{
+		boost::shared_ptr<const octomap::ColorOcTree> octree;
+		if(octoMapPubBin_.getNumSubscribers() || octoMapPubFull_.getNumSubscribers())
+		{
+			// with octomap_async, the copy made by the thread with the last snapshot
+			octree = getOctree();
+		}
+		if(octoMapPubBin_.getNumSubscribers() && octree.get())
+		{
+			octomap_msgs::Octomap msg;
+			octomap_msgs::binaryMapToMsg(*octree, msg);
+			msg.header.frame_id = mapFrameId;
+			msg.header.stamp = stamp;
+			octoMapPubBin_.publish(msg);
+			latched_.at(&octoMapPubBin_) = true;
+		}
+		if(octoMapPubFull_.getNumSubscribers() && octree.get())
+		{
+			octomap_msgs::Octomap msg;
+			octomap_msgs::fullMapToMsg(*octree, msg);
+			msg.header.frame_id = mapFrameId;
+			msg.header.stamp = stamp;
+			octoMapPubFull_.publish(msg);
+			latched_.at(&octoMapPubFull_) = true;
+		}
+		if(octoMapCloud_.getNumSubscribers() ||
+			octoMapFrontierCloud_.getNumSubscribers() ||
+			octoMapObstacleCloud_.getNumSubscribers() ||
+			octoMapGroundCloud_.getNumSubscribers() ||
+			octoMapEmptySpace_.getNumSubscribers())
+		{
+			sensor_msgs::PointCloud2 msg;
+			pcl::IndicesPtr obstacleIndices;
+			pcl::IndicesPtr frontierIndices;
+			pcl::IndicesPtr emptyIndices;
+			pcl::IndicesPtr groundIndices;
+			pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud;
+			if(octomapAsync_)
+			{
+				obstacleIndices = octomapSnapshot->obstacleIndices;
+				frontierIndices = octomapSnapshot->frontierIndices;
+				emptyIndices = octomapSnapshot->emptyIndices;
+				groundIndices = octomapSnapshot->groundIndices;
+				cloud = octomapSnapshot->cloud;
+			}
+			else
+			{
+				obstacleIndices.reset(new std::vector<int>);
+				frontierIndices.reset(new std::vector<int>);
+				emptyIndices.reset(new std::vector<int>);
+				groundIndices.reset(new std::vector<int>);
+				cloud = octomap_->createCloud(octomapTreeDepth_, obstacleIndices.get(), emptyIndices.get(), groundIndices.get(), true, frontierIndices.get(),0);
+			}
+
+			if(!cloud.get())
+			{
+				// subscribed after the last snapshot, ask the octomap thread for the clouds
+				requestOctomapProducts();
+			}
+			else
+			{
+				if(octoMapCloud_.getNumSubscribers())
+				{
+					pcl::PointCloud<pcl::PointXYZRGB> cloudOccupiedSpace;
+					pcl::IndicesPtr indices = util3d::concatenate(obstacleIndices, groundIndices);
+					pcl::copyPointCloud(*cloud, *indices, cloudOccupiedSpace);
+					pcl::toROSMsg(cloudOccupiedSpace, msg);
+					msg.header.frame_id = mapFrameId;
+					msg.header.stamp = stamp;
+					octoMapCloud_.publish(msg);
+					latched_.at(&octoMapCloud_) = true;
+				}
+				if(octoMapFrontierCloud_.getNumSubscribers())
+				{
+					pcl::PointCloud<pcl::PointXYZRGB> cloudFrontier;
+					pcl::copyPointCloud(*cloud, *frontierIndices, cloudFrontier);
+					pcl::toROSMsg(cloudFrontier, msg);
+					msg.header.frame_id = mapFrameId;
+					msg.header.stamp = stamp;
+					octoMapFrontierCloud_.publish(msg);
+					latched_.at(&octoMapFrontierCloud_) = true;
+				}
+				if(octoMapObstacleCloud_.getNumSubscribers())
+				{
+					pcl::PointCloud<pcl::PointXYZRGB> cloudObstacles;
+					pcl::copyPointCloud(*cloud, *obstacleIndices, cloudObstacles);
+					pcl::toROSMsg(cloudObstacles, msg);
+					msg.header.frame_id = mapFrameId;
+					msg.header.stamp = stamp;
+					octoMapObstacleCloud_.publish(msg);
+					latched_.at(&octoMapObstacleCloud_) = true;
+				}
+				if(octoMapGroundCloud_.getNumSubscribers())
+				{
+					pcl::PointCloud<pcl::PointXYZRGB> cloudGround;
+					pcl::copyPointCloud(*cloud, *groundIndices, cloudGround);
+					pcl::toROSMsg(cloudGround, msg);
+					msg.header.frame_id = mapFrameId;
+					msg.header.stamp = stamp;
+					octoMapGroundCloud_.publish(msg);
+					latched_.at(&octoMapGroundCloud_) = true;
+				}
+				if(octoMapEmptySpace_.getNumSubscribers())
+				{
+					pcl::PointCloud<pcl::PointXYZRGB> cloudEmptySpace;
+					pcl::copyPointCloud(*cloud, *emptyIndices, cloudEmptySpace);
+					pcl::toROSMsg(cloudEmptySpace, msg);
+					msg.header.frame_id = mapFrameId;
+					msg.header.stamp = stamp;
+					octoMapEmptySpace_.publish(msg);
+					latched_.at(&octoMapEmptySpace_) = true;
+				}
+			}
+		}
+		if(octoMapProj_.getNumSubscribers())
+		{
+			// create the projection map
+			float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
+			cv::Mat pixels;
+			if(!octomapAsync_)
+			{
+				pixels = octomap_->createProjectionMap(xMin, yMin, gridCellSize, occupancyGrid_->getMinMapSize(), octomapTreeDepth_);
+			}
+			else if(octomapSnapshot->hasProjection)
+			{
+				pixels = octomapSnapshot->projection;
+				xMin = octomapSnapshot->xMin;
+				yMin = octomapSnapshot->yMin;
+				gridCellSize = octomapSnapshot->cellSize;
+			}
+			else
+			{
+				requestOctomapProducts();
+			}
+
+			if(!pixels.empty())
+			{
+				//init
+				nav_msgs::OccupancyGrid map;
+				map.info.resolution = gridCellSize;
+				map.info.origin.position.x = 0.0;
+				map.info.origin.position.y = 0.0;
+				map.info.origin.position.z = 0.0;
+				map.info.origin.orientation.x = 0.0;
+				map.info.origin.orientation.y = 0.0;
+				map.info.origin.orientation.z = 0.0;
+				map.info.origin.orientation.w = 1.0;
+
+				map.info.width = pixels.cols;
+				map.info.height = pixels.rows;
+				map.info.origin.position.x = xMin;
+				map.info.origin.position.y = yMin;
+				map.data.resize(map.info.width * map.info.height);
+
+				memcpy(map.data.data(), pixels.data, map.info.width * map.info.height);
+
+				map.header.frame_id = mapFrameId;
+				map.header.stamp = stamp;
+
+				octoMapProj_.publish(map);
+				latched_.at(&octoMapProj_) = true;
+			}
+			else if(poses.size() && (!octomapAsync_ || octomapSnapshot->hasProjection))
+			{
+				ROS_WARN("Octomap projection map is empty! (poses=%d octomap nodes=%d). "
+						"Make sure you activated \"%s\" and \"%s\" to true. "
+						"See \"$ rosrun rtabmap_ros rtabmap --params | grep Grid\" for more info.",
+						(int)poses.size(), octomapAsync_?(int)octomapSnapshot->treeSize:(int)octomap_->octree()->size(),
+						Parameters::kGrid3D().c_str(), Parameters::kGridFromDepth().c_str());
+			}
+		}
+		if(octomapAsync_)
+		{
+			octomapPublishedVersion_ = octomapSnapshot->version;
+		}
+	}
+
+	if( mapCacheCleanup_ &&
+		octoMapPubBin_.getNumSubscribers() == 0 &&
+		octoMapPubFull_.getNumSubscribers() == 0 &&
+		octoMapCloud_.getNumSubscribers() == 0 &&
+		octoMapFrontierCloud_.getNumSubscribers() == 0 &&
+		octoMapObstacleCloud_.getNumSubscribers() == 0 &&
+		octoMapGroundCloud_.getNumSubscribers() == 0 &&
+		octoMapEmptySpace_.getNumSubscribers() == 0 &&
+		octoMapProj_.getNumSubscribers() == 0)
+	{
+		if(octomapAsync_)
+		{
+			if(!octomapSentNodes_.empty())
+			{
+				ROS_INFO("MapsManager: cleanup octomap (%d nodes)...", (int)octomapSentNodes_.size());
+				clearOctomap();
+			}
+		}
+		else
+		{
+			if(octomap_->octree()->getNumLeafNodes()>0)
+			{
+				ROS_INFO("MapsManager: cleanup octomap (%ld leaf nodes, ~%ld MB)...",
+						octomap_->octree()->getNumLeafNodes(),
+						octomap_->octree()->memoryUsage()/1048576);
+			}
+			octomap_->clear();
+		}
+	}
+
+	if(octoMapPubBin_.getNumSubscribers() == 0)
 	{
-		latched_.at(&cloudMapPub_) = false;
+		latched_.at(&octoMapPubBin_) = false;
 	}
-	if(scanMapPub_.getNumSubscribers() == 0)
+	if(octoMapPubFull_.getNumSubscribers() == 0)
 	{
-		latched_.at(&scanMapPub_) = false;
+		latched_.at(&octoMapPubFull_) = false;
 	}
-	if(cloudGroundPub_.getNumSubscribers() == 0)
+	if(octoMapCloud_.getNumSubscribers() == 0)
 	{
-		latched_.at(&cloudGroundPub_) = false;
+		latched_.at(&octoMapCloud_) = false;
 	}
-	if(cloudObstaclesPub_.getNumSubscribers() == 0)
+	if(octoMapFrontierCloud_.getNumSubscribers() == 0)
 	{
-		latched_.at(&cloudObstaclesPub_) = false;
+		latched_.at(&octoMapFrontierCloud_) = false;
+	}
+	if(octoMapObstacleCloud_.getNumSubscribers() == 0)
+	{
+		latched_.at(&octoMapObstacleCloud_) = false;
+	}
+	if(octoMapGroundCloud_.getNumSubscribers() == 0)
+	{
+		latched_.at(&octoMapGroundCloud_) = false;
+	}
+	if(octoMapEmptySpace_.getNumSubscribers() == 0)
+	{
+		latched_.at(&octoMapEmptySpace_) = false;
+	}
+	if(octoMapProj_.getNumSubscribers() == 0)
+	{
+		latched_.at(&octoMapProj_) = false;
 	}
 
-#ifdef WITH_OCTOMAP_MSGS
-#ifdef RTABMAP_OCTOMAP
-	if( octomapUpdated_ ||
+#endif
+#endif
+
+	// grids computed below are reused by the pyramid
+	cv::Mat gridPixels, gridProbPixels;
+	float gridXMin=0.0f, gridYMin=0.0f, gridCellSize = 0.05f;
+	if( gridUpdated_ ||
 		!latching_ ||
-		(octoMapPubBin_.getNumSubscribers() && !latched_.at(&octoMapPubBin_)) ||
-		(octoMapPubFull_.getNumSubscribers() && !latched_.at(&octoMapPubFull_)) ||
-		(octoMapCloud_.getNumSubscribers() && !latched_.at(&octoMapCloud_)) ||
-		(octoMapFrontierCloud_.getNumSubscribers() && !latched_.at(&octoMapFrontierCloud_)) ||
-		(octoMapObstacleCloud_.getNumSubscribers() && !latched_.at(&octoMapObstacleCloud_)) ||
-		(octoMapGroundCloud_.getNumSubscribers() && !latched_.at(&octoMapGroundCloud_)) ||
-		(octoMapEmptySpace_.getNumSubscribers() && !latched_.at(&octoMapEmptySpace_)) ||
-		(octoMapProj_.getNumSubscribers() && !latched_.at(&octoMapProj_)))
+		(gridMapPub_.getNumSubscribers() && !latched_.at(&gridMapPub_)) ||
+		(projMapPub_.getNumSubscribers() && !latched_.at(&projMapPub_)) ||
+		(gridProbMapPub_.getNumSubscribers() && !latched_.at(&gridProbMapPub_)))
 	{
-		if(octoMapPubBin_.getNumSubscribers())
-		{
-			octomap_msgs::Octomap msg;
-			octomap_msgs::binaryMapToMsg(*octomap_->octree(), msg);
-			msg.header.frame_id = mapFrameId;
-			msg.header.stamp = stamp;
-			octoMapPubBin_.publish(msg);
-			latched_.at(&octoMapPubBin_) = true;
-		}
-		if(octoMapPubFull_.getNumSubscribers())
+		if(projMapPub_.getNumSubscribers())
 		{
-			octomap_msgs::Octomap msg;
-			octomap_msgs::fullMapToMsg(*octomap_->octree(), msg);
-			msg.header.frame_id = mapFrameId;
-			msg.header.stamp = stamp;
-			octoMapPubFull_.publish(msg);
-			latched_.at(&octoMapPubFull_) = true;
+			if(parameters_.find(Parameters::kGridFromDepth()) != parameters_.end() &&
+				!uStr2Bool(parameters_.at(Parameters::kGridFromDepth())))
+			{
+				ROS_WARN("/proj_map topic is deprecated! Subscribe to /grid_map topic "
+						"instead with <param name=\"%s\" type=\"string\" value=\"true\"/>. "
+						"Do \"$ rosrun rtabmap_ros rtabmap --params | grep Grid\" to see "
+						"all occupancy grid parameters.",
+						Parameters::kGridFromDepth().c_str());
+			}
+			else
+			{
+				ROS_WARN("/proj_map topic is deprecated! Subscribe to /grid_map topic instead.");
+			}
 		}
-		if(octoMapCloud_.getNumSubscribers() ||
-			octoMapFrontierCloud_.getNumSubscribers() ||
-			octoMapObstacleCloud_.getNumSubscribers() ||
-			octoMapGroundCloud_.getNumSubscribers() ||
-			octoMapEmptySpace_.getNumSubscribers())
+
+		if(gridProbMapPub_.getNumSubscribers())
 		{
-			sensor_msgs::PointCloud2 msg;
-			pcl::IndicesPtr obstacleIndices(new std::vector<int>);
-			pcl::IndicesPtr frontierIndices(new std::vector<int>);
-			pcl::IndicesPtr emptyIndices(new std::vector<int>);
-			pcl::IndicesPtr groundIndices(new std::vector<int>);
-			pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud = octomap_->createCloud(octomapTreeDepth_, obstacleIndices.get(), emptyIndices.get(), groundIndices.get(), true, frontierIndices.get(),0);
-
-			if(octoMapCloud_.getNumSubscribers())
-			{
-				pcl::PointCloud<pcl::PointXYZRGB> cloudOccupiedSpace;
-				pcl::IndicesPtr indices = util3d::concatenate(obstacleIndices, groundIndices);
-				pcl::copyPointCloud(*cloud, *indices, cloudOccupiedSpace);
-				pcl::toROSMsg(cloudOccupiedSpace, msg);
-				msg.header.frame_id = mapFrameId;
-				msg.header.stamp = stamp;
-				octoMapCloud_.publish(msg);
-				latched_.at(&octoMapCloud_) = true;
-			}
-			if(octoMapFrontierCloud_.getNumSubscribers())
-			{
-				pcl::PointCloud<pcl::PointXYZRGB> cloudFrontier;
-				pcl::copyPointCloud(*cloud, *frontierIndices, cloudFrontier);
-				pcl::toROSMsg(cloudFrontier, msg);
-				msg.header.frame_id = mapFrameId;
-				msg.header.stamp = stamp;
-				octoMapFrontierCloud_.publish(msg);
-				latched_.at(&octoMapFrontierCloud_) = true;
-			}
-			if(octoMapObstacleCloud_.getNumSubscribers())
-			{
-				pcl::PointCloud<pcl::PointXYZRGB> cloudObstacles;
-				pcl::copyPointCloud(*cloud, *obstacleIndices, cloudObstacles);
-				pcl::toROSMsg(cloudObstacles, msg);
-				msg.header.frame_id = mapFrameId;
-				msg.header.stamp = stamp;
-				octoMapObstacleCloud_.publish(msg);
-				latched_.at(&octoMapObstacleCloud_) = true;
-			}
-			if(octoMapGroundCloud_.getNumSubscribers())
-			{
-				pcl::PointCloud<pcl::PointXYZRGB> cloudGround;
-				pcl::copyPointCloud(*cloud, *groundIndices, cloudGround);
-				pcl::toROSMsg(cloudGround, msg);
-				msg.header.frame_id = mapFrameId;
-				msg.header.stamp = stamp;
-				octoMapGroundCloud_.publish(msg);
-				latched_.at(&octoMapGroundCloud_) = true;
-			}
-			if(octoMapEmptySpace_.getNumSubscribers())
-			{
-				pcl::PointCloud<pcl::PointXYZRGB> cloudEmptySpace;
-				pcl::copyPointCloud(*cloud, *emptyIndices, cloudEmptySpace);
-				pcl::toROSMsg(cloudEmptySpace, msg);
-				msg.header.frame_id = mapFrameId;
-				msg.header.stamp = stamp;
-				octoMapEmptySpace_.publish(msg);
-				latched_.at(&octoMapEmptySpace_) = true;
+			// create the grid map
+			float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
+			cv::Mat pixels = this->getGridProbMap(xMin, yMin, gridCellSize);
+			gridProbPixels = pixels;
+			if(!pixels.empty())
+			{
+				//init
+				nav_msgs::OccupancyGrid map;
+				map.info.resolution = gridCellSize;
+				map.info.origin.position.x = 0.0;
+				map.info.origin.position.y = 0.0;
+				map.info.origin.position.z = 0.0;
+				map.info.origin.orientation.x = 0.0;
+				map.info.origin.orientation.y = 0.0;
+				map.info.origin.orientation.z = 0.0;
+				map.info.origin.orientation.w = 1.0;
+
+				map.info.width = pixels.cols;
+				map.info.height = pixels.rows;
+				map.info.origin.position.x = xMin;
+				map.info.origin.position.y = yMin;
+				map.data.resize(map.info.width * map.info.height);
+
+				memcpy(map.data.data(), pixels.data, map.info.width * map.info.height);
+
+				map.header.frame_id = mapFrameId;
+				map.header.stamp = stamp;
+
+				if(gridProbMapPub_.getNumSubscribers())
+				{
+					gridProbMapPub_.publish(map);
+					latched_.at(&gridProbMapPub_) = true;
+				}
+			}
+			else if(poses.size())
+			{
+				ROS_WARN("Grid map is empty! (local maps=%d)", (int)gridMaps_.size());
 			}
 		}
-		if(octoMapProj_.getNumSubscribers())
+		if(gridMapPub_.getNumSubscribers() || projMapPub_.getNumSubscribers())
 		{
-			// create the projection map
-			float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
-			cv::Mat pixels = octomap_->createProjectionMap(xMin, yMin, gridCellSize, occupancyGrid_->getMinMapSize(), octomapTreeDepth_);
+			// create the grid map
+			float xMin=0.0f, yMin=0.0f;
+			cv::Mat pixels = this->getGridMap(xMin, yMin, gridCellSize);
+			gridPixels = pixels;
+			gridXMin = xMin;
+			gridYMin = yMin;
 
 			if(!pixels.empty())
 			{
@@ -1322,217 +2625,774 @@ void MapsManager::publishMaps(
 				map.header.frame_id = mapFrameId;
 				map.header.stamp = stamp;
 
-				octoMapProj_.publish(map);
-				latched_.at(&octoMapProj_) = true;
+				if(gridMapPub_.getNumSubscribers())
+				{
+					gridMapPub_.publish(map);
+					latched_.at(&gridMapPub_) = true;
+				}
+				if(projMapPub_.getNumSubscribers())
+				{
+					projMapPub_.publish(map);
+					latched_.at(&projMapPub_) = true;
+				}
+			}
+			else if(poses.size())
+			{
+				ROS_WARN("Grid map is empty! (local maps=%d)", (int)gridMaps_.size());
+			}
+		}
+	}
+
+	publishGridPyramid(poses, stamp, mapFrameId, gridPixels, gridXMin, gridYMin, gridCellSize, gridProbPixels);
+
+	if(gridMapPub_.getNumSubscribers() == 0)
+	{
+		latched_.at(&gridMapPub_) = false;
+	}
+	if(projMapPub_.getNumSubscribers() == 0)
+	{
+		latched_.at(&projMapPub_) = false;
+	}
+	if(gridProbMapPub_.getNumSubscribers() == 0)
+	{
+		latched_.at(&gridProbMapPub_) = false;
+	}
+
+	if(!this->hasSubscribers() && mapCacheCleanup_)
+	{
+		if(!gridMaps_.empty())
+		{
+			size_t totalBytes = 0;
+			for(std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator iter=gridMaps_.begin(); iter!=gridMaps_.end(); ++iter)
+			{
+				totalBytes+= sizeof(int)+
+						iter->second.first.first.total()*iter->second.first.first.elemSize() +
+						iter->second.first.second.total()*iter->second.first.second.elemSize() +
+						iter->second.second.total()*iter->second.second.elemSize();
+			}
+			totalBytes += gridMapsViewpoints_.size()*sizeof(int) + gridMapsViewpoints_.size() * sizeof(cv::Point3f);
+			ROS_INFO("MapsManager: cleanup %ld grid maps (~%ld MB)...", gridMaps_.size(), totalBytes/1048576);
+		}
+		gridMaps_.clear();
+		gridMapsViewpoints_.clear();
+		localMapRanges_.clear();
+		releaseSharedLocalGrids();
+	}
+}
+
+namespace {
+
+nav_msgs::OccupancyGrid toOccupancyGridMsg(
+		const cv::Mat & pixels,
+		float xMin,
+		float yMin,
+		float cellSize,
+		const std::string & frameId,
+		const ros::Time & stamp)
+{
+	nav_msgs::OccupancyGrid map;
+	map.info.resolution = cellSize;
+	map.info.origin.position.x = xMin;
+	map.info.origin.position.y = yMin;
+	map.info.origin.position.z = 0.0;
+	map.info.origin.orientation.w = 1.0;
+	map.info.width = pixels.cols;
+	map.info.height = pixels.rows;
+	map.data.resize(map.info.width * map.info.height);
+	UASSERT(pixels.isContinuous());
+	memcpy(map.data.data(), pixels.data, map.info.width * map.info.height);
+	map.header.frame_id = frameId;
+	map.header.stamp = stamp;
+	return map;
+}
+
+// Bounds in map frame of a local grid (points in node frame)
+cv::Rect_<float> localGridBounds(const Transform & pose, const std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> & grid)
+{
+	float minX=std::numeric_limits<float>::max(), minY=minX;
+	float maxX=-minX, maxY=-minX;
+	const cv::Mat * mats[3] = {&grid.first.first, &grid.first.second, &grid.second};
+	for(int m=0; m<3; ++m)
+	{
+		const cv::Mat & points = *mats[m];
+		if(points.empty() || points.depth() != CV_32F)
+		{
+			continue;
+		}
+		int channels = points.channels();
+		for(int i=0; i<points.cols; ++i)
+		{
+			const float * pt = points.ptr<float>(0, i);
+			cv::Point3f p = util3d::transformPoint(cv::Point3f(pt[0], pt[1], channels>=3?pt[2]:0.0f), pose);
+			minX = std::min(minX, p.x);
+			minY = std::min(minY, p.y);
+			maxX = std::max(maxX, p.x);
+			maxY = std::max(maxY, p.y);
+		}
+	}
+	if(maxX < minX)
+	{
+		return cv::Rect_<float>();
+	}
+	return cv::Rect_<float>(minX, minY, maxX-minX, maxY-minY);
+}
+
+cv::Rect_<float> unionBounds(const cv::Rect_<float> & a, const cv::Rect_<float> & b)
+{
+	if(a.width <= 0.0f && a.height <= 0.0f && a.x == 0.0f && a.y == 0.0f)
+	{
+		return b;
+	}
+	if(b.width <= 0.0f && b.height <= 0.0f && b.x == 0.0f && b.y == 0.0f)
+	{
+		return a;
+	}
+	return a | b;
+}
+
+// Downsample the region of the full resolution grid (-1=unknown, 0=free,
+// 100=occupied) into a level with cells "factor" times larger. Cells are
+// max-pooled (occupied > free > unknown), or the known values are averaged
+// for probability maps.
+void poolGrid(const cv::Mat & base, cv::Mat & level, int factor, cv::Rect region, bool average)
+{
+	cv::Size size((base.cols+factor-1)/factor, (base.rows+factor-1)/factor);
+	if(level.size() != size)
+	{
+		level = cv::Mat(size, CV_8SC1, cv::Scalar(-1));
+		region = cv::Rect(0, 0, base.cols, base.rows);
+	}
+	if(region.area() == 0)
+	{
+		return;
+	}
+	int x1 = (region.x+region.width-1)/factor;
+	int y1 = (region.y+region.height-1)/factor;
+	for(int y=region.y/factor; y<=y1; ++y)
+	{
+		for(int x=region.x/factor; x<=x1; ++x)
+		{
+			int sum = 0;
+			int count = 0;
+			signed char maxValue = -1;
+			for(int v=y*factor; v<(y+1)*factor && v<base.rows; ++v)
+			{
+				const signed char * row = base.ptr<signed char>(v);
+				for(int u=x*factor; u<(x+1)*factor && u<base.cols; ++u)
+				{
+					if(row[u] >= 0)
+					{
+						sum += row[u];
+						++count;
+						maxValue = row[u]>maxValue?row[u]:maxValue;
+					}
+				}
+			}
+			level.at<signed char>(y, x) = average?(count?sum/count:-1):maxValue;
+		}
+	}
+}
+
+} // namespace
+
+void MapsManager::publishGridPyramid(
+		const std::map<int, rtabmap::Transform> & poses,
+		const ros::Time & stamp,
+		const std::string & mapFrameId,
+		const cv::Mat & gridMap,
+		float gridXMin,
+		float gridYMin,
+		float gridCellSize,
+		const cv::Mat & gridProbMap)
+{
+	if(!gridPyramidHasSubscribers())
+	{
+		// rebuild from scratch when someone subscribes again
+		gridPyramidBase_ = cv::Mat();
+		gridProbPyramidBase_ = cv::Mat();
+		gridPyramidNodes_.clear();
+		return;
+	}
+
+	bool probSubscribed = false;
+	for(size_t i=0; i<gridPyramid_.size(); ++i)
+	{
+		probSubscribed = probSubscribed || gridPyramid_[i].gridProbPub.getNumSubscribers() != 0;
+	}
+
+	if(gridUpdated_ || gridPyramidBase_.empty() || (probSubscribed && gridProbPyramidBase_.empty()))
+	{
+		// Find the region of the map changed since last update from the local
+		// grids added, moved or removed. If the graph changed, everything is updated.
+		bool full = gridPyramidBase_.empty() || (probSubscribed && gridProbPyramidBase_.empty());
+		cv::Rect_<float> changed;
+		const std::map<int, Transform> & addedNodes = occupancyGrid_->addedNodes();
+		std::map<int, std::pair<Transform, cv::Rect_<float> > > nodes;
+		for(std::map<int, Transform>::const_iterator iter=addedNodes.begin(); iter!=addedNodes.end() && !full; ++iter)
+		{
+			std::map<int, std::pair<Transform, cv::Rect_<float> > >::iterator previous = gridPyramidNodes_.find(iter->first);
+			if(previous != gridPyramidNodes_.end() &&
+			   memcmp(previous->second.first.data(), iter->second.data(), 12*sizeof(float)) == 0)
+			{
+				nodes.insert(*previous);
+				continue;
+			}
+			if(previous != gridPyramidNodes_.end() && iter->first > 0)
+			{
+				full = true;
+				break;
+			}
+			std::map<int, std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator grid = gridMaps_.find(iter->first);
+			if(grid == gridMaps_.end())
+			{
+				full = true;
+				break;
+			}
+			cv::Rect_<float> bounds = localGridBounds(iter->second, grid->second);
+			changed = unionBounds(changed, bounds);
+			if(previous != gridPyramidNodes_.end())
+			{
+				changed = unionBounds(changed, previous->second.second);
+			}
+			nodes.insert(std::make_pair(iter->first, std::make_pair(iter->second, bounds)));
+		}
+		for(std::map<int, std::pair<Transform, cv::Rect_<float> > >::iterator iter=gridPyramidNodes_.begin(); iter!=gridPyramidNodes_.end() && !full; ++iter)
+		{
+			if(addedNodes.find(iter->first) == addedNodes.end())
+			{
+				if(iter->first > 0)
+				{
+					full = true;
+				}
+				else
+				{
+					changed = unionBounds(changed, iter->second.second);
+				}
+			}
+		}
+		if(full)
+		{
+			nodes.clear();
+			for(std::map<int, Transform>::const_iterator iter=addedNodes.begin(); iter!=addedNodes.end(); ++iter)
+			{
+				std::map<int, std::pair<std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator grid = gridMaps_.find(iter->first);
+				nodes.insert(std::make_pair(iter->first, std::make_pair(iter->second,
+						grid!=gridMaps_.end()?localGridBounds(iter->second, grid->second):cv::Rect_<float>())));
+			}
+		}
+		gridPyramidNodes_ = nodes;
+
+		if(full || changed.width > 0.0f || changed.height > 0.0f)
+		{
+			// reuse the grids already created by publishMaps() if any
+			float xMin = gridXMin, yMin = gridYMin, cellSize = gridCellSize;
+			cv::Mat grid = gridMap;
+			if(grid.empty())
+			{
+				grid = this->getGridMap(xMin, yMin, cellSize);
 			}
-			else if(poses.size())
+			cv::Mat gridProb;
+			if(probSubscribed && !gridPyramid_.empty())
 			{
-				ROS_WARN("Octomap projection map is empty! (poses=%d octomap nodes=%d). "
-						"Make sure you activated \"%s\" and \"%s\" to true. "
-						"See \"$ rosrun rtabmap_ros rtabmap --params | grep Grid\" for more info.",
-						(int)poses.size(), (int)octomap_->octree()->size(),
-						Parameters::kGrid3D().c_str(), Parameters::kGridFromDepth().c_str());
+				gridProb = gridProbMap;
+				if(gridProb.empty())
+				{
+					gridProb = this->getGridProbMap(xMin, yMin, cellSize);
+				}
+			}
+			bool originChanged = xMin != gridPyramidXMin_ || yMin != gridPyramidYMin_ || cellSize != gridPyramidCellSize_ ||
+					grid.size() != gridPyramidBase_.size();
+			cv::Rect gridRegion(0, 0, grid.cols, grid.rows);
+			if(!full && !originChanged)
+			{
+				// one cell margin for rounding
+				int x0 = (int)floor((changed.x - xMin)/cellSize)-1;
+				int y0 = (int)floor((changed.y - yMin)/cellSize)-1;
+				int x1 = (int)ceil((changed.x + changed.width - xMin)/cellSize)+1;
+				int y1 = (int)ceil((changed.y + changed.height - yMin)/cellSize)+1;
+				gridRegion &= cv::Rect(x0, y0, x1-x0+1, y1-y0+1);
+			}
+			cv::Rect gridProbRegion = gridProb.empty()?cv::Rect():
+					(gridProb.size() == grid.size()?gridRegion:cv::Rect(0, 0, gridProb.cols, gridProb.rows));
+			if(!gridProb.empty() && gridProbPyramidBase_.size() != gridProb.size())
+			{
+				gridProbRegion = cv::Rect(0, 0, gridProb.cols, gridProb.rows);
+			}
+			for(size_t i=0; i<gridPyramid_.size(); ++i)
+			{
+				int factor = 2<<i;
+				if(gridRegion.area())
+				{
+					poolGrid(grid, gridPyramid_[i].grid, factor, gridRegion, false);
+					gridPyramid_[i].gridDirty = true;
+				}
+				if(gridProbRegion.area())
+				{
+					poolGrid(gridProb, gridPyramid_[i].gridProb, factor, gridProbRegion, true);
+					gridPyramid_[i].gridProbDirty = true;
+				}
 			}
+			gridPyramidBase_ = grid;
+			gridProbPyramidBase_ = gridProb;
+			gridPyramidXMin_ = xMin;
+			gridPyramidYMin_ = yMin;
+			gridPyramidCellSize_ = cellSize;
 		}
 	}
 
-	if( mapCacheCleanup_ &&
-		octoMapPubBin_.getNumSubscribers() == 0 &&
-		octoMapPubFull_.getNumSubscribers() == 0 &&
-		octoMapCloud_.getNumSubscribers() == 0 &&
-		octoMapFrontierCloud_.getNumSubscribers() == 0 &&
-		octoMapObstacleCloud_.getNumSubscribers() == 0 &&
-		octoMapGroundCloud_.getNumSubscribers() == 0 &&
-		octoMapEmptySpace_.getNumSubscribers() == 0 &&
-		octoMapProj_.getNumSubscribers() == 0)
+	if(gridPyramidBase_.empty())
+	{
+		return;
+	}
+
+	ros::Time now = ros::Time::now();
+	for(size_t i=0; i<gridPyramid_.size(); ++i)
 	{
-		if(octomap_->octree()->getNumLeafNodes()>0)
+		GridLevel & level = gridPyramid_[i];
+		if(level.rate <= 0.0 || level.lastPublished.isZero() || (now-level.lastPublished).toSec() >= 1.0/level.rate)
 		{
-			ROS_INFO("MapsManager: cleanup octomap (%ld leaf nodes, ~%ld MB)...",
-					octomap_->octree()->getNumLeafNodes(),
-					octomap_->octree()->memoryUsage()/1048576);
+			// A level stays dirty until it is actually published, so that a
+			// late subscriber gets the latest version
+			float cellSize = gridPyramidCellSize_ * float(2<<i);
+			bool published = false;
+			if(level.gridDirty && level.gridPub.getNumSubscribers() && !level.grid.empty())
+			{
+				level.gridPub.publish(toOccupancyGridMsg(level.grid, gridPyramidXMin_, gridPyramidYMin_, cellSize, mapFrameId, stamp));
+				level.gridDirty = false;
+				published = true;
+			}
+			if(level.gridProbDirty && level.gridProbPub.getNumSubscribers() && !level.gridProb.empty())
+			{
+				level.gridProbPub.publish(toOccupancyGridMsg(level.gridProb, gridPyramidXMin_, gridPyramidYMin_, cellSize, mapFrameId, stamp));
+				level.gridProbDirty = false;
+				published = true;
+			}
+			if(published)
+			{
+				level.lastPublished = now;
+			}
 		}
-		octomap_->clear();
 	}
+}
 
-	if(octoMapPubBin_.getNumSubscribers() == 0)
+void MapsManager::publishLocalMaps(
+		const rtabmap::Transform & robotPose,
+		const ros::Time & stamp,
+		const std::string & mapFrameId)
+{
+	if(robotPose.isNull() || localMapRadius_ <= 0.0 || !hasLocalMapSubscribers())
 	{
-		latched_.at(&octoMapPubBin_) = false;
+		return;
 	}
-	if(octoMapPubFull_.getNumSubscribers() == 0)
+	ros::Time now = ros::Time::now();
+	if(localMapRate_ > 0.0 && !localMapLastPublished_.isZero() && (now-localMapLastPublished_).toSec() < 1.0/localMapRate_)
 	{
-		latched_.at(&octoMapPubFull_) = false;
+		return;
 	}
-	if(octoMapCloud_.getNumSubscribers() == 0)
+	localMapLastPublished_ = now;
+
+	// window aligned on the cells to avoid flickering while the robot moves
+	float cellSize = occupancyGrid_->getCellSize();
+	int cells = int(localMapRadius_/cellSize);
+	float xMin = std::floor(robotPose.x()/cellSize - cells) * cellSize;
+	float yMin = std::floor(robotPose.y()/cellSize - cells) * cellSize;
+	cv::Mat logOdds(cells*2+1, cells*2+1, CV_32FC1, cv::Scalar(0.0f));
+	cv::Mat updatedBy(cells*2+1, cells*2+1, CV_32SC1, cv::Scalar(0)); // last node that updated the cell
+	bool publishCloud = cloudObstaclesLocalPub_.getNumSubscribers() != 0;
+	std::vector<std::pair<cv::Point3f, int> > obstaclePoints; // point and cell index
+
+	// nodes overlapping the 3x3 neighbor cells of the robot, fused
+	// in order of creation so that recent observations clear old obstacles
+	std::set<int> ids;
+	int bx = (int)std::floor(robotPose.x()/localMapRadius_);
+	int by = (int)std::floor(robotPose.y()/localMapRadius_);
+	for(int i=bx-1; i<=bx+1; ++i)
 	{
-		latched_.at(&octoMapCloud_) = false;
+		for(int j=by-1; j<=by+1; ++j)
+		{
+			std::map<std::pair<int, int>, std::vector<int> >::const_iterator bucket = localMapBuckets_.find(std::make_pair(i,j));
+			if(bucket != localMapBuckets_.end())
+			{
+				ids.insert(bucket->second.begin(), bucket->second.end());
+			}
+		}
 	}
-	if(octoMapFrontierCloud_.getNumSubscribers() == 0)
+	for(std::set<int>::iterator iter=ids.begin(); iter!=ids.end(); ++iter)
 	{
-		latched_.at(&octoMapFrontierCloud_) = false;
+		int id = *iter;
+		std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> >::const_iterator jter = gridMaps_.find(id);
+		if(jter == gridMaps_.end())
+		{
+			continue;
+		}
+		const Transform & pose = localMapPoses_.at(id);
+		// obstacles first, so that the ground and empty cells of the same node don't clear them
+		// (the cache holds <<ground, obstacles>, empty>)
+		const cv::Mat * layers[3] = {&jter->second.first.second, &jter->second.first.first, &jter->second.second};
+		for(int l=0; l<3; ++l)
+		{
+			const cv::Mat & cellsMat = *layers[l];
+			if(cellsMat.empty())
+			{
+				continue;
+			}
+			UASSERT(cellsMat.type() == CV_32FC2 || cellsMat.channels() >= 3);
+			bool is2d = cellsMat.channels() == 2;
+			float update = l==0?localMapProbHit_:localMapProbMiss_;
+			for(int k=0; k<cellsMat.cols; ++k)
+			{
+				const float * ptr = cellsMat.ptr<float>(0, k);
+				cv::Point3f pt = util3d::transformPoint(cv::Point3f(ptr[0], ptr[1], is2d?0.0f:ptr[2]), pose);
+				int u = (int)std::floor((pt.x-xMin)/cellSize);
+				int v = (int)std::floor((pt.y-yMin)/cellSize);
+				if(u<0 || v<0 || u>=logOdds.cols || v>=logOdds.rows)
+				{
+					continue;
+				}
+				int & lastId = updatedBy.at<int>(v, u);
+				if(lastId == id)
+				{
+					// a cell is updated once per node
+					continue;
+				}
+				lastId = id;
+				if(l == 0 && publishCloud)
+				{
+					obstaclePoints.push_back(std::make_pair(pt, v*logOdds.cols+u));
+				}
+				float & value = logOdds.at<float>(v, u);
+				value = std::min(localMapProbClampingMax_, std::max(localMapProbClampingMin_, value + update));
+			}
+		}
 	}
-	if(octoMapObstacleCloud_.getNumSubscribers() == 0)
+
+	cv::Mat grid(logOdds.size(), CV_8SC1, cv::Scalar(-1));
+	for(int v=0; v<grid.rows; ++v)
 	{
-		latched_.at(&octoMapObstacleCloud_) = false;
+		for(int u=0; u<grid.cols; ++u)
+		{
+			if(updatedBy.at<int>(v, u) != 0)
+			{
+				grid.at<signed char>(v, u) = logOdds.at<float>(v, u) >= localMapOccupancyThr_?100:0;
+			}
+		}
 	}
-	if(octoMapGroundCloud_.getNumSubscribers() == 0)
+	pcl::PointCloud<pcl::PointXYZ>::Ptr obstacles(new pcl::PointCloud<pcl::PointXYZ>);
+	for(size_t i=0; i<obstaclePoints.size(); ++i)
 	{
-		latched_.at(&octoMapGroundCloud_) = false;
+		// keep only the obstacles not cleared by more recent nodes
+		if(((const signed char *)grid.data)[obstaclePoints[i].second] == 100)
+		{
+			const cv::Point3f & pt = obstaclePoints[i].first;
+			obstacles->push_back(pcl::PointXYZ(pt.x, pt.y, pt.z));
+		}
 	}
-	if(octoMapEmptySpace_.getNumSubscribers() == 0)
+
+	if(gridLocalMapPub_.getNumSubscribers())
 	{
-		latched_.at(&octoMapEmptySpace_) = false;
+		gridLocalMapPub_.publish(toOccupancyGridMsg(grid, xMin, yMin, cellSize, mapFrameId, stamp));
 	}
-	if(octoMapProj_.getNumSubscribers() == 0)
+	if(publishCloud)
 	{
-		latched_.at(&octoMapProj_) = false;
+		if(cloudOutputVoxelized_ && !obstacles->empty())
+		{
+			obstacles = util3d::voxelize(obstacles, cellSize);
+		}
+		sensor_msgs::PointCloud2::Ptr cloudMsg(new sensor_msgs::PointCloud2);
+		pcl::toROSMsg(*obstacles, *cloudMsg);
+		cloudMsg->header.stamp = stamp;
+		cloudMsg->header.frame_id = mapFrameId;
+		cloudObstaclesLocalPub_.publish(cloudMsg);
 	}
+}
 
-#endif
-#endif
+namespace {
+inline int floorDiv(int a, int b)
+{
+	return a>=0?a/b:-((-a+b-1)/b);
+}
+inline bool contributionLess(const std::pair<std::pair<int, int>, float> & a, const std::pair<std::pair<int, int>, float> & b)
+{
+	return a.first < b.first;
+}
+}
 
-	if( gridUpdated_ ||
-		!latching_ ||
-		(gridMapPub_.getNumSubscribers() && !latched_.at(&gridMapPub_)) ||
-		(projMapPub_.getNumSubscribers() && !latched_.at(&projMapPub_)) ||
-		(gridProbMapPub_.getNumSubscribers() && !latched_.at(&gridProbMapPub_)))
+MapsManager::ElevationCell & MapsManager::elevationCell(int x, int y)
+{
+	int tx = floorDiv(x, kElevationTileSize);
+	int ty = floorDiv(y, kElevationTileSize);
+	ElevationTile & tile = elevationTiles_[std::make_pair(tx, ty)];
+	return tile.cells[(y-ty*kElevationTileSize)*kElevationTileSize + (x-tx*kElevationTileSize)];
+}
+
+// Subtract the contributions of a node from the fused cells. Cells for which
+// the node was giving the min or max height are added to dirtyCells.
+void MapsManager::removeElevationContributions(
+		const std::vector<ElevationContribution> & contributions,
+		std::set<std::pair<int, int> > & dirtyCells)
+{
+	for(size_t i=0; i<contributions.size(); ++i)
 	{
-		if(projMapPub_.getNumSubscribers())
+		const ElevationContribution & c = contributions[i];
+		int tx = floorDiv(c.x, kElevationTileSize);
+		int ty = floorDiv(c.y, kElevationTileSize);
+		std::map<std::pair<int, int>, ElevationTile>::iterator tileIter = elevationTiles_.find(std::make_pair(tx, ty));
+		UASSERT(tileIter != elevationTiles_.end());
+		ElevationCell & cell = tileIter->second.cells[(c.y-ty*kElevationTileSize)*kElevationTileSize + (c.x-tx*kElevationTileSize)];
+		UASSERT(cell.count >= c.cell.count);
+		cell.count -= c.cell.count;
+		cell.sumZ -= c.cell.sumZ;
+		if(cell.count == 0)
 		{
-			if(parameters_.find(Parameters::kGridFromDepth()) != parameters_.end() &&
-				!uStr2Bool(parameters_.at(Parameters::kGridFromDepth())))
-			{
-				ROS_WARN("/proj_map topic is deprecated! Subscribe to /grid_map topic "
-						"instead with <param name=\"%s\" type=\"string\" value=\"true\"/>. "
-						"Do \"$ rosrun rtabmap_ros rtabmap --params | grep Grid\" to see "
-						"all occupancy grid parameters.",
-						Parameters::kGridFromDepth().c_str());
-			}
-			else
+			cell = ElevationCell();
+			--elevationKnownCells_;
+			if(--tileIter->second.used == 0)
 			{
-				ROS_WARN("/proj_map topic is deprecated! Subscribe to /grid_map topic instead.");
+				elevationTiles_.erase(tileIter);
 			}
 		}
-
-		if(gridProbMapPub_.getNumSubscribers())
+		else if(c.cell.minZ <= cell.minZ || c.cell.maxZ >= cell.maxZ)
 		{
-			// create the grid map
-			float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
-			cv::Mat pixels = this->getGridProbMap(xMin, yMin, gridCellSize);
-			if(!pixels.empty())
-			{
-				//init
-				nav_msgs::OccupancyGrid map;
-				map.info.resolution = gridCellSize;
-				map.info.origin.position.x = 0.0;
-				map.info.origin.position.y = 0.0;
-				map.info.origin.position.z = 0.0;
-				map.info.origin.orientation.x = 0.0;
-				map.info.origin.orientation.y = 0.0;
-				map.info.origin.orientation.z = 0.0;
-				map.info.origin.orientation.w = 1.0;
-
-				map.info.width = pixels.cols;
-				map.info.height = pixels.rows;
-				map.info.origin.position.x = xMin;
-				map.info.origin.position.y = yMin;
-				map.data.resize(map.info.width * map.info.height);
+			dirtyCells.insert(std::make_pair(c.x, c.y));
+		}
+	}
+}
 
-				memcpy(map.data.data(), pixels.data, map.info.width * map.info.height);
+void MapsManager::publishElevationMap(
+		const std::map<int, rtabmap::Transform> & poses,
+		const ros::Time & stamp,
+		const std::string & mapFrameId)
+{
+	if(!hasElevationMapSubscribers())
+	{
+		if(mapCacheCleanup_ && !elevationNodes_.empty())
+		{
+			ROS_INFO("MapsManager: cleanup elevation map (%d nodes, %d cells)...", (int)elevationNodes_.size(), elevationKnownCells_);
+			elevationNodes_.clear();
+			elevationTiles_.clear();
+			elevationKnownCells_ = 0;
+		}
+		latched_.at(&elevationMapPub_) = false;
+		latched_.at(&elevationLayersPub_) = false;
+		return;
+	}
 
-				map.header.frame_id = mapFrameId;
-				map.header.stamp = stamp;
+	UTimer time;
+	float cellSize = elevationCellSize_>0.0?elevationCellSize_:occupancyGrid_->getCellSize();
+	UASSERT(cellSize > 0.0f);
+	if(cellSize != elevationCurrentCellSize_)
+	{
+		elevationNodes_.clear();
+		elevationTiles_.clear();
+		elevationKnownCells_ = 0;
+		elevationCurrentCellSize_ = cellSize;
+	}
 
-				if(gridProbMapPub_.getNumSubscribers())
+	// Nodes removed or moved (e.g., after a loop closure) have their
+	// contributions subtracted from the fused cells, then are re-added
+	// with their new pose. Node 0 (latest data) is ignored.
+	std::set<std::pair<int, int> > dirtyCells;
+	float updateErrorSqr = occupancyGrid_->getUpdateError()*occupancyGrid_->getUpdateError();
+	for(std::map<int, std::pair<Transform, std::vector<ElevationContribution> > >::iterator iter=elevationNodes_.begin(); iter!=elevationNodes_.end();)
+	{
+		std::map<int, Transform>::const_iterator jter = poses.find(iter->first);
+		if(jter == poses.end() || jter->second.getDistanceSquared(iter->second.first) > updateErrorSqr)
+		{
+			removeElevationContributions(iter->second.second, dirtyCells);
+			elevationNodes_.erase(iter++);
+			elevationUpdated_ = true;
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	if(!dirtyCells.empty())
+	{
+		// min/max of these cells are recomputed from the remaining contributions
+		for(std::set<std::pair<int, int> >::iterator iter=dirtyCells.begin(); iter!=dirtyCells.end(); ++iter)
+		{
+			ElevationCell & cell = elevationCell(iter->first, iter->second);
+			cell.minZ = std::numeric_limits<float>::max();
+			cell.maxZ = -std::numeric_limits<float>::max();
+		}
+		for(std::map<int, std::pair<Transform, std::vector<ElevationContribution> > >::iterator iter=elevationNodes_.begin(); iter!=elevationNodes_.end(); ++iter)
+		{
+			const std::vector<ElevationContribution> & contributions = iter->second.second;
+			for(size_t i=0; i<contributions.size(); ++i)
+			{
+				if(dirtyCells.find(std::make_pair(contributions[i].x, contributions[i].y)) != dirtyCells.end())
 				{
-					gridProbMapPub_.publish(map);
-					latched_.at(&gridProbMapPub_) = true;
+					ElevationCell & cell = elevationCell(contributions[i].x, contributions[i].y);
+					cell.minZ = std::min(cell.minZ, contributions[i].cell.minZ);
+					cell.maxZ = std::max(cell.maxZ, contributions[i].cell.maxZ);
 				}
 			}
-			else if(poses.size())
+		}
+	}
+
+	int added = 0;
+	std::vector<std::pair<std::pair<int, int>, float> > points;
+	for(std::map<int, Transform>::const_iterator iter=poses.lower_bound(1); iter!=poses.end(); ++iter)
+	{
+		if(elevationNodes_.find(iter->first) != elevationNodes_.end())
+		{
+			continue;
+		}
+		std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> >::const_iterator jter = gridMaps_.find(iter->first);
+		if(jter == gridMaps_.end())
+		{
+			continue;
+		}
+		points.clear();
+		const cv::Mat * layers[2] = {&jter->second.first.first, &jter->second.first.second};
+		for(int l=0; l<2; ++l)
+		{
+			const cv::Mat & cellsMat = *layers[l];
+			if(cellsMat.empty() || cellsMat.channels() < 3)
 			{
-				ROS_WARN("Grid map is empty! (local maps=%d)", (int)gridMaps_.size());
+				// 2D grids don't have height
+				continue;
+			}
+			for(int k=0; k<cellsMat.cols; ++k)
+			{
+				const float * ptr = cellsMat.ptr<float>(0, k);
+				cv::Point3f pt = util3d::transformPoint(cv::Point3f(ptr[0], ptr[1], ptr[2]), iter->second);
+				points.push_back(std::make_pair(std::make_pair((int)std::floor(pt.x/cellSize), (int)std::floor(pt.y/cellSize)), pt.z));
 			}
 		}
-		if(gridMapPub_.getNumSubscribers() || projMapPub_.getNumSubscribers())
-		{
-			// create the grid map
-			float xMin=0.0f, yMin=0.0f, gridCellSize = 0.05f;
-			cv::Mat pixels = this->getGridMap(xMin, yMin, gridCellSize);
 
-			if(!pixels.empty())
+		// one contribution per cell of the node
+		std::sort(points.begin(), points.end(), contributionLess);
+		std::pair<Transform, std::vector<ElevationContribution> > & node = elevationNodes_[iter->first];
+		node.first = iter->second;
+		for(size_t i=0; i<points.size(); ++i)
+		{
+			if(i==0 || points[i].first != points[i-1].first)
 			{
-				//init
-				nav_msgs::OccupancyGrid map;
-				map.info.resolution = gridCellSize;
-				map.info.origin.position.x = 0.0;
-				map.info.origin.position.y = 0.0;
-				map.info.origin.position.z = 0.0;
-				map.info.origin.orientation.x = 0.0;
-				map.info.origin.orientation.y = 0.0;
-				map.info.origin.orientation.z = 0.0;
-				map.info.origin.orientation.w = 1.0;
-
-				map.info.width = pixels.cols;
-				map.info.height = pixels.rows;
-				map.info.origin.position.x = xMin;
-				map.info.origin.position.y = yMin;
-				map.data.resize(map.info.width * map.info.height);
-
-				memcpy(map.data.data(), pixels.data, map.info.width * map.info.height);
-
-				map.header.frame_id = mapFrameId;
-				map.header.stamp = stamp;
-
-				if(gridMapPub_.getNumSubscribers())
-				{
-					gridMapPub_.publish(map);
-					latched_.at(&gridMapPub_) = true;
-				}
-				if(projMapPub_.getNumSubscribers())
-				{
-					projMapPub_.publish(map);
-					latched_.at(&projMapPub_) = true;
-				}
+				ElevationContribution c;
+				c.x = points[i].first.first;
+				c.y = points[i].first.second;
+				node.second.push_back(c);
 			}
-			else if(poses.size())
+			node.second.back().cell.add(points[i].second, points[i].second, points[i].second, 1);
+		}
+		for(size_t i=0; i<node.second.size(); ++i)
+		{
+			const ElevationContribution & c = node.second[i];
+			int tx = floorDiv(c.x, kElevationTileSize);
+			int ty = floorDiv(c.y, kElevationTileSize);
+			ElevationTile & tile = elevationTiles_[std::make_pair(tx, ty)];
+			ElevationCell & cell = tile.cells[(c.y-ty*kElevationTileSize)*kElevationTileSize + (c.x-tx*kElevationTileSize)];
+			if(cell.count == 0)
 			{
-				ROS_WARN("Grid map is empty! (local maps=%d)", (int)gridMaps_.size());
+				++tile.used;
+				++elevationKnownCells_;
 			}
+			cell.add(c.cell.sumZ, c.cell.minZ, c.cell.maxZ, c.cell.count);
 		}
+		++added;
 	}
+	elevationUpdated_ = elevationUpdated_ || added > 0;
 
-	if(gridMapPub_.getNumSubscribers() == 0)
+	if(!elevationUpdated_ &&
+		latching_ &&
+		(!elevationMapPub_.getNumSubscribers() || latched_.at(&elevationMapPub_)) &&
+		(!elevationLayersPub_.getNumSubscribers() || latched_.at(&elevationLayersPub_)))
 	{
-		latched_.at(&gridMapPub_) = false;
+		return;
 	}
-	if(projMapPub_.getNumSubscribers() == 0)
+	elevationUpdated_ = false;
+	if(elevationTiles_.empty())
 	{
-		latched_.at(&projMapPub_) = false;
+		return;
 	}
-	if(gridProbMapPub_.getNumSubscribers() == 0)
+
+	// bounds of the known cells
+	int minX=0, minY=0, maxX=-1, maxY=-1;
+	bool first = true;
+	for(std::map<std::pair<int, int>, ElevationTile>::iterator iter=elevationTiles_.begin(); iter!=elevationTiles_.end(); ++iter)
 	{
-		latched_.at(&gridProbMapPub_) = false;
+		const std::vector<ElevationCell> & cells = iter->second.cells;
+		for(int i=0; i<(int)cells.size(); ++i)
+		{
+			if(cells[i].count)
+			{
+				int x = iter->first.first*kElevationTileSize + i%kElevationTileSize;
+				int y = iter->first.second*kElevationTileSize + i/kElevationTileSize;
+				if(first)
+				{
+					minX = maxX = x;
+					minY = maxY = y;
+					first = false;
+				}
+				minX = std::min(minX, x);
+				maxX = std::max(maxX, x);
+				minY = std::min(minY, y);
+				maxY = std::max(maxY, y);
+			}
+		}
 	}
 
-	if(!this->hasSubscribers() && mapCacheCleanup_)
+	// same layout than nav_msgs/OccupancyGrid: row 0 is yMin, unknown cells are NaN
+	cv::Mat layers(maxY-minY+1, maxX-minX+1, CV_32FC4, cv::Scalar::all(std::numeric_limits<float>::quiet_NaN()));
+	for(std::map<std::pair<int, int>, ElevationTile>::iterator iter=elevationTiles_.begin(); iter!=elevationTiles_.end(); ++iter)
 	{
-		if(!gridMaps_.empty())
+		const std::vector<ElevationCell> & cells = iter->second.cells;
+		for(int i=0; i<(int)cells.size(); ++i)
 		{
-			size_t totalBytes = 0;
-			for(std::map<int, std::pair< std::pair<cv::Mat, cv::Mat>, cv::Mat> >::iterator iter=gridMaps_.begin(); iter!=gridMaps_.end(); ++iter)
+			if(cells[i].count)
 			{
-				totalBytes+= sizeof(int)+
-						iter->second.first.first.total()*iter->second.first.first.elemSize() +
-						iter->second.first.second.total()*iter->second.first.second.elemSize() +
-						iter->second.second.total()*iter->second.second.elemSize();
+				int x = iter->first.first*kElevationTileSize + i%kElevationTileSize;
+				int y = iter->first.second*kElevationTileSize + i/kElevationTileSize;
+				cv::Vec4f & cell = layers.at<cv::Vec4f>(y-minY, x-minX);
+				cell[0] = float(cells[i].sumZ/double(cells[i].count));
+				cell[1] = cells[i].minZ;
+				cell[2] = cells[i].maxZ;
+				cell[3] = cells[i].count;
 			}
-			totalBytes += gridMapsViewpoints_.size()*sizeof(int) + gridMapsViewpoints_.size() * sizeof(cv::Point3f);
-			ROS_INFO("MapsManager: cleanup %ld grid maps (~%ld MB)...", gridMaps_.size(), totalBytes/1048576);
 		}
-		gridMaps_.clear();
-		gridMapsViewpoints_.clear();
 	}
+
+	nav_msgs::MapMetaData info;
+	info.map_load_time = stamp;
+	info.resolution = cellSize;
+	info.width = layers.cols;
+	info.height = layers.rows;
+	info.origin.position.x = minX*cellSize;
+	info.origin.position.y = minY*cellSize;
+	info.origin.orientation.w = 1.0;
+	elevationInfoPub_.publish(info);
+
+	sensor_msgs::Image msg;
+	msg.header.frame_id = mapFrameId;
+	msg.header.stamp = stamp;
+	msg.width = layers.cols;
+	msg.height = layers.rows;
+	msg.is_bigendian = 0;
+	if(elevationMapPub_.getNumSubscribers())
+	{
+		cv::Mat mean;
+		cv::extractChannel(layers, mean, 0);
+		msg.encoding = sensor_msgs::image_encodings::TYPE_32FC1;
+		msg.step = mean.cols * sizeof(float);
+		msg.data.resize(msg.step * mean.rows);
+		memcpy(msg.data.data(), mean.data, msg.data.size());
+		elevationMapPub_.publish(msg);
+		latched_.at(&elevationMapPub_) = true;
+	}
+	if(elevationLayersPub_.getNumSubscribers())
+	{
+		// mean, min, max, count
+		msg.encoding = sensor_msgs::image_encodings::TYPE_32FC4;
+		msg.step = layers.cols * 4 * sizeof(float);
+		msg.data.resize(msg.step * layers.rows);
+		memcpy(msg.data.data(), layers.data, msg.data.size());
+		elevationLayersPub_.publish(msg);
+		latched_.at(&elevationLayersPub_) = true;
+	}
+	ROS_INFO("Elevation map updated (%d nodes added, %d cells, %dx%d, %fs)",
+			added, elevationKnownCells_, layers.cols, layers.rows, time.ticks());
 }
 
 cv::Mat MapsManager::getGridMap(
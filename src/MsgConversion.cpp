@@ -28,13 +28,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "rtabmap_ros/MsgConversion.h"
 
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
 #include <zlib.h>
 #include <ros/ros.h>
 #include <rtabmap/core/util3d.h>
 #include <rtabmap/core/util3d_transforms.h>
 #include <rtabmap/core/util3d_filtering.h>
 #include <rtabmap/core/Compression.h>
+#include <rtabmap/core/util2d.h>
 #include <rtabmap/utilite/UStl.h>
+#include <rtabmap/utilite/UConversion.h>
 #include <rtabmap/utilite/ULogger.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <eigen_conversions/eigen_msg.h>
@@ -43,10 +46,219 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <image_geometry/stereo_camera_model.h>
 #include <sensor_msgs/image_encodings.h>
 #include <laser_geometry/laser_geometry.h>
+#include <boost/functional/hash.hpp>
+#include <boost/bind.hpp>
 #include <rtabmap/core/util3d_surface.h>
 
 namespace rtabmap_ros {
 
+ImageIngestionPlan::Encoding ImageIngestionPlan::encodingFromString(const std::string & encoding)
+{
+	if(encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
+	   encoding.compare(sensor_msgs::image_encodings::MONO8) == 0)
+	{
+		return kMono8;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::MONO16) == 0)
+	{
+		return kMono16;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::BGR8) == 0)
+	{
+		return kBgr8;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::RGB8) == 0)
+	{
+		return kRgb8;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::BGRA8) == 0)
+	{
+		return kBgra8;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::RGBA8) == 0)
+	{
+		return kRgba8;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::BAYER_GRBG8) == 0)
+	{
+		return kBayerGrbg8;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::BAYER_RGGB8) == 0)
+	{
+		return kBayerRggb8;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::TYPE_16UC1) == 0)
+	{
+		return k16UC1;
+	}
+	else if(encoding.compare(sensor_msgs::image_encodings::TYPE_32FC1) == 0)
+	{
+		return k32FC1;
+	}
+	return kUnknown;
+}
+
+void ImageIngestionPlan::reuseBuffer(cv::Mat & buffer, int rows, int cols, int type)
+{
+	if(buffer.u && buffer.u->refcount > 1)
+	{
+		buffer = cv::Mat();
+	}
+	buffer.create(rows, cols, type);
+}
+
+namespace {
+class MosaicConverter : public cv::ParallelLoopBody
+{
+public:
+	MosaicConverter(
+			const std::vector<cv_bridge::CvImageConstPtr> & images,
+			const std::vector<ImageIngestionPlan> & plans,
+			cv::Mat & mosaic) :
+		images_(images),
+		plans_(plans),
+		mosaic_(mosaic)
+	{}
+
+	virtual void operator()(const cv::Range & range) const
+	{
+		for(int i=range.start; i<range.end; ++i)
+		{
+			const cv::Mat & image = images_[i]->image;
+			cv::Mat subImage(mosaic_, cv::Rect(i*image.cols, 0, image.cols, image.rows));
+			plans_[i].convert(image, subImage);
+		}
+	}
+
+private:
+	const std::vector<cv_bridge::CvImageConstPtr> & images_;
+	const std::vector<ImageIngestionPlan> & plans_;
+	cv::Mat & mosaic_;
+};
+}
+
+void ImageIngestionPlan::convertToMosaic(
+		const std::vector<cv_bridge::CvImageConstPtr> & images,
+		const std::vector<ImageIngestionPlan> & plans,
+		cv::Mat & mosaic,
+		bool parallel)
+{
+	UASSERT(images.size() == plans.size());
+	MosaicConverter converter(images, plans, mosaic);
+	if(parallel && images.size() > 1)
+	{
+		cv::parallel_for_(cv::Range(0, (int)images.size()), converter);
+	}
+	else
+	{
+		converter(cv::Range(0, (int)images.size()));
+	}
+}
+
+ImageIngestionPlan::ImageIngestionPlan(Target target) :
+		target_(target),
+		encoding_(kUnknown),
+		outputType_(-1),
+		code_(-1)
+{
+}
+
+bool ImageIngestionPlan::update(const cv_bridge::CvImageConstPtr & image)
+{
+	if(!encodingStr_.empty() &&
+		image->image.cols == size_.width &&
+		image->image.rows == size_.height &&
+		image->encoding.compare(encodingStr_) == 0)
+	{
+		return encoding_ != kUnknown;
+	}
+
+	encodingStr_ = image->encoding;
+	size_ = image->image.size();
+	encoding_ = encodingFromString(image->encoding);
+	outputType_ = -1;
+	code_ = -1;
+	if(target_ == kTargetDepth)
+	{
+		if(encoding_ == kMono16 || encoding_ == k16UC1)
+		{
+			outputType_ = CV_16UC1;
+		}
+		else if(encoding_ == k32FC1)
+		{
+			outputType_ = CV_32FC1;
+		}
+		else
+		{
+			encoding_ = kUnknown;
+		}
+	}
+	else
+	{
+		bool mono = target_ == kTargetMono;
+		outputType_ = mono?CV_8UC1:CV_8UC3;
+		switch(encoding_)
+		{
+		case kMono8:
+			outputType_ = CV_8UC1;
+			break;
+		case kMono16:
+			outputType_ = CV_8UC1;
+			code_ = -2;
+			break;
+		case kBgr8:
+			code_ = mono?cv::COLOR_BGR2GRAY:-1;
+			break;
+		case kRgb8:
+			code_ = mono?cv::COLOR_RGB2GRAY:cv::COLOR_RGB2BGR;
+			break;
+		case kBgra8:
+			code_ = mono?cv::COLOR_BGRA2GRAY:cv::COLOR_BGRA2BGR;
+			break;
+		case kRgba8:
+			code_ = mono?cv::COLOR_RGBA2GRAY:cv::COLOR_RGBA2BGR;
+			break;
+		// same bayer codes than cv_bridge
+		case kBayerGrbg8:
+			code_ = mono?cv::COLOR_BayerGB2GRAY:cv::COLOR_BayerGB2BGR;
+			break;
+		case kBayerRggb8:
+			code_ = mono?cv::COLOR_BayerBG2GRAY:cv::COLOR_BayerBG2BGR;
+			break;
+		default:
+			encoding_ = kUnknown;
+			outputType_ = -1;
+			break;
+		}
+	}
+	return encoding_ != kUnknown;
+}
+
+void ImageIngestionPlan::convert(const cv::Mat & src, cv::Mat & dst) const
+{
+	UASSERT(encoding_ != kUnknown);
+	UASSERT(dst.empty() || (dst.type() == outputType_ && dst.size() == src.size()));
+	if(code_ == -1)
+	{
+		src.copyTo(dst);
+	}
+	else if(code_ == -2)
+	{
+		src.convertTo(dst, CV_8U, 1.0/256.0);
+	}
+	else
+	{
+		cv::cvtColor(src, dst, code_);
+	}
+}
+
+cv::Mat ImageIngestionPlan::convertToBuffer(const cv::Mat & src)
+{
+	reuseBuffer(buffer_, src.rows, src.cols, outputType_);
+	convert(src, buffer_);
+	return buffer_;
+}
+
 void transformToTF(const rtabmap::Transform & transform, tf::Transform & tfTransform)
 {
 	if(!transform.isNull())
@@ -66,18 +278,38 @@ rtabmap::Transform transformFromTF(const tf::Transform & transform)
 	return rtabmap::Transform::fromEigen3d(eigenTf);
 }
 
+namespace {
+// Transform storage is a row-major 3x4 float matrix, map it directly
+// instead of going through Eigen::Affine3d
+inline Eigen::Quaterniond rotationFromTransform(const rtabmap::Transform & transform)
+{
+	Eigen::Map<const Eigen::Matrix<float,3,4,Eigen::RowMajor> > m(transform.data());
+	Eigen::Quaterniond q(Eigen::Matrix3d(m.leftCols<3>().cast<double>()));
+	q.normalize();
+	return q;
+}
+inline rtabmap::Transform transformFromRotation(double x, double y, double z, const Eigen::Quaterniond & q)
+{
+	Eigen::Matrix3d r = q.toRotationMatrix();
+	return rtabmap::Transform(
+			r(0,0), r(0,1), r(0,2), x,
+			r(1,0), r(1,1), r(1,2), y,
+			r(2,0), r(2,1), r(2,2), z);
+}
+}
+
 void transformToGeometryMsg(const rtabmap::Transform & transform, geometry_msgs::Transform & msg)
 {
 	if(!transform.isNull())
 	{
-		tf::transformEigenToMsg(transform.toEigen3d(), msg);
-
-		// make sure the quaternion is normalized
-		long double recipNorm = 1.0 / sqrt(msg.rotation.x * msg.rotation.x + msg.rotation.y * msg.rotation.y + msg.rotation.z * msg.rotation.z + msg.rotation.w * msg.rotation.w);
-		msg.rotation.x *= recipNorm;
-		msg.rotation.y *= recipNorm;
-		msg.rotation.z *= recipNorm;
-		msg.rotation.w *= recipNorm;
+		Eigen::Quaterniond q = rotationFromTransform(transform);
+		msg.translation.x = transform.x();
+		msg.translation.y = transform.y();
+		msg.translation.z = transform.z();
+		msg.rotation.x = q.x();
+		msg.rotation.y = q.y();
+		msg.rotation.z = q.z();
+		msg.rotation.w = q.w();
 	}
 	else
 	{
@@ -96,16 +328,22 @@ rtabmap::Transform transformFromGeometryMsg(const geometry_msgs::Transform & msg
 		return rtabmap::Transform();
 	}
 
-	Eigen::Affine3d tfTransform;
-	tf::transformMsgToEigen(msg, tfTransform);
-	return rtabmap::Transform::fromEigen3d(tfTransform);
+	return transformFromRotation(msg.translation.x, msg.translation.y, msg.translation.z,
+			Eigen::Quaterniond(msg.rotation.w, msg.rotation.x, msg.rotation.y, msg.rotation.z));
 }
 
 void transformToPoseMsg(const rtabmap::Transform & transform, geometry_msgs::Pose & msg)
 {
 	if(!transform.isNull())
 	{
-		tf::poseEigenToMsg(transform.toEigen3d(), msg);
+		Eigen::Quaterniond q = rotationFromTransform(transform);
+		msg.position.x = transform.x();
+		msg.position.y = transform.y();
+		msg.position.z = transform.z();
+		msg.orientation.x = q.x();
+		msg.orientation.y = q.y();
+		msg.orientation.z = q.z();
+		msg.orientation.w = q.w();
 	}
 	else
 	{
@@ -126,9 +364,8 @@ rtabmap::Transform transformFromPoseMsg(const geometry_msgs::Pose & msg, bool ig
 		}
 		return rtabmap::Transform();
 	}
-	Eigen::Affine3d tfPose;
-	tf::poseMsgToEigen(msg, tfPose);
-	return rtabmap::Transform::fromEigen3d(tfPose);
+	return transformFromRotation(msg.position.x, msg.position.y, msg.position.z,
+			Eigen::Quaterniond(msg.orientation.w, msg.orientation.x, msg.orientation.y, msg.orientation.z));
 }
 
 void toCvCopy(const rtabmap_ros::RGBDImage & image, cv_bridge::CvImagePtr & rgb, cv_bridge::CvImagePtr & depth)
@@ -283,36 +520,39 @@ void rgbdImageToROS(const rtabmap::SensorData & data, rtabmap_ros::RGBDImage & m
 	}
 }
 
-rtabmap::SensorData rgbdImageFromROS(const rtabmap_ros::RGBDImageConstPtr & image)
+rtabmap::SensorData rgbdImageFromROS(
+		const rtabmap_ros::RGBDImageConstPtr & image,
+		ImageIngestionPlan * imagePlanPtr,
+		ImageIngestionPlan * depthPlanPtr,
+		ImageIngestionPlan * rightPlanPtr)
 {
 	rtabmap::SensorData data;
 	cv_bridge::CvImageConstPtr imageMsg;
 	cv_bridge::CvImageConstPtr depthMsg;
 	toCvShare(image, imageMsg, depthMsg);
 
+	ImageIngestionPlan tmpImagePlan(ImageIngestionPlan::kTargetColor);
+	ImageIngestionPlan & imagePlan = imagePlanPtr?*imagePlanPtr:tmpImagePlan;
+
 	rtabmap::StereoCameraModel stereoModel = stereoCameraModelFromROS(image->rgb_camera_info, image->depth_camera_info, rtabmap::Transform::getIdentity());
 
 	if(stereoModel.isValidForProjection())
 	{
-		cv_bridge::CvImageConstPtr imageRectLeft = imageMsg;
-		cv_bridge::CvImageConstPtr imageRectRight = depthMsg;
-		if(!(imageRectLeft->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) ==0 ||
-			 imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO8) ==0 ||
-			 imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO16) ==0 ||
-			 imageRectLeft->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-			 imageRectLeft->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0) ||
-			!(imageRectRight->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) ==0 ||
-			  imageRectRight->encoding.compare(sensor_msgs::image_encodings::MONO8) ==0 ||
-			  imageRectRight->encoding.compare(sensor_msgs::image_encodings::MONO16) ==0 ||
-			  imageRectRight->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-			  imageRectRight->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0))
-		{
-			ROS_ERROR("Input type must be image=mono8,mono16,rgb8,bgr8 (mono8 recommended), received types are %s (left) and %s (right)",
-					imageRectLeft->encoding.c_str(), imageRectRight->encoding.c_str());
+		ImageIngestionPlan tmpRightPlan(ImageIngestionPlan::kTargetMono);
+		ImageIngestionPlan & rightPlan = rightPlanPtr?*rightPlanPtr:tmpRightPlan;
+		if(!imagePlan.update(imageMsg) ||
+		   !rightPlan.update(depthMsg) ||
+		   imagePlan.encoding() == ImageIngestionPlan::kBayerGrbg8 ||
+		   imagePlan.encoding() == ImageIngestionPlan::kBayerRggb8 ||
+		   rightPlan.encoding() == ImageIngestionPlan::kBayerGrbg8 ||
+		   rightPlan.encoding() == ImageIngestionPlan::kBayerRggb8)
+		{
+			ROS_ERROR("Input type must be image=mono8,mono16,rgb8,bgr8,bgra8,rgba8 (mono8 recommended), received types are %s (left) and %s (right)",
+					imageMsg->encoding.c_str(), depthMsg->encoding.c_str());
 			return data;
 		}
 
-		if(!imageRectLeft->image.empty() && !imageRectRight->image.empty())
+		if(!imageMsg->image.empty() && !depthMsg->image.empty())
 		{
 			if(stereoModel.baseline() > 10.0)
 			{
@@ -327,31 +567,16 @@ rtabmap::SensorData rgbdImageFromROS(const rtabmap_ros::RGBDImageConstPtr & imag
 				}
 			}
 
-			cv::Mat left, right;
-			if(imageRectLeft->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
-			   imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0)
+			cv::Mat left = imageMsg->image;
+			if(imagePlan.needsConversion())
 			{
-				left = imageRectLeft->image;
+				left = imagePlan.convertToBuffer(imageMsg->image);
 			}
-			else if(imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0)
+			cv::Mat right = depthMsg->image;
+			if(rightPlan.needsConversion())
 			{
-				left = cv_bridge::cvtColor(imageRectLeft, "mono8")->image;
+				right = rightPlan.convertToBuffer(depthMsg->image);
 			}
-			else
-			{
-				left = cv_bridge::cvtColor(imageRectLeft, "bgr8")->image;
-			}
-			if(imageRectRight->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
-			   imageRectRight->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0)
-			{
-				right = imageRectRight->image;
-			}
-			else
-			{
-				right = cv_bridge::cvtColor(imageRectRight, "mono8")->image;
-			}
-
-			//
 
 			data = rtabmap::SensorData(
 					left,
@@ -367,7 +592,6 @@ rtabmap::SensorData rgbdImageFromROS(const rtabmap_ros::RGBDImageConstPtr & imag
 	}
 	else //depth
 	{
-		ros::Time higherStamp;
 		int imageWidth = imageMsg->image.cols;
 		int imageHeight = imageMsg->image.rows;
 		int depthWidth = depthMsg->image.cols;
@@ -377,21 +601,9 @@ rtabmap::SensorData rgbdImageFromROS(const rtabmap_ros::RGBDImageConstPtr & imag
 			imageWidth/depthWidth == imageHeight/depthHeight,
 			uFormat("rgb=%dx%d depth=%dx%d", imageWidth, imageHeight, depthWidth, depthHeight).c_str());
 
-		cv::Mat rgb;
-		cv::Mat depth;
-		rtabmap::CameraModel cameraModels;
-
-		if(!(imageMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) ==0 ||
-			 imageMsg->encoding.compare(sensor_msgs::image_encodings::MONO8) ==0 ||
-			 imageMsg->encoding.compare(sensor_msgs::image_encodings::MONO16) ==0 ||
-			 imageMsg->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-			 imageMsg->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0 ||
-			 imageMsg->encoding.compare(sensor_msgs::image_encodings::BGRA8) == 0 ||
-			 imageMsg->encoding.compare(sensor_msgs::image_encodings::RGBA8) == 0 ||
-			 imageMsg->encoding.compare(sensor_msgs::image_encodings::BAYER_GRBG8) == 0) ||
-			!(depthMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_16UC1) == 0 ||
-			 depthMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_32FC1) == 0 ||
-			 depthMsg->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0))
+		ImageIngestionPlan tmpDepthPlan(ImageIngestionPlan::kTargetDepth);
+		ImageIngestionPlan & depthPlan = depthPlanPtr?*depthPlanPtr:tmpDepthPlan;
+		if(!imagePlan.update(imageMsg) || !depthPlan.update(depthMsg))
 		{
 			ROS_ERROR("Input type must be image=mono8,mono16,rgb8,bgr8,bgra8,rgba8 and "
 			"image_depth=32FC1,16UC1,mono16. Current rgb=%s and depth=%s",
@@ -400,26 +612,14 @@ rtabmap::SensorData rgbdImageFromROS(const rtabmap_ros::RGBDImageConstPtr & imag
 			return data;
 		}
 
-		cv_bridge::CvImageConstPtr ptrImage = imageMsg;
-		if(imageMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1)==0 ||
-			imageMsg->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0 ||
-			imageMsg->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0)
-		{
-			// do nothing
-		}
-		else if(imageMsg->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0)
+		cv::Mat rgb = imageMsg->image;
+		if(imagePlan.needsConversion())
 		{
-			ptrImage = cv_bridge::cvtColor(imageMsg, "mono8");
+			rgb = imagePlan.convertToBuffer(imageMsg->image);
 		}
-		else
-		{
-			ptrImage = cv_bridge::cvtColor(imageMsg, "bgr8");
-		}
-
-		cv_bridge::CvImageConstPtr ptrDepth = depthMsg;
 		data = rtabmap::SensorData(
-				ptrImage->image,
-				ptrDepth->image,
+				rgb,
+				depthMsg->image,
 				rtabmap_ros::cameraModelFromROS(image->rgb_camera_info),
 				0,
 				rtabmap_ros::timestampFromROS(image->header.stamp));
@@ -428,6 +628,53 @@ rtabmap::SensorData rgbdImageFromROS(const rtabmap_ros::RGBDImageConstPtr & imag
 	return data;
 }
 
+bool isJpegCompressedImage(const sensor_msgs::CompressedImage & image)
+{
+	std::string format = uToLowerCase(image.format);
+	if(format.compare("jpg") != 0 &&
+	   format.compare("jpeg") != 0 &&
+	   format.find("jpeg compressed") == std::string::npos)
+	{
+		return false;
+	}
+	// JPEG SOI marker
+	return image.data.size() > 2 && image.data[0] == 0xFF && image.data[1] == 0xD8;
+}
+
+bool canForwardCompressedImage(const sensor_msgs::CompressedImage & image, int decimation)
+{
+	return decimation<=1 && isJpegCompressedImage(image);
+}
+
+bool rgbCompressedToROS(
+		const sensor_msgs::CompressedImageConstPtr & input,
+		const cv_bridge::CvImage & image,
+		int decimation,
+		sensor_msgs::CompressedImage & output)
+{
+	if(input.get() && canForwardCompressedImage(*input, decimation))
+	{
+		// same codec, forward the compressed data unchanged
+		output = *input;
+		return true;
+	}
+	UASSERT(!image.image.empty());
+	image.toCompressedImageMsg(output, cv_bridge::JPG);
+	return false;
+}
+
+bool canRelayRGBDImage(const rtabmap_ros::RGBDImage & image, bool compress, bool uncompress)
+{
+	if(!compress && !uncompress)
+	{
+		return true;
+	}
+	bool hasRaw = !image.rgb.data.empty() || !image.depth.data.empty();
+	bool hasCompressed = !image.rgb_compressed.data.empty() || !image.depth_compressed.data.empty();
+	return (compress && !uncompress && !hasRaw) ||
+		   (uncompress && !compress && !hasCompressed);
+}
+
 void compressedMatToBytes(const cv::Mat & compressed, std::vector<unsigned char> & bytes)
 {
 	UASSERT(compressed.empty() || compressed.type() == CV_8UC1);
@@ -560,7 +807,7 @@ void linkToROS(const rtabmap::Link & link, rtabmap_ros::Link & msg)
 	msg.fromId = link.from();
 	msg.toId = link.to();
 	msg.type = link.type();
-	if(link.infMatrix().type() == CV_64FC1 && link.infMatrix().cols == 6 && link.infMatrix().rows == 6)
+	if(link.infMatrix().type() == CV_64FC1 && link.infMatrix().cols == 6 && link.infMatrix().rows == 6 && link.infMatrix().isContinuous())
 	{
 		memcpy(msg.information.data(), link.infMatrix().data, 36*sizeof(double));
 	}
@@ -964,6 +1211,166 @@ rtabmap::StereoCameraModel stereoCameraModelFromROS(
 	return stereoCameraModelFromROS(leftCamInfo, rightCamInfo, localTransform, stereoTransform);
 }
 
+size_t StereoCameraModelCache::key(
+		const sensor_msgs::CameraInfo & leftCamInfo,
+		const sensor_msgs::CameraInfo & rightCamInfo,
+		bool alreadyRectified,
+		const rtabmap::Transform & stereoTransform)
+{
+	size_t seed = alreadyRectified?1:0;
+	if(!stereoTransform.isNull())
+	{
+		boost::hash_range(seed, stereoTransform.data(), stereoTransform.data()+12);
+	}
+	const sensor_msgs::CameraInfo * infos[2] = {&leftCamInfo, &rightCamInfo};
+	for(int i=0; i<2; ++i)
+	{
+		boost::hash_combine(seed, infos[i]->header.frame_id);
+		boost::hash_combine(seed, infos[i]->width);
+		boost::hash_combine(seed, infos[i]->height);
+		boost::hash_combine(seed, infos[i]->distortion_model);
+		boost::hash_range(seed, infos[i]->D.begin(), infos[i]->D.end());
+		boost::hash_range(seed, infos[i]->K.begin(), infos[i]->K.end());
+		boost::hash_range(seed, infos[i]->R.begin(), infos[i]->R.end());
+		boost::hash_range(seed, infos[i]->P.begin(), infos[i]->P.end());
+	}
+	return seed;
+}
+
+bool StereoCameraModelCache::get(size_t key, const rtabmap::Transform & localTransform, rtabmap::StereoCameraModel & model) const
+{
+	if(key_ == 0 || key != key_)
+	{
+		return false;
+	}
+	// shallow copy, the rectification maps are shared
+	model = model_;
+	model.setLocalTransform(localTransform);
+	return true;
+}
+
+void StereoCameraModelCache::set(size_t key, const rtabmap::StereoCameraModel & model, bool initRectification)
+{
+	model_ = model;
+	for(int i=0; i<2; ++i)
+	{
+		rectificationMaps_[i][0] = cv::Mat();
+		rectificationMaps_[i][1] = cv::Mat();
+	}
+	if(initRectification && model_.isValidForRectification())
+	{
+		model_.initRectificationMap();
+		// fixed-point maps, faster to remap than the float maps of the model
+		const rtabmap::CameraModel * cameras[2] = {&model_.left(), &model_.right()};
+		for(int i=0; i<2; ++i)
+		{
+			cv::initUndistortRectifyMap(
+					cameras[i]->K_raw(),
+					cameras[i]->D_raw(),
+					cameras[i]->R(),
+					cameras[i]->P(),
+					cameras[i]->imageSize(),
+					CV_16SC2,
+					rectificationMaps_[i][0],
+					rectificationMaps_[i][1]);
+		}
+	}
+	key_ = key;
+}
+
+rtabmap::Transform StereoCameraModelCache::stereoTransform(
+		const std::string & fromFrameId,
+		const std::string & toFrameId,
+		const ros::Time & stamp,
+		tf::TransformListener & listener,
+		double waitForTransform,
+		double refreshPeriod)
+{
+	std::string frames = fromFrameId + " " + toFrameId;
+	if(stereoTransform_.isNull() ||
+	   frames.compare(stereoFrames_) != 0 ||
+	   stamp < stereoTransformStamp_ ||
+	   (stamp - stereoTransformStamp_).toSec() > refreshPeriod)
+	{
+		rtabmap::Transform transform = getTransform(fromFrameId, toFrameId, stamp, listener, waitForTransform);
+		if(transform.isNull())
+		{
+			return transform;
+		}
+		stereoTransform_ = transform;
+		stereoFrames_ = frames;
+		stereoTransformStamp_ = stamp;
+	}
+	return stereoTransform_;
+}
+
+namespace {
+class StereoRemap : public cv::ParallelLoopBody
+{
+public:
+	StereoRemap(const cv::Mat * images, const cv::Mat (*maps)[2], cv::Mat * rectified, int stripes) :
+		images_(images),
+		maps_(maps),
+		rectified_(rectified),
+		stripes_(stripes)
+	{}
+
+	virtual void operator()(const cv::Range & range) const
+	{
+		for(int i=range.start; i<range.end; ++i)
+		{
+			int camera = i / stripes_;
+			int stripe = i % stripes_;
+			const cv::Mat & dst = rectified_[camera];
+			int y0 = dst.rows*stripe/stripes_;
+			int y1 = dst.rows*(stripe+1)/stripes_;
+			cv::Rect roi(0, y0, dst.cols, y1-y0);
+			cv::Mat dstStripe(dst, roi);
+			cv::remap(images_[camera], dstStripe, maps_[camera][0](roi), maps_[camera][1](roi), cv::INTER_LINEAR);
+		}
+	}
+
+private:
+	const cv::Mat * images_;
+	const cv::Mat (*maps_)[2];
+	cv::Mat * rectified_;
+	int stripes_;
+};
+}
+
+bool StereoCameraModelCache::rectify(cv::Mat & left, cv::Mat & right)
+{
+	if(rectificationMaps_[0][0].empty() ||
+	   rectificationMaps_[1][0].empty() ||
+	   left.size() != rectificationMaps_[0][0].size() ||
+	   right.size() != rectificationMaps_[1][0].size())
+	{
+		return false;
+	}
+	cv::Mat images[2] = {left, right};
+	for(int i=0; i<2; ++i)
+	{
+		ImageIngestionPlan::reuseBuffer(rectified_[i], images[i].rows, images[i].cols, images[i].type());
+	}
+	int stripes = 4;
+	cv::parallel_for_(cv::Range(0, 2*stripes), StereoRemap(images, rectificationMaps_, rectified_, stripes));
+	left = rectified_[0];
+	right = rectified_[1];
+	return true;
+}
+
+rtabmap::StereoCameraModel StereoCameraModelCache::rectifiedModel(const rtabmap::Transform & localTransform) const
+{
+	return rtabmap::StereoCameraModel(
+			model_.left().fx(),
+			model_.left().fy(),
+			model_.left().cx(),
+			model_.left().cy(),
+			model_.baseline(),
+			localTransform,
+			model_.left().imageSize());
+}
+
 void mapDataFromROS(
 		const rtabmap_ros::MapData & msg,
 		std::map<int, rtabmap::Transform> & poses,
@@ -977,7 +1384,7 @@ void mapDataFromROS(
 	//Data
 	for(unsigned int i=0; i<msg.nodes.size(); ++i)
 	{
-		signatures.insert(std::make_pair(msg.nodes[i].id, nodeDataFromROS(msg.nodes[i])));
+		signatures.insert(signatures.end(), std::make_pair(msg.nodes[i].id, nodeDataFromROS(msg.nodes[i])));
 	}
 }
 void mapDataToROS(
@@ -1001,6 +1408,51 @@ void mapDataToROS(
 	}
 }
 
+void posesToROS(const std::map<int, rtabmap::Transform> & poses, std::vector<int> & ids, std::vector<geometry_msgs::Pose> & msgs)
+{
+	ids.resize(poses.size());
+	msgs.resize(poses.size());
+	int index = 0;
+	for(std::map<int, rtabmap::Transform>::const_iterator iter = poses.begin();
+		iter != poses.end();
+		++iter, ++index)
+	{
+		ids[index] = iter->first;
+		transformToPoseMsg(iter->second, msgs[index]);
+	}
+}
+
+void posesFromROS(const std::vector<int> & ids, const std::vector<geometry_msgs::Pose> & msgs, std::map<int, rtabmap::Transform> & poses)
+{
+	UASSERT(ids.size() == msgs.size());
+	for(unsigned int i=0; i<ids.size(); ++i)
+	{
+		// ids are sorted when coming from posesToROS()
+		poses.insert(poses.end(), std::make_pair(ids[i], transformFromPoseMsg(msgs[i])));
+	}
+}
+
+void linksToROS(const std::multimap<int, rtabmap::Link> & links, std::vector<rtabmap_ros::Link> & msgs)
+{
+	msgs.resize(links.size());
+	int index = 0;
+	for(std::multimap<int, rtabmap::Link>::const_iterator iter = links.begin();
+		iter!=links.end();
+		++iter, ++index)
+	{
+		linkToROS(iter->second, msgs[index]);
+	}
+}
+
+void linksFromROS(const std::vector<rtabmap_ros::Link> & msgs, std::multimap<int, rtabmap::Link> & links)
+{
+	for(unsigned int i=0; i<msgs.size(); ++i)
+	{
+		// links are sorted by fromId when coming from linksToROS()
+		links.insert(links.end(), std::make_pair(msgs[i].fromId, linkFromROS(msgs[i])));
+	}
+}
+
 void mapGraphFromROS(
 		const rtabmap_ros::MapGraph & msg,
 		std::map<int, rtabmap::Transform> & poses,
@@ -1009,15 +1461,8 @@ void mapGraphFromROS(
 {
 	//optimized graph
 	UASSERT(msg.posesId.size() == msg.poses.size());
-	for(unsigned int i=0; i<msg.posesId.size(); ++i)
-	{
-		poses.insert(std::make_pair(msg.posesId[i], rtabmap_ros::transformFromPoseMsg(msg.poses[i])));
-	}
-	for(unsigned int i=0; i<msg.links.size(); ++i)
-	{
-		rtabmap::Transform t = rtabmap_ros::transformFromGeometryMsg(msg.links[i].transform);
-		links.insert(std::make_pair(msg.links[i].fromId, linkFromROS(msg.links[i])));
-	}
+	posesFromROS(msg.posesId, msg.poses, poses);
+	linksFromROS(msg.links, links);
 	mapToOdom = transformFromGeometryMsg(msg.mapToOdom);
 }
 void mapGraphToROS(
@@ -1027,27 +1472,8 @@ void mapGraphToROS(
 		rtabmap_ros::MapGraph & msg)
 {
 	//Optimized graph
-	msg.posesId.resize(poses.size());
-	msg.poses.resize(poses.size());
-	int index = 0;
-	for(std::map<int, rtabmap::Transform>::const_iterator iter = poses.begin();
-		iter != poses.end();
-		++iter)
-	{
-		msg.posesId[index] = iter->first;
-		transformToPoseMsg(iter->second, msg.poses[index]);
-		++index;
-	}
-
-	msg.links.resize(links.size());
-	index=0;
-	for(std::multimap<int, rtabmap::Link>::const_iterator iter = links.begin();
-		iter!=links.end();
-		++iter)
-	{
-		linkToROS(iter->second, msg.links[index++]);
-	}
-
+	posesToROS(poses, msg.posesId, msg.poses);
+	linksToROS(links, msg.links);
 	transformToGeometryMsg(mapToOdom, msg.mapToOdom);
 }
 
@@ -1330,6 +1756,62 @@ void nodeInfoToROS(const rtabmap::Signature & signature, rtabmap_ros::NodeData &
 	transformToPoseMsg(signature.getGroundTruthPose(), msg.groundTruthPose);
 }
 
+bool uncompressRGBDDecimated(
+		const rtabmap::SensorData & data,
+		int decimation,
+		cv::Mat & image,
+		cv::Mat & depth,
+		std::vector<rtabmap::CameraModel> & cameraModels,
+		int & remainingDecimation)
+{
+	int reduction = decimation>0 && decimation%8==0?8:decimation>0 && decimation%4==0?4:decimation>0 && decimation%2==0?2:1;
+	if(reduction == 1 ||
+	   data.imageCompressed().empty() ||
+	   data.depthOrRightCompressed().empty() ||
+	   data.cameraModels().empty())
+	{
+		return false;
+	}
+
+	// Reduced decoding is only exact if all cameras are divisible by the reduction
+	int fullWidth = 0;
+	for(unsigned int i=0; i<data.cameraModels().size(); ++i)
+	{
+		const cv::Size & size = data.cameraModels()[i].imageSize();
+		if(size.width == 0 || size.width % reduction != 0 || size.height % reduction != 0)
+		{
+			return false;
+		}
+		fullWidth += size.width;
+	}
+
+	cv::Mat reducedImage = cv::imdecode(data.imageCompressed(),
+			reduction==8?cv::IMREAD_REDUCED_COLOR_8:
+			reduction==4?cv::IMREAD_REDUCED_COLOR_4:
+			cv::IMREAD_REDUCED_COLOR_2);
+	if(reducedImage.empty() || reducedImage.cols*reduction != fullWidth)
+	{
+		return false;
+	}
+
+	cv::Mat fullDepth = rtabmap::uncompressImage(data.depthOrRightCompressed());
+	if(fullDepth.cols != fullWidth || fullDepth.rows != reducedImage.rows*reduction)
+	{
+		// registered depth with a different resolution than the image
+		return false;
+	}
+
+	image = reducedImage;
+	depth = rtabmap::util2d::decimate(fullDepth, reduction);
+	cameraModels.resize(data.cameraModels().size());
+	for(unsigned int i=0; i<data.cameraModels().size(); ++i)
+	{
+		cameraModels[i] = data.cameraModels()[i].scaled(1.0/double(reduction));
+	}
+	remainingDecimation = decimation/reduction;
+	return true;
+}
+
 std::map<std::string, float> odomInfoToStatistics(const rtabmap::OdometryInfo & info)
 {
 	std::map<std::string, float> stats;
@@ -1618,13 +2100,36 @@ rtabmap::Landmarks landmarksFromROS(
 		const std::string & frameId,
 		const std::string & odomFrameId,
 		const ros::Time & odomStamp,
-		tf::TransformListener & listener,
+		tf::Transformer & listener,
 		double waitForTransform,
 		double defaultLinVariance,
 		double defaultAngVariance)
+{
+	return landmarksFromROS(
+			tags,
+			frameId,
+			boost::bind(static_cast<rtabmap::Transform(*)(const std::string &, const std::string &, const ros::Time &, tf::Transformer &, double)>(&getTransform),
+					frameId, _1, _2, boost::ref(listener), waitForTransform),
+			boost::bind(static_cast<rtabmap::Transform(*)(const std::string &, const std::string &, const ros::Time &, const ros::Time &, tf::Transformer &, double)>(&getTransform),
+					frameId, odomFrameId, _1, odomStamp, boost::ref(listener), waitForTransform),
+			defaultLinVariance,
+			defaultAngVariance);
+}
+
+rtabmap::Landmarks landmarksFromROS(
+		const std::map<int, std::pair<geometry_msgs::PoseWithCovarianceStamped, float> > & tags,
+		const std::string & frameId,
+		const boost::function<rtabmap::Transform(const std::string &, const ros::Time &)> & baseToCameraLookup,
+		const boost::function<rtabmap::Transform(const ros::Time &)> & correctionLookup,
+		double defaultLinVariance,
+		double defaultAngVariance)
 {
 	//tag detections
 	rtabmap::Landmarks landmarks;
+	// detections of the same message share frame and stamp, look up TF only once per frame/stamp
+	std::map<std::pair<std::string, ros::Time>, rtabmap::Transform> baseToCameras;
+	std::map<ros::Time, rtabmap::Transform> corrections;
+	cv::Mat defaultCovariance;
 	for(std::map<int, std::pair<geometry_msgs::PoseWithCovarianceStamped, float> >::const_iterator iter=tags.begin(); iter!=tags.end(); ++iter)
 	{
 		if(iter->first <=0)
@@ -1632,12 +2137,15 @@ rtabmap::Landmarks landmarksFromROS(
 			ROS_ERROR("Invalid landmark received! IDs should be > 0 (it is %d). Ignoring this landmark.", iter->first);
 			continue;
 		}
-		rtabmap::Transform baseToCamera = rtabmap_ros::getTransform(
-				frameId,
-				iter->second.first.header.frame_id,
-				iter->second.first.header.stamp,
-				listener,
-				waitForTransform);
+		std::pair<std::string, ros::Time> cameraKey(iter->second.first.header.frame_id, iter->second.first.header.stamp);
+		std::map<std::pair<std::string, ros::Time>, rtabmap::Transform>::iterator cameraIter = baseToCameras.find(cameraKey);
+		if(cameraIter == baseToCameras.end())
+		{
+			cameraIter = baseToCameras.insert(std::make_pair(cameraKey, baseToCameraLookup(
+					iter->second.first.header.frame_id,
+					iter->second.first.header.stamp))).first;
+		}
+		const rtabmap::Transform & baseToCamera = cameraIter->second;
 
 		if(baseToCamera.isNull())
 		{
@@ -1651,18 +2159,19 @@ rtabmap::Landmarks landmarksFromROS(
 		if(!baseToTag.isNull())
 		{
 			// Correction of the global pose accounting the odometry movement since we received it
-			rtabmap::Transform correction = rtabmap_ros::getTransform(
-					frameId,
-					odomFrameId,
-					iter->second.first.header.stamp,
-					odomStamp,
-					listener,
-					waitForTransform);
+			std::map<ros::Time, rtabmap::Transform>::iterator correctionIter = corrections.find(iter->second.first.header.stamp);
+			bool newCorrection = correctionIter == corrections.end();
+			if(newCorrection)
+			{
+				correctionIter = corrections.insert(std::make_pair(iter->second.first.header.stamp, correctionLookup(
+						iter->second.first.header.stamp))).first;
+			}
+			const rtabmap::Transform & correction = correctionIter->second;
 			if(!correction.isNull())
 			{
 				baseToTag = correction * baseToTag;
 			}
-			else
+			else if(newCorrection)
 			{
 				ROS_WARN("Could not adjust tag pose accordingly to latest odometry pose. "
 						"If odometry is small since it received the tag pose and "
@@ -1671,9 +2180,13 @@ rtabmap::Landmarks landmarksFromROS(
 			cv::Mat covariance = cv::Mat(6,6, CV_64FC1, (void*)iter->second.first.pose.covariance.data()).clone();
 			if(covariance.empty() || !uIsFinite(covariance.at<double>(0,0)) || covariance.at<double>(0,0)<=0.0f)
 			{
-				covariance = cv::Mat::eye(6,6,CV_64FC1);
-				covariance(cv::Range(0,3), cv::Range(0,3)) *= defaultLinVariance;
-				covariance(cv::Range(3,6), cv::Range(3,6)) *= defaultAngVariance;
+				if(defaultCovariance.empty())
+				{
+					defaultCovariance = cv::Mat::eye(6,6,CV_64FC1);
+					defaultCovariance(cv::Range(0,3), cv::Range(0,3)) *= defaultLinVariance;
+					defaultCovariance(cv::Range(3,6), cv::Range(3,6)) *= defaultAngVariance;
+				}
+				covariance = defaultCovariance.clone();
 			}
 			landmarks.insert(std::make_pair(iter->first, rtabmap::Landmark(iter->first, iter->second.second, baseToTag, covariance)));
 		}
@@ -1685,7 +2198,7 @@ rtabmap::Transform getTransform(
 		const std::string & fromFrameId,
 		const std::string & toFrameId,
 		const ros::Time & stamp,
-		tf::TransformListener & listener,
+		tf::Transformer & listener,
 		double waitForTransform)
 {
 	// TF ready?
@@ -1722,7 +2235,7 @@ rtabmap::Transform getTransform(
 		const std::string & fixedFrame,
 		const ros::Time & stampSource,
 		const ros::Time & stampTarget,
-		tf::TransformListener & listener,
+		tf::Transformer & listener,
 		double waitForTransform)
 {
 	// TF ready?
@@ -1769,7 +2282,9 @@ bool convertRGBDMsgs(
 		const std::vector<cv::Mat> & localDescriptorsMsgs,
 		std::vector<cv::KeyPoint> * localKeyPoints,
 		std::vector<cv::Point3f> * localPoints3d,
-		cv::Mat * localDescriptors)
+		cv::Mat * localDescriptors,
+		std::vector<ImageIngestionPlan> * imagePlans,
+		std::vector<ImageIngestionPlan> * depthPlans)
 {
 	UASSERT(!cameraInfoMsgs.empty()>0 &&
 			(cameraInfoMsgs.size() == imageMsgs.size() || imageMsgs.empty()) &&
@@ -1788,19 +2303,25 @@ bool convertRGBDMsgs(
 	}
 
 	int cameraCount = cameraInfoMsgs.size();
+	std::vector<ImageIngestionPlan> tmpImagePlans;
+	std::vector<ImageIngestionPlan> tmpDepthPlans;
+	std::vector<ImageIngestionPlan> & imagePlansRef = imagePlans?*imagePlans:tmpImagePlans;
+	std::vector<ImageIngestionPlan> & depthPlansRef = depthPlans?*depthPlans:tmpDepthPlans;
+	if((int)imagePlansRef.size() != cameraCount)
+	{
+		imagePlansRef = std::vector<ImageIngestionPlan>(cameraCount, ImageIngestionPlan(ImageIngestionPlan::kTargetColor));
+	}
+	if((int)depthPlansRef.size() != cameraCount)
+	{
+		depthPlansRef = std::vector<ImageIngestionPlan>(cameraCount, ImageIngestionPlan(ImageIngestionPlan::kTargetDepth));
+	}
 	for(unsigned int i=0; i<cameraInfoMsgs.size(); ++i)
 	{
+		ImageIngestionPlan & imagePlan = imagePlansRef[i];
+		ImageIngestionPlan & depthPlan = depthPlansRef[i];
 		if(!imageMsgs.empty())
 		{
-			if(!(imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::MONO8) ==0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::MONO16) ==0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::BGRA8) == 0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::RGBA8) == 0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::BAYER_GRBG8) == 0 ||
-				 imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::BAYER_RGGB8) == 0))
+			if(!imagePlan.update(imageMsgs[i]))
 			{
 
 				ROS_ERROR("Input rgb type must be image=mono8,mono16,rgb8,bgr8,bgra8,rgba8. Current rgb=%s",
@@ -1815,10 +2336,7 @@ bool convertRGBDMsgs(
 								imageHeight,
 								imageMsgs[i]->image.rows).c_str());
 		}
-		 if(!depthMsgs.empty() &&
-			 !(depthMsgs[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_16UC1) == 0 ||
-			   depthMsgs[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_32FC1) == 0 ||
-			   depthMsgs[i]->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0))
+		if(!depthMsgs.empty() && !depthPlan.update(depthMsgs[i]))
 		{
 			ROS_ERROR("Input depth type must be image_depth=32FC1,16UC1,mono16. Current depth=%s",
 					depthMsgs[i]->encoding.c_str());
@@ -1877,30 +2395,17 @@ bool convertRGBDMsgs(
 
 		if(!imageMsgs.empty())
 		{
-			cv_bridge::CvImageConstPtr ptrImage = imageMsgs[i];
-			if(imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1)==0 ||
-			   imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0 ||
-			   imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0)
-			{
-				// do nothing
-			}
-			else if(imageMsgs[i]->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0)
-			{
-				ptrImage = cv_bridge::cvtColor(imageMsgs[i], "mono8");
-			}
-			else
-			{
-				ptrImage = cv_bridge::cvtColor(imageMsgs[i], "bgr8");
-			}
-
-			// initialize
+			// initialize, the mosaic is kept in the plan of the first camera
 			if(rgb.empty())
 			{
-				rgb = cv::Mat(imageHeight, imageWidth*cameraCount, ptrImage->image.type());
+				ImageIngestionPlan::reuseBuffer(imagePlansRef[0].buffer(), imageHeight, imageWidth*cameraCount, imagePlan.outputType());
+				rgb = imagePlansRef[0].buffer();
 			}
-			if(ptrImage->image.type() == rgb.type())
+			if(imagePlan.outputType() == rgb.type())
 			{
-				ptrImage->image.copyTo(cv::Mat(rgb, cv::Rect(i*imageWidth, 0, imageWidth, imageHeight)));
+				// converted directly in the output image
+				cv::Mat subImage(rgb, cv::Rect(i*imageWidth, 0, imageWidth, imageHeight));
+				imagePlan.convert(imageMsgs[i]->image, subImage);
 			}
 			else
 			{
@@ -1911,17 +2416,16 @@ bool convertRGBDMsgs(
 
 		if(!depthMsgs.empty())
 		{
-			cv_bridge::CvImageConstPtr ptrDepth = depthMsgs[i];
-			cv::Mat subDepth = ptrDepth->image;
-
 			if(depth.empty())
 			{
-				depth = cv::Mat(depthHeight, depthWidth*cameraCount, subDepth.type());
+				ImageIngestionPlan::reuseBuffer(depthPlansRef[0].buffer(), depthHeight, depthWidth*cameraCount, depthPlan.outputType());
+				depth = depthPlansRef[0].buffer();
 			}
 
-			if(subDepth.type() == depth.type())
+			if(depthPlan.outputType() == depth.type())
 			{
-				subDepth.copyTo(cv::Mat(depth, cv::Rect(i*depthWidth, 0, depthWidth, depthHeight)));
+				cv::Mat subDepth(depth, cv::Rect(i*depthWidth, 0, depthWidth, depthHeight));
+				depthPlan.convert(depthMsgs[i]->image, subDepth);
 			}
 			else
 			{
@@ -1962,24 +2466,23 @@ bool convertStereoMsg(
 		rtabmap::StereoCameraModel & stereoModel,
 		tf::TransformListener & listener,
 		double waitForTransform,
-		bool alreadyRectified)
+		bool alreadyRectified,
+		StereoCameraModelCache * stereoModelCache,
+		ImageIngestionPlan * leftPlanPtr,
+		ImageIngestionPlan * rightPlanPtr)
 {
 	UASSERT(leftImageMsg.get() && rightImageMsg.get());
 
-	if(!(leftImageMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
-		leftImageMsg->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0 ||
-		leftImageMsg->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0 ||
-		leftImageMsg->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-		leftImageMsg->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0 || 
-		leftImageMsg->encoding.compare(sensor_msgs::image_encodings::BGRA8) == 0 ||
-		leftImageMsg->encoding.compare(sensor_msgs::image_encodings::RGBA8) == 0) ||
-		!(rightImageMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
-		rightImageMsg->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0 ||
-		rightImageMsg->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0 ||
-		rightImageMsg->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-		rightImageMsg->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0 || 
-		rightImageMsg->encoding.compare(sensor_msgs::image_encodings::BGRA8) == 0 ||
-		rightImageMsg->encoding.compare(sensor_msgs::image_encodings::RGBA8) == 0))
+	ImageIngestionPlan tmpLeftPlan(ImageIngestionPlan::kTargetColor);
+	ImageIngestionPlan tmpRightPlan(ImageIngestionPlan::kTargetMono);
+	ImageIngestionPlan & leftPlan = leftPlanPtr?*leftPlanPtr:tmpLeftPlan;
+	ImageIngestionPlan & rightPlan = rightPlanPtr?*rightPlanPtr:tmpRightPlan;
+	if(!leftPlan.update(leftImageMsg) ||
+	   !rightPlan.update(rightImageMsg) ||
+	   leftPlan.encoding() == ImageIngestionPlan::kBayerGrbg8 ||
+	   leftPlan.encoding() == ImageIngestionPlan::kBayerRggb8 ||
+	   rightPlan.encoding() == ImageIngestionPlan::kBayerGrbg8 ||
+	   rightPlan.encoding() == ImageIngestionPlan::kBayerRggb8)
 	{
 		ROS_ERROR("Input type must be image=mono8,mono16,rgb8,bgr8,bgra8,rgba8");
 		ROS_ERROR("Input type must be image=mono8,mono16,rgb8,bgr8,bgra8,rgba8 Current left=%s and right=%s",
@@ -1988,27 +2491,21 @@ bool convertStereoMsg(
 		return false;
 	}
 
-	if(leftImageMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
-	   leftImageMsg->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0)
-	{
-		left = leftImageMsg->image;
-	}
-	else if(leftImageMsg->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0)
+	if(leftPlan.needsConversion() || leftPlan.encoding() != ImageIngestionPlan::kMono8)
 	{
-		left = cv_bridge::cvtColor(leftImageMsg, "mono8")->image;
+		left = leftPlan.convertToBuffer(leftImageMsg->image);
 	}
 	else
 	{
-		left = cv_bridge::cvtColor(leftImageMsg, "bgr8")->image;
+		left = leftImageMsg->image;
 	}
-	if(rightImageMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) == 0 ||
-	   rightImageMsg->encoding.compare(sensor_msgs::image_encodings::MONO8) == 0)
+	if(rightPlan.needsConversion())
 	{
-		right = rightImageMsg->image;
+		right = rightPlan.convertToBuffer(rightImageMsg->image);
 	}
 	else
 	{
-		right = cv_bridge::cvtColor(rightImageMsg, "mono8")->image;
+		right = rightImageMsg->image;
 	}
 
 	rtabmap::Transform localTransform = getTransform(frameId, leftImageMsg->header.frame_id, leftImageMsg->header.stamp, listener, waitForTransform);
@@ -2037,72 +2534,119 @@ bool convertStereoMsg(
 		}
 	}
 
+	// The transform between the cameras is needed only by some models. With
+	// a cache, it is looked up again only after a while so that the cached
+	// model still follows a change of the stereo TF.
 	rtabmap::Transform stereoTransform;
 	if(!alreadyRectified)
 	{
-		stereoTransform = getTransform(
-				rightCamInfoMsg.header.frame_id,
-				leftCamInfoMsg.header.frame_id,
-				leftCamInfoMsg.header.stamp,
-				listener,
-				waitForTransform);
+		if(stereoModelCache)
+		{
+			stereoTransform = stereoModelCache->stereoTransform(
+					rightCamInfoMsg.header.frame_id,
+					leftCamInfoMsg.header.frame_id,
+					leftCamInfoMsg.header.stamp,
+					listener,
+					waitForTransform);
+		}
+		else
+		{
+			stereoTransform = getTransform(
+					rightCamInfoMsg.header.frame_id,
+					leftCamInfoMsg.header.frame_id,
+					leftCamInfoMsg.header.stamp,
+					listener,
+					waitForTransform);
+		}
 		if(stereoTransform.isNull())
 		{
 			ROS_ERROR("Parameter %s is false but we cannot get TF between the two cameras!", rtabmap::Parameters::kRtabmapImagesAlreadyRectified().c_str());
 			return false;
 		}
 	}
-
-	stereoModel = rtabmap_ros::stereoCameraModelFromROS(leftCamInfoMsg, rightCamInfoMsg, localTransform, stereoTransform);
-
-	if(stereoModel.baseline() > 10.0)
+	else if(rightCamInfoMsg.P[3] == 0.0)
 	{
-		static bool shown = false;
-		if(!shown)
+		// baseline not set in the right camera info, fallback on TF
+		if(stereoModelCache)
+		{
+			stereoTransform = stereoModelCache->stereoTransform(
+					leftCamInfoMsg.header.frame_id,
+					rightCamInfoMsg.header.frame_id,
+					leftCamInfoMsg.header.stamp,
+					listener,
+					waitForTransform);
+		}
+		else
 		{
-			ROS_WARN("Detected baseline (%f m) is quite large! Is your "
-					 "right camera_info P(0,3) correctly set? Note that "
-					 "baseline=-P(0,3)/P(0,0). You may need to calibrate your camera. "
-					 "This warning is printed only once.",
-					 stereoModel.baseline());
-			shown = true;
+			stereoTransform = getTransform(
+					leftCamInfoMsg.header.frame_id,
+					rightCamInfoMsg.header.frame_id,
+					leftCamInfoMsg.header.stamp,
+					listener,
+					waitForTransform);
 		}
 	}
-	else if(stereoModel.baseline() == 0 && alreadyRectified)
+
+	size_t calibrationKey = stereoModelCache?StereoCameraModelCache::key(leftCamInfoMsg, rightCamInfoMsg, alreadyRectified, stereoTransform):0;
+	if(stereoModelCache == 0 || !stereoModelCache->get(calibrationKey, localTransform, stereoModel))
 	{
-		rtabmap::Transform stereoTransform = getTransform(
-				leftCamInfoMsg.header.frame_id,
-				rightCamInfoMsg.header.frame_id,
-				leftCamInfoMsg.header.stamp,
-				listener,
-				waitForTransform);
-		if(stereoTransform.isNull() || stereoTransform.x()<=0)
+		stereoModel = rtabmap_ros::stereoCameraModelFromROS(leftCamInfoMsg, rightCamInfoMsg, localTransform, alreadyRectified?rtabmap::Transform():stereoTransform);
+
+		if(stereoModel.baseline() > 10.0)
 		{
-			ROS_WARN("We cannot estimated the baseline of the rectified images with tf! (%s->%s = %s)",
-					rightCamInfoMsg.header.frame_id.c_str(), leftCamInfoMsg.header.frame_id.c_str(), stereoTransform.prettyPrint().c_str());
+			static bool shown = false;
+			if(!shown)
+			{
+				ROS_WARN("Detected baseline (%f m) is quite large! Is your "
+						 "right camera_info P(0,3) correctly set? Note that "
+						 "baseline=-P(0,3)/P(0,0). You may need to calibrate your camera. "
+						 "This warning is printed only once.",
+						 stereoModel.baseline());
+				shown = true;
+			}
 		}
-		else
+		else if(stereoModel.baseline() == 0 && alreadyRectified)
 		{
-			static bool warned = false;
-			if(!warned)
+			if(stereoTransform.isNull() || stereoTransform.x()<=0)
 			{
-				ROS_WARN("Right camera info doesn't have Tx set but we are assuming that stereo images are already rectified (see %s parameter). While not "
-						"recommended, we used TF to get the baseline (%s->%s = %fm) for convenience (e.g., D400 ir stereo issue). It is preferred to feed "
-						"a valid right camera info if stereo images are already rectified. This message is only printed once...",
-						rtabmap::Parameters::kRtabmapImagesAlreadyRectified().c_str(),
-						rightCamInfoMsg.header.frame_id.c_str(), leftCamInfoMsg.header.frame_id.c_str(), stereoTransform.x());
-				warned = true;
+				ROS_WARN("We cannot estimated the baseline of the rectified images with tf! (%s->%s = %s)",
+						rightCamInfoMsg.header.frame_id.c_str(), leftCamInfoMsg.header.frame_id.c_str(), stereoTransform.prettyPrint().c_str());
 			}
-			stereoModel = rtabmap::StereoCameraModel(
-					stereoModel.left().fx(),
-					stereoModel.left().fy(),
-					stereoModel.left().cx(),
-					stereoModel.left().cy(),
-					stereoTransform.x(),
-					stereoModel.localTransform(),
-					stereoModel.left().imageSize());
+			else
+			{
+				static bool warned = false;
+				if(!warned)
+				{
+					ROS_WARN("Right camera info doesn't have Tx set but we are assuming that stereo images are already rectified (see %s parameter). While not "
+							"recommended, we used TF to get the baseline (%s->%s = %fm) for convenience (e.g., D400 ir stereo issue). It is preferred to feed "
+							"a valid right camera info if stereo images are already rectified. This message is only printed once...",
+							rtabmap::Parameters::kRtabmapImagesAlreadyRectified().c_str(),
+							rightCamInfoMsg.header.frame_id.c_str(), leftCamInfoMsg.header.frame_id.c_str(), stereoTransform.x());
+					warned = true;
+				}
+				stereoModel = rtabmap::StereoCameraModel(
+						stereoModel.left().fx(),
+						stereoModel.left().fy(),
+						stereoModel.left().cx(),
+						stereoModel.left().cy(),
+						stereoTransform.x(),
+						stereoModel.localTransform(),
+						stereoModel.left().imageSize());
+			}
+		}
+
+		if(stereoModelCache && (stereoModel.baseline() > 0.0 || !alreadyRectified))
+		{
+			stereoModelCache->set(calibrationKey, stereoModel, !alreadyRectified);
 		}
 	}
+
+	if(!alreadyRectified && stereoModelCache && stereoModelCache->rectify(left, right))
+	{
+		// The model of the rectified images has no distortion, so the
+		// library doesn't rectify them again
+		stereoModel = stereoModelCache->rectifiedModel(stereoModel.localTransform());
+	}
 	return true;
 }
 
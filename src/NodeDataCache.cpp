@@ -0,0 +1,217 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rtabmap_ros/NodeDataCache.h"
+#include <ros/serialization.h>
+#include <rtabmap/utilite/ULogger.h>
+#include <rtabmap/utilite/UFile.h>
+#include <rtabmap/utilite/UDirectory.h>
+#include <rtabmap/utilite/UConversion.h>
+#include <fstream>
+#include <vector>
+
+namespace rtabmap_ros {
+
+namespace {
+// File layout: magic, version, node id, payload size, payload checksum, payload
+const uint32_t kMagic = 0x434E5452; // "RTNC"
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 3*sizeof(uint32_t) + sizeof(int32_t) + sizeof(uint64_t);
+
+uint64_t checksum(const std::vector<uint8_t> & data)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for(size_t i=0; i<data.size(); ++i)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+}
+
+NodeDataCache::NodeDataCache(const std::string & path)
+{
+	setPath(path);
+}
+
+void NodeDataCache::setPath(const std::string & path)
+{
+	path_ = path;
+	if(!path_.empty() && !UDirectory::exists(path_) && !UDirectory::makeDir(path_))
+	{
+		UERROR("Cannot create node cache directory \"%s\", node cache is disabled.", path_.c_str());
+		path_.clear();
+	}
+}
+
+std::string NodeDataCache::fileName(int id) const
+{
+	return path_ + UDirectory::separator() + uNumber2Str(id) + ".node";
+}
+
+bool NodeDataCache::contains(int id) const
+{
+	return isEnabled() && UFile::exists(fileName(id));
+}
+
+bool NodeDataCache::load(int id, rtabmap_ros::NodeData & msg) const
+{
+	if(!isEnabled())
+	{
+		return false;
+	}
+	std::string name = fileName(id);
+	std::ifstream file(name.c_str(), std::ios::in | std::ios::binary);
+	if(!file.is_open())
+	{
+		return false;
+	}
+
+	file.seekg(0, std::ios::end);
+	std::streamoff fileSize = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	uint32_t magic = 0, version = 0, size = 0;
+	int32_t fileId = 0;
+	uint64_t sum = 0;
+	file.read((char*)&magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&fileId, sizeof(fileId));
+	file.read((char*)&size, sizeof(size));
+	file.read((char*)&sum, sizeof(sum));
+	// the payload size must match the file length before allocating it
+	bool valid = file.good() && magic == kMagic && version == kVersion && fileId == id &&
+			fileSize == std::streamoff(kHeaderSize + size);
+	std::vector<uint8_t> buffer;
+	if(valid)
+	{
+		buffer.resize(size);
+		file.read((char*)buffer.data(), size);
+		valid = file.good() && checksum(buffer) == sum;
+	}
+	file.close();
+
+	if(valid)
+	{
+		try
+		{
+			ros::serialization::IStream stream(buffer.data(), buffer.size());
+			ros::serialization::deserialize(stream, msg);
+			valid = msg.id == id;
+		}
+		catch(const ros::Exception & e)
+		{
+			valid = false;
+		}
+	}
+	if(!valid)
+	{
+		UWARN("Node %d in cache is invalid (%s), it is removed.", id, name.c_str());
+		UFile::erase(name);
+	}
+	return valid;
+}
+
+bool NodeDataCache::save(const rtabmap_ros::NodeData & msg) const
+{
+	if(!isEnabled() || msg.id <= 0)
+	{
+		return false;
+	}
+	std::vector<uint8_t> buffer(ros::serialization::serializationLength(msg));
+	ros::serialization::OStream stream(buffer.data(), buffer.size());
+	ros::serialization::serialize(stream, msg);
+
+	uint32_t size = buffer.size();
+	int32_t id = msg.id;
+	uint64_t sum = checksum(buffer);
+
+	// Write in a temporary file first so that a crash doesn't leave a partial node
+	std::string name = fileName(msg.id);
+	std::string tmpName = name + ".tmp";
+	std::ofstream file(tmpName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!file.is_open())
+	{
+		UERROR("Cannot write node %d to cache (%s).", msg.id, tmpName.c_str());
+		return false;
+	}
+	file.write((const char*)&kMagic, sizeof(kMagic));
+	file.write((const char*)&kVersion, sizeof(kVersion));
+	file.write((const char*)&id, sizeof(id));
+	file.write((const char*)&size, sizeof(size));
+	file.write((const char*)&sum, sizeof(sum));
+	file.write((const char*)buffer.data(), buffer.size());
+	bool ok = file.good();
+	file.close();
+	if(!ok || UFile::rename(tmpName, name) != 0)
+	{
+		UERROR("Cannot write node %d to cache (%s).", msg.id, name.c_str());
+		UFile::erase(tmpName);
+		return false;
+	}
+	return true;
+}
+
+void NodeDataCache::remove(int id) const
+{
+	if(isEnabled())
+	{
+		UFile::erase(fileName(id));
+	}
+}
+
+std::set<int> NodeDataCache::ids() const
+{
+	std::set<int> ids;
+	if(isEnabled())
+	{
+		UDirectory dir(path_, "node");
+		const std::list<std::string> & names = dir.getFileNames();
+		for(std::list<std::string>::const_iterator iter=names.begin(); iter!=names.end(); ++iter)
+		{
+			int id = uStr2Int(iter->substr(0, iter->size()-5)); // remove ".node"
+			if(id > 0)
+			{
+				ids.insert(id);
+			}
+		}
+	}
+	return ids;
+}
+
+void NodeDataCache::clear() const
+{
+	std::set<int> cached = ids();
+	for(std::set<int>::iterator iter=cached.begin(); iter!=cached.end(); ++iter)
+	{
+		remove(*iter);
+	}
+}
+
+}
@@ -83,7 +83,11 @@ OdometryROS::OdometryROS(bool stereoParams, bool visParams, bool icpParams) :
 	maxUpdateRate_(0.0),
 	odomStrategy_(Parameters::defaultOdomStrategy()),
 	waitIMUToinit_(false),
-	imuProcessed_(false)
+	imuProcessed_(false),
+	localScanMapRate_(0.0),
+	localScanMapThread_(0),
+	localScanMapStop_(false),
+	localScanMapReceived_(false)
 {
 
 }
@@ -97,6 +101,17 @@ OdometryROS::~OdometryROS()
 		delete warningThread_;
 	}
 
+	if(localScanMapThread_)
+	{
+		{
+			boost::mutex::scoped_lock lock(localScanMapMutex_);
+			localScanMapStop_ = true;
+		}
+		localScanMapCondition_.notify_one();
+		localScanMapThread_->join();
+		delete localScanMapThread_;
+	}
+
 	delete odometry_;
 }
 
@@ -110,6 +125,8 @@ void OdometryROS::onInit()
 	odomInfoLitePub_ = nh.advertise<rtabmap_ros::OdomInfo>("odom_info_lite", 1);
 	odomLocalMap_ = nh.advertise<sensor_msgs::PointCloud2>("odom_local_map", 1);
 	odomLocalScanMap_ = nh.advertise<sensor_msgs::PointCloud2>("odom_local_scan_map", 1);
+	odomLocalScanMapAdded_ = nh.advertise<sensor_msgs::PointCloud2>("odom_local_scan_map_added", 1);
+	odomLocalScanMapRemoved_ = nh.advertise<sensor_msgs::PointCloud2>("odom_local_scan_map_removed", 1);
 	odomLastFrame_ = nh.advertise<sensor_msgs::PointCloud2>("odom_last_frame", 1);
 	odomRgbdImagePub_ = nh.advertise<rtabmap_ros::RGBDImage>("odom_rgbd_image", 1);
 
@@ -150,6 +167,7 @@ void OdometryROS::onInit()
 	pnh.param("max_update_rate", maxUpdateRate_, maxUpdateRate_);
 
 	pnh.param("wait_imu_to_init", waitIMUToinit_, waitIMUToinit_);
+	pnh.param("local_scan_map_rate", localScanMapRate_, localScanMapRate_);
 
 	if(publishTf_ && !guessFrameId_.empty() && guessFrameId_.compare(odomFrameId_) == 0)
 	{
@@ -175,6 +193,9 @@ void OdometryROS::onInit()
 	NODELET_INFO("Odometry: expected_update_rate   = %f Hz", expectedUpdateRate_);
 	NODELET_INFO("Odometry: max_update_rate        = %f Hz", maxUpdateRate_);
 	NODELET_INFO("Odometry: wait_imu_to_init       = %s", waitIMUToinit_?"true":"false");
+	NODELET_INFO("Odometry: local_scan_map_rate    = %f Hz", localScanMapRate_);
+
+	localScanMapThread_ = new boost::thread(boost::bind(&OdometryROS::localScanMapLoop, this));
 
 	configPath = uReplaceChar(configPath, '~', UDirectory::homeDir());
 	if(configPath.size() && configPath.at(0) != '/')
@@ -389,6 +410,158 @@ void OdometryROS::warningLoop(const std::string & subscribedTopicsMsg, bool appr
 	}
 }
 
+namespace {
+void scanMapToROS(const LaserScan & scan, sensor_msgs::PointCloud2 & cloudMsg)
+{
+	if(scan.hasNormals() && scan.hasIntensity())
+	{
+		pcl::PointCloud<pcl::PointXYZINormal>::Ptr cloud = util3d::laserScanToPointCloudINormal(scan, scan.localTransform());
+		pcl::toROSMsg(*cloud, cloudMsg);
+	}
+	else if(scan.hasNormals())
+	{
+		pcl::PointCloud<pcl::PointNormal>::Ptr cloud = util3d::laserScanToPointCloudNormal(scan, scan.localTransform());
+		pcl::toROSMsg(*cloud, cloudMsg);
+	}
+	else if(scan.hasIntensity())
+	{
+		pcl::PointCloud<pcl::PointXYZI>::Ptr cloud = util3d::laserScanToPointCloudI(scan, scan.localTransform());
+		pcl::toROSMsg(*cloud, cloudMsg);
+	}
+	else
+	{
+		pcl::PointCloud<pcl::PointXYZ>::Ptr cloud = util3d::laserScanToPointCloud(scan, scan.localTransform());
+		pcl::toROSMsg(*cloud, cloudMsg);
+	}
+}
+
+LaserScan scanSubset(const LaserScan & scan, const std::vector<int> & indices)
+{
+	const cv::Mat & data = scan.data();
+	size_t pointSize = data.elemSize();
+	cv::Mat subset(1, (int)indices.size(), data.type());
+	for(size_t i=0; i<indices.size(); ++i)
+	{
+		memcpy(subset.data + i*pointSize, data.data + indices[i]*pointSize, pointSize);
+	}
+	return LaserScan(subset, 0, 0, scan.format(), scan.localTransform());
+}
+}
+
+void OdometryROS::localScanMapLoop()
+{
+	while(true)
+	{
+		LaserScan scanMap;
+		std_msgs::Header header;
+		{
+			boost::mutex::scoped_lock lock(localScanMapMutex_);
+			while(!localScanMapReceived_ && !localScanMapStop_)
+			{
+				localScanMapCondition_.wait(lock);
+			}
+			if(localScanMapStop_)
+			{
+				break;
+			}
+			scanMap = localScanMapReceivedScan_;
+			header = localScanMapReceivedHeader_;
+			localScanMapReceivedScan_ = LaserScan();
+			localScanMapReceived_ = false;
+		}
+		publishLocalScanMap(scanMap, header);
+	}
+}
+
+void OdometryROS::publishLocalScanMap(const LaserScan & scanMap, const std_msgs::Header & header)
+{
+	// Points of the odometry scan map are appended at the end and removed
+	// (oldest ones when the map is full, or anywhere when they are out of
+	// range) without reordering the others, so the points of the previous map
+	// are matched in order with the current one. Any other change (e.g.,
+	// odometry reset or filtered map) still gives a valid diff, just larger.
+	const cv::Mat & current = scanMap.data();
+	const cv::Mat & previous = localScanMapPrevious_.data();
+	bool changed = true;
+	bool fullDiff = false;
+	std::vector<int> removed;
+	std::vector<int> added;
+	if(!previous.empty() &&
+		previous.type() == current.type() &&
+		previous.rows == 1 && current.rows == 1 &&
+		previous.isContinuous() && current.isContinuous() &&
+		localScanMapPrevious_.localTransform() == scanMap.localTransform())
+	{
+		size_t pointSize = current.elemSize();
+		if(current.cols == previous.cols &&
+			(current.data == previous.data || memcmp(current.data, previous.data, current.cols*pointSize) == 0))
+		{
+			changed = false;
+		}
+		else
+		{
+			int j=0;
+			for(int i=0; i<previous.cols; ++i)
+			{
+				if(j < current.cols && memcmp(previous.data + i*pointSize, current.data + j*pointSize, pointSize) == 0)
+				{
+					++j;
+				}
+				else
+				{
+					removed.push_back(i);
+				}
+			}
+			for(; j<current.cols; ++j)
+			{
+				added.push_back(j);
+			}
+		}
+	}
+	else
+	{
+		// not comparable, all previous points are removed and all current points added
+		fullDiff = true;
+	}
+
+	if(changed)
+	{
+		if(odomLocalScanMapAdded_.getNumSubscribers())
+		{
+			sensor_msgs::PointCloud2 cloudMsg;
+			scanMapToROS(fullDiff?scanMap:scanSubset(scanMap, added), cloudMsg);
+			cloudMsg.header.stamp = header.stamp;
+			cloudMsg.header.frame_id = odomFrameId_;
+			odomLocalScanMapAdded_.publish(cloudMsg);
+		}
+		if(odomLocalScanMapRemoved_.getNumSubscribers() && (fullDiff?!localScanMapPrevious_.isEmpty():removed.size()))
+		{
+			sensor_msgs::PointCloud2 cloudMsg;
+			scanMapToROS(fullDiff?localScanMapPrevious_:scanSubset(localScanMapPrevious_, removed), cloudMsg);
+			cloudMsg.header.stamp = header.stamp;
+			cloudMsg.header.frame_id = odomFrameId_;
+			odomLocalScanMapRemoved_.publish(cloudMsg);
+		}
+	}
+
+	// full map at reduced rate if set, otherwise every frame
+	if(odomLocalScanMap_.getNumSubscribers() &&
+		(localScanMapRate_ <= 0.0 ||
+		 localScanMapLastFullStamp_.isZero() ||
+		 (header.stamp - localScanMapLastFullStamp_).toSec() >= 1.0/localScanMapRate_ ||
+		 header.stamp < localScanMapLastFullStamp_))
+	{
+		sensor_msgs::PointCloud2 cloudMsg;
+		scanMapToROS(scanMap, cloudMsg);
+		cloudMsg.header.stamp = header.stamp; // use corresponding time stamp to image
+		cloudMsg.header.frame_id = odomFrameId_;
+		odomLocalScanMap_.publish(cloudMsg);
+		localScanMapLastFullStamp_ = header.stamp;
+	}
+
+	localScanMapPrevious_ = scanMap;
+}
+
 Transform OdometryROS::getTransform(const std::string & fromFrameId, const std::string & toFrameId, const ros::Time & stamp) const
 {
 	// TF ready?
@@ -773,33 +946,19 @@ void OdometryROS::processData(SensorData & data, const std_msgs::Header & header
 			}
 		}
 
-		if(odomLocalScanMap_.getNumSubscribers() && !info.localScanMap.isEmpty())
+		if((odomLocalScanMap_.getNumSubscribers() ||
+			odomLocalScanMapAdded_.getNumSubscribers() ||
+			odomLocalScanMapRemoved_.getNumSubscribers()) &&
+			!info.localScanMap.isEmpty())
 		{
-			sensor_msgs::PointCloud2 cloudMsg;
-			if(info.localScanMap.hasNormals() && info.localScanMap.hasIntensity())
-			{
-				pcl::PointCloud<pcl::PointXYZINormal>::Ptr cloud = util3d::laserScanToPointCloudINormal(info.localScanMap, info.localScanMap.localTransform());
-				pcl::toROSMsg(*cloud, cloudMsg);
-			}
-			else if(info.localScanMap.hasNormals())
-			{
-				pcl::PointCloud<pcl::PointNormal>::Ptr cloud = util3d::laserScanToPointCloudNormal(info.localScanMap, info.localScanMap.localTransform());
-				pcl::toROSMsg(*cloud, cloudMsg);
-			}
-			else if(info.localScanMap.hasIntensity())
-			{
-				pcl::PointCloud<pcl::PointXYZI>::Ptr cloud = util3d::laserScanToPointCloudI(info.localScanMap, info.localScanMap.localTransform());
-				pcl::toROSMsg(*cloud, cloudMsg);
-			}
-			else
-			{
-				pcl::PointCloud<pcl::PointXYZ>::Ptr cloud = util3d::laserScanToPointCloud(info.localScanMap, info.localScanMap.localTransform());
-				pcl::toROSMsg(*cloud, cloudMsg);
-			}
-
-			cloudMsg.header.stamp = header.stamp; // use corresponding time stamp to image
-			cloudMsg.header.frame_id = odomFrameId_;
-			odomLocalScanMap_.publish(cloudMsg);
+			// converted and published by localScanMapLoop(), only the latest map is kept.
+			// Deep copy: the map data can be modified by the next odometry update.
+			LaserScan scanMap(info.localScanMap.data().clone(), 0, 0, info.localScanMap.format(), info.localScanMap.localTransform());
+			boost::mutex::scoped_lock lock(localScanMapMutex_);
+			localScanMapReceivedScan_ = scanMap;
+			localScanMapReceivedHeader_ = header;
+			localScanMapReceived_ = true;
+			localScanMapCondition_.notify_one();
 		}
 	}
 	else if(data.imageRaw().empty() && data.laserScanRaw().isEmpty() && !data.imu().empty())
@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Per-node cost of decoding a compressed 1280x720 RGB-D node (JPEG image,
+ * PNG depth) and creating its decimated cloud, with a full resolution
+ * decode (SensorData::uncompressData()) and with the reduced resolution
+ * decode of rtabmap_ros::uncompressRGBDDecimated(), for decimation 1, 2, 4
+ * and 8. No ROS master is needed.
+ *
+ * Usage: decimated_decode_benchmark [nodes=50]
+ */
+
+#include "rtabmap_ros/MsgConversion.h"
+#include <rtabmap/core/SensorData.h>
+#include <rtabmap/core/Compression.h>
+#include <rtabmap/core/util3d.h>
+#include <rtabmap/utilite/UTimer.h>
+#include <rtabmap/utilite/UConversion.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <cstdio>
+
+namespace {
+
+// Textured image and smooth depth, so that the compressed sizes are realistic
+rtabmap::SensorData createNode(int id)
+{
+	cv::Mat rgb(720, 1280, CV_8UC3);
+	cv::Mat depth(720, 1280, CV_16UC1);
+	cv::randu(rgb, 0, 64);
+	for(int v=0; v<rgb.rows; ++v)
+	{
+		for(int u=0; u<rgb.cols; ++u)
+		{
+			cv::Vec3b & pixel = rgb.at<cv::Vec3b>(v, u);
+			pixel[0] += (u/8)%192;
+			pixel[1] += (v/8)%192;
+			pixel[2] += ((u+v)/16)%192;
+			depth.at<unsigned short>(v, u) = 1000 + (u+2*v+id)%3000;
+		}
+	}
+	cv::GaussianBlur(rgb, rgb, cv::Size(3,3), 0);
+	rtabmap::CameraModel model(700.0, 700.0, 640.0, 360.0, rtabmap::CameraModel::opticalRotation(), 0, cv::Size(1280, 720));
+	return rtabmap::SensorData(
+			rtabmap::compressImage2(rgb, ".jpg"),
+			rtabmap::compressImage2(depth, ".png"),
+			model,
+			id,
+			double(id));
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int nodes = argc>1?uStr2Int(argv[1]):50;
+	if(nodes <= 0)
+	{
+		printf("Usage: decimated_decode_benchmark [nodes=50]\n");
+		return 1;
+	}
+
+	std::vector<rtabmap::SensorData> data(nodes);
+	for(int i=0; i<nodes; ++i)
+	{
+		data[i] = createNode(i+1);
+	}
+
+	printf("%d nodes of 1280x720 (jpg=%d bytes, png=%d bytes), times per node\n",
+			nodes, data[0].imageCompressed().cols, data[0].depthOrRightCompressed().cols);
+	printf("decimation | full decode | full decode+cloud | reduced decode | reduced decode+cloud\n");
+	int decimations[4] = {1, 2, 4, 8};
+	for(int d=0; d<4; ++d)
+	{
+		int decimation = decimations[d];
+		double fullDecode = 0.0, fullTotal = 0.0, reducedDecode = 0.0, reducedTotal = 0.0;
+		size_t fullPoints = 0, reducedPoints = 0;
+		UTimer timer;
+		for(int i=0; i<nodes; ++i)
+		{
+			// full resolution decode, then decimation while creating the cloud
+			rtabmap::SensorData full = data[i];
+			cv::Mat image, depth;
+			timer.restart();
+			full.uncompressData(&image, &depth);
+			double t = timer.ticks();
+			fullDecode += t;
+			fullPoints += rtabmap::util3d::cloudRGBFromSensorData(full, decimation)->size();
+			fullTotal += t + timer.ticks();
+
+			// reduced resolution decode, only the remaining decimation while creating the cloud
+			rtabmap::SensorData reduced = data[i];
+			std::vector<rtabmap::CameraModel> models;
+			int remainingDecimation = decimation;
+			timer.restart();
+			if(rtabmap_ros::uncompressRGBDDecimated(reduced, decimation, image, depth, models, remainingDecimation))
+			{
+				reduced.setRGBDImage(image, depth, models, false);
+			}
+			else
+			{
+				reduced.uncompressData(&image, &depth);
+			}
+			t = timer.ticks();
+			reducedDecode += t;
+			reducedPoints += rtabmap::util3d::cloudRGBFromSensorData(reduced, remainingDecimation)->size();
+			reducedTotal += t + timer.ticks();
+		}
+		printf("%10d | %8.2f ms | %14.2f ms | %11.2f ms | %17.2f ms (points %d vs %d)\n",
+				decimation,
+				fullDecode*1000.0/nodes,
+				fullTotal*1000.0/nodes,
+				reducedDecode*1000.0/nodes,
+				reducedTotal*1000.0/nodes,
+				int(fullPoints/nodes),
+				int(reducedPoints/nodes));
+	}
+	return 0;
+}
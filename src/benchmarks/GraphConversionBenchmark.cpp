@@ -0,0 +1,243 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Cost of converting a graph with 10k, 100k and 1M nodes and links
+ * (neighbor links) to and from rtabmap_ros/MapGraph with the bulk
+ * converters used by mapGraphToROS()/mapGraphFromROS(), compared to the
+ * previous mapGraphToROS()/mapGraphFromROS() (map insertion without hint,
+ * transforms through Eigen::Affine3d). No ROS master is needed.
+ *
+ * Usage: graph_conversion_benchmark [max_links=1000000]
+ */
+
+#include "rtabmap_ros/MsgConversion.h"
+#include <rtabmap/utilite/UTimer.h>
+#include <rtabmap/utilite/UConversion.h>
+#include <rtabmap/utilite/ULogger.h>
+#include <eigen_conversions/eigen_msg.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Previous conversions (MsgConversion.cpp before the bulk converters),
+// copied as they were for comparison. Only the rtabmap_ros:: qualifiers
+// are removed so that the previous helpers below are called.
+namespace previous {
+
+void transformToGeometryMsg(const rtabmap::Transform & transform, geometry_msgs::Transform & msg)
+{
+	if(!transform.isNull())
+	{
+		tf::transformEigenToMsg(transform.toEigen3d(), msg);
+
+		// make sure the quaternion is normalized
+		long double recipNorm = 1.0 / sqrt(msg.rotation.x * msg.rotation.x + msg.rotation.y * msg.rotation.y + msg.rotation.z * msg.rotation.z + msg.rotation.w * msg.rotation.w);
+		msg.rotation.x *= recipNorm;
+		msg.rotation.y *= recipNorm;
+		msg.rotation.z *= recipNorm;
+		msg.rotation.w *= recipNorm;
+	}
+	else
+	{
+		msg = geometry_msgs::Transform();
+	}
+}
+
+
+rtabmap::Transform transformFromGeometryMsg(const geometry_msgs::Transform & msg)
+{
+	if(msg.rotation.w == 0 &&
+		msg.rotation.x == 0 &&
+		msg.rotation.y == 0 &&
+		msg.rotation.z ==0)
+	{
+		return rtabmap::Transform();
+	}
+
+	Eigen::Affine3d tfTransform;
+	tf::transformMsgToEigen(msg, tfTransform);
+	return rtabmap::Transform::fromEigen3d(tfTransform);
+}
+
+void transformToPoseMsg(const rtabmap::Transform & transform, geometry_msgs::Pose & msg)
+{
+	if(!transform.isNull())
+	{
+		tf::poseEigenToMsg(transform.toEigen3d(), msg);
+	}
+	else
+	{
+		msg = geometry_msgs::Pose();
+	}
+}
+
+rtabmap::Transform transformFromPoseMsg(const geometry_msgs::Pose & msg, bool ignoreRotationIfNotSet = false)
+{
+	if(msg.orientation.w == 0 &&
+		msg.orientation.x == 0 &&
+		msg.orientation.y == 0 &&
+		msg.orientation.z == 0)
+	{
+		if(ignoreRotationIfNotSet)
+		{
+			return rtabmap::Transform(msg.position.x, msg.position.y, msg.position.z, 0, 0, 0);
+		}
+		return rtabmap::Transform();
+	}
+	Eigen::Affine3d tfPose;
+	tf::poseMsgToEigen(msg, tfPose);
+	return rtabmap::Transform::fromEigen3d(tfPose);
+}
+
+rtabmap::Link linkFromROS(const rtabmap_ros::Link & msg)
+{
+	cv::Mat information = cv::Mat(6,6,CV_64FC1, (void*)msg.information.data()).clone();
+	return rtabmap::Link(msg.fromId, msg.toId, (rtabmap::Link::Type)msg.type, transformFromGeometryMsg(msg.transform), information);
+}
+
+void linkToROS(const rtabmap::Link & link, rtabmap_ros::Link & msg)
+{
+	msg.fromId = link.from();
+	msg.toId = link.to();
+	msg.type = link.type();
+	if(link.infMatrix().type() == CV_64FC1 && link.infMatrix().cols == 6 && link.infMatrix().rows == 6)
+	{
+		memcpy(msg.information.data(), link.infMatrix().data, 36*sizeof(double));
+	}
+	transformToGeometryMsg(link.transform(), msg.transform);
+}
+
+void mapGraphFromROS(
+		const rtabmap_ros::MapGraph & msg,
+		std::map<int, rtabmap::Transform> & poses,
+		std::multimap<int, rtabmap::Link> & links,
+		rtabmap::Transform & mapToOdom)
+{
+	//optimized graph
+	UASSERT(msg.posesId.size() == msg.poses.size());
+	for(unsigned int i=0; i<msg.posesId.size(); ++i)
+	{
+		poses.insert(std::make_pair(msg.posesId[i], transformFromPoseMsg(msg.poses[i])));
+	}
+	for(unsigned int i=0; i<msg.links.size(); ++i)
+	{
+		rtabmap::Transform t = transformFromGeometryMsg(msg.links[i].transform);
+		links.insert(std::make_pair(msg.links[i].fromId, linkFromROS(msg.links[i])));
+	}
+	mapToOdom = transformFromGeometryMsg(msg.mapToOdom);
+}
+void mapGraphToROS(
+		const std::map<int, rtabmap::Transform> & poses,
+		const std::multimap<int, rtabmap::Link> & links,
+		const rtabmap::Transform & mapToOdom,
+		rtabmap_ros::MapGraph & msg)
+{
+	//Optimized graph
+	msg.posesId.resize(poses.size());
+	msg.poses.resize(poses.size());
+	int index = 0;
+	for(std::map<int, rtabmap::Transform>::const_iterator iter = poses.begin();
+		iter != poses.end();
+		++iter)
+	{
+		msg.posesId[index] = iter->first;
+		transformToPoseMsg(iter->second, msg.poses[index]);
+		++index;
+	}
+
+	msg.links.resize(links.size());
+	index=0;
+	for(std::multimap<int, rtabmap::Link>::const_iterator iter = links.begin();
+		iter!=links.end();
+		++iter)
+	{
+		linkToROS(iter->second, msg.links[index++]);
+	}
+
+	transformToGeometryMsg(mapToOdom, msg.mapToOdom);
+}
+
+} // namespace previous
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int maxLinks = argc>1?uStr2Int(argv[1]):1000000;
+	if(maxLinks < 10000)
+	{
+		printf("Usage: graph_conversion_benchmark [max_links=1000000] (minimum 10000)\n");
+		return 1;
+	}
+
+	printf("links (and nodes) | previous to/from ROS | bulk to/from ROS\n");
+	for(int count=10000; count<=maxLinks; count*=10)
+	{
+		std::map<int, rtabmap::Transform> poses;
+		std::multimap<int, rtabmap::Link> links;
+		for(int i=1; i<=count; ++i)
+		{
+			poses.insert(poses.end(), std::make_pair(i, rtabmap::Transform(0.1f*i, 0.05f*i, 0.0f, 0.0f, 0.0f, 0.001f*i)));
+			links.insert(links.end(), std::make_pair(i, rtabmap::Link(i, i+1, rtabmap::Link::kNeighbor, rtabmap::Transform(0.1f, 0.05f, 0.0f, 0.0f, 0.0f, 0.001f), cv::Mat::eye(6,6,CV_64FC1)*100.0)));
+		}
+
+		UTimer timer;
+		rtabmap_ros::MapGraph previousMsg;
+		previous::mapGraphToROS(poses, links, rtabmap::Transform::getIdentity(), previousMsg);
+		double previousTo = timer.ticks();
+		std::map<int, rtabmap::Transform> previousPoses;
+		std::multimap<int, rtabmap::Link> previousLinks;
+		rtabmap::Transform previousMapToOdom;
+		previous::mapGraphFromROS(previousMsg, previousPoses, previousLinks, previousMapToOdom);
+		double previousFrom = timer.ticks();
+
+		rtabmap_ros::MapGraph bulkMsg;
+		rtabmap_ros::mapGraphToROS(poses, links, rtabmap::Transform::getIdentity(), bulkMsg);
+		double bulkTo = timer.ticks();
+		std::map<int, rtabmap::Transform> bulkPoses;
+		std::multimap<int, rtabmap::Link> bulkLinks;
+		rtabmap::Transform mapToOdom;
+		rtabmap_ros::mapGraphFromROS(bulkMsg, bulkPoses, bulkLinks, mapToOdom);
+		double bulkFrom = timer.ticks();
+
+		if(bulkPoses.size() != poses.size() || bulkLinks.size() != links.size() ||
+		   bulkPoses.rbegin()->second.getDistance(poses.rbegin()->second) > 0.001f)
+		{
+			printf("Conversion error!\n");
+			return 1;
+		}
+
+		printf("%17d | %8.1f / %8.1f ms | %7.1f / %7.1f ms\n",
+				count,
+				previousTo*1000.0, previousFrom*1000.0,
+				bulkTo*1000.0, bulkFrom*1000.0);
+	}
+	return 0;
+}
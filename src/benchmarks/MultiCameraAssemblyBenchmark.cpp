@@ -0,0 +1,124 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Per-frame cost of assembling the images of 2, 4 and 6 synthetic 640x480
+ * RGB-D cameras (rgb8 and 16UC1, like rgbd_odometry with rgbd_cameras>1)
+ * in the mosaic buffers, converting the cameras one after the other and
+ * in parallel with ImageIngestionPlan::convertToMosaic(). No ROS master is
+ * needed.
+ *
+ * Usage: multi_camera_assembly_benchmark [frames=200]
+ */
+
+#include "rtabmap_ros/MsgConversion.h"
+#include <rtabmap/utilite/UTimer.h>
+#include <rtabmap/utilite/UConversion.h>
+#include <sensor_msgs/image_encodings.h>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+cv_bridge::CvImageConstPtr createImage(const std::string & encoding, int type, int camera)
+{
+	cv_bridge::CvImagePtr image(new cv_bridge::CvImage);
+	image->header.frame_id = uFormat("camera%d", camera);
+	image->encoding = encoding;
+	image->image = cv::Mat(480, 640, type);
+	if(type == CV_16UC1)
+	{
+		cv::randu(image->image, 500, 5000);
+	}
+	else
+	{
+		cv::randu(image->image, 0, 255);
+	}
+	return image;
+}
+
+double assemble(
+		const std::vector<cv_bridge::CvImageConstPtr> & rgbImages,
+		const std::vector<cv_bridge::CvImageConstPtr> & depthImages,
+		int frames,
+		bool parallel)
+{
+	int cameraCount = rgbImages.size();
+	std::vector<rtabmap_ros::ImageIngestionPlan> rgbPlans(cameraCount, rtabmap_ros::ImageIngestionPlan(rtabmap_ros::ImageIngestionPlan::kTargetColor));
+	std::vector<rtabmap_ros::ImageIngestionPlan> depthPlans(cameraCount, rtabmap_ros::ImageIngestionPlan(rtabmap_ros::ImageIngestionPlan::kTargetDepth));
+	cv::Mat rgbBuffer, depthBuffer;
+	UTimer timer;
+	for(int i=0; i<frames; ++i)
+	{
+		for(int j=0; j<cameraCount; ++j)
+		{
+			rgbPlans[j].update(rgbImages[j]);
+			depthPlans[j].update(depthImages[j]);
+		}
+		rtabmap_ros::ImageIngestionPlan::reuseBuffer(rgbBuffer, 480, 640*cameraCount, rgbPlans[0].outputType());
+		rtabmap_ros::ImageIngestionPlan::reuseBuffer(depthBuffer, 480, 640*cameraCount, depthPlans[0].outputType());
+		rtabmap_ros::ImageIngestionPlan::convertToMosaic(rgbImages, rgbPlans, rgbBuffer, parallel);
+		rtabmap_ros::ImageIngestionPlan::convertToMosaic(depthImages, depthPlans, depthBuffer, parallel);
+	}
+	return timer.ticks()*1000.0/double(frames);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int frames = argc>1?uStr2Int(argv[1]):200;
+	if(frames <= 0)
+	{
+		printf("Usage: multi_camera_assembly_benchmark [frames=200]\n");
+		return 1;
+	}
+
+	printf("%d frames of 640x480 rgb8+16UC1 cameras, %d threads, times per frame\n", frames, cv::getNumThreads());
+	printf("cameras | sequential | parallel | speedup\n");
+	int cameraCounts[3] = {2, 4, 6};
+	for(int c=0; c<3; ++c)
+	{
+		std::vector<cv_bridge::CvImageConstPtr> rgbImages, depthImages;
+		for(int j=0; j<cameraCounts[c]; ++j)
+		{
+			rgbImages.push_back(createImage(sensor_msgs::image_encodings::RGB8, CV_8UC3, j));
+			depthImages.push_back(createImage(sensor_msgs::image_encodings::TYPE_16UC1, CV_16UC1, j));
+		}
+		// warm up (allocations, thread pool)
+		assemble(rgbImages, depthImages, 5, true);
+
+		double sequential = assemble(rgbImages, depthImages, frames, false);
+		double parallel = assemble(rgbImages, depthImages, frames, true);
+		printf("%7d | %7.3f ms | %5.3f ms | %6.2fx\n",
+				cameraCounts[c],
+				sequential,
+				parallel,
+				parallel>0.0?sequential/parallel:0.0);
+	}
+	return 0;
+}
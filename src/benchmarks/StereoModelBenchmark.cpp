@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+ * Per-frame cost of the stereo camera model creation and rectification of
+ * unrectified 1280x720 pairs, when the model is rebuilt on every frame
+ * (previous behavior) and when it is reused from StereoCameraModelCache,
+ * which also rectifies the pair in parallel in reused buffers.
+ * No ROS master is needed.
+ *
+ * Usage: stereo_model_benchmark [frames=200]
+ */
+
+#include "rtabmap_ros/MsgConversion.h"
+#include <rtabmap/core/StereoCameraModel.h>
+#include <rtabmap/utilite/UTimer.h>
+#include <rtabmap/utilite/UConversion.h>
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+sensor_msgs::CameraInfo cameraInfo(const std::string & frameId, double tx)
+{
+	sensor_msgs::CameraInfo info;
+	info.header.frame_id = frameId;
+	info.width = 1280;
+	info.height = 720;
+	info.distortion_model = "plumb_bob";
+	double D[5] = {-0.17, 0.025, 0.0005, -0.0003, 0.0};
+	info.D.assign(D, D+5);
+	double K[9] = {700.0, 0.0, 640.0, 0.0, 700.0, 360.0, 0.0, 0.0, 1.0};
+	std::copy(K, K+9, info.K.begin());
+	double R[9] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+	std::copy(R, R+9, info.R.begin());
+	double P[12] = {700.0, 0.0, 640.0, tx, 0.0, 700.0, 360.0, 0.0, 0.0, 0.0, 1.0, 0.0};
+	std::copy(P, P+12, info.P.begin());
+	return info;
+}
+
+void printStats(const char * name, std::vector<double> & times)
+{
+	std::sort(times.begin(), times.end());
+	double sum = 0.0;
+	for(size_t i=0; i<times.size(); ++i)
+	{
+		sum += times[i];
+	}
+	printf("%-32s mean=%8.3f ms  median=%8.3f ms  p95=%8.3f ms\n",
+			name,
+			sum/double(times.size()),
+			times[times.size()/2],
+			times[std::min(times.size()-1, size_t(double(times.size())*0.95))]);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int frames = argc>1?uStr2Int(argv[1]):200;
+	if(frames <= 0)
+	{
+		printf("Usage: stereo_model_benchmark [frames=200]\n");
+		return 1;
+	}
+
+	sensor_msgs::CameraInfo leftInfo = cameraInfo("left_camera", 0.0);
+	sensor_msgs::CameraInfo rightInfo = cameraInfo("right_camera", -700.0*0.12);
+	rtabmap::Transform localTransform(0,0,1,0, -1,0,0,0, 0,-1,0,0);
+	rtabmap::Transform stereoTransform(1,0,0,-0.12, 0,1,0,0, 0,0,1,0);
+
+	cv::Mat left(720, 1280, CV_8UC1);
+	cv::Mat right(720, 1280, CV_8UC1);
+	cv::randu(left, 0, 255);
+	cv::randu(right, 0, 255);
+
+	std::vector<double> modelBefore, modelAfter, frameBefore, frameAfter;
+	rtabmap_ros::StereoCameraModelCache cache;
+	UTimer timer;
+	for(int i=0; i<frames; ++i)
+	{
+		// previous behavior: new model and rectification maps on each frame
+		timer.restart();
+		rtabmap::StereoCameraModel model = rtabmap_ros::stereoCameraModelFromROS(leftInfo, rightInfo, localTransform, stereoTransform);
+		model.initRectificationMap();
+		modelBefore.push_back(timer.ticks()*1000.0);
+		cv::Mat rectLeft = model.left().rectifyImage(left);
+		cv::Mat rectRight = model.right().rectifyImage(right);
+		frameBefore.push_back(modelBefore.back() + timer.ticks()*1000.0);
+
+		// cached model
+		timer.restart();
+		size_t key = rtabmap_ros::StereoCameraModelCache::key(leftInfo, rightInfo, false, stereoTransform);
+		rtabmap::StereoCameraModel cached;
+		if(!cache.get(key, localTransform, cached))
+		{
+			cached = rtabmap_ros::stereoCameraModelFromROS(leftInfo, rightInfo, localTransform, stereoTransform);
+			cache.set(key, cached, true);
+			cache.get(key, localTransform, cached);
+		}
+		modelAfter.push_back(timer.ticks()*1000.0);
+		// parallel remap in the buffers of the cache
+		rectLeft = left;
+		rectRight = right;
+		cache.rectify(rectLeft, rectRight);
+		frameAfter.push_back(modelAfter.back() + timer.ticks()*1000.0);
+	}
+
+	printf("%d frames of 1280x720 unrectified stereo pairs\n", frames);
+	printStats("model (rebuilt each frame)", modelBefore);
+	printStats("model (cached)", modelAfter);
+	printStats("model+rectify (rebuilt)", frameBefore);
+	printStats("model+rectify (cached)", frameAfter);
+	return 0;
+}
@@ -0,0 +1,318 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**
+ * Standalone latency benchmark of rtabmap_ros::VoxelLayer. A LayeredCostmap
+ * with only the voxel layer is fed synthetic depth-like PointCloud2
+ * observations through a costmap_2d::ObservationBuffer, while the robot
+ * moves in a rolling window. updateBounds() and updateCosts() are timed on
+ * every cycle for all combinations of grid sizes and point densities, then
+ * percentile latencies are printed. The ROS clock is set to the stamp of
+ * each synthetic cloud, so that the buffer keeps about
+ * observation_keep_time*rate observations like on a live robot ("obs"
+ * column, counted after the last cycle).
+ *
+ * Usage (a roscore must be running for parameters and dynamic_reconfigure):
+ *   rosrun rtabmap_ros voxel_layer_benchmark _grid_sizes:="5 10 20" _densities:="1000 10000 50000"
+ */
+
+#include <ros/ros.h>
+#include <costmap_2d/layered_costmap.h>
+#include <costmap_2d/observation_buffer.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <geometry_msgs/Point.h>
+#ifdef COSTMAP_2D_POINTCLOUD2
+#include <tf2_ros/buffer.h>
+#include <tf2/LinearMath/Quaternion.h>
+#else
+#include <tf/transform_listener.h>
+#endif
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <sstream>
+#include <vector>
+#include "voxel_layer.h"
+
+#ifdef COSTMAP_2D_POINTCLOUD2
+typedef tf2_ros::Buffer TFBuffer;
+#else
+typedef tf::TransformListener TFBuffer;
+#endif
+
+// Give access to the observation buffers normally created from the
+// "observation_sources" parameter
+class BenchmarkVoxelLayer : public rtabmap_ros::VoxelLayer
+{
+public:
+  void addObservationBuffer(const boost::shared_ptr<costmap_2d::ObservationBuffer>& buffer)
+  {
+    observation_buffers_.push_back(buffer);
+    marking_buffers_.push_back(buffer);
+    clearing_buffers_.push_back(buffer);
+  }
+};
+
+struct Latencies
+{
+  std::vector<double> bounds;
+  std::vector<double> costs;
+  int observations;
+};
+
+std::vector<double> parseList(const std::string& str)
+{
+  std::vector<double> values;
+  std::istringstream stream(str);
+  double value;
+  while (stream >> value)
+  {
+    values.push_back(value);
+  }
+  return values;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+  if (values.empty())
+    return 0.0;
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5));
+  return values[index];
+}
+
+void setTransform(TFBuffer& tf, const std::string& parent, const std::string& child, const ros::Time& stamp,
+                  double x, double y, double z, double yaw)
+{
+#ifdef COSTMAP_2D_POINTCLOUD2
+  geometry_msgs::TransformStamped transform;
+  transform.header.stamp = stamp;
+  transform.header.frame_id = parent;
+  transform.child_frame_id = child;
+  transform.transform.translation.x = x;
+  transform.transform.translation.y = y;
+  transform.transform.translation.z = z;
+  tf2::Quaternion q;
+  q.setRPY(0, 0, yaw);
+  transform.transform.rotation.x = q.x();
+  transform.transform.rotation.y = q.y();
+  transform.transform.rotation.z = q.z();
+  transform.transform.rotation.w = q.w();
+  tf.setTransform(transform, "voxel_layer_benchmark");
+#else
+  tf::Transform transform(tf::createQuaternionFromYaw(yaw), tf::Vector3(x, y, z));
+  tf.setTransform(tf::StampedTransform(transform, stamp, parent, child), "voxel_layer_benchmark");
+#endif
+}
+
+// Depth-camera-like cloud in sensor frame (x forward, z up): random
+// points in the field of view, up to max_range
+void createCloud(sensor_msgs::PointCloud2& cloud, int points, double fov, double max_range)
+{
+  cloud.header.frame_id = "sensor";
+  sensor_msgs::PointCloud2Modifier modifier(cloud);
+  modifier.setPointCloud2FieldsByString(1, "xyz");
+  modifier.resize(points);
+  sensor_msgs::PointCloud2Iterator<float> iter_x(cloud, "x");
+  sensor_msgs::PointCloud2Iterator<float> iter_y(cloud, "y");
+  sensor_msgs::PointCloud2Iterator<float> iter_z(cloud, "z");
+  for (int i = 0; i < points; ++i, ++iter_x, ++iter_y, ++iter_z)
+  {
+    double angle = fov * (double(rand()) / RAND_MAX - 0.5);
+    double range = 0.3 + (max_range - 0.3) * double(rand()) / RAND_MAX;
+    *iter_x = range * cos(angle);
+    *iter_y = range * sin(angle);
+    *iter_z = -0.5 + 2.0 * double(rand()) / RAND_MAX;
+  }
+}
+
+Latencies run(TFBuffer& tf, const std::string& name, double grid_size, double resolution, int points, int cycles,
+              double rate, double keep_time, double speed, double max_range)
+{
+  Latencies latencies;
+  costmap_2d::LayeredCostmap layered_costmap("map", true, true);
+  boost::shared_ptr<BenchmarkVoxelLayer> layer(new BenchmarkVoxelLayer());
+  layered_costmap.addPlugin(layer);
+  layer->initialize(&layered_costmap, name, &tf);
+
+  unsigned int cells = (unsigned int)(grid_size / resolution);
+  layered_costmap.resizeMap(cells, cells, resolution, -grid_size / 2, -grid_size / 2);
+
+  std::vector<geometry_msgs::Point> footprint(4);
+  footprint[0].x = 0.2;  footprint[0].y = 0.2;
+  footprint[1].x = 0.2;  footprint[1].y = -0.2;
+  footprint[2].x = -0.2; footprint[2].y = -0.2;
+  footprint[3].x = -0.2; footprint[3].y = 0.2;
+  layered_costmap.setFootprint(footprint);
+
+  boost::shared_ptr<costmap_2d::ObservationBuffer> buffer(new costmap_2d::ObservationBuffer(
+      "synthetic", keep_time, 0.0, 0.0, 2.0, max_range, max_range + 0.5, tf, "map", "sensor", 0.2));
+  layer->addObservationBuffer(buffer);
+
+  sensor_msgs::PointCloud2 cloud;
+  createCloud(cloud, points, 1.0, max_range);
+
+  costmap_2d::Costmap2D* master = layered_costmap.getCostmap();
+  latencies.bounds.reserve(cycles);
+  latencies.costs.reserve(cycles);
+  for (int i = 0; i < cycles; ++i)
+  {
+    // Robot drives on a large circle so that the rolling window slides and turns
+    double t = double(i) / rate;
+    ros::Time stamp(1.0 + t);
+    // ObservationBuffer stamps its updates and purges old clouds with ros::Time::now()
+    ros::Time::setNow(stamp);
+    double yaw = t * speed / 5.0;
+    double x = 5.0 * sin(yaw);
+    double y = 5.0 - 5.0 * cos(yaw);
+    setTransform(tf, "map", "base_link", stamp, x, y, 0.0, yaw);
+    setTransform(tf, "base_link", "sensor", stamp, 0.1, 0.0, 0.5, 0.0);
+
+    cloud.header.stamp = stamp;
+    buffer->lock();
+    buffer->bufferCloud(cloud);
+    buffer->unlock();
+
+    // Same steps than LayeredCostmap::updateMap(), with this layer only
+    master->updateOrigin(x - master->getSizeInMetersX() / 2, y - master->getSizeInMetersY() / 2);
+    double min_x = 1e30, min_y = 1e30, max_x = -1e30, max_y = -1e30;
+
+    ros::WallTime start = ros::WallTime::now();
+    layer->updateBounds(x, y, yaw, &min_x, &min_y, &max_x, &max_y);
+    latencies.bounds.push_back((ros::WallTime::now() - start).toSec() * 1000.0);
+
+    int x0, xn, y0, yn;
+    master->worldToMapEnforceBounds(min_x, min_y, x0, y0);
+    master->worldToMapEnforceBounds(max_x, max_y, xn, yn);
+    x0 = std::max(0, x0);
+    xn = std::min(int(master->getSizeInCellsX()), xn + 1);
+    y0 = std::max(0, y0);
+    yn = std::min(int(master->getSizeInCellsY()), yn + 1);
+    if (xn < x0 || yn < y0)
+    {
+      latencies.costs.push_back(0.0);
+      continue;
+    }
+    master->resetMap(x0, y0, xn, yn);
+
+    start = ros::WallTime::now();
+    layer->updateCosts(*master, x0, y0, xn, yn);
+    latencies.costs.push_back((ros::WallTime::now() - start).toSec() * 1000.0);
+  }
+
+  std::vector<costmap_2d::Observation> observations;
+  buffer->lock();
+  buffer->getObservations(observations);
+  buffer->unlock();
+  latencies.observations = (int)observations.size();
+  int expected = std::min(cycles, (int)(keep_time * rate) + 1);
+  if (std::abs(latencies.observations - expected) > 1)
+  {
+    ROS_WARN("%s: %d observations in the buffer, %d expected with observation_keep_time=%f and rate=%f",
+             name.c_str(), latencies.observations, expected, keep_time, rate);
+  }
+  return latencies;
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "voxel_layer_benchmark");
+  ros::NodeHandle pnh("~");
+
+  std::string grid_sizes_str = "5 10 20";       // m
+  std::string densities_str = "1000 10000 50000";  // points per cloud
+  double resolution = 0.05;
+  int cycles = 200;
+  double rate = 10.0;       // Hz, stamps of the synthetic clouds
+  double keep_time = 1.0;   // s, sliding window of observations kept in the buffer
+  double speed = 0.5;       // m/s
+  double max_range = 4.0;   // m
+  int z_voxels = 10;
+  double z_resolution = 0.2;
+  int seed = 0;
+  pnh.param("grid_sizes", grid_sizes_str, grid_sizes_str);
+  pnh.param("densities", densities_str, densities_str);
+  pnh.param("resolution", resolution, resolution);
+  pnh.param("cycles", cycles, cycles);
+  pnh.param("rate", rate, rate);
+  pnh.param("observation_keep_time", keep_time, keep_time);
+  pnh.param("speed", speed, speed);
+  pnh.param("max_range", max_range, max_range);
+  pnh.param("z_voxels", z_voxels, z_voxels);
+  pnh.param("z_resolution", z_resolution, z_resolution);
+  pnh.param("seed", seed, seed);
+
+  std::vector<double> grid_sizes = parseList(grid_sizes_str);
+  std::vector<double> densities = parseList(densities_str);
+  if (grid_sizes.empty() || densities.empty() || cycles <= 0 || rate <= 0.0 || resolution <= 0.0)
+  {
+    ROS_ERROR("Invalid benchmark parameters (grid_sizes=\"%s\", densities=\"%s\", cycles=%d, rate=%f, resolution=%f)",
+              grid_sizes_str.c_str(), densities_str.c_str(), cycles, rate, resolution);
+    return 1;
+  }
+
+  ROS_INFO("voxel_layer_benchmark: resolution=%f cycles=%d rate=%f keep_time=%f speed=%f max_range=%f "
+           "z_voxels=%d z_resolution=%f", resolution, cycles, rate, keep_time, speed, max_range, z_voxels,
+           z_resolution);
+
+  printf("%8s %8s %8s %5s | %28s | %28s\n", "size(m)", "cells", "points", "obs",
+         "updateBounds p50/p90/p99/max", "updateCosts p50/p90/p99/max");
+  int n = 0;
+  for (size_t i = 0; i < grid_sizes.size() && ros::ok(); ++i)
+  {
+    for (size_t j = 0; j < densities.size() && ros::ok(); ++j)
+    {
+      srand(seed);
+      TFBuffer tf(ros::Duration(keep_time + 10.0));
+
+      // each run has its own layer namespace, as dynamic_reconfigure servers cannot be recreated
+      std::ostringstream name_stream;
+      name_stream << "voxel_layer_benchmark/voxel_layer_" << n++;
+      std::string name = name_stream.str();
+      pnh.setParam(name + "/z_voxels", z_voxels);
+      pnh.setParam(name + "/z_resolution", z_resolution);
+      pnh.setParam(name + "/origin_z", 0.0);
+      pnh.setParam(name + "/publish_voxel_map", false);
+
+      Latencies latencies = run(tf, name, grid_sizes[i], resolution, (int)densities[j], cycles, rate, keep_time,
+                                speed, max_range);
+
+      printf("%8.1f %8d %8d %5d | %6.2f %6.2f %6.2f %6.2f ms | %6.2f %6.2f %6.2f %6.2f ms\n",
+             grid_sizes[i], (int)(grid_sizes[i] / resolution), (int)densities[j], latencies.observations,
+             percentile(latencies.bounds, 0.5), percentile(latencies.bounds, 0.9),
+             percentile(latencies.bounds, 0.99), percentile(latencies.bounds, 1.0),
+             percentile(latencies.costs, 0.5), percentile(latencies.costs, 0.9),
+             percentile(latencies.costs, 0.99), percentile(latencies.costs, 1.0));
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
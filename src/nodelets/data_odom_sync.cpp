@@ -38,6 +38,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <sensor_msgs/CameraInfo.h>
 #include <nav_msgs/Odometry.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include "rtabmap_ros/RGBDImage.h"
+#include "rtabmap/utilite/UConversion.h"
 
 namespace rtabmap_ros
 {
@@ -47,6 +53,11 @@ class DataOdomSyncNodelet : public nodelet::Nodelet
 public:
 	//Constructor
 	DataOdomSyncNodelet():
+		publishRGBD_(false),
+		queueSize_(10),
+		matched_(0),
+		offsetSum_(0.0),
+		offsetMax_(0.0),
 		sync_(0)
 	{
 	}
@@ -71,10 +82,16 @@ private:
 		image_transport::TransportHints hintsRgb("raw", ros::TransportHints(), rgb_pnh);
 		image_transport::TransportHints hintsDepth("raw", ros::TransportHints(), depth_pnh);
 
-		int queueSize = 10;
-		private_nh.param("queue_size", queueSize, queueSize);
+		double diagnosticsPeriod = 1.0;
+		private_nh.param("queue_size", queueSize_, queueSize_);
+		private_nh.param("publish_rgbd", publishRGBD_, publishRGBD_);
+		private_nh.param("diagnostics_period", diagnosticsPeriod, diagnosticsPeriod);
+
+		NODELET_INFO("%s: queue_size = %d", getName().c_str(), queueSize_);
+		NODELET_INFO("%s: publish_rgbd = %s", getName().c_str(), publishRGBD_?"true":"false");
+		NODELET_INFO("%s: diagnostics_period = %f", getName().c_str(), diagnosticsPeriod);
 
-		sync_ = new message_filters::Synchronizer<MySyncPolicy>(MySyncPolicy(queueSize), image_sub_, image_depth_sub_, info_sub_, odom_sub_);
+		sync_ = new message_filters::Synchronizer<MySyncPolicy>(MySyncPolicy(queueSize_), image_sub_, image_depth_sub_, info_sub_, odom_sub_);
 		sync_->registerCallback(boost::bind(&DataOdomSyncNodelet::callback, this, _1, _2, _3, _4));
 
 		image_sub_.subscribe(rgb_it, rgb_nh.resolveName("image_in"), 1, hintsRgb);
@@ -82,17 +99,168 @@ private:
 		info_sub_.subscribe(rgb_nh, "camera_info_in", 1);
 		odom_sub_.subscribe(nh, "odom_in", 1);
 
+		// Also count what each input receives, to derive what the sync policy drops
+		inputs_.resize(4);
+		inputs_[0].name = image_sub_.getTopic();
+		inputs_[1].name = image_depth_sub_.getTopic();
+		inputs_[2].name = info_sub_.getTopic();
+		inputs_[3].name = odom_sub_.getTopic();
+		image_sub_.registerCallback(boost::bind(&DataOdomSyncNodelet::imageReceived, this, _1, 0));
+		image_depth_sub_.registerCallback(boost::bind(&DataOdomSyncNodelet::imageReceived, this, _1, 1));
+		info_sub_.registerCallback(boost::bind(&DataOdomSyncNodelet::infoReceived, this, _1));
+		odom_sub_.registerCallback(boost::bind(&DataOdomSyncNodelet::odomReceived, this, _1));
+
 		imagePub_ = rgb_it.advertise("image_out", 1);
 		imageDepthPub_ = depth_it.advertise("image_out", 1);
 		infoPub_ = rgb_nh.advertise<sensor_msgs::CameraInfo>("camera_info_out", 1);
 		odomPub_ = nh.advertise<nav_msgs::Odometry>("odom_out", 1);
+		if(publishRGBD_)
+		{
+			rgbdImagePub_ = nh.advertise<rtabmap_ros::RGBDImage>("rgbd_image", 1);
+		}
+
+		if(diagnosticsPeriod > 0.0)
+		{
+			// global topic aggregated by diagnostic_aggregator
+			diagnosticsPub_ = nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+			diagnosticsTimer_ = nh.createTimer(ros::Duration(diagnosticsPeriod), &DataOdomSyncNodelet::publishDiagnostics, this);
+		}
+	};
+
+	// counts since the last report
+	struct InputStats
+	{
+		InputStats() : received(0), late(0) {}
+		std::string name;
+		int received;
+		int late;
 	};
 
+	void inputReceived(int index, const ros::Time & stamp)
+	{
+		boost::mutex::scoped_lock lock(statsMutex_);
+		++inputs_[index].received;
+		// older than the last synchronized set, it cannot be matched anymore
+		if(!lastMatchedStamp_.isZero() && stamp < lastMatchedStamp_)
+		{
+			++inputs_[index].late;
+		}
+	}
+	void imageReceived(const sensor_msgs::ImageConstPtr & msg, int index)
+	{
+		inputReceived(index, msg->header.stamp);
+	}
+	void infoReceived(const sensor_msgs::CameraInfoConstPtr & msg)
+	{
+		inputReceived(2, msg->header.stamp);
+	}
+	void odomReceived(const nav_msgs::OdometryConstPtr & msg)
+	{
+		inputReceived(3, msg->header.stamp);
+	}
+
+	void publishDiagnostics(const ros::TimerEvent &)
+	{
+		if(diagnosticsPub_.getNumSubscribers() == 0)
+		{
+			return;
+		}
+
+		diagnostic_msgs::DiagnosticArrayPtr msg(new diagnostic_msgs::DiagnosticArray);
+		msg->header.stamp = ros::Time::now();
+		diagnostic_msgs::DiagnosticStatus status;
+		status.name = getName();
+		status.hardware_id = "none";
+		status.level = diagnostic_msgs::DiagnosticStatus::OK;
+
+		boost::mutex::scoped_lock lock(statsMutex_);
+		status.values.resize(4);
+		status.values[0].key = "Queue size";
+		status.values[0].value = uNumber2Str(queueSize_);
+		status.values[1].key = "Matched";
+		status.values[1].value = uNumber2Str(matched_);
+		status.values[2].key = "Offset mean (s)";
+		status.values[2].value = uNumber2Str(matched_>0?offsetSum_/double(matched_):0.0);
+		status.values[3].key = "Offset max (s)";
+		status.values[3].value = uNumber2Str(offsetMax_);
+		int totalDropped = 0;
+		for(unsigned int i=0; i<inputs_.size(); ++i)
+		{
+			// Each set uses one message per input, the others received during the
+			// period were dropped (or are still waiting in the sync queue)
+			int dropped = inputs_[i].received > matched_?inputs_[i].received - matched_:0;
+			totalDropped += dropped;
+			diagnostic_msgs::KeyValue kv;
+			kv.key = inputs_[i].name + " received";
+			kv.value = uNumber2Str(inputs_[i].received);
+			status.values.push_back(kv);
+			kv.key = inputs_[i].name + " dropped";
+			kv.value = uNumber2Str(dropped);
+			status.values.push_back(kv);
+			kv.key = inputs_[i].name + " late";
+			kv.value = uNumber2Str(inputs_[i].late);
+			status.values.push_back(kv);
+		}
+		if(matched_ == 0)
+		{
+			status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+			status.message = "No synchronized data since last report";
+		}
+		else
+		{
+			status.message = uFormat("%d synchronized, %d dropped since last report", matched_, totalDropped);
+		}
+		for(unsigned int i=0; i<inputs_.size(); ++i)
+		{
+			inputs_[i].received = 0;
+			inputs_[i].late = 0;
+		}
+		matched_ = 0;
+		offsetSum_ = 0.0;
+		offsetMax_ = 0.0;
+		lock.unlock();
+
+		msg->status.push_back(status);
+		diagnosticsPub_.publish(msg);
+	}
+
 	void callback(const sensor_msgs::ImageConstPtr& image,
 			const sensor_msgs::ImageConstPtr& imageDepth,
 			const sensor_msgs::CameraInfoConstPtr& camInfo,
 			const nav_msgs::OdometryConstPtr & odom)
 	{
+		{
+			ros::Time minStamp = image->header.stamp;
+			ros::Time maxStamp = image->header.stamp;
+			const ros::Time stamps[3] = {imageDepth->header.stamp, camInfo->header.stamp, odom->header.stamp};
+			for(int i=0; i<3; ++i)
+			{
+				minStamp = stamps[i]<minStamp?stamps[i]:minStamp;
+				maxStamp = stamps[i]>maxStamp?stamps[i]:maxStamp;
+			}
+			double offset = (maxStamp - minStamp).toSec();
+
+			boost::mutex::scoped_lock lock(statsMutex_);
+			++matched_;
+			lastMatchedStamp_ = minStamp;
+			offsetSum_ += offset;
+			offsetMax_ = offset>offsetMax_?offset:offsetMax_;
+		}
+
+		if(rgbdImagePub_.getNumSubscribers())
+		{
+			rtabmap_ros::RGBDImagePtr msg(new rtabmap_ros::RGBDImage);
+			msg->header.frame_id = camInfo->header.frame_id;
+			msg->header.stamp = image->header.stamp>imageDepth->header.stamp?image->header.stamp:imageDepth->header.stamp;
+			msg->rgb_camera_info = *camInfo;
+			msg->depth_camera_info = *camInfo;
+			// The images are copied once in the message (the inputs are shared
+			// with other subscribers), it is published by pointer so that
+			// nodelets in the same manager don't serialize or copy it again.
+			msg->rgb = *image;
+			msg->depth = *imageDepth;
+			rgbdImagePub_.publish(msg);
+		}
 		if(imagePub_.getNumSubscribers())
 		{
 			imagePub_.publish(image);
@@ -115,6 +283,19 @@ private:
 	image_transport::Publisher imageDepthPub_;
 	ros::Publisher infoPub_;
 	ros::Publisher odomPub_;
+	ros::Publisher rgbdImagePub_;
+	ros::Publisher diagnosticsPub_;
+	ros::Timer diagnosticsTimer_;
+
+	bool publishRGBD_;
+	int queueSize_;
+
+	boost::mutex statsMutex_;
+	std::vector<InputStats> inputs_;
+	int matched_;
+	ros::Time lastMatchedStamp_;
+	double offsetSum_;
+	double offsetMax_;
 
 	image_transport::SubscriberFilter image_sub_;
 	image_transport::SubscriberFilter image_depth_sub_;
@@ -0,0 +1,491 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include "rtabmap_ros/MapData.h"
+#include "rtabmap_ros/MsgConversion.h"
+#include "rtabmap_ros/MapsManager.h"
+#include "rtabmap_ros/NodeDataCache.h"
+#include "rtabmap_ros/GetMap.h"
+#include "rtabmap_ros/GetNodeData.h"
+#include <rtabmap/core/util3d_transforms.h>
+#include <rtabmap/core/util3d.h>
+#include <rtabmap/core/util3d_filtering.h>
+#include <rtabmap/core/util3d_mapping.h>
+#include <rtabmap/core/Compression.h>
+#include <rtabmap/core/Graph.h>
+#include <rtabmap/utilite/ULogger.h>
+#include <rtabmap/utilite/UStl.h>
+#include <rtabmap/utilite/UTimer.h>
+#include <rtabmap/utilite/UFile.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <std_srvs/Empty.h>
+#include <std_msgs/Int32.h>
+#include <boost/thread.hpp>
+
+using namespace rtabmap;
+
+namespace rtabmap_ros
+{
+
+/**
+ * Assemble maps from the "mapData" topic published by rtabmap. When loaded in
+ * the same nodelet manager than rtabmap, MapData messages are passed by pointer
+ * and local grids already uncompressed by rtabmap's MapsManager are reused.
+ * On start, only the graph is requested from rtabmap ("get_map_data" with
+ * graphOnly), then data of nodes not found in the on-disk node cache
+ * ("node_cache_path") are requested in batches with "get_node_data".
+ * Cached nodes not in rtabmap's graph anymore are removed at that time. When
+ * rtabmap modifies local grids ("local_grids_modified", e.g., after
+ * "cleanup_local_grids"), the cache is cleared and all nodes are requested
+ * again.
+ */
+class MapAssembler : public nodelet::Nodelet
+{
+
+public:
+	MapAssembler() :
+		localGridsRegenerated_(false),
+		gridFromDepth_(Parameters::defaultGridFromDepth()),
+		syncTimeout_(10.0),
+		syncBatchSize_(50),
+		localGridsModified_(0),
+		syncThread_(0)
+	{}
+
+	virtual ~MapAssembler()
+	{
+		if(syncThread_)
+		{
+			syncThread_->join();
+			delete syncThread_;
+		}
+	}
+
+private:
+	virtual void onInit()
+	{
+		ros::NodeHandle & nh = getNodeHandle();
+		ros::NodeHandle & pnh = getPrivateNodeHandle();
+
+		std::string configPath;
+		std::string nodeCachePath;
+		bool startupSync = true;
+		pnh.param("config_path", configPath, configPath);
+		pnh.param("regenerate_local_grids", localGridsRegenerated_, localGridsRegenerated_);
+		pnh.param("node_cache_path", nodeCachePath, nodeCachePath);
+		pnh.param("startup_sync", startupSync, startupSync);
+		pnh.param("startup_sync_timeout", syncTimeout_, syncTimeout_);
+		pnh.param("startup_sync_batch_size", syncBatchSize_, syncBatchSize_);
+
+		//parameters
+		rtabmap::ParametersMap parameters;
+		uInsert(parameters, rtabmap::Parameters::getDefaultParameters("Grid"));
+		uInsert(parameters, rtabmap::Parameters::getDefaultParameters("StereoBM"));
+		if(!configPath.empty())
+		{
+			if(UFile::exists(configPath.c_str()))
+			{
+				NODELET_INFO( "%s: Loading parameters from %s", getName().c_str(), configPath.c_str());
+				rtabmap::ParametersMap allParameters;
+				Parameters::readINI(configPath.c_str(), allParameters);
+				// only update odometry parameters
+				for(ParametersMap::iterator iter=parameters.begin(); iter!=parameters.end(); ++iter)
+				{
+					ParametersMap::iterator jter = allParameters.find(iter->first);
+					if(jter!=allParameters.end())
+					{
+						iter->second = jter->second;
+					}
+				}
+			}
+			else
+			{
+				NODELET_ERROR( "Config file \"%s\" not found!", configPath.c_str());
+			}
+		}
+		for(rtabmap::ParametersMap::iterator iter=parameters.begin(); iter!=parameters.end(); ++iter)
+		{
+			std::string vStr;
+			bool vBool;
+			int vInt;
+			double vDouble;
+			if(pnh.getParam(iter->first, vStr))
+			{
+				NODELET_INFO( "Setting %s parameter \"%s\"=\"%s\"", getName().c_str(), iter->first.c_str(), vStr.c_str());
+				iter->second = vStr;
+			}
+			else if(pnh.getParam(iter->first, vBool))
+			{
+				NODELET_INFO( "Setting %s parameter \"%s\"=\"%s\"", getName().c_str(), iter->first.c_str(), uBool2Str(vBool).c_str());
+				iter->second = uBool2Str(vBool);
+			}
+			else if(pnh.getParam(iter->first, vDouble))
+			{
+				NODELET_INFO( "Setting %s parameter \"%s\"=\"%s\"", getName().c_str(), iter->first.c_str(), uNumber2Str(vDouble).c_str());
+				iter->second = uNumber2Str(vDouble);
+			}
+			else if(pnh.getParam(iter->first, vInt))
+			{
+				NODELET_INFO( "Setting %s parameter \"%s\"=\"%s\"", getName().c_str(), iter->first.c_str(), uNumber2Str(vInt).c_str());
+				iter->second = uNumber2Str(vInt);
+			}
+
+			if(iter->first.compare(Parameters::kVisMinInliers()) == 0 && atoi(iter->second.c_str()) < 8)
+			{
+				NODELET_WARN( "Parameter min_inliers must be >= 8, setting to 8...");
+				iter->second = uNumber2Str(8);
+			}
+		}
+
+		std::vector<std::string> argList = getMyArgv();
+		char ** argv = new char*[argList.size()];
+		for(unsigned int i=0; i<argList.size(); ++i)
+		{
+			argv[i] = &argList[i].at(0);
+		}
+		rtabmap::ParametersMap argParameters = rtabmap::Parameters::parseArguments(argList.size(), argv);
+		delete [] argv;
+		for(rtabmap::ParametersMap::iterator iter=argParameters.begin(); iter!=argParameters.end(); ++iter)
+		{
+			rtabmap::ParametersMap::iterator jter = parameters.find(iter->first);
+			if(jter!=parameters.end())
+			{
+				NODELET_INFO( "Update %s parameter \"%s\"=\"%s\" from arguments", getName().c_str(), iter->first.c_str(), iter->second.c_str());
+				jter->second = iter->second;
+			}
+		}
+
+		// Backward compatibility
+		for(std::map<std::string, std::pair<bool, std::string> >::const_iterator iter=Parameters::getRemovedParameters().begin();
+			iter!=Parameters::getRemovedParameters().end();
+			++iter)
+		{
+			std::string vStr;
+			if(pnh.getParam(iter->first, vStr))
+			{
+				if(iter->second.first && parameters.find(iter->second.second) != parameters.end())
+				{
+					// can be migrated
+					parameters.at(iter->second.second)= vStr;
+					NODELET_WARN( "%s: Parameter name changed: \"%s\" -> \"%s\". Please update your launch file accordingly. Value \"%s\" is still set to the new parameter name.",
+							getName().c_str(), iter->first.c_str(), iter->second.second.c_str(), vStr.c_str());
+				}
+				else
+				{
+					if(iter->second.second.empty())
+					{
+						NODELET_ERROR( "%s: Parameter \"%s\" doesn't exist anymore!",
+								getName().c_str(), iter->first.c_str());
+					}
+					else
+					{
+						NODELET_ERROR( "%s: Parameter \"%s\" doesn't exist anymore! You may look at this similar parameter: \"%s\"",
+								getName().c_str(), iter->first.c_str(), iter->second.second.c_str());
+					}
+				}
+			}
+		}
+
+		NODELET_INFO("%s: regenerate_local_grids          = %s", getName().c_str(), localGridsRegenerated_?"true":"false");
+		NODELET_INFO("%s: node_cache_path                 = %s", getName().c_str(), nodeCachePath.c_str());
+		NODELET_INFO("%s: startup_sync                    = %s", getName().c_str(), startupSync?"true":"false");
+		NODELET_INFO("%s: startup_sync_timeout            = %f s", getName().c_str(), syncTimeout_);
+		NODELET_INFO("%s: startup_sync_batch_size         = %d", getName().c_str(), syncBatchSize_);
+		mapsManager_.init(nh, pnh, getName(), false);
+		mapsManager_.backwardCompatibilityParameters(pnh, parameters);
+		mapsManager_.setParameters(parameters);
+		Parameters::parse(parameters, Parameters::kGridFromDepth(), gridFromDepth_);
+		nodeCache_.setPath(nodeCachePath);
+
+		mapDataTopic_ = nh.subscribe("mapData", 1, &MapAssembler::mapDataReceivedCallback, this);
+		localGridsModifiedTopic_ = nh.subscribe("local_grids_modified", 1, &MapAssembler::localGridsModifiedCallback, this);
+
+		// private service
+		resetService_ = pnh.advertiseService("reset", &MapAssembler::reset, this);
+
+		if(startupSync)
+		{
+			syncThread_ = new boost::thread(boost::bind(&MapAssembler::startupSync, this, syncTimeout_, syncBatchSize_));
+		}
+	}
+
+	// rtabmap modified local grids without republishing the nodes: we don't
+	// know which ones, so all node data is requested again.
+	void localGridsModifiedCallback(const std_msgs::Int32ConstPtr & msg)
+	{
+		if(msg->data == localGridsModified_)
+		{
+			return;
+		}
+		localGridsModified_ = msg->data;
+		NODELET_WARN("map_assembler: Local grids modified by rtabmap, clearing node cache and requesting all nodes again.");
+		if(syncThread_)
+		{
+			syncThread_->join();
+			delete syncThread_;
+		}
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			nodes_.clear();
+			mapsManager_.clear();
+		}
+		nodeCache_.clear();
+		syncThread_ = new boost::thread(boost::bind(&MapAssembler::startupSync, this, syncTimeout_, syncBatchSize_));
+	}
+
+	void addNode(const rtabmap_ros::NodeData & msg)
+	{
+		Signature data = rtabmap_ros::nodeDataFromROS(msg);
+		if(localGridsRegenerated_)
+		{
+			data.sensorData().setOccupancyGrid(cv::Mat(), cv::Mat(), cv::Mat(), 0, cv::Point3f());
+		}
+		uInsert(nodes_, std::make_pair(msg.id, data));
+	}
+
+	// Handshake with rtabmap after a restart: get only the graph, then the
+	// data of the nodes that are not already in memory or in the node cache.
+	void startupSync(double timeout, int batchSize)
+	{
+		UTimer timer;
+		ros::NodeHandle & nh = getNodeHandle();
+		ros::ServiceClient graphClient = nh.serviceClient<rtabmap_ros::GetMap>("get_map_data");
+		ros::ServiceClient dataClient = nh.serviceClient<rtabmap_ros::GetNodeData>("get_node_data");
+		if(!graphClient.waitForExistence(ros::Duration(timeout)))
+		{
+			NODELET_WARN("map_assembler: Service \"%s\" not available after %f s, skipping startup sync. "
+					"The map will be assembled from next \"mapData\" messages.",
+					graphClient.getService().c_str(), timeout);
+			return;
+		}
+
+		rtabmap_ros::GetMap getMap;
+		getMap.request.global = true;
+		getMap.request.optimized = true;
+		getMap.request.graphOnly = true;
+		if(!graphClient.call(getMap))
+		{
+			NODELET_WARN("map_assembler: Failed to call \"%s\", skipping startup sync.", graphClient.getService().c_str());
+			return;
+		}
+		const rtabmap_ros::MapData & graph = getMap.response.data;
+		double graphTime = timer.ticks();
+
+		std::map<int, const rtabmap_ros::NodeData*> infos;
+		for(size_t i=0; i<graph.nodes.size(); ++i)
+		{
+			infos.insert(std::make_pair(graph.nodes[i].id, &graph.nodes[i]));
+		}
+
+		// Remove nodes deleted from rtabmap's graph (the global graph has
+		// all nodes). Nodes received after the graph request are kept.
+		std::set<int> graphIds(graph.graph.posesId.begin(), graph.graph.posesId.end());
+		int lastGraphId = graphIds.empty()?0:*graphIds.rbegin();
+		int pruned = 0;
+		std::set<int> diskIds = nodeCache_.ids();
+		for(std::set<int>::iterator iter=diskIds.begin(); iter!=diskIds.end() && *iter <= lastGraphId; ++iter)
+		{
+			if(graphIds.find(*iter) == graphIds.end())
+			{
+				nodeCache_.remove(*iter);
+				++pruned;
+			}
+		}
+
+		std::set<int> cachedIds;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			for(std::map<int, Signature>::iterator iter=nodes_.begin(); iter!=nodes_.end();)
+			{
+				if(iter->first > 0 && iter->first <= lastGraphId && graphIds.find(iter->first) == graphIds.end())
+				{
+					nodes_.erase(iter++);
+				}
+				else
+				{
+					cachedIds.insert(iter->first);
+					++iter;
+				}
+			}
+		}
+
+		// Load from disk the nodes we don't have, checking that they are
+		// the same nodes than in the graph (e.g., not from an older map).
+		std::list<rtabmap_ros::NodeData> loaded;
+		std::vector<int> missing;
+		for(size_t i=0; i<graph.graph.posesId.size() && ros::ok(); ++i)
+		{
+			int id = graph.graph.posesId[i];
+			if(id <= 0 || cachedIds.find(id) != cachedIds.end())
+			{
+				continue;
+			}
+			rtabmap_ros::NodeData node;
+			std::map<int, const rtabmap_ros::NodeData*>::iterator info = infos.find(id);
+			if(nodeCache_.load(id, node) &&
+			   (info == infos.end() || (node.stamp == info->second->stamp && node.mapId == info->second->mapId)))
+			{
+				loaded.push_back(node);
+			}
+			else
+			{
+				missing.push_back(id);
+			}
+		}
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			for(std::list<rtabmap_ros::NodeData>::iterator iter=loaded.begin(); iter!=loaded.end(); ++iter)
+			{
+				addNode(*iter);
+			}
+		}
+		int fromDisk = (int)loaded.size();
+		loaded.clear();
+		double diskTime = timer.ticks();
+
+		int fetched = 0;
+		if(!missing.empty() && dataClient.waitForExistence(ros::Duration(timeout)))
+		{
+			size_t batch = batchSize>0?(size_t)batchSize:missing.size();
+			for(size_t i=0; i<missing.size() && ros::ok(); i+=batch)
+			{
+				rtabmap_ros::GetNodeData getData;
+				getData.request.ids.assign(missing.begin()+i, missing.begin()+std::min(missing.size(), i+batch));
+				getData.request.grid = true;
+				getData.request.images = localGridsRegenerated_ && gridFromDepth_;
+				getData.request.scan = localGridsRegenerated_ && !gridFromDepth_;
+				getData.request.user_data = false;
+				if(!dataClient.call(getData))
+				{
+					NODELET_WARN("map_assembler: Failed to call \"%s\" for %d nodes.", dataClient.getService().c_str(), (int)getData.request.ids.size());
+					continue;
+				}
+				boost::mutex::scoped_lock lock(mutex_);
+				for(size_t j=0; j<getData.response.data.size(); ++j)
+				{
+					nodeCache_.save(getData.response.data[j]);
+					addNode(getData.response.data[j]);
+					++fetched;
+				}
+			}
+		}
+		else if(!missing.empty())
+		{
+			NODELET_WARN("map_assembler: Service \"%s\" not available, %d nodes will be missing until republished.",
+					dataClient.getService().c_str(), (int)missing.size());
+		}
+		double fetchTime = timer.ticks();
+
+		rtabmap_ros::MapDataPtr msg(new rtabmap_ros::MapData);
+		msg->header.stamp = ros::Time::now();
+		msg->header.frame_id = graph.header.frame_id;
+		msg->graph = graph.graph;
+		mapDataReceivedCallback(msg);
+
+		NODELET_INFO("map_assembler: Startup sync of %d nodes: %d from memory, %d from disk cache, %d fetched, "
+				"%d deleted nodes removed from cache (graph=%fs disk=%fs fetch=%fs)",
+				(int)graph.graph.posesId.size(), (int)cachedIds.size(), fromDisk, fetched, pruned, graphTime, diskTime, fetchTime);
+	}
+
+	void mapDataReceivedCallback(const rtabmap_ros::MapDataConstPtr & msg)
+	{
+		UTimer timer;
+		boost::mutex::scoped_lock lock(mutex_);
+
+		std::map<int, Transform> poses;
+		std::multimap<int, Link> constraints;
+		Transform mapOdom;
+		rtabmap_ros::mapGraphFromROS(msg->graph, poses, constraints, mapOdom);
+		for(unsigned int i=0; i<msg->nodes.size(); ++i)
+		{
+			if(msg->nodes[i].image.size() ||
+			   msg->nodes[i].depth.size() ||
+			   msg->nodes[i].laserScan.size())
+			{
+				// Always saved: a node republished by rtabmap (e.g., after its local
+				// grid has been modified) replaces the one in memory and in the cache.
+				nodeCache_.save(msg->nodes[i]);
+				addNode(msg->nodes[i]);
+			}
+		}
+
+		// create a tmp signature with latest sensory data
+		if(poses.size() && nodes_.find(poses.rbegin()->first) != nodes_.end())
+		{
+			Signature tmpS = nodes_.at(poses.rbegin()->first);
+			SensorData tmpData = tmpS.sensorData();
+			tmpData.setId(0);
+			uInsert(nodes_, std::make_pair(0, Signature(0, -1, 0, tmpS.getStamp(), "", tmpS.getPose(), Transform(), tmpData)));
+			poses.insert(std::make_pair(0, poses.rbegin()->second));
+		}
+
+		// Update maps
+		poses = mapsManager_.updateMapCaches(
+				poses,
+				0,
+				false,
+				false,
+				nodes_);
+
+		mapsManager_.publishMaps(poses, msg->header.stamp, msg->header.frame_id);
+
+		NODELET_INFO("map_assembler: Publishing data = %fs", timer.ticks());
+	}
+
+	bool reset(std_srvs::Empty::Request&, std_srvs::Empty::Response&)
+	{
+		NODELET_INFO("map_assembler: reset!");
+		boost::mutex::scoped_lock lock(mutex_);
+		mapsManager_.clear();
+		return true;
+	}
+
+	MapsManager mapsManager_;
+	std::map<int, Signature> nodes_;
+
+	ros::Subscriber mapDataTopic_;
+	ros::Subscriber localGridsModifiedTopic_;
+
+	ros::ServiceServer resetService_;
+
+	bool localGridsRegenerated_;
+	bool gridFromDepth_;
+	double syncTimeout_;
+	int syncBatchSize_;
+	int localGridsModified_;
+
+	NodeDataCache nodeCache_;
+	boost::thread * syncThread_;
+	boost::mutex mutex_;
+};
+
+PLUGINLIB_EXPORT_CLASS(rtabmap_ros::MapAssembler, nodelet::Nodelet);
+}
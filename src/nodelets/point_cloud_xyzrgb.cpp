@@ -78,6 +78,9 @@ public:
 		normalK_(0),
 		normalRadius_(0.0),
 		filterNaNs_(false),
+		rgbdImagePlan_(ImageIngestionPlan::kTargetColor),
+		rgbdDepthPlan_(ImageIngestionPlan::kTargetDepth),
+		rgbdRightPlan_(ImageIngestionPlan::kTargetMono),
 		approxSyncDepth_(0),
 		approxSyncDisparity_(0),
 		approxSyncStereo_(0),
@@ -449,7 +452,7 @@ private:
 		{
 			ros::WallTime time = ros::WallTime::now();
 
-			rtabmap::SensorData data = rtabmap_ros::rgbdImageFromROS(image);
+			rtabmap::SensorData data = rtabmap_ros::rgbdImageFromROS(image, &rgbdImagePlan_, &rgbdDepthPlan_, &rgbdRightPlan_);
 			pcl::PointCloud<pcl::PointXYZRGB>::Ptr pclCloud;
 			pcl::IndicesPtr indices(new std::vector<int>);
 			if(data.isValid())
@@ -534,6 +537,9 @@ private:
 	bool filterNaNs_;
 	std::vector<float> roiRatios_;
 	rtabmap::ParametersMap stereoBMParameters_;
+	ImageIngestionPlan rgbdImagePlan_;
+	ImageIngestionPlan rgbdDepthPlan_;
+	ImageIngestionPlan rgbdRightPlan_;
 
 	ros::Publisher cloudPub_;
 
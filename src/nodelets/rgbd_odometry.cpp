@@ -51,6 +51,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <rtabmap/utilite/UConversion.h>
 #include <rtabmap/utilite/UStl.h>
 
+#include <boost/thread/thread.hpp>
+
 using namespace rtabmap;
 
 namespace rtabmap_ros
@@ -358,6 +360,11 @@ private:
 		}
 	}
 
+	void lookupCameraTransform(const std::string & cameraFrameId, const ros::Time & stamp, Transform * localTransform) const
+	{
+		*localTransform = getTransform(this->frameId(), cameraFrameId, stamp);
+	}
+
 	void commonCallback(
 				const std::vector<cv_bridge::CvImageConstPtr> & rgbImages,
 				const std::vector<cv_bridge::CvImageConstPtr> & depthImages,
@@ -375,23 +382,17 @@ private:
 			uFormat("rgb=%dx%d depth=%dx%d", imageWidth, imageHeight, depthWidth, depthHeight).c_str());
 
 		int cameraCount = rgbImages.size();
-		cv::Mat rgb;
-		cv::Mat depth;
 		pcl::PointCloud<pcl::PointXYZ> scanCloud;
 		std::vector<CameraModel> cameraModels;
+		std::vector<ros::Time> stamps(cameraCount);
+		if((int)rgbPlans_.size() != cameraCount)
+		{
+			rgbPlans_ = std::vector<ImageIngestionPlan>(cameraCount, ImageIngestionPlan(keepColor_?ImageIngestionPlan::kTargetColor:ImageIngestionPlan::kTargetMono));
+			depthPlans_ = std::vector<ImageIngestionPlan>(cameraCount, ImageIngestionPlan(ImageIngestionPlan::kTargetDepth));
+		}
 		for(unsigned int i=0; i<rgbImages.size(); ++i)
 		{
-			if(!(rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) ==0 ||
-				 rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::MONO8) ==0 ||
-				 rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::MONO16) ==0 ||
-				 rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-				 rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0 ||
-				 rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::BGRA8) == 0 ||
-				 rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::RGBA8) == 0 ||
-				 rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::BAYER_GRBG8) == 0) ||
-				!(depthImages[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_16UC1) == 0 ||
-				 depthImages[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_32FC1) == 0 ||
-				 depthImages[i]->encoding.compare(sensor_msgs::image_encodings::MONO16) == 0))
+			if(!rgbPlans_[i].update(rgbImages[i]) || !depthPlans_[i].update(depthImages[i]))
 				 {
 	 				NODELET_ERROR("Input type must be image=mono8,mono16,rgb8,bgr8,bgra8,rgba8 and "
 	 				"image_depth=32FC1,16UC1,mono16. Current rgb=%s and depth=%s",
@@ -412,76 +413,66 @@ private:
 							depthHeight,
 							depthImages[i]->image.rows).c_str());
 
-			ros::Time stamp = rgbImages[i]->header.stamp>depthImages[i]->header.stamp?rgbImages[i]->header.stamp:depthImages[i]->header.stamp;
+			stamps[i] = rgbImages[i]->header.stamp>depthImages[i]->header.stamp?rgbImages[i]->header.stamp:depthImages[i]->header.stamp;
 
-			if(i == 0)
-			{
-				higherStamp = stamp;
-			}
-			else if(stamp > higherStamp)
+			if(i == 0 || stamps[i] > higherStamp)
 			{
-				higherStamp = stamp;
+				higherStamp = stamps[i];
 			}
 
-			Transform localTransform = getTransform(this->frameId(), rgbImages[i]->header.frame_id, stamp);
-			if(localTransform.isNull())
+			if(rgbPlans_[i].outputType() != rgbPlans_[0].outputType())
 			{
+				NODELET_ERROR("Some RGB images are not the same type!");
 				return;
 			}
-
-			cv_bridge::CvImageConstPtr ptrImage = rgbImages[i];
-			if(rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) !=0 &&
-			   rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::MONO8) != 0)
-			{
-				if(keepColor_ && rgbImages[i]->encoding.compare(sensor_msgs::image_encodings::MONO16) != 0)
-				{
-					ptrImage = cv_bridge::cvtColor(rgbImages[i], "bgr8");
-				}
-				else
-				{
-					ptrImage = cv_bridge::cvtColor(rgbImages[i], "mono8");
-				}
-			}
-
-			cv_bridge::CvImageConstPtr ptrDepth = depthImages[i];
-			cv::Mat subDepth = ptrDepth->image;
-
-			// initialize
-			if(rgb.empty())
-			{
-				rgb = cv::Mat(imageHeight, imageWidth*cameraCount, ptrImage->image.type());
-			}
-			if(depth.empty())
+			if(depthPlans_[i].outputType() != depthPlans_[0].outputType())
 			{
-				depth = cv::Mat(depthHeight, depthWidth*cameraCount, subDepth.type());
+				NODELET_ERROR("Some Depth images are not the same type! %d vs %d", depthPlans_[i].outputType(), depthPlans_[0].outputType());
+				return;
 			}
+		}
 
-			if(ptrImage->image.type() == rgb.type())
+		// With many cameras, the TF lookups run on their own threads, in parallel
+		// together and with the conversion below. They are not done in
+		// cv::parallel_for_, where waiting for a transform would hold OpenCV's pool.
+		std::vector<Transform> localTransforms(cameraCount);
+		boost::thread_group lookups;
+		if(cameraCount > 1)
+		{
+			for(int i=0; i<cameraCount; ++i)
 			{
-				ptrImage->image.copyTo(cv::Mat(rgb, cv::Rect(i*imageWidth, 0, imageWidth, imageHeight)));
+				lookups.create_thread(boost::bind(&RGBDOdometry::lookupCameraTransform, this, rgbImages[i]->header.frame_id, stamps[i], &localTransforms[i]));
 			}
-			else
+		}
+		else
+		{
+			lookupCameraTransform(rgbImages[0]->header.frame_id, stamps[0], &localTransforms[0]);
+			if(localTransforms[0].isNull())
 			{
-				NODELET_ERROR("Some RGB images are not the same type!");
 				return;
 			}
+		}
 
-			if(subDepth.type() == depth.type())
-			{
-				subDepth.copyTo(cv::Mat(depth, cv::Rect(i*depthWidth, 0, depthWidth, depthHeight)));
-			}
-			else
+		// initialize (buffers of the previous frame are reused if odometry released them)
+		ImageIngestionPlan::reuseBuffer(rgbBuffer_, imageHeight, imageWidth*cameraCount, rgbPlans_[0].outputType());
+		ImageIngestionPlan::reuseBuffer(depthBuffer_, depthHeight, depthWidth*cameraCount, depthPlans_[0].outputType());
+
+		ImageIngestionPlan::convertToMosaic(rgbImages, rgbPlans_, rgbBuffer_);
+		ImageIngestionPlan::convertToMosaic(depthImages, depthPlans_, depthBuffer_);
+
+		lookups.join_all();
+		for(int i=0; i<cameraCount; ++i)
+		{
+			if(localTransforms[i].isNull())
 			{
-				NODELET_ERROR("Some Depth images are not the same type! %d vs %d", subDepth.type(), depth.type());
 				return;
 			}
-
-			cameraModels.push_back(rtabmap_ros::cameraModelFromROS(cameraInfos[i], localTransform));
+			cameraModels.push_back(rtabmap_ros::cameraModelFromROS(cameraInfos[i], localTransforms[i]));
 		}
 
 		rtabmap::SensorData data(
-				rgb,
-				depth,
+				rgbBuffer_,
+				depthBuffer_,
 				cameraModels,
 				0,
 				rtabmap_ros::timestampFromROS(higherStamp));
@@ -757,6 +748,10 @@ private:
 	message_filters::Synchronizer<MyExactSync5Policy> * exactSync5_;
 	int queueSize_;
 	bool keepColor_;
+	std::vector<ImageIngestionPlan> rgbPlans_;
+	std::vector<ImageIngestionPlan> depthPlans_;
+	cv::Mat rgbBuffer_;
+	cv::Mat depthBuffer_;
 };
 
 PLUGINLIB_EXPORT_CLASS(rtabmap_ros::RGBDOdometry, nodelet::Nodelet);
@@ -89,9 +89,9 @@ private:
 	{
 		if(rgbdImagePub_.getNumSubscribers())
 		{
-			if(!compress_ && !uncompress_)
+			if(canRelayRGBDImage(*input, compress_, uncompress_))
 			{
-				//just republish it
+				// already in the requested form, forward it without copy or re-encoding
 				rgbdImagePub_.publish(input);
 				return;
 			}
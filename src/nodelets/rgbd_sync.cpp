@@ -66,7 +66,9 @@ public:
 		warningThread_(0),
 		callbackCalled_(false),
 		approxSyncDepth_(0),
-		exactSyncDepth_(0)
+		exactSyncDepth_(0),
+		approxSyncCompressedRgb_(0),
+		exactSyncCompressedRgb_(0)
 	{}
 
 	virtual ~RGBDSync()
@@ -75,6 +77,10 @@ public:
 			delete approxSyncDepth_;
 		if(exactSyncDepth_)
 			delete exactSyncDepth_;
+		if(approxSyncCompressedRgb_)
+			delete approxSyncCompressedRgb_;
+		if(exactSyncCompressedRgb_)
+			delete exactSyncCompressedRgb_;
 
 		if(warningThread_)
 		{
@@ -112,17 +118,6 @@ private:
 		rgbdImagePub_ = nh.advertise<rtabmap_ros::RGBDImage>("rgbd_image", 1);
 		rgbdImageCompressedPub_ = nh.advertise<rtabmap_ros::RGBDImage>("rgbd_image/compressed", 1);
 
-		if(approxSync)
-		{
-			approxSyncDepth_ = new message_filters::Synchronizer<MyApproxSyncDepthPolicy>(MyApproxSyncDepthPolicy(queueSize), imageSub_, imageDepthSub_, cameraInfoSub_);
-			approxSyncDepth_->registerCallback(boost::bind(&RGBDSync::callback, this, _1, _2, _3));
-		}
-		else
-		{
-			exactSyncDepth_ = new message_filters::Synchronizer<MyExactSyncDepthPolicy>(MyExactSyncDepthPolicy(queueSize), imageSub_, imageDepthSub_, cameraInfoSub_);
-			exactSyncDepth_->registerCallback(boost::bind(&RGBDSync::callback, this, _1, _2, _3));
-		}
-
 		ros::NodeHandle rgb_nh(nh, "rgb");
 		ros::NodeHandle depth_nh(nh, "depth");
 		ros::NodeHandle rgb_pnh(pnh, "rgb");
@@ -132,14 +127,46 @@ private:
 		image_transport::TransportHints hintsRgb("raw", ros::TransportHints(), rgb_pnh);
 		image_transport::TransportHints hintsDepth("raw", ros::TransportHints(), depth_pnh);
 
-		imageSub_.subscribe(rgb_it, rgb_nh.resolveName("image"), 1, hintsRgb);
+		// With compressed rgb input, subscribe directly to the compressed topic
+		// so that it can be forwarded without being decoded and re-encoded.
+		bool compressedRgb = hintsRgb.getTransport().compare("compressed") == 0;
+		NODELET_INFO("%s: rgb/image_transport = %s", getName().c_str(), hintsRgb.getTransport().c_str());
+
+		if(compressedRgb)
+		{
+			if(approxSync)
+			{
+				approxSyncCompressedRgb_ = new message_filters::Synchronizer<MyApproxSyncCompressedRgbPolicy>(MyApproxSyncCompressedRgbPolicy(queueSize), imageCompressedSub_, imageDepthSub_, cameraInfoSub_);
+				approxSyncCompressedRgb_->registerCallback(boost::bind(&RGBDSync::callbackCompressedRgb, this, _1, _2, _3));
+			}
+			else
+			{
+				exactSyncCompressedRgb_ = new message_filters::Synchronizer<MyExactSyncCompressedRgbPolicy>(MyExactSyncCompressedRgbPolicy(queueSize), imageCompressedSub_, imageDepthSub_, cameraInfoSub_);
+				exactSyncCompressedRgb_->registerCallback(boost::bind(&RGBDSync::callbackCompressedRgb, this, _1, _2, _3));
+			}
+			imageCompressedSub_.subscribe(rgb_nh, rgb_nh.resolveName("image") + "/compressed", 1);
+		}
+		else
+		{
+			if(approxSync)
+			{
+				approxSyncDepth_ = new message_filters::Synchronizer<MyApproxSyncDepthPolicy>(MyApproxSyncDepthPolicy(queueSize), imageSub_, imageDepthSub_, cameraInfoSub_);
+				approxSyncDepth_->registerCallback(boost::bind(&RGBDSync::callback, this, _1, _2, _3));
+			}
+			else
+			{
+				exactSyncDepth_ = new message_filters::Synchronizer<MyExactSyncDepthPolicy>(MyExactSyncDepthPolicy(queueSize), imageSub_, imageDepthSub_, cameraInfoSub_);
+				exactSyncDepth_->registerCallback(boost::bind(&RGBDSync::callback, this, _1, _2, _3));
+			}
+			imageSub_.subscribe(rgb_it, rgb_nh.resolveName("image"), 1, hintsRgb);
+		}
 		imageDepthSub_.subscribe(depth_it, depth_nh.resolveName("image"), 1, hintsDepth);
 		cameraInfoSub_.subscribe(rgb_nh, "camera_info", 1);
 
 		std::string subscribedTopicsMsg = uFormat("\n%s subscribed to (%s sync):\n   %s \\\n   %s \\\n   %s",
 							getName().c_str(),
 							approxSync?"approx":"exact",
-							imageSub_.getTopic().c_str(),
+							compressedRgb?imageCompressedSub_.getTopic().c_str():imageSub_.getTopic().c_str(),
 							imageDepthSub_.getTopic().c_str(),
 							cameraInfoSub_.getTopic().c_str());
 
@@ -170,17 +197,42 @@ private:
 			  const sensor_msgs::ImageConstPtr& image,
 			  const sensor_msgs::ImageConstPtr& depth,
 			  const sensor_msgs::CameraInfoConstPtr& cameraInfo)
+	{
+		processData(image, sensor_msgs::CompressedImageConstPtr(), depth, cameraInfo);
+	}
+
+	void callbackCompressedRgb(
+			  const sensor_msgs::CompressedImageConstPtr& imageCompressed,
+			  const sensor_msgs::ImageConstPtr& depth,
+			  const sensor_msgs::CameraInfoConstPtr& cameraInfo)
+	{
+		sensor_msgs::ImageConstPtr image;
+		if(rgbdImagePub_.getNumSubscribers() || !rtabmap_ros::canForwardCompressedImage(*imageCompressed, decimation_))
+		{
+			// raw image required, decode it only in that case
+			image = cv_bridge::toCvCopy(imageCompressed)->toImageMsg();
+		}
+		processData(image, imageCompressed, depth, cameraInfo);
+	}
+
+	// image can be null if imageCompressed is set and no raw output is required
+	void processData(
+			  const sensor_msgs::ImageConstPtr& image,
+			  const sensor_msgs::CompressedImageConstPtr& imageCompressed,
+			  const sensor_msgs::ImageConstPtr& depth,
+			  const sensor_msgs::CameraInfoConstPtr& cameraInfo)
 	{
 		callbackCalled_ = true;
 		if(rgbdImagePub_.getNumSubscribers() || rgbdImageCompressedPub_.getNumSubscribers())
 		{
-			double rgbStamp = image->header.stamp.toSec();
+			const std_msgs::Header & rgbHeader = image.get()?image->header:imageCompressed->header;
+			double rgbStamp = rgbHeader.stamp.toSec();
 			double depthStamp = depth->header.stamp.toSec();
 			double infoStamp = cameraInfo->header.stamp.toSec();
 
 			rtabmap_ros::RGBDImage msg;
 			msg.header.frame_id = cameraInfo->header.frame_id;
-			msg.header.stamp = image->header.stamp>depth->header.stamp?image->header.stamp:depth->header.stamp;
+			msg.header.stamp = rgbHeader.stamp>depth->header.stamp?rgbHeader.stamp:depth->header.stamp;
 			if(decimation_>1 && !(depth->width % decimation_ == 0 && depth->height % decimation_ == 0))
 			{
 				ROS_WARN("Decimation of depth images should be exact (decimation=%d, size=(%d,%d))! "
@@ -204,9 +256,11 @@ private:
 
 			cv::Mat rgbMat;
 			cv::Mat depthMat;
-			cv_bridge::CvImageConstPtr imagePtr = cv_bridge::toCvShare(image);
 			cv_bridge::CvImageConstPtr imageDepthPtr = cv_bridge::toCvShare(depth);
-			rgbMat = imagePtr->image;
+			if(image.get())
+			{
+				rgbMat = cv_bridge::toCvShare(image)->image;
+			}
 			depthMat = imageDepthPtr->image;
 
 			if(decimation_>1)
@@ -241,11 +295,15 @@ private:
 					msgCompressed.rgb_camera_info = msg.rgb_camera_info;
 					msgCompressed.depth_camera_info = msg.depth_camera_info;
 
+					// the compressed input is forwarded unchanged if possible, otherwise image is set
 					cv_bridge::CvImage cvImg;
-					cvImg.header = image->header;
-					cvImg.image = rgbMat;
-					cvImg.encoding = image->encoding;
-					cvImg.toCompressedImageMsg(msgCompressed.rgb_compressed, cv_bridge::JPG);
+					if(image.get())
+					{
+						cvImg.header = image->header;
+						cvImg.image = rgbMat;
+						cvImg.encoding = image->encoding;
+					}
+					rtabmap_ros::rgbCompressedToROS(imageCompressed, cvImg, decimation_, msgCompressed.rgb_compressed);
 
 					msgCompressed.depth_compressed.header = imageDepthPtr->header;
 					msgCompressed.depth_compressed.data = rtabmap::compressImage(depthMat, ".png");
@@ -256,7 +314,7 @@ private:
 				}
 			}
 
-			if(rgbdImagePub_.getNumSubscribers())
+			if(rgbdImagePub_.getNumSubscribers() && image.get())
 			{
 				cv_bridge::CvImage cvImg;
 				cvImg.header = image->header;
@@ -273,14 +331,14 @@ private:
 				rgbdImagePub_.publish(msg);
 			}
 
-			if( rgbStamp != image->header.stamp.toSec() ||
+			if( rgbStamp != rgbHeader.stamp.toSec() ||
 				depthStamp != depth->header.stamp.toSec())
 			{
 				NODELET_ERROR("Input stamps changed between the beginning and the end of the callback! Make "
 						"sure the node publishing the topics doesn't override the same data after publishing them. A "
 						"solution is to use this node within another nodelet manager. Stamps: "
 						"rgb=%f->%f depth=%f->%f",
-						rgbStamp, image->header.stamp.toSec(),
+						rgbStamp, rgbHeader.stamp.toSec(),
 						depthStamp, depth->header.stamp.toSec());
 			}
 		}
@@ -299,6 +357,7 @@ private:
 	ros::Publisher rgbdImageCompressedPub_;
 
 	image_transport::SubscriberFilter imageSub_;
+	message_filters::Subscriber<sensor_msgs::CompressedImage> imageCompressedSub_;
 	image_transport::SubscriberFilter imageDepthSub_;
 	message_filters::Subscriber<sensor_msgs::CameraInfo> cameraInfoSub_;
 
@@ -307,6 +366,12 @@ private:
 
 	typedef message_filters::sync_policies::ExactTime<sensor_msgs::Image, sensor_msgs::Image, sensor_msgs::CameraInfo> MyExactSyncDepthPolicy;
 	message_filters::Synchronizer<MyExactSyncDepthPolicy> * exactSyncDepth_;
+
+	typedef message_filters::sync_policies::ApproximateTime<sensor_msgs::CompressedImage, sensor_msgs::Image, sensor_msgs::CameraInfo> MyApproxSyncCompressedRgbPolicy;
+	message_filters::Synchronizer<MyApproxSyncCompressedRgbPolicy> * approxSyncCompressedRgb_;
+
+	typedef message_filters::sync_policies::ExactTime<sensor_msgs::CompressedImage, sensor_msgs::Image, sensor_msgs::CameraInfo> MyExactSyncCompressedRgbPolicy;
+	message_filters::Synchronizer<MyExactSyncCompressedRgbPolicy> * exactSyncCompressedRgb_;
 };
 
 PLUGINLIB_EXPORT_CLASS(rtabmap_ros::RGBDSync, nodelet::Nodelet);
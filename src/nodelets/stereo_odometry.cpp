@@ -64,7 +64,8 @@ public:
 		approxSync_(0),
 		exactSync_(0),
 		queueSize_(5),
-		keepColor_(false)
+		keepColor_(false),
+		alreadyRectified_(Parameters::defaultRtabmapImagesAlreadyRectified())
 	{
 	}
 
@@ -98,6 +99,9 @@ private:
 		NODELET_INFO("StereoOdometry: subscribe_rgbd = %s", subscribeRGBD?"true":"false");
 		NODELET_INFO("StereoOdometry: keep_color = %s", keepColor_?"true":"false");
 
+		leftPlan_ = ImageIngestionPlan(keepColor_?ImageIngestionPlan::kTargetColor:ImageIngestionPlan::kTargetMono);
+		rightPlan_ = ImageIngestionPlan(ImageIngestionPlan::kTargetMono);
+
 		std::string subscribedTopicsMsg;
 		if(subscribeRGBD)
 		{
@@ -157,6 +161,8 @@ private:
 			ROS_WARN("Stereo odometry works only with \"Reg/Strategy\"=0. Ignoring value %s.", iter->second.c_str());
 		}
 		uInsert(parameters, ParametersPair(Parameters::kRegStrategy(), "0"));
+
+		Parameters::parse(parameters, Parameters::kRtabmapImagesAlreadyRectified(), alreadyRectified_);
 	}
 
 	void callback(
@@ -190,96 +196,27 @@ private:
 
 			ros::Time stamp = imageRectLeft->header.stamp>imageRectRight->header.stamp?imageRectLeft->header.stamp:imageRectRight->header.stamp;
 
-			Transform localTransform = getTransform(this->frameId(), imageRectLeft->header.frame_id, stamp);
-			if(localTransform.isNull())
-			{
-				return;
-			}
-
 			int quality = -1;
 			if(imageRectLeft->data.size() && imageRectRight->data.size())
 			{
-				bool alreadyRectified = true;
-				Parameters::parse(parameters(), Parameters::kRtabmapImagesAlreadyRectified(), alreadyRectified);
-				rtabmap::Transform stereoTransform;
-				if(!alreadyRectified)
+				cv::Mat left, right;
+				rtabmap::StereoCameraModel stereoModel;
+				if(!convertImages(
+						cv_bridge::toCvShare(imageRectLeft),
+						cv_bridge::toCvShare(imageRectRight),
+						*cameraInfoLeft,
+						*cameraInfoRight,
+						left,
+						right,
+						stereoModel))
 				{
-					stereoTransform = getTransform(
-							cameraInfoRight->header.frame_id,
-							cameraInfoLeft->header.frame_id,
-							cameraInfoLeft->header.stamp);
-					if(stereoTransform.isNull())
-					{
-						NODELET_ERROR("Parameter %s is false but we cannot get TF between the two cameras!", Parameters::kRtabmapImagesAlreadyRectified().c_str());
-						return;
-					}
-				}
-
-				rtabmap::StereoCameraModel stereoModel = rtabmap_ros::stereoCameraModelFromROS(*cameraInfoLeft, *cameraInfoRight, localTransform, stereoTransform);
-
-				if(stereoModel.baseline() == 0 && alreadyRectified)
-				{
-					stereoTransform = getTransform(
-							cameraInfoLeft->header.frame_id,
-							cameraInfoRight->header.frame_id,
-							cameraInfoLeft->header.stamp);
-
-					if(!stereoTransform.isNull() && stereoTransform.x()>0)
-					{
-						static bool warned = false;
-						if(!warned)
-						{
-							ROS_WARN("Right camera info doesn't have Tx set but we are assuming that stereo images are already rectified (see %s parameter). While not "
-									"recommended, we used TF to get the baseline (%s->%s = %fm) for convenience (e.g., D400 ir stereo issue). It is preferred to feed "
-									"a valid right camera info if stereo images are already rectified. This message is only printed once...",
-									rtabmap::Parameters::kRtabmapImagesAlreadyRectified().c_str(),
-									cameraInfoRight->header.frame_id.c_str(), cameraInfoLeft->header.frame_id.c_str(), stereoTransform.x());
-							warned = true;
-						}
-						stereoModel = rtabmap::StereoCameraModel(
-								stereoModel.left().fx(),
-								stereoModel.left().fy(),
-								stereoModel.left().cx(),
-								stereoModel.left().cy(),
-								stereoTransform.x(),
-								stereoModel.localTransform(),
-								stereoModel.left().imageSize());
-					}
-				}
-
-				if(alreadyRectified && stereoModel.baseline() <= 0)
-				{
-					NODELET_ERROR("The stereo baseline (%f) should be positive (baseline=-Tx/fx). We assume a horizontal left/right stereo "
-							  "setup where the Tx (or P(0,3)) is negative in the right camera info msg.", stereoModel.baseline());
 					return;
 				}
 
-				if(stereoModel.baseline() > 10.0)
-				{
-					static bool shown = false;
-					if(!shown)
-					{
-						NODELET_WARN("Detected baseline (%f m) is quite large! Is your "
-								 "right camera_info P(0,3) correctly set? Note that "
-								 "baseline=-P(0,3)/P(0,0). This warning is printed only once.",
-								 stereoModel.baseline());
-						shown = true;
-					}
-				}
-				cv_bridge::CvImagePtr ptrImageLeft = cv_bridge::toCvCopy(imageRectLeft,
-						imageRectLeft->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1)==0 ||
-						imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO8)==0?"":
-							keepColor_ && imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO16)!=0?"bgr8":"mono8");
-				cv_bridge::CvImagePtr ptrImageRight = cv_bridge::toCvCopy(imageRectRight,
-						imageRectRight->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1)==0 ||
-						imageRectRight->encoding.compare(sensor_msgs::image_encodings::MONO8)==0?"":"mono8");
-
 				UTimer stepTimer;
-				//
-				UDEBUG("localTransform = %s", localTransform.prettyPrint().c_str());
 				rtabmap::SensorData data(
-						ptrImageLeft->image,
-						ptrImageRight->image,
+						left,
+						right,
 						stereoModel,
 						0,
 						rtabmap_ros::timestampFromROS(stamp));
@@ -327,111 +264,27 @@ private:
 
 			ros::Time stamp = imageRectLeft->header.stamp>imageRectRight->header.stamp?imageRectLeft->header.stamp:imageRectRight->header.stamp;
 
-			Transform localTransform = getTransform(this->frameId(), imageRectLeft->header.frame_id, stamp);
-			if(localTransform.isNull())
-			{
-				return;
-			}
-
-			ros::WallTime time = ros::WallTime::now();
-
 			int quality = -1;
 			if(!imageRectLeft->image.empty() && !imageRectRight->image.empty())
 			{
-				bool alreadyRectified = true;
-				Parameters::parse(parameters(), Parameters::kRtabmapImagesAlreadyRectified(), alreadyRectified);
-				rtabmap::Transform stereoTransform;
-				if(!alreadyRectified)
+				cv::Mat left, right;
+				rtabmap::StereoCameraModel stereoModel;
+				if(!convertImages(
+						imageRectLeft,
+						imageRectRight,
+						image->rgb_camera_info,
+						image->depth_camera_info,
+						left,
+						right,
+						stereoModel))
 				{
-					stereoTransform = getTransform(
-							image->depth_camera_info.header.frame_id,
-							image->rgb_camera_info.header.frame_id,
-							image->rgb_camera_info.header.stamp);
-					if(stereoTransform.isNull())
-					{
-						NODELET_ERROR("Parameter %s is false but we cannot get TF between the two cameras!", Parameters::kRtabmapImagesAlreadyRectified().c_str());
-						return;
-					}
-				}
-
-				rtabmap::StereoCameraModel stereoModel = rtabmap_ros::stereoCameraModelFromROS(image->rgb_camera_info, image->depth_camera_info, localTransform);
-
-				if(stereoModel.baseline() == 0 && alreadyRectified)
-				{
-					stereoTransform = getTransform(
-							image->rgb_camera_info.header.frame_id,
-							image->depth_camera_info.header.frame_id,
-							image->rgb_camera_info.header.stamp);
-
-					if(!stereoTransform.isNull() && stereoTransform.x()>0)
-					{
-						static bool warned = false;
-						if(!warned)
-						{
-							ROS_WARN("Right camera info doesn't have Tx set but we are assuming that stereo images are already rectified (see %s parameter). While not "
-									"recommended, we used TF to get the baseline (%s->%s = %fm) for convenience (e.g., D400 ir stereo issue). It is preferred to feed "
-									"a valid right camera info if stereo images are already rectified. This message is only printed once...",
-									rtabmap::Parameters::kRtabmapImagesAlreadyRectified().c_str(),
-									image->depth_camera_info.header.frame_id.c_str(), image->rgb_camera_info.header.frame_id.c_str(), stereoTransform.x());
-							warned = true;
-						}
-						stereoModel = rtabmap::StereoCameraModel(
-								stereoModel.left().fx(),
-								stereoModel.left().fy(),
-								stereoModel.left().cx(),
-								stereoModel.left().cy(),
-								stereoTransform.x(),
-								stereoModel.localTransform(),
-								stereoModel.left().imageSize());
-					}
-				}
-
-				if(alreadyRectified && stereoModel.baseline() <= 0)
-				{
-					NODELET_ERROR("The stereo baseline (%f) should be positive (baseline=-Tx/fx). We assume a horizontal left/right stereo "
-							  "setup where the Tx (or P(0,3)) is negative in the right camera info msg.", stereoModel.baseline());
 					return;
 				}
 
-				if(stereoModel.baseline() > 10.0)
-				{
-					static bool shown = false;
-					if(!shown)
-					{
-						NODELET_WARN("Detected baseline (%f m) is quite large! Is your "
-								 "right camera_info P(0,3) correctly set? Note that "
-								 "baseline=-P(0,3)/P(0,0). This warning is printed only once.",
-								 stereoModel.baseline());
-						shown = true;
-					}
-				}
-
-				cv_bridge::CvImageConstPtr ptrImageLeft = imageRectLeft;
-				if(imageRectLeft->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) !=0 &&
-				   imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO8) != 0)
-				{
-					if(keepColor_ && imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO16) != 0)
-					{
-						ptrImageLeft = cv_bridge::cvtColor(imageRectLeft, "bgr8");
-					}
-					else
-					{
-						ptrImageLeft = cv_bridge::cvtColor(imageRectLeft, "mono8");
-					}
-				}
-				cv_bridge::CvImageConstPtr ptrImageRight = imageRectRight;
-				if(imageRectLeft->encoding.compare(sensor_msgs::image_encodings::TYPE_8UC1) !=0 &&
-				   imageRectLeft->encoding.compare(sensor_msgs::image_encodings::MONO8) != 0)
-				{
-					ptrImageRight = cv_bridge::cvtColor(imageRectRight, "mono8");
-				}
-
 				UTimer stepTimer;
-				//
-				UDEBUG("localTransform = %s", localTransform.prettyPrint().c_str());
 				rtabmap::SensorData data(
-						ptrImageLeft->image,
-						ptrImageRight->image,
+						left,
+						right,
 						stereoModel,
 						0,
 						rtabmap_ros::timestampFromROS(stamp));
@@ -448,6 +301,47 @@ private:
 		}
 	}
 
+private:
+	// Same conversion and stereo model caching as rtabmap node
+	bool convertImages(
+			const cv_bridge::CvImageConstPtr & imageLeft,
+			const cv_bridge::CvImageConstPtr & imageRight,
+			const sensor_msgs::CameraInfo & cameraInfoLeft,
+			const sensor_msgs::CameraInfo & cameraInfoRight,
+			cv::Mat & left,
+			cv::Mat & right,
+			rtabmap::StereoCameraModel & stereoModel)
+	{
+		if(!rtabmap_ros::convertStereoMsg(
+				imageLeft,
+				imageRight,
+				cameraInfoLeft,
+				cameraInfoRight,
+				this->frameId(),
+				"",
+				ros::Time(),
+				left,
+				right,
+				stereoModel,
+				this->tfListener(),
+				this->waitForTransformDuration(),
+				alreadyRectified_,
+				&stereoModelCache_,
+				&leftPlan_,
+				&rightPlan_))
+		{
+			return false;
+		}
+
+		if(alreadyRectified_ && stereoModel.baseline() <= 0)
+		{
+			NODELET_ERROR("The stereo baseline (%f) should be positive (baseline=-Tx/fx). We assume a horizontal left/right stereo "
+					  "setup where the Tx (or P(0,3)) is negative in the right camera info msg.", stereoModel.baseline());
+			return false;
+		}
+		return true;
+	}
+
 protected:
 	virtual void flushCallbacks()
 	{
@@ -478,6 +372,10 @@ private:
 	ros::Subscriber rgbdSub_;
 	int queueSize_;
 	bool keepColor_;
+	bool alreadyRectified_;
+	StereoCameraModelCache stereoModelCache_;
+	ImageIngestionPlan leftPlan_;
+	ImageIngestionPlan rightPlan_;
 };
 
 PLUGINLIB_EXPORT_CLASS(rtabmap_ros::StereoOdometry, nodelet::Nodelet);
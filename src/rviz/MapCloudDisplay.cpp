@@ -296,7 +296,17 @@ void MapCloudDisplay::processMapData(const rtabmap_ros::MapData& map)
 			cv::Mat image, depth;
 			rtabmap::LaserScan scan;
 
-			s.sensorData().uncompressData(fromDepth?&image:0, fromDepth?&depth:0, !fromDepth?&scan:0);
+			int decimation = cloud_decimation_->getInt();
+			std::vector<rtabmap::CameraModel> models;
+			if(fromDepth && rtabmap_ros::uncompressRGBDDecimated(s.sensorData(), decimation, image, depth, models, decimation))
+			{
+				// image decoded at reduced resolution, only the remaining decimation is applied below
+				s.sensorData().setRGBDImage(image, depth, models, false);
+			}
+			else
+			{
+				s.sensorData().uncompressData(fromDepth?&image:0, fromDepth?&depth:0, !fromDepth?&scan:0);
+			}
 
 			sensor_msgs::PointCloud2::Ptr cloudMsg(new sensor_msgs::PointCloud2);
 			if(fromDepth && !s.sensorData().imageRaw().empty() && !s.sensorData().depthOrRightRaw().empty())
@@ -306,7 +316,7 @@ void MapCloudDisplay::processMapData(const rtabmap_ros::MapData& map)
 
 				cloud = rtabmap::util3d::cloudRGBFromSensorData(
 						s.sensorData(),
-						cloud_decimation_->getInt(),
+						decimation,
 						cloud_max_depth_->getFloat(),
 						cloud_min_depth_->getFloat(),
 						validIndices.get());
@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <gtest/gtest.h>
+#include <ros/time.h>
+#include <tf/tf.h>
+#include <boost/bind.hpp>
+#include <rtabmap/utilite/UConversion.h>
+#include "rtabmap_ros/MsgConversion.h"
+
+namespace {
+
+// tf::Transformer filled with synthetic transforms, counting the
+// lookups done by landmarksFromROS()
+class CountingTransformer
+{
+public:
+	CountingTransformer() :
+		transformer_(true, ros::Duration(10.0)),
+		cameraLookups_(0),
+		correctionLookups_(0)
+	{}
+
+	void addCamera(const std::string & cameraFrameId, const tf::Transform & baseToCamera, const ros::Time & stamp)
+	{
+		transformer_.setTransform(tf::StampedTransform(baseToCamera, stamp, "base_link", cameraFrameId));
+	}
+	void addOdometry(const tf::Transform & odomToBase, const ros::Time & stamp)
+	{
+		transformer_.setTransform(tf::StampedTransform(odomToBase, stamp, "odom", "base_link"));
+	}
+
+	rtabmap::Transform baseToCamera(const std::string & cameraFrameId, const ros::Time & stamp)
+	{
+		++cameraLookups_;
+		return rtabmap_ros::getTransform("base_link", cameraFrameId, stamp, transformer_, 0.0);
+	}
+	rtabmap::Transform correction(const ros::Time & stamp, const ros::Time & odomStamp)
+	{
+		++correctionLookups_;
+		return rtabmap_ros::getTransform("base_link", "odom", stamp, odomStamp, transformer_, 0.0);
+	}
+
+	tf::Transformer & transformer() {return transformer_;}
+	int cameraLookups() const {return cameraLookups_;}
+	int correctionLookups() const {return correctionLookups_;}
+
+private:
+	tf::Transformer transformer_;
+	int cameraLookups_;
+	int correctionLookups_;
+};
+
+geometry_msgs::PoseWithCovarianceStamped tagPose(const std::string & frameId, const ros::Time & stamp, double z)
+{
+	geometry_msgs::PoseWithCovarianceStamped pose;
+	pose.header.frame_id = frameId;
+	pose.header.stamp = stamp;
+	pose.pose.pose.position.z = z;
+	pose.pose.pose.orientation.w = 1.0;
+	return pose;
+}
+
+} // namespace
+
+TEST(LandmarksFromROS, OneLookupPerFrameAndStamp)
+{
+	CountingTransformer tf;
+	const int cameras = 3;
+	const int stamps = 2;
+	const int tagsPerImage = 10;
+	ros::Time odomStamp(100.3);
+	for(int t=0; t<=stamps; ++t)
+	{
+		ros::Time stamp(100.0 + 0.1*t);
+		tf.addOdometry(tf::Transform(tf::Quaternion::getIdentity(), tf::Vector3(0.5*t, 0, 0)), stamp);
+		for(int c=0; c<cameras; ++c)
+		{
+			tf.addCamera(uFormat("camera%d", c), tf::Transform(tf::Quaternion::getIdentity(), tf::Vector3(0, 0.1*c, 0.5)), stamp);
+		}
+	}
+	tf.addOdometry(tf::Transform(tf::Quaternion::getIdentity(), tf::Vector3(1.5, 0, 0)), odomStamp);
+
+	std::map<int, std::pair<geometry_msgs::PoseWithCovarianceStamped, float> > tags;
+	int id = 1;
+	for(int t=0; t<stamps; ++t)
+	{
+		for(int c=0; c<cameras; ++c)
+		{
+			for(int i=0; i<tagsPerImage; ++i)
+			{
+				tags.insert(std::make_pair(id++, std::make_pair(tagPose(uFormat("camera%d", c), ros::Time(100.0 + 0.1*t), 1.0+i), 0.1f)));
+			}
+		}
+	}
+	// unknown camera, looked up once and all its tags ignored
+	for(int i=0; i<tagsPerImage; ++i)
+	{
+		tags.insert(std::make_pair(id++, std::make_pair(tagPose("unknown_camera", ros::Time(100.0), 1.0), 0.1f)));
+	}
+
+	rtabmap::Landmarks landmarks = rtabmap_ros::landmarksFromROS(
+			tags,
+			"base_link",
+			boost::bind(&CountingTransformer::baseToCamera, &tf, _1, _2),
+			boost::bind(&CountingTransformer::correction, &tf, _1, odomStamp),
+			0.01,
+			0.02);
+
+	EXPECT_EQ(cameras*stamps*tagsPerImage, (int)landmarks.size());
+	EXPECT_EQ(cameras*stamps+1, tf.cameraLookups());
+	EXPECT_EQ(stamps, tf.correctionLookups());
+
+	// first tag: camera0 at first stamp, robot moved 1.5 m since
+	const rtabmap::Landmark & landmark = landmarks.at(1);
+	EXPECT_NEAR(-1.5, landmark.getPose().x(), 1e-4);
+	EXPECT_NEAR(0.0, landmark.getPose().y(), 1e-4);
+	EXPECT_NEAR(1.5, landmark.getPose().z(), 1e-4);
+	EXPECT_DOUBLE_EQ(0.01, landmark.getCovariance().at<double>(0,0));
+	EXPECT_DOUBLE_EQ(0.02, landmark.getCovariance().at<double>(5,5));
+}
+
+TEST(LandmarksFromROS, TransformerOverload)
+{
+	CountingTransformer tf;
+	ros::Time stamp(50.0);
+	tf.addOdometry(tf::Transform::getIdentity(), stamp);
+	tf.addCamera("camera", tf::Transform(tf::Quaternion::getIdentity(), tf::Vector3(0.2, 0, 0)), stamp);
+
+	std::map<int, std::pair<geometry_msgs::PoseWithCovarianceStamped, float> > tags;
+	tags.insert(std::make_pair(1, std::make_pair(tagPose("camera", stamp, 2.0), 0.1f)));
+	tags.insert(std::make_pair(2, std::make_pair(tagPose("camera", stamp, 3.0), 0.1f)));
+
+	rtabmap::Landmarks landmarks = rtabmap_ros::landmarksFromROS(
+			tags, "base_link", "odom", stamp, tf.transformer(), 0.0, 0.01, 0.02);
+	ASSERT_EQ(2u, landmarks.size());
+	EXPECT_NEAR(0.2, landmarks.at(2).getPose().x(), 1e-4);
+	EXPECT_NEAR(3.0, landmarks.at(2).getPose().z(), 1e-4);
+}
+
+int main(int argc, char **argv)
+{
+	ros::Time::init();
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2010-2016, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <gtest/gtest.h>
+#include <ros/time.h>
+#include <sensor_msgs/image_encodings.h>
+#include <rtabmap/core/util2d.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <ctime>
+#include <cstdio>
+#include "rtabmap_ros/MsgConversion.h"
+
+namespace {
+
+cv::Mat texturedImage()
+{
+	cv::Mat image(120, 160, CV_8UC3);
+	cv::randu(image, 0, 64);
+	for(int v=0; v<image.rows; ++v)
+	{
+		for(int u=0; u<image.cols; ++u)
+		{
+			cv::Vec3b & pixel = image.at<cv::Vec3b>(v, u);
+			pixel[0] += (u*2)%192;
+			pixel[1] += (v*2)%192;
+		}
+	}
+	return image;
+}
+
+sensor_msgs::CompressedImage compress(const cv::Mat & image, cv_bridge::Format format)
+{
+	cv_bridge::CvImage cvImg;
+	cvImg.header.frame_id = "camera";
+	cvImg.header.stamp = ros::Time(10.0);
+	cvImg.encoding = sensor_msgs::image_encodings::BGR8;
+	cvImg.image = image;
+	sensor_msgs::CompressedImage msg;
+	cvImg.toCompressedImageMsg(msg, format);
+	return msg;
+}
+
+// rgbd_image/compressed of rgbd_sync: the raw image is decoded only if the
+// input cannot be forwarded, like in its compressed rgb callback
+rtabmap_ros::RGBDImage syncCompressed(const sensor_msgs::CompressedImage & input, int decimation = 1)
+{
+	sensor_msgs::CompressedImageConstPtr inputPtr(new sensor_msgs::CompressedImage(input));
+	cv_bridge::CvImage image;
+	if(!rtabmap_ros::canForwardCompressedImage(input, decimation))
+	{
+		cv_bridge::CvImagePtr decoded = cv_bridge::toCvCopy(input);
+		image.header = decoded->header;
+		image.encoding = decoded->encoding;
+		image.image = decimation>1?rtabmap::util2d::decimate(decoded->image, decimation):decoded->image;
+	}
+	rtabmap_ros::RGBDImage msg;
+	rtabmap_ros::rgbCompressedToROS(inputPtr, image, decimation, msg.rgb_compressed);
+	return msg;
+}
+
+// CPU time per message (ms) of syncCompressed()
+double cpuTimePerMessage(const sensor_msgs::CompressedImage & input, int messages)
+{
+	std::clock_t start = std::clock();
+	for(int i=0; i<messages; ++i)
+	{
+		rtabmap_ros::RGBDImage msg = syncCompressed(input);
+		EXPECT_FALSE(msg.rgb_compressed.data.empty());
+	}
+	return 1000.0*double(std::clock()-start)/double(CLOCKS_PER_SEC)/double(messages);
+}
+
+} // namespace
+
+TEST(RGBDCompressed, JpegFormats)
+{
+	sensor_msgs::CompressedImage jpeg = compress(texturedImage(), cv_bridge::JPG);
+	EXPECT_TRUE(rtabmap_ros::isJpegCompressedImage(jpeg));
+
+	// format set by compressed_image_transport
+	jpeg.format = "rgb8; jpeg compressed bgr8";
+	EXPECT_TRUE(rtabmap_ros::isJpegCompressedImage(jpeg));
+
+	sensor_msgs::CompressedImage png = compress(texturedImage(), cv_bridge::PNG);
+	EXPECT_FALSE(rtabmap_ros::isJpegCompressedImage(png));
+	png.format = "bgr8; png compressed bgr8";
+	EXPECT_FALSE(rtabmap_ros::isJpegCompressedImage(png));
+
+	// format and payload must agree
+	png.format = "jpeg";
+	EXPECT_FALSE(rtabmap_ros::isJpegCompressedImage(png));
+	sensor_msgs::CompressedImage empty;
+	empty.format = "jpeg";
+	EXPECT_FALSE(rtabmap_ros::isJpegCompressedImage(empty));
+}
+
+TEST(RGBDCompressed, JpegRoundTripIsBitIdentical)
+{
+	sensor_msgs::CompressedImage input = compress(texturedImage(), cv_bridge::JPG);
+	rtabmap_ros::RGBDImage msg = syncCompressed(input);
+
+	EXPECT_EQ(input.format, msg.rgb_compressed.format);
+	EXPECT_TRUE(input.data == msg.rgb_compressed.data);
+
+	cv_bridge::CvImagePtr rgb, depth;
+	rtabmap_ros::toCvCopy(msg, rgb, depth);
+	ASSERT_TRUE(rgb.get() != 0);
+	cv::Mat expected = cv_bridge::toCvCopy(input)->image;
+	ASSERT_EQ(expected.size(), rgb->image.size());
+	ASSERT_EQ(expected.type(), rgb->image.type());
+	EXPECT_EQ(0, cv::norm(expected, rgb->image, cv::NORM_INF));
+}
+
+TEST(RGBDCompressed, OtherCodecIsRecompressed)
+{
+	cv::Mat image = texturedImage();
+	sensor_msgs::CompressedImage input = compress(image, cv_bridge::PNG);
+	rtabmap_ros::RGBDImage msg = syncCompressed(input);
+
+	EXPECT_TRUE(rtabmap_ros::isJpegCompressedImage(msg.rgb_compressed));
+
+	cv_bridge::CvImagePtr rgb, depth;
+	rtabmap_ros::toCvCopy(msg, rgb, depth);
+	ASSERT_TRUE(rgb.get() != 0);
+	ASSERT_EQ(image.size(), rgb->image.size());
+	// lossy, but close to the original
+	EXPECT_LT(cv::norm(image, rgb->image, cv::NORM_L1)/double(image.total()*image.channels()), 10.0);
+}
+
+TEST(RGBDCompressed, DecimatedJpegIsRecompressed)
+{
+	cv::Mat image = texturedImage();
+	sensor_msgs::CompressedImage input = compress(image, cv_bridge::JPG);
+	EXPECT_FALSE(rtabmap_ros::canForwardCompressedImage(input, 2));
+	rtabmap_ros::RGBDImage msg = syncCompressed(input, 2);
+
+	EXPECT_TRUE(rtabmap_ros::isJpegCompressedImage(msg.rgb_compressed));
+	EXPECT_FALSE(input.data == msg.rgb_compressed.data);
+	cv_bridge::CvImagePtr rgb, depth;
+	rtabmap_ros::toCvCopy(msg, rgb, depth);
+	ASSERT_TRUE(rgb.get() != 0);
+	EXPECT_EQ(image.cols/2, rgb->image.cols);
+	EXPECT_EQ(image.rows/2, rgb->image.rows);
+}
+
+TEST(RGBDCompressed, RelayPassThrough)
+{
+	sensor_msgs::CompressedImage jpeg = compress(texturedImage(), cv_bridge::JPG);
+	rtabmap_ros::RGBDImage compressed;
+	compressed.rgb_compressed = jpeg;
+	compressed.depth_compressed.format = "png";
+	compressed.depth_compressed.data.resize(10, 1);
+
+	rtabmap_ros::RGBDImage raw;
+	cv_bridge::CvImage(std_msgs::Header(), sensor_msgs::image_encodings::BGR8, texturedImage()).toImageMsg(raw.rgb);
+
+	// nothing to convert
+	EXPECT_TRUE(rtabmap_ros::canRelayRGBDImage(compressed, false, false));
+	EXPECT_TRUE(rtabmap_ros::canRelayRGBDImage(raw, false, false));
+	// already in the requested form
+	EXPECT_TRUE(rtabmap_ros::canRelayRGBDImage(compressed, true, false));
+	EXPECT_TRUE(rtabmap_ros::canRelayRGBDImage(raw, false, true));
+	// conversion required
+	EXPECT_FALSE(rtabmap_ros::canRelayRGBDImage(raw, true, false));
+	EXPECT_FALSE(rtabmap_ros::canRelayRGBDImage(compressed, false, true));
+	rtabmap_ros::RGBDImage both = compressed;
+	both.rgb = raw.rgb;
+	EXPECT_FALSE(rtabmap_ros::canRelayRGBDImage(both, true, false));
+	EXPECT_FALSE(rtabmap_ros::canRelayRGBDImage(both, true, true));
+}
+
+TEST(RGBDCompressed, CpuTimePerMessage)
+{
+	cv::Mat image;
+	cv::resize(texturedImage(), image, cv::Size(640, 480));
+	sensor_msgs::CompressedImage jpeg = compress(image, cv_bridge::JPG);
+	sensor_msgs::CompressedImage png = compress(image, cv_bridge::PNG);
+
+	int messages = 30;
+	double forwarded = cpuTimePerMessage(jpeg, messages);
+	double recompressed = cpuTimePerMessage(png, messages);
+	printf("640x480 rgb_compressed, CPU time per message: forwarded (jpeg) = %.3f ms, decoded and re-encoded (png) = %.3f ms\n",
+			forwarded, recompressed);
+	RecordProperty("forwarded_us", int(forwarded*1000.0));
+	RecordProperty("recompressed_us", int(recompressed*1000.0));
+	EXPECT_LT(forwarded, recompressed);
+}
+
+int main(int argc, char **argv)
+{
+	ros::Time::init();
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}